@@ -545,6 +545,17 @@ QextSerialPort::QueryMode QextSerialPort::queryMode() const
     return d_func()->_queryMode;
 }
 
+#ifdef Q_OS_UNIX
+/*!
+    Returns the file descriptor of the port, or -1 if the port is not open.
+*/
+int QextSerialPort::handle() const
+{
+    QReadLocker locker(&d_func()->lock);
+    return isOpen() ? d_func()->fd : -1;
+}
+#endif
+
 /*!
     Reads all available data from the device, and returns it as a QByteArray.
     This function has no way of reporting errors; returning an empty QByteArray()
@@ -166,6 +166,10 @@ public:
     ulong lineStatus();
     QString errorString();
 
+#ifdef Q_OS_UNIX
+    int handle() const;
+#endif
+
     void emitSocketError(SocketError err)
     {
         emit socketError(err);
@@ -7,20 +7,25 @@
 
 #include <QListWidgetItem>
 #include <QFileDialog>
+#include <QPushButton>
 #include <QtConcurrentRun>
 
 #include "graphexport.h"
 #include "graphwidget.h"
 #include "graphcurve.h"
 #include "graphdata.h"
+#include "../../storage.h"
+#include "../../storageexport.h"
 
-GraphExport::GraphExport(std::vector<GraphCurveInfo*> *curves, QWidget *parent) :
+GraphExport::GraphExport(std::vector<GraphCurveInfo*> *curves, Storage *storage, QWidget *parent) :
     QDialog(parent), ui(new Ui::GraphExport)
 {
     ui->setupUi(this);
     ui->progress->hide();
 
     m_curves = curves;
+    m_storage = storage;
+    m_export = NULL;
 
     ui->colList->item(0)->setData(Qt::UserRole, -1);
     int maxSampleIdx = 0;
@@ -58,11 +63,22 @@ GraphExport::~GraphExport()
 
 void GraphExport::updatePreview()
 {
-    if(ui->binRadio->isChecked())
+    if(!ui->csvRadio->isChecked())
     {
         // TODO: how to implement?
         ui->prevText->setPlainText(tr("No preview available for binary format."));
     }
+    else if(ui->storageBox->isChecked())
+    {
+        try
+        {
+            ui->prevText->setPlainText(QString::fromUtf8(StorageExport::previewCSV(m_storage, storageSettings(), 500)));
+        }
+        catch(const QString& ex)
+        {
+            ui->prevText->setPlainText(tr("No preview available: %1").arg(ex));
+        }
+    }
     else
     {
         ui->prevText->setPlainText(generateCSV(500));
@@ -223,6 +239,9 @@ QByteArray GraphExport::generateBin()
 
 void GraphExport::accept()
 {
+    if(ui->storageBox->isChecked())
+        return exportStorage();
+
     ui->buttonBox->setEnabled(false);
 
     if(exportData())
@@ -260,6 +279,144 @@ bool GraphExport::exportData()
     return true;
 }
 
+StorageExportSettings GraphExport::storageSettings()
+{
+    StorageExportSettings settings;
+    settings.filename = ui->fileLine->text();
+    settings.from = ui->sampleStartBox->value();
+    settings.to = ui->sampleEndBox->value();
+
+    if(ui->binRadio->isChecked())
+    {
+        settings.format = EXPORT_BINARY;
+        settings.bigEndian = !ui->endianBox->currentIndex();
+        settings.indexWidth = (1 << ui->idxWidthBox->currentIndex());
+        switch(ui->typeBox->currentIndex())
+        {
+            case 0: settings.binType = NUM_UINT8 + ui->widthBox->currentIndex(); break;
+            case 1: settings.binType = NUM_FLOAT; break;
+            case 2: settings.binType = NUM_DOUBLE; break;
+        }
+
+        if(ui->indexBox->isChecked())
+        {
+            StorageExportColumn idx;
+            idx.name = "index";
+            settings.columns.push_back(idx);
+        }
+
+        if(ui->curveBox->currentIndex() != -1)
+        {
+            GraphCurveInfo *info = m_curves->at(ui->curveBox->itemData(ui->curveBox->currentIndex()).toInt());
+            StorageExportColumn c;
+            c.name = info->curve->title().text();
+            c.pos = info->info.pos;
+            c.type = info->curve->getDataType();
+            c.filter = info->info.filter.data();
+            settings.columns.push_back(c);
+        }
+        return settings;
+    }
+
+    settings.format = ui->csvRadio->isChecked() ? EXPORT_CSV : EXPORT_COLUMNS;
+    settings.separator = ui->sepEdit->text();
+    settings.header = ui->colNamesBox->isChecked();
+    switch(ui->endBox->currentIndex())
+    {
+        case 0: settings.lineEnd = "\r\n"; break;
+        case 1: settings.lineEnd = "\n"; break;
+        case 2: settings.lineEnd = "\n\r"; break;
+        case 3: settings.lineEnd = "\r"; break;
+    }
+
+    for(int i = 0; i < ui->colList->count(); ++i)
+    {
+        QListWidgetItem *item = ui->colList->item(i);
+        if(item->checkState() != Qt::Checked)
+            continue;
+
+        StorageExportColumn c;
+        int idx = item->data(Qt::UserRole).toInt();
+        if(idx == -1)
+            c.name = "index";
+        else
+        {
+            GraphCurveInfo *info = m_curves->at(idx);
+            c.name = info->curve->title().text();
+            c.pos = info->info.pos;
+            c.type = info->curve->getDataType();
+            c.filter = info->info.filter.data();
+        }
+        settings.columns.push_back(c);
+    }
+    return settings;
+}
+
+void GraphExport::exportStorage()
+{
+    if(m_export)
+        return;
+
+    m_export = new StorageExport(this);
+    try {
+        m_export->start(m_storage, storageSettings());
+    } catch(const QString& ex) {
+        delete m_export;
+        m_export = NULL;
+        return Utils::showErrorBox(ex, this);
+    }
+
+    ui->buttonBox->button(QDialogButtonBox::Ok)->setEnabled(false);
+    ui->progress->show();
+    ui->progress->setValue(0);
+    connect(m_export, SIGNAL(progress(int)),          ui->progress, SLOT(setValue(int)));
+    connect(m_export, SIGNAL(finished(bool,QString)),               SLOT(storageExportFinished(bool,QString)));
+}
+
+void GraphExport::storageExportFinished(bool success, const QString& error)
+{
+    m_export->deleteLater();
+    m_export = NULL;
+
+    ui->buttonBox->button(QDialogButtonBox::Ok)->setEnabled(true);
+
+    if(success)
+        return QDialog::accept();
+
+    ui->progress->hide();
+    if(!error.isEmpty())
+        Utils::showErrorBox(error, this);
+}
+
+void GraphExport::on_storageBox_toggled(bool checked)
+{
+    ui->colRadio->setEnabled(checked);
+    if(!checked && ui->colRadio->isChecked())
+        ui->csvRadio->setChecked(true);
+
+    on_rangeResetBtn_clicked();
+    updatePreview();
+}
+
+void GraphExport::on_colRadio_toggled(bool checked)
+{
+    ui->sepEdit->setEnabled(!checked);
+    ui->endBox->setEnabled(!checked);
+    ui->colNamesBox->setEnabled(!checked);
+    updatePreview();
+}
+
+int GraphExport::rangeMax()
+{
+    if(ui->storageBox->isChecked())
+        return (int)(std::min)(m_storage->getSize(), quint32(INT_MAX));
+
+    int maxSize = 0;
+    for(quint32 i = 0; i < m_curves->size(); ++i)
+        maxSize = (std::max)(maxSize, (int)m_curves->at(i)->curve->getSize());
+    return maxSize;
+}
+
 void GraphExport::on_binRadio_toggled(bool checked)
 {
     ui->stack->setCurrentIndex(!checked);
@@ -339,9 +496,7 @@ void GraphExport::on_sampleEndBox_valueChanged(int val)
 
 void GraphExport::on_rangeResetBtn_clicked()
 {
-    int maxSize = 0;
-    for(quint32 i = 0; i < m_curves->size(); ++i)
-        maxSize = (std::max)(maxSize, (int)m_curves->at(i)->curve->getSize());
+    const int maxSize = rangeMax();
 
     ui->sampleEndBox->setMaximum(maxSize);
     ui->sampleEndBox->setValue(maxSize);
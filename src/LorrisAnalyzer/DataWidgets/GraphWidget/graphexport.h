@@ -16,6 +16,9 @@
 #include "ui_graphexport.h"
 
 struct GraphCurveInfo;
+class Storage;
+class StorageExport;
+struct StorageExportSettings;
 
 class GraphExport : public QDialog, private Ui::GraphExport
 {
@@ -25,7 +28,7 @@ Q_SIGNALS:
     void updateProgress(int val);
     
 public:
-    explicit GraphExport(std::vector<GraphCurveInfo*> *curves, QWidget *parent = 0);
+    explicit GraphExport(std::vector<GraphCurveInfo*> *curves, Storage *storage, QWidget *parent = 0);
     ~GraphExport();
 
 public slots:
@@ -39,6 +42,10 @@ private slots:
     void on_sampleStartBox_valueChanged(int val);
     void on_sampleEndBox_valueChanged(int val);
     void on_rangeResetBtn_clicked();
+    void on_storageBox_toggled(bool checked);
+    void on_colRadio_toggled(bool checked);
+
+    void storageExportFinished(bool success, const QString& error);
 
     void updatePreview();
 
@@ -51,9 +58,14 @@ private:
 
     QByteArray generateBin();
     bool exportData();
+    void exportStorage();
+    StorageExportSettings storageSettings();
+    int rangeMax();
 
     Ui::GraphExport *ui;
     std::vector<GraphCurveInfo*> *m_curves;
+    Storage *m_storage;
+    StorageExport *m_export;
     QFuture<QByteArray> m_future;
     QFutureWatcher<QByteArray> m_watcher;
 };
@@ -804,7 +804,7 @@ void GraphWidget::updateSampleSize()
 
 void GraphWidget::exportData()
 {
-    GraphExport ex(&m_curves, this);
+    GraphExport ex(&m_curves, m_storage, this);
     ex.exec();
 }
 
@@ -10,155 +10,330 @@
 
 using namespace GLUtils;
 
+static const int FLOATS_PER_VERTEX = 7;
+
 GLModel::GLModel(const QString &name)
 {
     m_name = name;
     m_smooth_shading = false;
+    m_list = 0;
+}
+
+GLModel::~GLModel()
+{
+    // the buffer is freed by QOpenGLBuffer, if its context still exists
+    m_buffer.destroy();
+    if(m_list != 0)
+        glDeleteLists(m_list, 1);
 }
 
-void GLModel::addVertex(double *coords)
+void GLModel::addVertex(const float *coords)
 {
     m_vertices.push_back(vector4(coords[0], coords[1], coords[2], coords[3]));
 }
 
-void GLModel::addNormal(double *coords)
+void GLModel::addNormal(const float *coords)
 {
     m_normals.push_back(vector3(coords[0], coords[1], coords[2]));
 }
 
-void GLModel::addFace(const polygonFace &face)
+void GLModel::addFace(const int *v, const int *vn, int count)
+{
+    m_faces.push_back(m_face_v.size());
+    m_face_v.insert(m_face_v.end(), v, v + count);
+    if(vn)
+        m_face_vn.insert(m_face_vn.end(), vn, vn + count);
+    else
+        m_face_vn.resize(m_face_v.size(), -1);
+}
+
+void GLModel::addMaterial(const material &mtl)
 {
-    m_faces.push_back(face);
+    m_materials.push_back(std::make_pair((quint32)m_faces.size(), mtl));
 }
 
 void GLModel::dump(bool mini)
 {
     qDebug("\nModel %s", m_name.toStdString().c_str());
-    //m_material.dump();
-    qDebug("Vertex count: %lu", m_vertices.size());
-    for(quint32 i = 0; !mini && i < m_vertices.size(); ++i)
+    qDebug("Vertex count: %lu", m_data.size()/FLOATS_PER_VERTEX);
+    for(quint32 i = 0; !mini && i < m_data.size(); i += FLOATS_PER_VERTEX)
     {
-        const vector4& v = m_vertices[i];
-        qDebug("  %u: %f %f %f %f", i, v.x, v.y, v.z, v.w);
+        const float *v = &m_data[i];
+        qDebug("  %u: %f %f %f %f normal %f %f %f", i/FLOATS_PER_VERTEX, v[0], v[1], v[2], v[3], v[4], v[5], v[6]);
     }
 
-    qDebug("Faces count: %lu", m_faces.size());
-    qDebug("Normals count: %lu", m_normals.size());
-
-    for(quint32 i = 0; !mini && i < m_normals.size(); ++i)
-    {
-        const vector3& v = m_normals[i];
-        qDebug("  %u: %f %f %f", i, v.x, v.y, v.z);
-    }
+    qDebug("Material count: %lu", m_batches.size());
 }
 
-void GLModel::createNormals()
+void GLModel::build()
 {
-    if(!m_normals.empty())
-        return;
+    const quint32 faceCount = m_faces.size();
+    m_faces.push_back(m_face_v.size());
+
+    // drop faces with indexes out of range
+    std::vector<bool> valid(faceCount, true);
+    size_t triangles = 0;
+    for(quint32 i = 0; i < faceCount; ++i)
+    {
+        for(quint32 y = m_faces[i]; valid[i] && y < m_faces[i+1]; ++y)
+        {
+            valid[i] = quint32(m_face_v[y]) < m_vertices.size() &&
+                    (m_face_vn[y] == -1 || quint32(m_face_vn[y]) < m_normals.size());
+        }
+        if(valid[i])
+            triangles += m_faces[i+1] - m_faces[i] - 2;
+    }
 
-    if(!m_smooth_shading)
+    // The file has no normals, compute them from the faces
+    if(m_normals.empty())
     {
-        m_normals.resize(m_vertices.size(), vector3());
-        std::vector<int> seen(m_vertices.size(), 0);
+        if(!m_smooth_shading)
+            m_normals.resize(m_vertices.size(), vector3());
 
-        for(quint32 i = 0; i < m_faces.size(); ++i)
+        for(quint32 i = 0; i < faceCount; ++i)
         {
-            polygonFace& f = m_faces[i];
+            if(!valid[i])
+                continue;
 
-            int v[3] = { f.v[0], f.v[1], f.v[2] };
+            const int *v = &m_face_v[m_faces[i]];
             vector3 normal = GLUtils::normalize(GLUtils::cross(
                                 vector3(m_vertices[v[1]]) - vector3(m_vertices[v[0]]),
                                 vector3(m_vertices[v[2]]) - vector3(m_vertices[v[0]])));
 
-            for(int j = 0; j < 3; ++j)
+            for(quint32 y = m_faces[i]; y < m_faces[i+1]; ++y)
             {
-                int cur_v = v[j];
-                f.vn[j] = cur_v;
-
-                if(++seen[cur_v] == 1)
-                    m_normals[cur_v] = normal;
+                if(m_smooth_shading)
+                    m_face_vn[y] = m_normals.size();
                 else
                 {
-                    vector3& vec = m_normals[cur_v];
-                    vec.x = vec.x * (1.0 - 1.0/seen[cur_v]) + normal.x * 1.0/seen[cur_v];
-                    vec.y = vec.y * (1.0 - 1.0/seen[cur_v]) + normal.y * 1.0/seen[cur_v];
-                    vec.z = vec.z * (1.0 - 1.0/seen[cur_v]) + normal.z * 1.0/seen[cur_v];
-                    vec = GLUtils::normalize(vec);
+                    m_face_vn[y] = m_face_v[y];
+                    m_normals[m_face_v[y]] = m_normals[m_face_v[y]] + normal;
                 }
             }
+
+            if(m_smooth_shading)
+                m_normals.push_back(normal);
+        }
+
+        if(!m_smooth_shading)
+        {
+            for(quint32 i = 0; i < m_normals.size(); ++i)
+                m_normals[i] = GLUtils::normalize(m_normals[i]);
         }
     }
-    else
+
+    // Material ranges of faces, the ones before first usemtl have no material
+    std::vector<std::pair<quint32, int> > ranges; // first face, material index
+    if(m_materials.empty() || m_materials[0].first != 0)
+        ranges.push_back(std::make_pair(0u, -1));
+    for(quint32 i = 0; i < m_materials.size(); ++i)
+        ranges.push_back(std::make_pair(m_materials[i].first, int(i)));
+    ranges.push_back(std::make_pair(faceCount, -1));
+
+    m_data.clear();
+    m_data.reserve(triangles*3*FLOATS_PER_VERTEX);
+    m_batches.clear();
+
+    // faces with the same material are drawn at once
+    std::vector<bool> done(ranges.size(), false);
+    for(quint32 i = 0; i+1 < ranges.size(); ++i)
     {
-        for(quint32 i = 0; i < m_faces.size(); ++i)
+        if(done[i])
+            continue;
+
+        batch b;
+        b.first = m_data.size()/FLOATS_PER_VERTEX;
+        b.hasMaterial = ranges[i].second != -1;
+        if(b.hasMaterial)
+            b.mtl = m_materials[ranges[i].second].second;
+
+        for(quint32 r = i; r+1 < ranges.size(); ++r)
         {
-            polygonFace& f = m_faces[i];
+            if(done[r] || (ranges[r].second != -1) != b.hasMaterial ||
+               (b.hasMaterial && !(m_materials[ranges[r].second].second == b.mtl)))
+                continue;
 
-            int v[3] = { f.v[0], f.v[1], f.v[2] };
-            vector3 normal = GLUtils::normalize(GLUtils::cross(
-                                vector3(m_vertices[v[1]]) - vector3(m_vertices[v[0]]),
-                                vector3(m_vertices[v[2]]) - vector3(m_vertices[v[0]])));
-            m_normals.push_back(normal);
-            std::fill(f.vn.begin(), f.vn.end(), m_normals.size()-1);
+            done[r] = true;
+            for(quint32 f = ranges[r].first; f < ranges[r+1].first; ++f)
+                if(valid[f])
+                    addTriangles(f);
         }
+
+        b.count = m_data.size()/FLOATS_PER_VERTEX - b.first;
+        if(b.count != 0)
+            m_batches.push_back(b);
     }
+
+    std::vector<vector4>().swap(m_vertices);
+    std::vector<vector3>().swap(m_normals);
+    std::vector<quint32>().swap(m_faces);
+    std::vector<int>().swap(m_face_v);
+    std::vector<int>().swap(m_face_vn);
+    m_materials.clear();
 }
 
-void GLModel::draw()
+void GLModel::addTriangles(quint32 face)
 {
-    bool isTransparent = false;
-    /*
-    if (hasTexture()) {
-        glBindTexture (GL_TEXTURE_2D, m_pTexture->getID());
-        isTransparent = m_pTexture->isTransparent();
-    }*/
+    const quint32 start = m_faces[face];
+    const quint32 count = m_faces[face+1] - start;
 
-    bool isDepthTestEnabled = glIsEnabled(GL_DEPTH_TEST);
-    if (isTransparent)
-        glDisable(GL_DEPTH_TEST);
+    vector3 faceNormal;
+    bool hasFaceNormal = false;
 
-    int shading = 0;
-    glGetIntegerv(GL_SHADE_MODEL, &shading);
-    glShadeModel(m_smooth_shading ? GL_SMOOTH : GL_FLAT);
-
-    std::vector<std::pair<quint32, material> >::iterator m_itr = m_materials.begin();
-    for(quint32 i = 0; i < m_faces.size(); ++i)
+    // GL_POLYGON was used for faces, they are convex and can be split into a fan
+    for(quint32 t = 1; t+1 < count; ++t)
     {
-        polygonFace& f = m_faces[i];
-
-        if(m_itr != m_materials.end() && i == (*m_itr).first)
+        const quint32 idx[3] = { start, start + t, start + t + 1 };
+        for(int i = 0; i < 3; ++i)
         {
-            const material& mtl = (*m_itr).second;
-            glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, mtl.Ka);
-            glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, mtl.Kd);
-            glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, mtl.Ks);
-            glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, mtl.Ns);
-            glColor3f(mtl.Kd[0], mtl.Kd[1], mtl.Kd[2]);
-            ++m_itr;
+            const vector4& v = m_vertices[m_face_v[idx[i]]];
+            m_data.push_back(v.x);
+            m_data.push_back(v.y);
+            m_data.push_back(v.z);
+            m_data.push_back(v.w);
+
+            const int vn = m_face_vn[idx[i]];
+            if(vn == -1 && !hasFaceNormal)
+            {
+                const int *fv = &m_face_v[start];
+                faceNormal = GLUtils::normalize(GLUtils::cross(
+                                vector3(m_vertices[fv[1]]) - vector3(m_vertices[fv[0]]),
+                                vector3(m_vertices[fv[2]]) - vector3(m_vertices[fv[0]])));
+                hasFaceNormal = true;
+            }
+
+            const vector3& n = vn == -1 ? faceNormal : m_normals[vn];
+            m_data.push_back(n.x);
+            m_data.push_back(n.y);
+            m_data.push_back(n.z);
         }
+    }
+}
 
-        glBegin(GL_POLYGON);
-        for (quint32 y = 0; y < f.v.size(); ++y)
-        {
-            glNormal3fv(m_normals[f.vn[y]].d());
+void GLModel::save(QDataStream &str) const
+{
+    str << m_name << m_smooth_shading << (quint32)m_batches.size();
+    for(quint32 i = 0; i < m_batches.size(); ++i)
+    {
+        const batch& b = m_batches[i];
+        str << b.first << b.count << b.hasMaterial;
+        for(int y = 0; y < 4; ++y)
+            str << b.mtl.Ka[y] << b.mtl.Kd[y] << b.mtl.Ks[y];
+        str << b.mtl.d << b.mtl.Ns << (qint32)b.mtl.illum;
+    }
+
+    str << (quint32)m_data.size();
+    str.writeRawData((const char*)m_data.data(), m_data.size()*sizeof(float));
+}
+
+bool GLModel::load(QDataStream &str)
+{
+    quint32 count = 0;
+    str >> m_name >> m_smooth_shading >> count;
+
+    m_batches.clear();
+    for(quint32 i = 0; i < count && str.status() == QDataStream::Ok; ++i)
+    {
+        batch b;
+        qint32 illum = 0;
+        str >> b.first >> b.count >> b.hasMaterial;
+        for(int y = 0; y < 4; ++y)
+            str >> b.mtl.Ka[y] >> b.mtl.Kd[y] >> b.mtl.Ks[y];
+        str >> b.mtl.d >> b.mtl.Ns >> illum;
+        b.mtl.illum = illum;
+        m_batches.push_back(b);
+    }
+
+    str >> count;
+    if(str.status() != QDataStream::Ok || count % FLOATS_PER_VERTEX != 0 ||
+       quint64(count)*sizeof(float) > quint64(str.device()->bytesAvailable()))
+        return false;
+
+    m_data.resize(count);
+    if(str.readRawData((char*)m_data.data(), count*sizeof(float)) != int(count*sizeof(float)))
+        return false;
+
+    for(quint32 i = 0; i < m_batches.size(); ++i)
+        if(quint64(m_batches[i].first) + m_batches[i].count > count/FLOATS_PER_VERTEX)
+            return false;
+    return true;
+}
+
+void GLModel::upload()
+{
+    if(m_buffer.create())
+    {
+        m_buffer.bind();
+        m_buffer.allocate(m_data.data(), m_data.size()*sizeof(float));
+        m_buffer.release();
+        return;
+    }
+
+    // no VBOs on old GL, the arrays are copied into a display list instead
+    m_list = glGenLists(1);
+    if(m_list == 0)
+        return;
+
+    glNewList(m_list, GL_COMPILE);
+    drawArrays((const char*)m_data.data());
+    glEndList();
+}
+
+void GLModel::resetGL()
+{
+    m_buffer.destroy();
+    m_list = 0;
+}
+
+void GLModel::drawArrays(const char *base)
+{
+    static const int stride = FLOATS_PER_VERTEX*sizeof(float);
 
-            //if (hasTexture() && hasTextureCoords())
-              //  glTexCoord3fv(m_texVector[(*itFace).vt[y]]);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glVertexPointer(4, GL_FLOAT, stride, base);
+    glNormalPointer(GL_FLOAT, stride, base + 4*sizeof(float));
 
-            glVertex4fv(m_vertices[f.v[y]].d());
+    for(quint32 i = 0; i < m_batches.size(); ++i)
+    {
+        const batch& b = m_batches[i];
+        if(b.hasMaterial)
+        {
+            glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, b.mtl.Ka);
+            glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, b.mtl.Kd);
+            glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, b.mtl.Ks);
+            glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, b.mtl.Ns);
+            glColor3f(b.mtl.Kd[0], b.mtl.Kd[1], b.mtl.Kd[2]);
         }
-        glEnd();	//	GL_POLYGON
+        glDrawArrays(GL_TRIANGLES, b.first, b.count);
     }
-    //	restore depth test
-    if (isDepthTestEnabled)
-        glEnable(GL_DEPTH_TEST);
-    else
-        glDisable(GL_DEPTH_TEST);
-    glShadeModel(shading);
+
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
 }
 
-void GLModel::addMaterial(const material &mtl)
+void GLModel::draw()
 {
-    m_materials.push_back(std::make_pair((quint32)m_faces.size(), mtl));
+    if(m_batches.empty())
+        return;
+
+    if(!m_buffer.isCreated() && m_list == 0)
+        upload();
+
+    int shading = 0;
+    glGetIntegerv(GL_SHADE_MODEL, &shading);
+    glShadeModel(m_smooth_shading ? GL_SMOOTH : GL_FLAT);
+
+    if(m_list != 0)
+        glCallList(m_list);
+    else if(m_buffer.isCreated())
+    {
+        m_buffer.bind();
+        drawArrays(NULL);
+        m_buffer.release();
+    }
+    else
+        drawArrays((const char*)m_data.data());
+
+    glShadeModel(shading);
 }
@@ -9,10 +9,10 @@
 #define GLMODEL_H
 
 #include <vector>
-#include <QVector4D>
-#include <QVector3D>
 #include <QString>
-#include <QGLFunctions>
+#include <QDataStream>
+#include <QOpenGLBuffer>
+#include <string.h>
 #include <utility>
 
 namespace GLUtils {
@@ -45,6 +45,12 @@ struct material
         illum = m.illum;
     }
 
+    bool operator ==(const material& m) const
+    {
+        return memcmp(Ka, m.Ka, sizeof(Ka)) == 0 && memcmp(Kd, m.Kd, sizeof(Kd)) == 0 &&
+               memcmp(Ks, m.Ks, sizeof(Ks)) == 0 && d == m.d && Ns == m.Ns && illum == m.illum;
+    }
+
     void dump()
     {
         qDebug("Ka: %f %f %f %f", Ka[0], Ka[1], Ka[2], Ka[3]);
@@ -66,46 +72,70 @@ struct material
     //char *map_Ka;
 };
 
-struct polygonFace
-{
-    void add(int v1, int vt1 = 1, int vn1 = 1)
-    {
-        v.push_back(--v1);
-        vt.push_back(--vt1);
-        vn.push_back(--vn1);
-    }
-
-    std::vector<int> v;
-    std::vector<int> vt;
-    std::vector<int> vn;
-};
-
+/*
+ * The model is built from the data read by ObjFileLoader: faces are
+ * triangulated into one vertex array, sorted by material. It is uploaded
+ * to a VBO on the first draw (or compiled into a display list if VBOs are
+ * not supported) and then drawn with one call per material.
+ */
 class GLModel
 {
 public:
     GLModel(const QString& name);
+    ~GLModel();
 
-    void addVertex(double *coords);
-    void addNormal(double *coords);
-    void addFace(const polygonFace& face);
-
-    void createNormals();
-    void dump(bool mini);
-    void draw();
+    void addVertex(const float *coords);
+    void addNormal(const float *coords);
+    // Indexes are zero-based within this model, vn may be NULL
+    void addFace(const int *v, const int *vn, int count);
+    void addMaterial(const material &mtl);
 
     void setSmoothShading(bool on)
     {
         m_smooth_shading = on;
     }
 
-    void addMaterial(const material &mtl);
+    // Creates the vertex array, the source data are freed
+    void build();
+    bool empty() const { return m_batches.empty(); }
+
+    void save(QDataStream& str) const;
+    bool load(QDataStream& str);
+
+    void dump(bool mini);
+    // The GL context must be current
+    void draw();
+    // Called with the new context current after the old one was destroyed
+    void resetGL();
 
 private:
+    struct batch
+    {
+        quint32 first;
+        quint32 count;
+        bool hasMaterial;
+        material mtl;
+    };
+
+    void upload();
+    void drawArrays(const char *base);
+    void addTriangles(quint32 face);
+
+    // source data
     std::vector<GLUtils::vector4> m_vertices;
     std::vector<GLUtils::vector3> m_normals;
-    std::vector<polygonFace> m_faces;
+    std::vector<quint32> m_faces; // index of the first vertex of each face
+    std::vector<int> m_face_v;
+    std::vector<int> m_face_vn;
     std::vector<std::pair<quint32, material> > m_materials;
 
+    // x, y, z, w and normal x, y, z of each triangle vertex
+    std::vector<float> m_data;
+    std::vector<batch> m_batches;
+
+    QOpenGLBuffer m_buffer;
+    GLuint m_list;
+
     QString m_name;
     bool m_smooth_shading;
 };
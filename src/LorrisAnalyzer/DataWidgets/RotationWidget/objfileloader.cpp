@@ -6,27 +6,17 @@
 ***********************************************/
 
 #include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDataStream>
 #include <QTextStream>
 #include <QStringList>
-#include <QDir>
-#include <QGLFunctions>
+#include <math.h>
+#include <string.h>
 
 #include "objfileloader.h"
 #include "../../../misc/utils.h"
 
-static const QString objEntryTypes[] =
-{
-    "v",          // 0 - vertex
-    "f",          // 1 - face
-    "vt",         // 2 - textures
-    "vn",         // 3 - normals
-    "s",          // 4 - smooth shading
-    "o",          // 5 - model
-    "mtllib",     // 6 - material lib
-    "usemtl",     // 7 - use material
-    "g",          // 8 - group
-};
-
 static const QString mtlEntryTypes[] =
 {
     "newmtl",     // 0 - new material
@@ -39,8 +29,136 @@ static const QString mtlEntryTypes[] =
     "illum"       // 7 - illumination
 };
 
+static const quint32 CACHE_MAGIC = 0x4C4F4243; // "LOBC"
+static const quint32 CACHE_VERSION = 1;
+
+static QString cacheName(const QString& file)
+{
+    return file + ".lcache";
+}
+
+static inline bool isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static const char *skipBlank(const char *itr, const char *end)
+{
+    while(itr != end && isBlank(*itr))
+        ++itr;
+    return itr;
+}
+
+static const char *skipToken(const char *itr, const char *end)
+{
+    while(itr != end && !isBlank(*itr))
+        ++itr;
+    return itr;
+}
+
+static bool tokenIs(const char *itr, const char *end, const char *str)
+{
+    const size_t len = strlen(str);
+    return size_t(end - itr) == len && memcmp(itr, str, len) == 0;
+}
+
+// Last token of the line, the names are read like this
+static QString lastToken(const char *itr, const char *end)
+{
+    while(end != itr && isBlank(*(end-1)))
+        --end;
+
+    const char *start = end;
+    while(start != itr && !isBlank(*(start-1)))
+        --start;
+    return QString::fromUtf8(start, end - start);
+}
+
+static bool parseInt(const char *& itr, const char *end, int& res)
+{
+    const char *start = itr;
+    bool neg = false;
+    if(itr != end && (*itr == '-' || *itr == '+'))
+        neg = (*itr++ == '-');
+
+    int val = 0;
+    for(; itr != end && *itr >= '0' && *itr <= '9'; ++itr)
+        val = val*10 + (*itr - '0');
+
+    if(itr == start || !(itr[-1] >= '0' && itr[-1] <= '9'))
+    {
+        itr = start;
+        return false;
+    }
+
+    res = neg ? -val : val;
+    return true;
+}
+
+// strtod() needs a terminated string and uses the locale's decimal point
+static bool parseFloat(const char *& itr, const char *end, float& res)
+{
+    static const double powers[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    const char *start = itr;
+    bool neg = false;
+    if(itr != end && (*itr == '-' || *itr == '+'))
+        neg = (*itr++ == '-');
+
+    double val = 0;
+    int digits = 0;
+    int exp = 0;
+    for(; itr != end && *itr >= '0' && *itr <= '9'; ++itr, ++digits)
+        val = val*10 + (*itr - '0');
+
+    if(itr != end && *itr == '.')
+    {
+        for(++itr; itr != end && *itr >= '0' && *itr <= '9'; ++itr, ++digits, --exp)
+            val = val*10 + (*itr - '0');
+    }
+
+    if(digits == 0)
+    {
+        itr = start;
+        return false;
+    }
+
+    if(itr != end && (*itr == 'e' || *itr == 'E'))
+    {
+        const char *e = itr + 1;
+        int eval;
+        if(parseInt(e, end, eval))
+        {
+            exp += eval;
+            itr = e;
+        }
+    }
+
+    if(exp > 0)
+        val *= exp < int(sizeof_array(powers)) ? powers[exp] : pow(10.0, exp);
+    else if(exp < 0)
+        val /= -exp < int(sizeof_array(powers)) ? powers[-exp] : pow(10.0, -exp);
+
+    res = neg ? -val : val;
+    return true;
+}
+
+// OBJ indexes start at 1 and negative ones are relative to the end of the list
+static int objIndex(int idx, int total, int modelCount)
+{
+    return idx > 0 ? idx - 1 - total : modelCount + idx;
+}
+
 bool ObjFileLoader::load(const QString& file, std::vector<GLModel*>& modelList)
 {
+    // resources can't have a cache next to them
+    const bool cached = !file.startsWith(':');
+    if(cached && loadCache(file, modelList))
+        return true;
+
     QFile f(file);
     if(!f.open(QIODevice::ReadOnly))
         return false;
@@ -52,9 +170,36 @@ bool ObjFileLoader::load(const QString& file, std::vector<GLModel*>& modelList)
         path = file.left(idx+1);
     }
 
+    // compressed resources can't be mapped
+    QByteArray buff;
+    const char *data = f.size() != 0 ? (const char*)f.map(0, f.size()) : NULL;
+    qint64 size = f.size();
+    if(!data)
+    {
+        buff = f.readAll();
+        data = buff.constData();
+        size = buff.size();
+    }
+
+    QStringList deps;
+    deps << file;
+
+    const size_t first = modelList.size();
+    parse(data, data + size, path, modelList, deps);
+
+    if(cached)
+    {
+        const std::vector<GLModel*> models(modelList.begin() + first, modelList.end());
+        saveCache(file, deps, models);
+    }
+    return true;
+}
+
+void ObjFileLoader::parse(const char *data, const char *end, const QString& path,
+                          std::vector<GLModel*>& modelList, QStringList& deps)
+{
     QHash<QString, material> materials;
     QHash<QString, material>::iterator m_itr;
-    QTextStream str(&f);
 
     GLModel *model = new GLModel("");
     int vertexTotal = 0;
@@ -63,105 +208,189 @@ bool ObjFileLoader::load(const QString& file, std::vector<GLModel*>& modelList)
     int normalsTotal = 0;
     int normalsModel = 0;
 
-    for(QString line = str.readLine(); !line.isNull(); line = str.readLine())
+    // reused for every face
+    std::vector<int> face_v;
+    std::vector<int> face_vn;
+
+    for(const char *line = data; line != end; )
     {
-        if(line.startsWith('#'))
-            continue;
+        const char *eol = (const char*)memchr(line, '\n', end - line);
+        if(!eol)
+            eol = end;
 
-        QStringList parts = line.split(' ', QString::SkipEmptyParts);
-        if(parts.size() < 2)
-            continue;
+        const char *itr = skipBlank(line, eol);
+        const char *type = itr;
+        const char *typeEnd = skipToken(itr, eol);
+        itr = skipBlank(typeEnd, eol);
 
-        int type = getObjType(parts[0]);
-        if(type == -1)
+        line = (eol == end) ? end : eol + 1;
+
+        if(type == typeEnd || *type == '#' || itr == eol)
             continue;
 
-        switch(type)
+        if(tokenIs(type, typeEnd, "v"))
+        {
+            float coords[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+            for(int i = 0; i < 4 && parseFloat(itr, eol, coords[i]); ++i)
+                itr = skipBlank(itr, eol);
+            model->addVertex(coords);
+            ++vertexModel;
+        }
+        else if(tokenIs(type, typeEnd, "f"))
         {
-            case 5: // model
+            face_v.clear();
+            face_vn.clear();
+            bool hasNormals = true;
+            bool valid = true;
+
+            while(valid && itr != eol)
             {
-                if(model)
+                // v, v/vt, v/vt/vn or v//vn
+                int v, vt = 0, vn = 0;
+                valid = parseInt(itr, eol, v);
+                if(valid && itr != eol && *itr == '/')
                 {
-                    model->createNormals();
-                    modelList.push_back(model);
+                    ++itr;
+                    parseInt(itr, eol, vt);
+                    if(itr != eol && *itr == '/')
+                    {
+                        ++itr;
+                        valid = parseInt(itr, eol, vn);
+                    }
                 }
-                model = new GLModel(parts.back());
-                if(type == 5)
+
+                if(valid)
                 {
-                    vertexTotal += vertexModel;
-                    vertexModel = 0;
-                    normalsTotal += normalsModel;
-                    normalsModel = 0;
+                    hasNormals = hasNormals && vn != 0;
+                    face_v.push_back(objIndex(v, vertexTotal, vertexModel));
+                    face_vn.push_back(objIndex(vn, normalsTotal, normalsModel));
                 }
-                continue;
+                itr = skipBlank(skipToken(itr, eol), eol);
             }
-            case 8: // group
-            {
-                if(!model)
-                    model = new GLModel(parts.back());
-                continue;
-            }
-            case 6: // mtllib
-                loadMaterials(path + parts.back(), materials);
-                continue;
-        }
 
-        if(!model)
-            continue;
-
-        switch(type)
+            if(valid && face_v.size() >= 3)
+                model->addFace(face_v.data(), hasNormals ? face_vn.data() : NULL, face_v.size());
+            else
+                qWarning("ObjFileLoader::parse(): invalid face %s", QByteArray(type, eol - type).constData());
+        }
+        else if(tokenIs(type, typeEnd, "vn"))
         {
-            case 0: // vertex
-            {
-                double coords[4] = { 0.0, 0.0, 0.0, 1.0 };
-                for(int i = 1; i < parts.size() && i < 5; ++i)
-                    coords[i-1] = parts[i].toDouble();
-                model->addVertex(coords);
-                ++vertexModel;
-                break;
-            }
-            case 1: // face
-            {
-                polygonFace f;
-                if(loadFace(parts, &f, vertexTotal, normalsTotal))
-                    model->addFace(f);
-                break;
-            }
-            case 2: // textures
-                break;
-            case 3: // normals
-            {
-                double coords[3] = { 0.0, 0.0, 0.0 };
-                for(int i = 1; i < parts.size() && i < 4; ++i)
-                    coords[i-1] = parts[i].toDouble();
-                model->addNormal(coords);
-                ++normalsModel;
-                break;
-            }
-            case 4: // smooth shading
-                model->setSmoothShading(parts.back() != "off");
-                break;
-            case 7: // usemtl
-            {
-                if(parts.back().isNull())
-                    parts.back() = "";
-
-                m_itr = materials.find(parts.back());
-                if(m_itr == materials.end())
-                    break;
+            float coords[3] = { 0.0f, 0.0f, 0.0f };
+            for(int i = 0; i < 3 && parseFloat(itr, eol, coords[i]); ++i)
+                itr = skipBlank(itr, eol);
+            model->addNormal(coords);
+            ++normalsModel;
+        }
+        else if(tokenIs(type, typeEnd, "s"))
+        {
+            const char *e = skipToken(itr, eol);
+            model->setSmoothShading(!tokenIs(itr, e, "off") && !tokenIs(itr, e, "0"));
+        }
+        else if(tokenIs(type, typeEnd, "o"))
+        {
+            model->build();
+            if(!model->empty())
+                modelList.push_back(model);
+            else
+                delete model;
+
+            model = new GLModel(lastToken(itr, eol));
+            vertexTotal += vertexModel;
+            vertexModel = 0;
+            normalsTotal += normalsModel;
+            normalsModel = 0;
+        }
+        else if(tokenIs(type, typeEnd, "usemtl"))
+        {
+            m_itr = materials.find(lastToken(itr, eol));
+            if(m_itr != materials.end())
                 model->addMaterial(*m_itr);
-                break;
-            }
         }
+        else if(tokenIs(type, typeEnd, "mtllib"))
+        {
+            const QString name = path + lastToken(itr, eol);
+            loadMaterials(name, materials);
+            deps << name;
+        }
+        // vt and g are not used
     }
-    if(model)
-    {
-        model->createNormals();
+
+    model->build();
+    if(!model->empty())
         modelList.push_back(model);
+    else
+        delete model;
+}
+
+bool ObjFileLoader::loadCache(const QString& file, std::vector<GLModel*>& modelList)
+{
+    QFile f(cacheName(file));
+    if(!f.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream str(&f);
+    str.setVersion(QDataStream::Qt_4_6);
+
+    quint32 magic = 0, version = 0, count = 0;
+    str >> magic >> version >> count;
+    if(str.status() != QDataStream::Ok || magic != CACHE_MAGIC || version != CACHE_VERSION)
+        return false;
+
+    // the .obj and the material libraries it was built from
+    for(quint32 i = 0; i < count; ++i)
+    {
+        QString path;
+        qint64 size, modified;
+        str >> path >> size >> modified;
+
+        QFileInfo info(path);
+        if(str.status() != QDataStream::Ok || (i == 0 && path != file) || !info.exists() ||
+           info.size() != size || info.lastModified().toMSecsSinceEpoch() != modified)
+            return false;
     }
+
+    str >> count;
+
+    std::vector<GLModel*> models;
+    for(quint32 i = 0; i < count; ++i)
+    {
+        GLModel *model = new GLModel(QString());
+        models.push_back(model);
+        if(!model->load(str) || str.status() != QDataStream::Ok)
+        {
+            delete_vect(models);
+            return false;
+        }
+    }
+
+    modelList.insert(modelList.end(), models.begin(), models.end());
     return true;
 }
 
+void ObjFileLoader::saveCache(const QString& file, const QStringList& deps, const std::vector<GLModel*>& modelList)
+{
+    QFile f(cacheName(file));
+    if(!f.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return;
+
+    QDataStream str(&f);
+    str.setVersion(QDataStream::Qt_4_6);
+
+    str << CACHE_MAGIC << CACHE_VERSION << (quint32)deps.size();
+    for(int i = 0; i < deps.size(); ++i)
+    {
+        QFileInfo info(deps[i]);
+        str << deps[i] << info.size() << info.lastModified().toMSecsSinceEpoch();
+    }
+
+    str << (quint32)modelList.size();
+    for(quint32 i = 0; i < modelList.size(); ++i)
+        modelList[i]->save(str);
+
+    if(str.status() != QDataStream::Ok)
+        f.remove();
+}
+
 void ObjFileLoader::loadMaterials(const QString& file, QHash<QString, material>& materials)
 {
     QFile f(file);
@@ -225,16 +454,6 @@ void ObjFileLoader::loadMaterials(const QString& file, QHash<QString, material>&
         materials.insert(name, mtl);
 }
 
-int ObjFileLoader::getObjType(const QString &line)
-{
-    for(quint32 i = 0; i < sizeof_array(objEntryTypes); ++i)
-    {
-        if(objEntryTypes[i] == line)
-            return i;
-    }
-    return -1;
-}
-
 int ObjFileLoader::getMtlType(const QString &line)
 {
     for(quint32 i = 0; i < sizeof_array(mtlEntryTypes); ++i)
@@ -244,82 +463,3 @@ int ObjFileLoader::getMtlType(const QString &line)
     }
     return -1;
 }
-
-bool ObjFileLoader::loadFace(const QStringList &parts, polygonFace *f, int vertexTotal, int normalsTotal)
-{
-    if(parts.size() < 4)
-        return false;
-
-    static const QRegExp typeExp[] =
-    {
-        QRegExp("^[0-9]+$"),               // 0 - v1
-        QRegExp("^[0-9]+/[0-9]+$"),        // 1 - v1/vt1
-        QRegExp("^[0-9]+/[0-9]+/[0-9]+$"), // 2 - v1/vt1/vn1
-        QRegExp("^[0-9]+//[0-9]+$"),       // 3 - v1//vn1
-    };
-
-    int type = -1;
-    for(quint32 i = 0; type == -1 && i < sizeof_array(typeExp); ++i)
-        if(typeExp[i].exactMatch(parts[1]))
-            type = i;
-
-    if(type == -1)
-    {
-        qWarning("ObjFileLoader::loadFace(): invalid face format %s", parts[1].toStdString().c_str());
-        return false;
-    }
-
-    bool ok[3];
-    for(int i = 1; i < parts.size(); ++i)
-    {
-        switch(type)
-        {
-            case 0:
-            {
-                int v = parts[i].toInt(ok);
-                if(ok[0])
-                    f->add(v - vertexTotal);
-                break;
-            }
-            case 1:
-            {
-                QStringList split = parts[i].split('/', QString::SkipEmptyParts);
-                if(split.size() != 2)
-                    break;
-
-                int v = split[0].toInt(ok);
-                int vt = split[1].toInt(ok + 1);
-                if(ok[0] && ok[1])
-                    f->add(v - vertexTotal, vt);
-                break;
-            }
-            case 2:
-            {
-                QStringList split = parts[i].split('/', QString::SkipEmptyParts);
-                if(split.size() != 3)
-                    break;
-
-                int v = split[0].toInt(ok);
-                int vt = split[1].toInt(ok + 1);
-                int vn = split[2].toInt(ok + 2);
-
-                if(ok[0] && ok[1] && ok[2])
-                    f->add(v - vertexTotal, vt, vn);
-                break;
-            }
-            case 3:
-            {
-                QStringList split = parts[i].split("//", QString::SkipEmptyParts);
-                if(split.size() != 2)
-                    break;
-
-                int v = split[0].toInt(ok);
-                int vn = split[1].toInt(ok + 1);
-                if(ok[0] && ok[1])
-                    f->add(v- vertexTotal, -1, vn - normalsTotal);
-                break;
-            }
-        }
-    }
-    return (f->v.size() >= 3);
-}
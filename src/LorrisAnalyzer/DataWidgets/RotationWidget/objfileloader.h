@@ -9,21 +9,29 @@
 #define OBJFILELOADER_H
 
 #include <QString>
+#include <QStringList>
 #include <vector>
 #include <QHash>
 
 #include "glmodel.h"
 
+/*
+ * Parses the file in place, without allocating per line. The built models
+ * are cached in a binary file next to the .obj, which is used as long as
+ * the .obj and its material libraries are unchanged.
+ */
 class ObjFileLoader
 {
 public:
     static bool load(const QString& file, std::vector<GLModel*>& modelList);
 
 private:
-    static int getObjType(const QString& line);
+    static void parse(const char *data, const char *end, const QString& path,
+                      std::vector<GLModel*>& modelList, QStringList& deps);
     static int getMtlType(const QString& line);
     static void loadMaterials(const QString& file, QHash<QString, material>& materials);
-    static bool loadFace(const QStringList& parts, polygonFace *f, int vertexTotal, int normalsTotal);
+    static bool loadCache(const QString& file, std::vector<GLModel*>& modelList);
+    static void saveCache(const QString& file, const QStringList& deps, const std::vector<GLModel*>& modelList);
 };
 
 #endif // OBJFILELOADER_H
@@ -40,7 +40,10 @@ RenderWidget::RenderWidget(QWidget *parent) :
 
 RenderWidget::~RenderWidget()
 {
+    // the models free their GL buffers
+    makeCurrent();
     delete_vect(m_models);
+    doneCurrent();
 }
 
 void RenderWidget::resetCamera()
@@ -59,6 +62,10 @@ void RenderWidget::resetCamera()
 
 void RenderWidget::initializeGL()
 {
+    // The context is new, the models have to upload their data again
+    for(quint32 i = 0; i < m_models.size(); ++i)
+        m_models[i]->resetGL();
+
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_LIGHTING);
     glEnable(GL_NORMALIZE);
@@ -328,14 +335,17 @@ void RenderWidget::requestRender()
 
 void RenderWidget::setModelFile(const QString &path)
 {
+    makeCurrent();
     delete_vect(m_models);
+    doneCurrent();
+
     if(!ObjFileLoader::load(path, m_models))
     {
-        delete_vect(m_models);
         ObjFileLoader::load(m_modelFile, m_models);
         return;
     }
     m_modelFile = path;
+    update();
 }
 
 void RenderWidget::save(DataFileParser *file)
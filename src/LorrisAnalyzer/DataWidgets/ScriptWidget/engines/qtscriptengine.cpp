@@ -47,7 +47,6 @@ QtScriptEngine::QtScriptEngine(WidgetArea *area, quint32 w_id, ScriptWidget *par
     ScriptEngine(area, w_id, parent)
 {
     m_engine = NULL;
-    setSource(QString());
 }
 
 QtScriptEngine::~QtScriptEngine()
@@ -70,81 +69,10 @@ void QtScriptEngine::prepareNewContext()
 {
     m_global = m_engine->currentContext()->activationObject();
 
-    // Functions
-    QScriptValue clearTerm = m_engine->newFunction(&QtScriptEngine_private::__clearTerm);
-    QScriptValue appendTerm = m_engine->newFunction(&QtScriptEngine_private::__appendTerm);
-    QScriptValue sendData = m_engine->newFunction(&QtScriptEngine_private::__sendData);
-    QScriptValue getW = m_engine->newFunction(&QtScriptEngine_private::__getWidth);
-    QScriptValue getH = m_engine->newFunction(&QtScriptEngine_private::__getHeight);
-    QScriptValue throwEx = m_engine->newFunction(&QtScriptEngine_private::__throwException);
-    QScriptValue getJoy = m_engine->newFunction(&QtScriptEngine_private::__getJoystick);
-    QScriptValue getFirstJoy = m_engine->newFunction(&QtScriptEngine_private::__getFirstJoystick);
-    QScriptValue closeJoy = m_engine->newFunction(&QtScriptEngine_private::__closeJoystick);
-    QScriptValue getJoyName = m_engine->newFunction(&QtScriptEngine_private::__getJoystickNames);
-    QScriptValue getJoyIds = m_engine->newFunction(&QtScriptEngine_private::__getJoystickIds);
-    QScriptValue newTimer = m_engine->newFunction(&QtScriptEngine_private::__newTimer);
-    QScriptValue addComboItems = m_engine->newFunction(&QtScriptEngine_private::__addComboBoxItems);
-    QScriptValue moveW = m_engine->newFunction(&QtScriptEngine_private::__moveWidget);
-    QScriptValue resizeW = m_engine->newFunction(&QtScriptEngine_private::__resizeWidget);
-    QScriptValue getData = m_engine->newFunction(&QtScriptEngine_private::__getData);
-    QScriptValue getDataCount = m_engine->newFunction(&QtScriptEngine_private::__getDataCount);
-    QScriptValue playErrorSound = m_engine->newFunction(&QtScriptEngine_private::__playErrorSound);
-    QScriptValue setMaxPacketNumber = m_engine->newFunction(&QtScriptEngine_private::__setMaxPacketNumber);
-    QScriptValue setInterval = m_engine->newFunction(&QtScriptEngine_private::__setInterval);
-    QScriptValue setTimeout = m_engine->newFunction(&QtScriptEngine_private::__setTimeout);
-    QScriptValue clearTimer = m_engine->newFunction(&QtScriptEngine_private::__clearTimer);
-
-    QScriptValue numberW = m_engine->newFunction(&QtScriptEngine_private::__newNumberWidget);
-    QScriptValue barW = m_engine->newFunction(&QtScriptEngine_private::__newBarWidget);
-    QScriptValue colorW = m_engine->newFunction(&QtScriptEngine_private::__newColorWidget);
-    QScriptValue graphW = m_engine->newFunction(&QtScriptEngine_private::__newGraphWidget);
-    QScriptValue inputW = m_engine->newFunction(&QtScriptEngine_private::__newInputWidget);
-    QScriptValue circleW = m_engine->newFunction(&QtScriptEngine_private::__newCircleWidget);
-    QScriptValue sliderW = m_engine->newFunction(&QtScriptEngine_private::__newSliderWidget);
-    QScriptValue canvasW = m_engine->newFunction(&QtScriptEngine_private::__newCanvasWidget);
-    QScriptValue newW = m_engine->newFunction(&QtScriptEngine_private::__newWidget);
-
-    m_global.setProperty("clearTerm", clearTerm);
-    m_global.setProperty("appendTerm", appendTerm);
-    m_global.setProperty("print", appendTerm);
-    m_global.setProperty("sendData", sendData);
-    m_global.setProperty("send", sendData);
-    m_global.setProperty("getWidth", getW);
-    m_global.setProperty("getHeight", getH);
-    m_global.setProperty("throwException", throwEx);
-    m_global.setProperty("alert", throwEx);
-    m_global.setProperty("getJoystick", getJoy);
-    m_global.setProperty("getFirstJoystick", getFirstJoy);
-    m_global.setProperty("closeJoystick", closeJoy);
-    m_global.setProperty("getJoystickNames", getJoyName);
-    m_global.setProperty("getJoystickIds", getJoyIds);
-    m_global.setProperty("newTimer", newTimer);
-    m_global.setProperty("addComboBoxItems", addComboItems);
-    m_global.setProperty("moveWidget", moveW);
-    m_global.setProperty("resizeWidget", resizeW);
-    m_global.setProperty("getData", getData);
-    m_global.setProperty("getDataCount", getDataCount);
-    m_global.setProperty("playErrorSound", playErrorSound);
-    m_global.setProperty("setMaxPacketNumber", setMaxPacketNumber);
-    m_global.setProperty("setInterval", setInterval);
-    m_global.setProperty("setTimeout", setTimeout);
-    m_global.setProperty("clearInterval", clearTimer);
-    m_global.setProperty("clearTimeout", clearTimer);
-
-    m_global.setProperty("newNumberWidget", numberW);
-    m_global.setProperty("newBarWidget", barW);
-    m_global.setProperty("newColorWidget", colorW);
-    m_global.setProperty("newGraphWidget", graphW);
-    m_global.setProperty("newInputWidget", inputW);
-    m_global.setProperty("newCircleWidget", circleW);
-    m_global.setProperty("newSliderWidget", sliderW);
-    m_global.setProperty("newCanvasWidget", canvasW);
-    m_global.setProperty("newWidget", newW);
-
-    // defines
-    const QHash<QString, quint32>& enums = sWidgetFactory.getScriptEnums();
-    for(QHash<QString, quint32>::const_iterator itr = enums.begin(); itr != enums.end(); ++itr)
-         m_global.setProperty(itr.key(),  QScriptValue(m_engine, *itr));
+    // Functions and defines are bound when the script uses them
+    QScriptValue natives = m_engine->newObject(&m_engine->m_natives);
+    natives.setPrototype(m_global.prototype());
+    m_global.setPrototype(natives);
 
     // objects
     m_global.setProperty("script", m_engine->newQObject(parent()));
@@ -161,6 +89,14 @@ void QtScriptEngine::prepareNewContext()
             m_global.setProperty(name, m_engine->newQObject(*itr));
     }
 
+    clearScriptObjects();
+    emit stopUsingJoy(m_engine);
+
+    qScriptRegisterMetaType(m_engine, GraphCurveToScriptValue, GraphCurveFromScriptValue);
+}
+
+void QtScriptEngine::clearScriptObjects()
+{
     // remove script created widgets and timer from previous script
     while(!m_widgets.empty())
         m_area->removeWidget((*m_widgets.begin())->getId());
@@ -168,10 +104,6 @@ void QtScriptEngine::prepareNewContext()
     for(std::list<QTimer*>::iterator itr = m_timers.begin(); itr != m_timers.end(); ++itr)
         delete *itr;
     m_timers.clear();
-
-    emit stopUsingJoy(m_engine);
-
-    qScriptRegisterMetaType(m_engine, GraphCurveToScriptValue, GraphCurveFromScriptValue);
 }
 
 void QtScriptEngine::widgetDestroyed(QObject *widget)
@@ -188,6 +120,18 @@ void QtScriptEngine::setSource(const QString &source)
         m_on_script_exit.call();
 
     delete m_engine;
+    m_engine = NULL;
+
+    // Widgets start with an empty script and sessions replace it right away,
+    // so no engine is created until there is something to run.
+    if(source.trimmed().isEmpty())
+    {
+        clearScriptObjects();
+        m_global = m_on_data = m_on_key = m_on_widget_add = m_on_widget_remove =
+                m_on_script_exit = m_on_save = m_on_raw = QScriptValue();
+        return;
+    }
+
     m_engine = new QtScriptEngine_private(this, parent());
     m_engine->setAgent(new ScriptAgent(this, m_engine));
 
@@ -312,12 +256,14 @@ QTimer *QtScriptEngine::newTimer()
 
 void QtScriptEngine::onWidgetAdd(DataWidget *w)
 {
+    connect(w, SIGNAL(titleChanged(QString)), SLOT(onTitleChange(QString)));
+    if(!m_engine)
+        return;
+
     QString name = sanitizeWidgetName(w->getTitle());
     if(!name.isEmpty())
         m_global.setProperty(name, m_engine->newQObject(w));
 
-    connect(w, SIGNAL(titleChanged(QString)), SLOT(onTitleChange(QString)));
-
     if(!m_on_widget_add.isFunction())
         return;
     QScriptValueList args;
@@ -327,10 +273,13 @@ void QtScriptEngine::onWidgetAdd(DataWidget *w)
 
 void QtScriptEngine::onWidgetRemove(DataWidget *w)
 {
+    disconnect(w, SIGNAL(titleChanged(QString)), this, SLOT(onTitleChange(QString)));
+    if(!m_engine)
+        return;
+
     QString name = sanitizeWidgetName(w->getTitle());
     if(!name.isEmpty())
         m_global.setProperty(name, m_engine->undefinedValue());
-    disconnect(w, SIGNAL(titleChanged(QString)), this, SLOT(onTitleChange(QString)));
 
     if(!m_on_widget_remove.isFunction())
         return;
@@ -342,6 +291,9 @@ void QtScriptEngine::onWidgetRemove(DataWidget *w)
 
 void QtScriptEngine::onTitleChange(const QString& newTitle)
 {
+    if(!m_engine)
+        return;
+
     DataWidget *w = (DataWidget*)sender();
     QString name = sanitizeWidgetName(w->getTitle());
 
@@ -421,7 +373,7 @@ void QtScriptEngine::rawData(const QByteArray &data)
 }
 
 QtScriptEngine_private::QtScriptEngine_private(QtScriptEngine *base, QObject *parent) :
-    QScriptEngine(parent)
+    QScriptEngine(parent), m_natives(this)
 {
     m_base = base;
     setProcessEventsInterval(50);
@@ -429,6 +381,84 @@ QtScriptEngine_private::QtScriptEngine_private(QtScriptEngine *base, QObject *pa
     connect(&m_freezeDetectTimer, SIGNAL(timeout()), this, SLOT(freezeDetectorTimeout()));
 }
 
+QtScriptNativeClass::QtScriptNativeClass(QScriptEngine *engine) : QScriptClass(engine)
+{
+}
+
+const QHash<QString, QScriptEngine::FunctionSignature>& QtScriptNativeClass::functions()
+{
+    static QHash<QString, QScriptEngine::FunctionSignature> functions;
+    if(!functions.isEmpty())
+        return functions;
+
+    functions["clearTerm"] = &QtScriptEngine_private::__clearTerm;
+    functions["appendTerm"] = &QtScriptEngine_private::__appendTerm;
+    functions["print"] = &QtScriptEngine_private::__appendTerm;
+    functions["sendData"] = &QtScriptEngine_private::__sendData;
+    functions["send"] = &QtScriptEngine_private::__sendData;
+    functions["getWidth"] = &QtScriptEngine_private::__getWidth;
+    functions["getHeight"] = &QtScriptEngine_private::__getHeight;
+    functions["throwException"] = &QtScriptEngine_private::__throwException;
+    functions["alert"] = &QtScriptEngine_private::__throwException;
+    functions["getJoystick"] = &QtScriptEngine_private::__getJoystick;
+    functions["getFirstJoystick"] = &QtScriptEngine_private::__getFirstJoystick;
+    functions["closeJoystick"] = &QtScriptEngine_private::__closeJoystick;
+    functions["getJoystickNames"] = &QtScriptEngine_private::__getJoystickNames;
+    functions["getJoystickIds"] = &QtScriptEngine_private::__getJoystickIds;
+    functions["newTimer"] = &QtScriptEngine_private::__newTimer;
+    functions["addComboBoxItems"] = &QtScriptEngine_private::__addComboBoxItems;
+    functions["moveWidget"] = &QtScriptEngine_private::__moveWidget;
+    functions["resizeWidget"] = &QtScriptEngine_private::__resizeWidget;
+    functions["getData"] = &QtScriptEngine_private::__getData;
+    functions["getDataCount"] = &QtScriptEngine_private::__getDataCount;
+    functions["playErrorSound"] = &QtScriptEngine_private::__playErrorSound;
+    functions["setMaxPacketNumber"] = &QtScriptEngine_private::__setMaxPacketNumber;
+    functions["setInterval"] = &QtScriptEngine_private::__setInterval;
+    functions["setTimeout"] = &QtScriptEngine_private::__setTimeout;
+    functions["clearInterval"] = &QtScriptEngine_private::__clearTimer;
+    functions["clearTimeout"] = &QtScriptEngine_private::__clearTimer;
+
+    functions["newNumberWidget"] = &QtScriptEngine_private::__newNumberWidget;
+    functions["newBarWidget"] = &QtScriptEngine_private::__newBarWidget;
+    functions["newColorWidget"] = &QtScriptEngine_private::__newColorWidget;
+    functions["newGraphWidget"] = &QtScriptEngine_private::__newGraphWidget;
+    functions["newInputWidget"] = &QtScriptEngine_private::__newInputWidget;
+    functions["newCircleWidget"] = &QtScriptEngine_private::__newCircleWidget;
+    functions["newSliderWidget"] = &QtScriptEngine_private::__newSliderWidget;
+    functions["newCanvasWidget"] = &QtScriptEngine_private::__newCanvasWidget;
+    functions["newWidget"] = &QtScriptEngine_private::__newWidget;
+    return functions;
+}
+
+QScriptClass::QueryFlags QtScriptNativeClass::queryProperty(const QScriptValue&, const QScriptString& name,
+                                                            QueryFlags flags, uint *)
+{
+    if(!(flags & HandlesReadAccess))
+        return 0;
+
+    const QString str = name.toString();
+    if(functions().contains(str) || sWidgetFactory.getScriptEnums().contains(str))
+        return HandlesReadAccess;
+    return 0;
+}
+
+QScriptValue QtScriptNativeClass::property(const QScriptValue&, const QScriptString& name, uint)
+{
+    const QString str = name.toString();
+
+    QScriptValue res;
+    QHash<QString, QScriptEngine::FunctionSignature>::const_iterator itr = functions().find(str);
+    if(itr != functions().end())
+        res = engine()->newFunction(*itr);
+    else
+        res = QScriptValue(engine(), sWidgetFactory.getScriptEnums().value(str));
+
+    // The global object's own property is found first next time,
+    // and the script can still overwrite it as before.
+    engine()->globalObject().setProperty(name, res);
+    return res;
+}
+
 QScriptValue QtScriptEngine_private::evaluate(const QString &program, const QString &fileName, int lineNumber)
 {
     startFreezeDetector();
@@ -11,6 +11,7 @@
 #include <QObject>
 #include <QScriptEngine>
 #include <QScriptProgram>
+#include <QScriptClass>
 #include <QSize>
 #include <QTimer>
 
@@ -22,11 +23,25 @@ class WidgetArea;
 class DataWidget;
 class QtScriptEngine;
 
+// Resolves the native functions and enums when the script first uses them,
+// the global object has an object of this class as its prototype.
+class QtScriptNativeClass : public QScriptClass
+{
+public:
+    QtScriptNativeClass(QScriptEngine *engine);
+
+    QueryFlags queryProperty(const QScriptValue& object, const QScriptString& name, QueryFlags flags, uint *id);
+    QScriptValue property(const QScriptValue& object, const QScriptString& name, uint id);
+
+    static const QHash<QString, QScriptEngine::FunctionSignature>& functions();
+};
+
 class QtScriptEngine_private : public QScriptEngine
 {
     Q_OBJECT
 
     friend class QtScriptEngine;
+    friend class QtScriptNativeClass;
 Q_SIGNALS:
     void stopUsingJoy(QObject *object);
 
@@ -88,6 +103,7 @@ private:
     QScriptValue  m_global;
     QtScriptEngine *m_base;
     QTimer m_freezeDetectTimer;
+    QtScriptNativeClass m_natives;
 };
 
 class QtScriptEngine : public ScriptEngine
@@ -128,6 +144,7 @@ private slots:
 
 private:
     void prepareNewContext();
+    void clearScriptObjects();
 
     QScriptValue  m_global;
     QScriptValue  m_on_data;
@@ -7,6 +7,11 @@
 
 #include <QPainter>
 #include <QMouseEvent>
+#include <QPaintEvent>
+#include <QBuffer>
+#include <algorithm>
+#include <climits>
+#include <cmath>
 
 #include "canvaswidget.h"
 #include "../../misc/utils.h"
@@ -14,6 +19,19 @@
 REGISTER_DATAWIDGET(WIDGET_CANVAS, Canvas, NULL)
 W_TR(QT_TRANSLATE_NOOP("DataWidget", "Canvas"))
 
+static const int TILE_SIZE = 256;
+// The raster layer holds at most MAX_TILES tiles (64 MiB) within
+// RASTER_LIMIT px of the origin, anything else is kept as vectors
+static const int MAX_TILES = 256;
+static const int RASTER_LIMIT = 1 << 20;
+static const size_t MAX_VECTORS = 1000;
+static const int DEFAULT_HISTORY_LIMIT = 10000;
+
+static int tileIdx(int coord)
+{
+    return coord >= 0 ? coord / TILE_SIZE : (coord - TILE_SIZE + 1) / TILE_SIZE;
+}
+
 CanvasWidget::CanvasWidget(QWidget *parent) : DataWidget(parent)
 {
     m_canvas = new Canvas(this);
@@ -123,6 +141,11 @@ void CanvasWidget::setFillColor(const QString &color)
     m_canvas->fillColor() = QColor(color);
 }
 
+void CanvasWidget::setHistoryLimit(int limit)
+{
+    m_canvas->setHistoryLimit(limit);
+}
+
 void CanvasWidget::clear()
 {
     m_lastLine = QPoint();
@@ -149,6 +172,7 @@ Canvas::Canvas(QWidget *parent) : QWidget(parent)
 
     m_lineWidth = 2;
     m_lineColor = Qt::black;
+    m_historyLimit = DEFAULT_HISTORY_LIMIT;
 }
 
 void Canvas::save(DataFileParser *file)
@@ -216,6 +240,12 @@ void Canvas::save(DataFileParser *file)
         *file << img.x << img.y;
         *file << img.pixmap.width() << img.pixmap.height();
     }
+
+    file->writeBlockIdentifier("canvasWhistory");
+    file->writeVal(m_historyLimit);
+
+    saveTiles(file);
+    saveVectors(file);
 }
 
 void Canvas::load(DataFileParser *file)
@@ -296,13 +326,98 @@ void Canvas::load(DataFileParser *file)
             int w = file->readVal<int>();
             int h = file->readVal<int>();
 
-            addImage(path, x, y, w, h);
+            image img = { path, loadImage(path, w, h), x, y };
+            if(!img.pixmap.isNull())
+                m_images.push_back(img);
         }
     }
 
+    if(file->seekToNextBlock("canvasWhistory", BLOCK_WIDGET))
+        m_historyLimit = file->readVal<int>();
+
+    // Files from older versions have only the primitives
+    if(loadTiles(file))
+        loadVectors(file);
+    else
+        rasterizeHistory();
+
+    setHistoryLimit(m_historyLimit);
     update();
 }
 
+void Canvas::saveTiles(DataFileParser *file)
+{
+    file->writeBlockIdentifier("canvasWtiles");
+    file->writeVal((quint32)m_tiles.size());
+    for(QHash<TileIdx, QImage>::const_iterator itr = m_tiles.begin(); itr != m_tiles.end(); ++itr)
+    {
+        QByteArray data;
+        QBuffer buff(&data);
+        buff.open(QIODevice::WriteOnly);
+        itr->save(&buff, "PNG");
+
+        file->writeVal(itr.key().first);
+        file->writeVal(itr.key().second);
+        file->writeVal((quint32)data.size());
+        file->write(data);
+    }
+}
+
+bool Canvas::loadTiles(DataFileParser *file)
+{
+    if(!file->seekToNextBlock("canvasWtiles", BLOCK_WIDGET))
+        return false;
+
+    quint32 count = file->readVal<quint32>();
+    for(quint32 i = 0; i < count; ++i)
+    {
+        int x = file->readVal<int>();
+        int y = file->readVal<int>();
+        QByteArray data = file->read(file->readVal<quint32>());
+
+        QImage img;
+        if(m_tiles.size() < MAX_TILES && img.loadFromData(data, "PNG") && img.size() == QSize(TILE_SIZE, TILE_SIZE))
+            m_tiles.insert(TileIdx(x, y), img.convertToFormat(QImage::Format_ARGB32_Premultiplied));
+    }
+    return true;
+}
+
+void Canvas::saveVectors(DataFileParser *file)
+{
+    file->writeBlockIdentifier("canvasWvectors");
+    file->writeVal((quint32)m_vectors.size());
+    for(size_t i = 0; i < m_vectors.size(); ++i)
+    {
+        const vectorShape& v = m_vectors[i];
+
+        int vals[4] = { v.bounds.x(), v.bounds.y(), v.bounds.width(), v.bounds.height() };
+        file->write((char*)vals, sizeof(vals));
+
+        file->writeVal((quint32)v.pic.size());
+        file->write(v.pic.data(), v.pic.size());
+    }
+}
+
+void Canvas::loadVectors(DataFileParser *file)
+{
+    if(!file->seekToNextBlock("canvasWvectors", BLOCK_WIDGET))
+        return;
+
+    quint32 count = file->readVal<quint32>();
+    int vals[4];
+    for(quint32 i = 0; i < count; ++i)
+    {
+        vectorShape v;
+
+        file->read((char*)vals, sizeof(vals));
+        v.bounds = QRect(vals[0], vals[1], vals[2], vals[3]);
+
+        QByteArray data = file->read(file->readVal<quint32>());
+        if(v.pic.setData(data.constData(), data.size()) && m_vectors.size() < MAX_VECTORS)
+            m_vectors.push_back(v);
+    }
+}
+
 void Canvas::setBackground(QColor bg)
 {
     QPalette p(palette());
@@ -312,35 +427,315 @@ void Canvas::setBackground(QColor bg)
     update();
 }
 
+void Canvas::setHistoryLimit(int limit)
+{
+    m_historyLimit = (std::max)(0, limit);
+
+    trimHistory(m_lines);
+    trimHistory(m_rects);
+    trimHistory(m_circles);
+    trimHistory(m_images);
+}
+
+template <typename T>
+void Canvas::addToHistory(std::vector<T>& history, const T& prim)
+{
+    if(m_historyLimit == 0)
+        return;
+
+    history.push_back(prim);
+    trimHistory(history);
+}
+
+template <typename T>
+void Canvas::trimHistory(std::vector<T>& history)
+{
+    if(history.size() <= size_t(m_historyLimit))
+        return;
+
+    // drop the oldest half at once, so that it does not move on every call
+    const size_t keep = m_historyLimit/2;
+    history.erase(history.begin(), history.end() - keep);
+}
+
+QImage& Canvas::tile(int x, int y)
+{
+    QHash<TileIdx, QImage>::iterator itr = m_tiles.find(TileIdx(x, y));
+    if(itr == m_tiles.end())
+    {
+        QImage img(TILE_SIZE, TILE_SIZE, QImage::Format_ARGB32_Premultiplied);
+        img.fill(0);
+        itr = m_tiles.insert(TileIdx(x, y), img);
+    }
+    return *itr;
+}
+
+template <typename T, typename F>
+void Canvas::forEachTile(const T& prim, const QRect& bounds, F f)
+{
+    for(int y = tileIdx(bounds.top()); y <= tileIdx(bounds.bottom()); ++y)
+    {
+        const int top = (std::max)(bounds.top(), y*TILE_SIZE);
+        const int bottom = (std::min)(bounds.bottom(), y*TILE_SIZE + TILE_SIZE - 1);
+
+        int left, right;
+        if(!rowExtent(prim, top, bottom, left, right))
+            continue;
+
+        // tiles completely inside an outline are skipped
+        int holeFirst = INT_MAX, holeLast = INT_MIN;
+        int holeLeft, holeRight;
+        if(rowHole(prim, top, bottom, holeLeft, holeRight))
+        {
+            holeFirst = tileIdx(holeLeft) + 1;
+            holeLast = tileIdx(holeRight + 1) - 1;
+        }
+
+        for(int x = tileIdx(left); x <= tileIdx(right); ++x)
+        {
+            if(x == holeFirst && holeFirst <= holeLast)
+            {
+                x = holeLast;
+                continue;
+            }
+
+            if(!f(x, y))
+                return;
+        }
+    }
+}
+
+template <typename T>
+bool Canvas::fitsRaster(const T& prim, const QRect& bounds) const
+{
+    const QRect range(-RASTER_LIMIT, -RASTER_LIMIT, 2*RASTER_LIMIT, 2*RASTER_LIMIT);
+    if(!range.contains(bounds))
+        return false;
+
+    int free = MAX_TILES - m_tiles.size();
+    forEachTile(prim, bounds, [this, &free](int x, int y) -> bool {
+        if(!m_tiles.contains(TileIdx(x, y)))
+            --free;
+        return free >= 0;
+    });
+    return free >= 0;
+}
+
+template <typename T>
+void Canvas::addVector(const T& prim, const QRect& bounds)
+{
+    vectorShape v;
+    v.bounds = bounds;
+
+    QPainter p(&v.pic);
+    paint(p, prim);
+    p.end();
+
+    m_vectors.push_back(v);
+    if(m_vectors.size() > MAX_VECTORS)
+        m_vectors.erase(m_vectors.begin(), m_vectors.end() - MAX_VECTORS/2);
+}
+
+template <typename T>
+void Canvas::rasterize(const T& prim)
+{
+    const QRect bounds = boundingRect(prim);
+    if(bounds.isEmpty())
+        return;
+
+    if(!fitsRaster(prim, bounds))
+        addVector(prim, bounds);
+    else
+    {
+        forEachTile(prim, bounds, [this, &prim](int x, int y) -> bool {
+            QPainter p(&tile(x, y));
+            p.translate(-x*TILE_SIZE, -y*TILE_SIZE);
+            paint(p, prim);
+            return true;
+        });
+    }
+
+    update(bounds.translated(m_offset));
+}
+
+template <typename T>
+bool Canvas::rowExtent(const T& prim, int, int, int& left, int& right)
+{
+    const QRect bounds = boundingRect(prim);
+    left = bounds.left();
+    right = bounds.right();
+    return true;
+}
+
+bool Canvas::rowExtent(const line& l, int top, int bottom, int& left, int& right)
+{
+    // the part of the segment within the rows, widened by the pen
+    const int m = l.width/2 + 1;
+    const QPointF p1 = l.l.p1();
+    const QPointF p2 = l.l.p2();
+    const double dy = p2.y() - p1.y();
+
+    double t0 = 0.0, t1 = 1.0;
+    if(dy == 0.0)
+    {
+        if(p1.y() < top - m || p1.y() > bottom + m)
+            return false;
+    }
+    else
+    {
+        double ta = (top - m - p1.y()) / dy;
+        double tb = (bottom + m - p1.y()) / dy;
+        if(ta > tb)
+            std::swap(ta, tb);
+        t0 = (std::max)(t0, ta);
+        t1 = (std::min)(t1, tb);
+        if(t0 > t1)
+            return false;
+    }
+
+    const double x0 = p1.x() + (p2.x() - p1.x())*t0;
+    const double x1 = p1.x() + (p2.x() - p1.x())*t1;
+    left = int(std::floor((std::min)(x0, x1))) - m;
+    right = int(std::ceil((std::max)(x0, x1))) + m;
+    return true;
+}
+
+bool Canvas::rowHole(const rect& r, int top, int bottom, int& left, int& right)
+{
+    if(r.fillColor.isValid())
+        return false;
+
+    const int m = r.width/2 + 1;
+    const QRect inner = r.r.normalized().adjusted(m, m, -m, -m);
+    if(inner.isEmpty() || top < inner.top() || bottom > inner.bottom())
+        return false;
+
+    left = inner.left();
+    right = inner.right();
+    return true;
+}
+
+bool Canvas::rowHole(const circle& c, int top, int bottom, int& left, int& right)
+{
+    if(c.fillColor.isValid())
+        return false;
+
+    const int m = c.width/2 + 1;
+    const double a = qAbs(c.r1) - m;
+    const double b = qAbs(c.r2) - m;
+    if(a <= 0 || b <= 0)
+        return false;
+
+    // the narrowest part of the inner ellipse within the rows
+    const double dy = (std::max)(qAbs(top - c.center.y()), qAbs(bottom - c.center.y()));
+    if(dy >= b)
+        return false;
+
+    const int w = int(a*std::sqrt(1.0 - (dy/b)*(dy/b))) - 1;
+    if(w <= 0)
+        return false;
+
+    left = c.center.x() - w;
+    right = c.center.x() + w;
+    return true;
+}
+
+void Canvas::rasterizeHistory()
+{
+    // in the order they used to be painted in
+    for(size_t i = 0; i < m_images.size(); ++i)
+        rasterize(m_images[i]);
+    for(size_t i = 0; i < m_lines.size(); ++i)
+        rasterize(m_lines[i]);
+    for(size_t i = 0; i < m_rects.size(); ++i)
+        rasterize(m_rects[i]);
+    for(size_t i = 0; i < m_circles.size(); ++i)
+        rasterize(m_circles[i]);
+}
+
+QRect Canvas::boundingRect(const line& l)
+{
+    const int m = l.width/2 + 1;
+    return QRect(l.l.p1(), l.l.p2()).normalized().adjusted(-m, -m, m, m);
+}
+
+QRect Canvas::boundingRect(const rect& r)
+{
+    const int m = r.width/2 + 1;
+    return r.r.normalized().adjusted(-m, -m, m, m);
+}
+
+QRect Canvas::boundingRect(const circle& c)
+{
+    const int m = c.width/2 + 1;
+    return QRect(c.center.x() - c.r1, c.center.y() - c.r2, 2*c.r1, 2*c.r2).normalized().adjusted(-m, -m, m, m);
+}
+
+QRect Canvas::boundingRect(const image& img)
+{
+    return QRect(QPoint(img.x, img.y), img.pixmap.size());
+}
+
+void Canvas::paint(QPainter& p, const line& l)
+{
+    QPen pen(l.color);
+    pen.setWidth(l.width);
+    p.setPen(pen);
+
+    p.drawLine(l.l);
+}
+
+void Canvas::paint(QPainter& p, const rect& r)
+{
+    QPen pen(r.color);
+    pen.setWidth(r.width);
+    p.setPen(pen);
+    p.setBrush(r.fillColor.isValid() ? QBrush(r.fillColor) : QBrush());
+
+    p.drawRect(r.r);
+}
+
+void Canvas::paint(QPainter& p, const circle& c)
+{
+    QPen pen(c.color);
+    pen.setWidth(c.width);
+    p.setPen(pen);
+    p.setBrush(c.fillColor.isValid() ? QBrush(c.fillColor) : QBrush());
+
+    p.drawEllipse(c.center, c.r1, c.r2);
+}
+
+void Canvas::paint(QPainter& p, const image& img)
+{
+    p.drawPixmap(img.x, img.y, img.pixmap);
+}
+
 void Canvas::addLine(const QLine &l)
 {
     line lin = {l, m_lineColor, m_lineWidth };
-    m_lines.push_back(lin);
-
-    update();
+    rasterize(lin);
+    addToHistory(m_lines, lin);
 }
 
 void Canvas::addRect(const QRect &r)
 {
     rect rec = {r, m_lineColor, m_fillColor, m_lineWidth };
-    m_rects.push_back(rec);
-
-    update();
+    rasterize(rec);
+    addToHistory(m_rects, rec);
 }
 
 void Canvas::addCircle(const QPoint& center, int r1, int r2)
 {
     circle cir = { center, r1, r2, m_lineColor, m_fillColor, m_lineWidth };
-    m_circles.push_back(cir);
-
-    update();
+    rasterize(cir);
+    addToHistory(m_circles, cir);
 }
 
-void Canvas::addImage(const QString &path, int x, int y, int w, int h)
+QPixmap Canvas::loadImage(const QString& path, int w, int h)
 {
     QPixmap p(path);
     if(p.isNull())
-        return;
+        return p;
 
     if(w && h)
         p = p.scaled(w, h, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
@@ -349,13 +744,24 @@ void Canvas::addImage(const QString &path, int x, int y, int w, int h)
         const int s = (std::max)(w, h);
         p = p.scaled(s, s, Qt::KeepAspectRatioByExpanding, Qt::SmoothTransformation);
     }
+    return p;
+}
+
+void Canvas::addImage(const QString &path, int x, int y, int w, int h)
+{
+    QPixmap p = loadImage(path, w, h);
+    if(p.isNull())
+        return;
 
     image img = { path, p, x,  y };
-    m_images.push_back(img);
+    rasterize(img);
+    addToHistory(m_images, img);
 }
 
 void Canvas::clear()
 {
+    m_tiles.clear();
+    m_vectors.clear();
     m_lines.clear();
     m_rects.clear();
     m_circles.clear();
@@ -371,63 +777,31 @@ void Canvas::clear()
     update();
 }
 
-void Canvas::paintEvent(QPaintEvent *)
+void Canvas::paintEvent(QPaintEvent *event)
 {
     QPainter p(this);
     p.translate(m_offset);
 
-    QPen pen;
-    QBrush brush;
+    const QRect area = event->rect().translated(-m_offset);
 
-    for(size_t i = 0; i < m_images.size(); ++i)
+    for(int y = tileIdx(area.top()); y <= tileIdx(area.bottom()); ++y)
     {
-        const image& img = m_images[i];
-        p.drawPixmap(img.x, img.y, img.pixmap);
-    }
-
-    for(quint32 i = 0; i < m_lines.size(); ++i)
-    {
-        const line& l = m_lines[i];
-
-        pen.setColor(l.color);
-        pen.setWidth(l.width);
-        p.setPen(pen);
-
-        p.drawLine(l.l);
-    }
-
-    for(quint32 i = 0; i < m_rects.size(); ++i)
-    {
-        const rect& r = m_rects[i];
-
-        pen.setColor(r.color);
-        pen.setWidth(r.width);
-        p.setPen(pen);
-
-        if(r.fillColor.isValid())
-            brush = QBrush(r.fillColor);
-        else
-            brush = QBrush();
-        p.setBrush(brush);
+        for(int x = tileIdx(area.left()); x <= tileIdx(area.right()); ++x)
+        {
+            QHash<TileIdx, QImage>::const_iterator itr = m_tiles.constFind(TileIdx(x, y));
+            if(itr == m_tiles.constEnd())
+                continue;
 
-        p.drawRect(r.r);
+            const QPoint origin(x*TILE_SIZE, y*TILE_SIZE);
+            const QRect r = area & QRect(origin, QSize(TILE_SIZE, TILE_SIZE));
+            p.drawImage(r, *itr, r.translated(-origin));
+        }
     }
 
-    for(quint32 i = 0; i < m_circles.size(); ++i)
+    for(size_t i = 0; i < m_vectors.size(); ++i)
     {
-        const circle& c = m_circles[i];
-
-        pen.setColor(c.color);
-        pen.setWidth(c.width);
-        p.setPen(pen);
-
-        if(c.fillColor.isValid())
-            brush = QBrush(c.fillColor);
-        else
-            brush = QBrush();
-        p.setBrush(brush);
-
-        p.drawEllipse(c.center, c.r1, c.r2);
+        if(m_vectors[i].bounds.intersects(area))
+            p.drawPicture(0, 0, m_vectors[i].pic);
     }
 }
 
@@ -457,5 +831,5 @@ void Canvas::mouseMoveEvent(QMouseEvent *event)
     m_mouse = event->globalPos();
 
     m_offset += diff;
-    update();
+    scroll(diff.x(), diff.y());
 }
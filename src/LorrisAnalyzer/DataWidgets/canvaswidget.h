@@ -8,6 +8,12 @@
 #ifndef CANVASWIDGET_H
 #define CANVASWIDGET_H
 
+#include <QImage>
+#include <QPicture>
+#include <QHash>
+#include <QPair>
+#include <vector>
+
 #include "datawidget.h"
 
 class Canvas;
@@ -39,6 +45,7 @@ public slots:
     void setLineSize(int width);
     void setLineColor(const QString& color);
     void setFillColor(const QString& color);
+    void setHistoryLimit(int limit);
     void clear();
 
     int getCanvasWidth() const;
@@ -49,6 +56,15 @@ private:
     QPoint m_lastLine;
 };
 
+/*
+ * Everything drawn is rasterized into tiles of a persistent layer right away,
+ * repaints only copy the tiles in the dirty region. Tiles are made only where
+ * something is drawn, up to a fixed number of them. Primitives which would need
+ * more tiles or lie too far from the origin are recorded as vectors instead
+ * and painted over the layer. The primitives themselves are kept in a bounded
+ * history, which is saved along with the tiles so that older versions can
+ * still show the drawing.
+ */
 class Canvas : public QWidget
 {
     Q_OBJECT
@@ -65,12 +81,15 @@ public:
     void addImage(const QString& path, int x, int y, int w, int h);
     void clear();
 
+    // Number of kept primitives of each type, 0 disables the history
+    void setHistoryLimit(int limit);
+
     QColor& lineColor() { return m_lineColor; }
     QColor& fillColor() { return m_fillColor; }
     int& lineWidth() { return m_lineWidth; }
 
 protected:
-    void paintEvent(QPaintEvent *);
+    void paintEvent(QPaintEvent *event);
     void mousePressEvent(QMouseEvent *event);
     void mouseReleaseEvent(QMouseEvent *event);
     void mouseMoveEvent(QMouseEvent *event);
@@ -109,10 +128,52 @@ private:
         int y;
     };
 
+    struct vectorShape
+    {
+        QRect bounds;
+        QPicture pic;
+    };
+
+    typedef QPair<int, int> TileIdx;
+
+    static QRect boundingRect(const line& l);
+    static QRect boundingRect(const rect& r);
+    static QRect boundingRect(const circle& c);
+    static QRect boundingRect(const image& img);
+    static void paint(QPainter& p, const line& l);
+    static void paint(QPainter& p, const rect& r);
+    static void paint(QPainter& p, const circle& c);
+    static void paint(QPainter& p, const image& img);
+    // Columns of the rows [top, bottom] the primitive may paint to, false if none
+    template <typename T> static bool rowExtent(const T& prim, int top, int bottom, int& left, int& right);
+    static bool rowExtent(const line& l, int top, int bottom, int& left, int& right);
+    // Columns of the rows [top, bottom] inside an outline, which it leaves untouched
+    template <typename T> static bool rowHole(const T&, int, int, int&, int&) { return false; }
+    static bool rowHole(const rect& r, int top, int bottom, int& left, int& right);
+    static bool rowHole(const circle& c, int top, int bottom, int& left, int& right);
+
+    // Calls f(x, y) for the tiles the primitive may paint to, until it returns false
+    template <typename T, typename F> static void forEachTile(const T& prim, const QRect& bounds, F f);
+    template <typename T> bool fitsRaster(const T& prim, const QRect& bounds) const;
+    template <typename T> void addVector(const T& prim, const QRect& bounds);
+    template <typename T> void rasterize(const T& prim);
+    template <typename T> void addToHistory(std::vector<T>& history, const T& prim);
+    template <typename T> void trimHistory(std::vector<T>& history);
+    QImage& tile(int x, int y);
+    static QPixmap loadImage(const QString& path, int w, int h);
+    void rasterizeHistory();
+    void saveTiles(DataFileParser *file);
+    bool loadTiles(DataFileParser *file);
+    void saveVectors(DataFileParser *file);
+    void loadVectors(DataFileParser *file);
+
+    QHash<TileIdx, QImage> m_tiles;
+    std::vector<vectorShape> m_vectors;
     std::vector<line> m_lines;
     std::vector<rect> m_rects;
     std::vector<circle> m_circles;
     std::vector<image> m_images;
+    int m_historyLimit;
     QPoint m_mouse;
     QPoint m_offset;
     QColor m_lineColor;
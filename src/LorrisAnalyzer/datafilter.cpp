@@ -7,6 +7,7 @@
 
 #include <QScrollArea>
 #include <QApplication>
+#include <QScriptProgram>
 
 #include "datafilter.h"
 #include "../misc/utils.h"
@@ -363,6 +364,69 @@ void ByteFilterCondition::load(DataFileParser *file)
     }
 }
 
+// Script conditions share one engine, each of them runs with its own global
+// object, which inherits the engine's one, so their variables don't clash.
+// QScriptProgram keeps the compiled code for the engine it was run in,
+// so conditions with the same script (e.g. loaded again) are compiled once.
+static QScriptEngine *filterEngine = NULL;
+static QScriptValue filterGlobal;
+static int filterEngineRefs = 0;
+static QHash<QString, QScriptProgram> filterPrograms;
+
+static const int MAX_FILTER_PROGRAMS = 64;
+
+static QScriptEngine *acquireFilterEngine()
+{
+    if(filterEngineRefs++ == 0)
+    {
+        filterEngine = new QScriptEngine();
+        filterGlobal = filterEngine->globalObject();
+    }
+    return filterEngine;
+}
+
+static void releaseFilterEngine()
+{
+    if(--filterEngineRefs != 0)
+        return;
+
+    filterPrograms.clear();
+    filterGlobal = QScriptValue();
+    delete filterEngine;
+    filterEngine = NULL;
+}
+
+namespace {
+// Makes the condition's object the engine's global one for its lifetime
+class FilterGlobalScope
+{
+public:
+    FilterGlobalScope(QScriptEngine *engine, const QScriptValue& global) : m_engine(engine)
+    {
+        m_engine->setGlobalObject(global);
+    }
+
+    ~FilterGlobalScope()
+    {
+        m_engine->setGlobalObject(filterGlobal);
+    }
+
+private:
+    QScriptEngine *m_engine;
+};
+}
+
+static QScriptProgram filterProgram(const QString& source)
+{
+    QHash<QString, QScriptProgram>::iterator itr = filterPrograms.find(source);
+    if(itr != filterPrograms.end())
+        return *itr;
+
+    if(filterPrograms.size() >= MAX_FILTER_PROGRAMS)
+        filterPrograms.clear();
+    return *filterPrograms.insert(source, QScriptProgram(source));
+}
+
 ScriptFilterCondition::ScriptFilterCondition(int engine) : FilterCondition(COND_SCRIPT)
 {
     m_lang = engine;
@@ -370,40 +434,57 @@ ScriptFilterCondition::ScriptFilterCondition(int engine) : FilterCondition(COND_
                   "function dataPass(data, dev, cmd) {\n"
                   "    return false;\n"
                   "}\n");
-    m_engine.pushContext();
+    m_engine = acquireFilterEngine();
+    m_global = m_engine->newObject();
+    m_global.setPrototype(filterGlobal);
+}
+
+ScriptFilterCondition::~ScriptFilterCondition()
+{
+    m_func = QScriptValue();
+    m_global = QScriptValue();
+    releaseFilterEngine();
 }
 
 void ScriptFilterCondition::setScript(const QString &script)
 {
     m_error.clear();
     m_script = script;
+    m_func = QScriptValue();
 
-    m_engine.popContext();
-    QScriptContext *ctx = m_engine.pushContext();
+    // a fresh global object, so nothing is left from the previous script
+    m_global = m_engine->newObject();
+    m_global.setPrototype(filterGlobal);
 
-    m_engine.evaluate(script);
-    if(m_engine.hasUncaughtException())
-    {
-        m_error = QString("%1: %2").arg(m_engine.uncaughtExceptionLineNumber()).arg(m_engine.uncaughtException().toString());
+    FilterGlobalScope scope(m_engine, m_global);
+
+    QScriptContext *ctx = m_engine->pushContext();
+    ctx->setActivationObject(m_global);
+    m_engine->evaluate(filterProgram(script));
+    if(m_engine->hasUncaughtException())
+        m_error = QString("%1: %2").arg(m_engine->uncaughtExceptionLineNumber()).arg(m_engine->uncaughtException().toString());
+    m_engine->popContext();
+
+    if(!m_error.isEmpty())
         return;
-    }
 
-    m_func = ctx->activationObject().property("dataPass");
+    m_func = m_global.property("dataPass");
     if(!m_func.isFunction())
     {
         m_error = QObject::tr("Could not find dataPass function!");
+        m_func = QScriptValue();
         return;
     }
 
     QScriptValueList args;
-    args.push_back(m_engine.newArray());
+    args.push_back(m_engine->newArray());
     args << -1 << -1;
 
     m_func.call(QScriptValue(), args);
 
-    if(m_engine.hasUncaughtException())
+    if(m_engine->hasUncaughtException())
     {
-        m_error = QString("%1: %2").arg(m_engine.uncaughtExceptionLineNumber()).arg(m_engine.uncaughtException().toString());
+        m_error = QString("%1: %2").arg(m_engine->uncaughtExceptionLineNumber()).arg(m_engine->uncaughtException().toString());
         m_func = QScriptValue();
         return;
     }
@@ -416,9 +497,9 @@ bool ScriptFilterCondition::isOkay(analyzer_data *data)
 
     const QByteArray& pkt_data = data->getData();
 
-    QScriptValue jsData = m_engine.newArray(pkt_data.size());
+    QScriptValue jsData = m_engine->newArray(pkt_data.size());
     for(qint32 i = 0; i < pkt_data.size(); ++i)
-        jsData.setProperty(i, QScriptValue(&m_engine, (quint8)pkt_data[i]));
+        jsData.setProperty(i, QScriptValue(m_engine, (quint8)pkt_data[i]));
 
     QScriptValueList args;
     args.push_back(jsData);
@@ -430,6 +511,8 @@ bool ScriptFilterCondition::isOkay(analyzer_data *data)
     if(data->getCmd(res))  args << res;
     else                   args << -1;
 
+    // variables assigned without var end up in the condition's global object
+    FilterGlobalScope scope(m_engine, m_global);
     QScriptValue val = m_func.call(QScriptValue(), args);
     return val.toBool();
 }
@@ -121,6 +121,7 @@ class ScriptFilterCondition : public FilterCondition
 {
 public:
     ScriptFilterCondition(int engine);
+    ~ScriptFilterCondition();
 
     bool isOkay(analyzer_data *data);
     void save(DataFileParser *file);
@@ -137,7 +138,10 @@ public:
 private:
     QString m_script;
     int m_lang;
-    QScriptEngine m_engine;
+    // shared by all script conditions
+    QScriptEngine *m_engine;
+    // the condition's global object, inherits the engine's one
+    QScriptValue m_global;
     QScriptValue m_func;
     QString m_error;
 };
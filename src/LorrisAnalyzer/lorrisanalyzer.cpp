@@ -24,11 +24,13 @@
 #include <QFileDialog>
 #include <QStringBuilder>
 #include <QToolBar>
+#include <QProgressDialog>
 
 #include "lorrisanalyzer.h"
 #include "sourcedialog.h"
 #include "packet.h"
 #include "storage.h"
+#include "storageexport.h"
 #include "widgetarea.h"
 #include "sourceselectdialog.h"
 #include "packetparser.h"
@@ -496,16 +498,42 @@ void LorrisAnalyzer::exportBin()
     if(filename.isEmpty())
         return;
 
+    StorageExportSettings settings;
+    settings.filename = filename;
+    settings.format = EXPORT_RAW;
+
+    StorageExport *exporter = new StorageExport(this);
     try {
-        m_storage.ExportToBin(filename);
+        exporter->start(&m_storage, settings);
     } catch(const QString& ex) {
+        delete exporter;
         return Utils::showErrorBox(ex);
     }
 
-    QString name = filename.split(QRegExp("[\\/]"), QString::SkipEmptyParts).last();
-    emit statusBarMsg(tr("Binary data were exported to file \"%1\"").arg(name), 5000);
-
     sConfig.set(CFG_STRING_ANALYZER_IMPORT, filename);
+
+    QProgressDialog *dialog = new QProgressDialog(tr("Exporting binary data..."), tr("Cancel"), 0, 100, this);
+    dialog->setWindowModality(Qt::WindowModal);
+
+    connect(exporter, SIGNAL(progress(int)),           dialog,   SLOT(setValue(int)));
+    connect(dialog,   SIGNAL(canceled()),              exporter, SLOT(cancel()));
+    connect(exporter, SIGNAL(finished(bool,QString)),  dialog,   SLOT(deleteLater()));
+    connect(exporter, SIGNAL(finished(bool,QString)),            SLOT(exportBinFinished(bool,QString)));
+}
+
+void LorrisAnalyzer::exportBinFinished(bool success, const QString& error)
+{
+    StorageExport *exporter = (StorageExport*)sender();
+    exporter->deleteLater();
+
+    if(!error.isEmpty())
+        return Utils::showErrorBox(error);
+
+    if(!success)
+        return;
+
+    QString name = exporter->getFilename().split(QRegExp("[\\/]"), QString::SkipEmptyParts).last();
+    emit statusBarMsg(tr("Binary data were exported to file \"%1\"").arg(name), 5000);
 }
 
 void LorrisAnalyzer::importBinAct()
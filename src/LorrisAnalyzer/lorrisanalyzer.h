@@ -98,6 +98,7 @@ private slots:
     void saveButton();
     void saveAsButton();
     void exportBin();
+    void exportBinFinished(bool success, const QString& error);
     void importBinAct();
     void clearAllButton();
     void openFile();
@@ -393,18 +393,6 @@ bool Storage::checkMagic(DataFileParser *file)
     return true;
 }
 
-void Storage::ExportToBin(const QString &filename)
-{
-    QFile f(filename);
-    if(!f.open(QIODevice::Truncate | QIODevice::WriteOnly))
-        throw tr("Unable to open file %1 for writing!").arg(filename);
-
-    for(quint32 i = 0; i < m_data.size(); ++i)
-        f.write(m_data[i]);
-
-    f.close();
-}
-
 void Storage::readLegacyStructure(DataFileParser *file, analyzer_packet *packet)
 {
     char version[3] = { 0 };
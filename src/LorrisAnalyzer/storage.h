@@ -51,6 +51,7 @@ public:
     quint32 getMaxIdx() const { return m_data.size() ? m_data.size()-1 : 0; }
     bool isEmpty() const { return m_data.empty(); }
     bool isFull() const { return m_data.full(); }
+    quint64 getDropped() const { return m_data.dropped(); }
     QByteArray *get(quint32 index) { return &m_data[index]; }
     analyzer_packet *loadFromFile(QString *name, quint8 load, WidgetArea *area, FilterTabWidget *filters, quint32 &data_idx);
 
@@ -63,7 +64,6 @@ public:
 public slots:
     void SaveToFile(QString filename, WidgetArea *area, FilterTabWidget *filters);
     void SaveToFile(WidgetArea *area, FilterTabWidget *filters);
-    void ExportToBin(const QString& filename);
 
 private:
     bool checkMagic(DataFileParser *file);
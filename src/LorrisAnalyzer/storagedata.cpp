@@ -11,6 +11,7 @@ StorageData::StorageData()
 {
     m_packet_limit = INT_MAX;
     m_offset = 0;
+    m_dropped = 0;
 }
 
 StorageData::~StorageData()
@@ -20,6 +21,7 @@ StorageData::~StorageData()
 
 void StorageData::clear()
 {
+    m_dropped += m_data.size();
     m_data.clear();
     m_offset = 0;
 }
@@ -44,6 +46,7 @@ void StorageData::setPacketLimit(int limit)
         itr = (std::max)(0, m_offset-limit);
         vec.insert(vec.end(), m_data.begin()+itr, m_data.begin()+m_offset);
 
+        m_dropped += m_data.size() - vec.size();
         m_data.swap(vec);
     }
 
@@ -73,6 +76,7 @@ QByteArray *StorageData::push_back(const QByteArray& data)
             m_offset = 0;
 
         m_data[m_offset] = data;
+        ++m_dropped;
         res = &m_data[m_offset];
         ++m_offset;
     }
@@ -21,6 +21,9 @@ public:
     inline bool empty() const { return m_data.empty(); }
     inline bool full() const { return m_data.size() >= (quint32)m_packet_limit; }
     inline quint32 size() const { return m_data.size(); }
+    // Number of packets removed from the front since the object was created,
+    // index + dropped() identifies a packet even after older ones are removed
+    inline quint64 dropped() const { return m_dropped; }
 
     int getPacketLimit() const { return m_packet_limit; }
     void setPacketLimit(int limit);
@@ -32,6 +35,7 @@ private:
     std::vector<QByteArray> m_data;
     int m_packet_limit;
     int m_offset;
+    quint64 m_dropped;
 };
 
 #endif // STORAGEDATA_H
@@ -0,0 +1,702 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#include <string.h>
+#include <algorithm>
+#include <QtEndian>
+
+#include "storageexport.h"
+#include "storage.h"
+#include "packet.h"
+#include "datafilter.h"
+#include "DataWidgets/datawidget.h"
+#include "../misc/utils.h"
+
+static const char COLUMNS_MAGIC[] = "LORRISCL";
+static const int COLUMNS_MAGIC_LEN = sizeof(COLUMNS_MAGIC) - 1;
+static const quint8 COLUMNS_VERSION = 1;
+
+static const int CHUNK_PACKETS = 8192;
+// chunks waiting for the writer, limits the memory held by the export
+static const int MAX_CHUNKS_IN_FLIGHT = 3;
+static const int WRITE_BUFFER = 1024*1024;
+
+static int typeSize(quint8 type)
+{
+    switch(type)
+    {
+        case NUM_UINT8:
+        case NUM_INT8:
+            return 1;
+        case NUM_UINT16:
+        case NUM_INT16:
+            return 2;
+        case NUM_UINT32:
+        case NUM_INT32:
+        case NUM_FLOAT:
+            return 4;
+        case NUM_UINT64:
+        case NUM_INT64:
+        case NUM_DOUBLE:
+            return 8;
+    }
+    return 0;
+}
+
+static quint8 columnType(const StorageExportColumn& c)
+{
+    return c.pos < 0 ? quint8(NUM_UINT64) : c.type;
+}
+
+template <typename T>
+static void decodeColumn(const StorageExportChunk& chunk, const QBitArray *accepted, quint32 pos,
+                         bool bigEndian, T *values, char *present)
+{
+    const int count = chunk.packets.size();
+    for(int i = 0; i < count; ++i)
+    {
+        const QByteArray& p = chunk.packets[i];
+        if((accepted && !accepted->testBit(i)) || pos + sizeof(T) > quint32(p.size()))
+        {
+            values[i] = 0;
+            present[i] = 0;
+            continue;
+        }
+
+        T val;
+        memcpy(&val, p.constData() + pos, sizeof(T));
+        if(sizeof(T) > 1 && bigEndian)
+            Utils::swapEndian(val);
+        values[i] = val;
+        present[i] = 1;
+    }
+}
+
+template <typename T>
+static T valueAt(const QByteArray& values, quint8 type, quint32 row)
+{
+    switch(type)
+    {
+        case NUM_UINT8:  return T(((const quint8*)values.constData())[row]);
+        case NUM_UINT16: return T(((const quint16*)values.constData())[row]);
+        case NUM_UINT32: return T(((const quint32*)values.constData())[row]);
+        case NUM_UINT64: return T(((const quint64*)values.constData())[row]);
+        case NUM_INT8:   return T(((const qint8*)values.constData())[row]);
+        case NUM_INT16:  return T(((const qint16*)values.constData())[row]);
+        case NUM_INT32:  return T(((const qint32*)values.constData())[row]);
+        case NUM_INT64:  return T(((const qint64*)values.constData())[row]);
+        case NUM_FLOAT:  return T(((const float*)values.constData())[row]);
+        case NUM_DOUBLE: return T(((const double*)values.constData())[row]);
+    }
+    return T(0);
+}
+
+// Writes the number backwards, ending just before end
+static char *formatUInt(char *end, quint64 val)
+{
+    do
+    {
+        *(--end) = '0' + (val % 10);
+        val /= 10;
+    } while(val != 0);
+    return end;
+}
+
+static char *formatInt(char *end, qint64 val)
+{
+    if(val >= 0)
+        return formatUInt(end, val);
+
+    end = formatUInt(end, quint64(0) - quint64(val));
+    *(--end) = '-';
+    return end;
+}
+
+StorageExportWriter::StorageExportWriter(const StorageExportSettings& settings, bool packetBigEndian)
+    : m_settings(settings), m_packetBigEndian(packetBigEndian), m_cancel(false), m_file(this)
+{
+    m_failed = false;
+    m_separator = settings.separator.toUtf8();
+    m_lineEnd = settings.lineEnd.toUtf8();
+    m_columns.resize(settings.columns.size());
+    m_buffer.reserve(WRITE_BUFFER);
+}
+
+StorageExportWriter::~StorageExportWriter()
+{
+    // the export did not finish
+    if(m_file.isOpen())
+    {
+        m_file.close();
+        m_file.remove();
+    }
+}
+
+void StorageExportWriter::open()
+{
+    m_file.setFileName(m_settings.filename);
+    if(!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered))
+        throw tr("Unable to open file %1 for writing!").arg(m_settings.filename);
+
+    writeHeader();
+}
+
+void StorageExportWriter::writeHeader()
+{
+    switch(m_settings.format)
+    {
+        case EXPORT_CSV:
+        {
+            if(!m_settings.header)
+                break;
+
+            for(size_t i = 0; i < m_settings.columns.size(); ++i)
+            {
+                if(i != 0)
+                    write(m_separator);
+
+                QString name = m_settings.columns[i].name;
+                write("\"" + name.replace("\"", "\"\"").toUtf8() + "\"");
+            }
+            write(m_lineEnd);
+            break;
+        }
+        case EXPORT_COLUMNS:
+        {
+            write(COLUMNS_MAGIC, COLUMNS_MAGIC_LEN);
+            write((const char*)&COLUMNS_VERSION, sizeof(COLUMNS_VERSION));
+
+            const quint16 count = qToLittleEndian<quint16>(m_settings.columns.size());
+            write((const char*)&count, sizeof(count));
+
+            for(size_t i = 0; i < m_settings.columns.size(); ++i)
+            {
+                const quint8 type = columnType(m_settings.columns[i]);
+                const QByteArray name = m_settings.columns[i].name.toUtf8();
+                const quint16 len = qToLittleEndian<quint16>(name.size());
+
+                write((const char*)&type, sizeof(type));
+                write((const char*)&len, sizeof(len));
+                write(name);
+            }
+            break;
+        }
+    }
+}
+
+void StorageExportWriter::write(const char *data, int len)
+{
+    m_buffer.append(data, len);
+    if(m_buffer.size() >= WRITE_BUFFER)
+        flush();
+}
+
+void StorageExportWriter::flush()
+{
+    if(!m_file.isOpen() || m_buffer.isEmpty())
+        return;
+
+    if(!m_failed && m_file.write(m_buffer) != m_buffer.size())
+    {
+        m_failed = true;
+        emit error(tr("Can't write to file \"%1\": %2").arg(m_file.fileName(), m_file.errorString()));
+    }
+
+    // keeps the reserved capacity
+    m_buffer.resize(0);
+}
+
+void StorageExportWriter::writeChunk(const StorageExportChunk& chunk)
+{
+    if(m_cancel || m_failed)
+        return;
+
+    if(m_settings.format == EXPORT_RAW)
+    {
+        for(int i = 0; i < chunk.packets.size(); ++i)
+            write(chunk.packets[i]);
+    }
+    else
+    {
+        decode(chunk);
+        switch(m_settings.format)
+        {
+            case EXPORT_CSV:     appendCSV();     break;
+            case EXPORT_BINARY:  appendBinary();  break;
+            case EXPORT_COLUMNS: appendColumns(); break;
+        }
+    }
+
+    emit chunkWritten(chunk.packets.size());
+}
+
+void StorageExportWriter::finish()
+{
+    flush();
+    m_file.close();
+
+    if(m_cancel || m_failed)
+        m_file.remove();
+
+    emit finished();
+}
+
+QByteArray StorageExportWriter::formatCSV(const StorageExportChunk& chunk)
+{
+    Q_ASSERT(!m_file.isOpen());
+
+    m_buffer.resize(0);
+    writeHeader();
+    decode(chunk);
+    appendCSV();
+    return QByteArray(m_buffer.constData(), m_buffer.size());
+}
+
+void StorageExportWriter::decode(const StorageExportChunk& chunk)
+{
+    const int count = chunk.packets.size();
+
+    for(size_t c = 0; c < m_columns.size(); ++c)
+    {
+        const StorageExportColumn& info = m_settings.columns[c];
+        column& col = m_columns[c];
+
+        col.values.resize(typeSize(columnType(info))*count);
+        col.present.resize(count);
+
+        if(info.pos < 0)
+        {
+            quint64 *values = (quint64*)col.values.data();
+            for(int i = 0; i < count; ++i)
+                values[i] = chunk.first + i;
+            memset(col.present.data(), 1, count);
+            continue;
+        }
+
+        const QBitArray *accepted = NULL;
+        if(c < size_t(chunk.accepted.size()) && !chunk.accepted[c].isEmpty())
+            accepted = &chunk.accepted[c];
+
+        char *v = col.values.data();
+        char *p = col.present.data();
+        switch(info.type)
+        {
+            case NUM_UINT8:  decodeColumn(chunk, accepted, info.pos, m_packetBigEndian, (quint8*)v, p);  break;
+            case NUM_UINT16: decodeColumn(chunk, accepted, info.pos, m_packetBigEndian, (quint16*)v, p); break;
+            case NUM_UINT32: decodeColumn(chunk, accepted, info.pos, m_packetBigEndian, (quint32*)v, p); break;
+            case NUM_UINT64: decodeColumn(chunk, accepted, info.pos, m_packetBigEndian, (quint64*)v, p); break;
+            case NUM_INT8:   decodeColumn(chunk, accepted, info.pos, m_packetBigEndian, (qint8*)v, p);   break;
+            case NUM_INT16:  decodeColumn(chunk, accepted, info.pos, m_packetBigEndian, (qint16*)v, p);  break;
+            case NUM_INT32:  decodeColumn(chunk, accepted, info.pos, m_packetBigEndian, (qint32*)v, p);  break;
+            case NUM_INT64:  decodeColumn(chunk, accepted, info.pos, m_packetBigEndian, (qint64*)v, p);  break;
+            case NUM_FLOAT:  decodeColumn(chunk, accepted, info.pos, m_packetBigEndian, (float*)v, p);   break;
+            case NUM_DOUBLE: decodeColumn(chunk, accepted, info.pos, m_packetBigEndian, (double*)v, p);  break;
+            default:
+                memset(p, 0, count);
+                break;
+        }
+    }
+
+    // Packets without any value (not accepted by the filters) are skipped,
+    // the index column alone does not count
+    m_rows.clear();
+    bool hasValues = false;
+    for(size_t c = 0; c < m_columns.size(); ++c)
+        hasValues |= (m_settings.columns[c].pos >= 0);
+
+    for(int i = 0; i < count; ++i)
+    {
+        bool used = !hasValues;
+        for(size_t c = 0; !used && c < m_columns.size(); ++c)
+            used = m_settings.columns[c].pos >= 0 && m_columns[c].present.constData()[i];
+        if(used)
+            m_rows.push_back(i);
+    }
+}
+
+void StorageExportWriter::appendValue(quint8 type, const column& c, quint32 row)
+{
+    char buff[24];
+    char *end = buff + sizeof(buff);
+    char *itr;
+    switch(type)
+    {
+        case NUM_UINT8:
+        case NUM_UINT16:
+        case NUM_UINT32:
+        case NUM_UINT64:
+            itr = formatUInt(end, valueAt<quint64>(c.values, type, row));
+            break;
+        case NUM_INT8:
+        case NUM_INT16:
+        case NUM_INT32:
+        case NUM_INT64:
+            itr = formatInt(end, valueAt<qint64>(c.values, type, row));
+            break;
+        case NUM_FLOAT:
+            // QByteArray::number does not depend on the locale, unlike printf
+            write(QByteArray::number(valueAt<double>(c.values, type, row), 'g', 9));
+            return;
+        case NUM_DOUBLE:
+            write(QByteArray::number(valueAt<double>(c.values, type, row), 'g', 17));
+            return;
+        default:
+            return;
+    }
+    write(itr, end - itr);
+}
+
+void StorageExportWriter::appendCSV()
+{
+    for(size_t r = 0; r < m_rows.size(); ++r)
+    {
+        const quint32 row = m_rows[r];
+        for(size_t c = 0; c < m_columns.size(); ++c)
+        {
+            if(c != 0)
+                write(m_separator);
+            if(m_columns[c].present.constData()[row])
+                appendValue(columnType(m_settings.columns[c]), m_columns[c], row);
+        }
+        write(m_lineEnd);
+    }
+}
+
+void StorageExportWriter::appendBinary()
+{
+    const int valueSize = typeSize(m_settings.binType);
+    const int idxSize = m_settings.indexWidth;
+
+    for(size_t r = 0; r < m_rows.size(); ++r)
+    {
+        const quint32 row = m_rows[r];
+        for(size_t c = 0; c < m_columns.size(); ++c)
+        {
+            const column& col = m_columns[c];
+            const quint8 type = columnType(m_settings.columns[c]);
+
+            // absent values are written as 0, see StorageExportSettings
+            char buff[8] = { 0 };
+            int size = valueSize;
+            if(m_settings.columns[c].pos < 0)
+            {
+                const quint64 idx = qToLittleEndian(valueAt<quint64>(col.values, type, row));
+                memcpy(buff, &idx, sizeof(idx));
+                size = idxSize;
+            }
+            else if(col.present.constData()[row])
+            {
+                switch(m_settings.binType)
+                {
+                    case NUM_FLOAT:
+                    {
+                        const float f = valueAt<double>(col.values, type, row);
+                        memcpy(buff, &f, sizeof(f));
+                        toLittleEndian(buff, sizeof(f));
+                        break;
+                    }
+                    case NUM_DOUBLE:
+                    {
+                        const double d = valueAt<double>(col.values, type, row);
+                        memcpy(buff, &d, sizeof(d));
+                        toLittleEndian(buff, sizeof(d));
+                        break;
+                    }
+                    default:
+                    {
+                        // integers are truncated to the lower bytes
+                        quint64 i;
+                        if(type == NUM_FLOAT || type == NUM_DOUBLE)
+                            i = quint64(valueAt<qint64>(col.values, type, row));
+                        else
+                            i = valueAt<quint64>(col.values, type, row);
+                        i = qToLittleEndian(i);
+                        memcpy(buff, &i, sizeof(i));
+                        break;
+                    }
+                }
+            }
+
+            if(m_settings.bigEndian && size > 1)
+                Utils::swapEndian(buff, size);
+            write(buff, size);
+        }
+    }
+}
+
+void StorageExportWriter::appendColumns()
+{
+    const quint32 rows = m_rows.size();
+    if(rows == 0)
+        return;
+
+    const quint32 rowsLE = qToLittleEndian(rows);
+    write((const char*)&rowsLE, sizeof(rowsLE));
+
+    const bool all = (rows == quint32(m_columns.empty() ? 0 : m_columns[0].present.size()));
+    for(size_t c = 0; c < m_columns.size(); ++c)
+    {
+        const column& col = m_columns[c];
+        const int size = typeSize(columnType(m_settings.columns[c]));
+
+        if(all)
+        {
+            write(col.present);
+            writeLittleEndian(col.values.constData(), rows, size);
+            continue;
+        }
+
+        for(quint32 r = 0; r < rows; ++r)
+            write(col.present.constData() + m_rows[r], 1);
+        for(quint32 r = 0; r < rows; ++r)
+            writeLittleEndian(col.values.constData() + m_rows[r]*size, 1, size);
+    }
+}
+
+void StorageExportWriter::toLittleEndian(char *data, int size)
+{
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+    if(size > 1)
+        Utils::swapEndian(data, size);
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(size);
+#endif
+}
+
+void StorageExportWriter::writeLittleEndian(const char *data, quint32 count, int size)
+{
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+    char buff[8];
+    for(quint32 i = 0; i < count; ++i)
+    {
+        memcpy(buff, data + i*size, size);
+        toLittleEndian(buff, size);
+        write(buff, size);
+    }
+#else
+    write(data, count*size);
+#endif
+}
+
+StorageExport::StorageExport(QObject *parent) : QObject(parent)
+{
+    qRegisterMetaType<StorageExportChunk>("StorageExportChunk");
+
+    m_writer = NULL;
+    m_storage = NULL;
+    m_base = m_next = m_end = 0;
+    m_written = m_total = 0;
+    m_inFlight = 0;
+    m_finishing = false;
+    m_canceled = false;
+    m_thread.setObjectName("StorageExport");
+}
+
+StorageExport::~StorageExport()
+{
+    if(!m_writer)
+        return;
+
+    m_writer->cancel();
+    m_thread.quit();
+    m_thread.wait();
+
+    // removes the unfinished file
+    delete m_writer;
+}
+
+void StorageExport::start(Storage *storage, const StorageExportSettings& settings)
+{
+    Q_ASSERT(!m_writer);
+
+    for(size_t i = 0; i < settings.columns.size(); ++i)
+    {
+        const StorageExportColumn& c = settings.columns[i];
+        if(c.pos >= 0 && typeSize(c.type) == 0)
+            throw tr("Values of column \"%1\" can't be exported.").arg(c.name);
+    }
+
+    analyzer_packet *packet = storage->getPacket();
+    StorageExportWriter *writer = new StorageExportWriter(settings, packet && packet->big_endian);
+    try {
+        writer->open();
+    } catch(...) {
+        delete writer;
+        throw;
+    }
+
+    m_storage = storage;
+    m_settings = settings;
+    m_error.clear();
+    m_finishing = false;
+    m_canceled = false;
+
+    const quint32 from = (std::min)(settings.from, storage->getSize());
+    const quint32 to = (std::max)(from, (std::min)(settings.to, storage->getSize()));
+    m_base = storage->getDropped();
+    m_next = m_base + from;
+    m_end = m_base + to;
+    m_total = to - from;
+    m_written = 0;
+    m_inFlight = 0;
+
+    for(size_t i = 0; i < settings.columns.size(); ++i)
+        if(settings.columns[i].filter)
+            connect(settings.columns[i].filter.data(), SIGNAL(destroyed()), SLOT(filterDestroyed()));
+
+    m_writer = writer;
+    m_writer->moveToThread(&m_thread);
+    connect(m_writer, SIGNAL(chunkWritten(quint32)), SLOT(chunkWritten(quint32)));
+    connect(m_writer, SIGNAL(error(QString)),        SLOT(writerError(QString)));
+    connect(m_writer, SIGNAL(finished()),            SLOT(writerFinished()));
+    m_thread.start();
+
+    emit progress(0);
+    sendChunks();
+}
+
+bool StorageExport::takeChunk(Storage *storage, const StorageExportSettings& settings,
+                              quint64 base, quint64 first, quint32 count, StorageExportChunk& chunk)
+{
+    // the packets were dropped from the storage or it was cleared
+    if(first < storage->getDropped())
+        return false;
+
+    const quint32 idx = first - storage->getDropped();
+    if(quint64(idx) + count > storage->getSize())
+        return false;
+
+    chunk.first = first - base;
+    chunk.packets.reserve(count);
+    for(quint32 i = 0; i < count; ++i)
+        chunk.packets.append(*storage->get(idx + i));
+
+    chunk.accepted.resize(settings.columns.size());
+    for(size_t c = 0; c < settings.columns.size(); ++c)
+    {
+        DataFilter *filter = settings.columns[c].filter.data();
+        if(!filter || settings.columns[c].pos < 0)
+            continue;
+
+        QBitArray& accepted = chunk.accepted[c];
+        accepted.resize(count);
+        for(quint32 i = 0; i < count; ++i)
+        {
+            analyzer_data data(storage->get(idx + i), storage->getPacket());
+            accepted.setBit(i, filter->isOkay(&data));
+        }
+    }
+    return true;
+}
+
+void StorageExport::sendChunks()
+{
+    if(m_finishing)
+        return;
+
+    while(m_inFlight < MAX_CHUNKS_IN_FLIGHT && m_next < m_end)
+    {
+        const quint32 count = (std::min)(quint64(CHUNK_PACKETS), m_end - m_next);
+
+        StorageExportChunk chunk;
+        if(!takeChunk(m_storage, m_settings, m_base, m_next, count, chunk))
+            return stop(tr("The data were removed from the storage during the export."));
+
+        m_next += count;
+        ++m_inFlight;
+        QMetaObject::invokeMethod(m_writer, "writeChunk", Qt::QueuedConnection, Q_ARG(StorageExportChunk, chunk));
+    }
+
+    if(m_next >= m_end && m_inFlight == 0)
+    {
+        m_finishing = true;
+        QMetaObject::invokeMethod(m_writer, "finish", Qt::QueuedConnection);
+    }
+}
+
+void StorageExport::chunkWritten(quint32 packets)
+{
+    --m_inFlight;
+    m_written += packets;
+
+    // 100 is reported once the file is closed
+    emit progress((std::min)(quint64(99), m_written*100/(std::max)(quint64(1), m_total)));
+
+    sendChunks();
+}
+
+void StorageExport::cancel()
+{
+    if(!m_writer)
+        return;
+
+    m_canceled = true;
+    stop(QString());
+}
+
+void StorageExport::stop(const QString& error)
+{
+    if(!m_writer)
+        return;
+
+    if(m_error.isEmpty())
+        m_error = error;
+
+    m_writer->cancel();
+    if(!m_finishing)
+    {
+        m_finishing = true;
+        QMetaObject::invokeMethod(m_writer, "finish", Qt::QueuedConnection);
+    }
+}
+
+void StorageExport::writerError(const QString& message)
+{
+    stop(message);
+}
+
+void StorageExport::filterDestroyed()
+{
+    stop(tr("A filter used by the export was removed."));
+}
+
+void StorageExport::writerFinished()
+{
+    m_thread.quit();
+    m_thread.wait();
+
+    delete m_writer;
+    m_writer = NULL;
+
+    for(size_t i = 0; i < m_settings.columns.size(); ++i)
+        if(m_settings.columns[i].filter)
+            disconnect(m_settings.columns[i].filter.data(), SIGNAL(destroyed()), this, SLOT(filterDestroyed()));
+
+    const bool success = !m_canceled && m_error.isEmpty();
+    if(success)
+        emit progress(100);
+    emit finished(success, m_error);
+}
+
+QByteArray StorageExport::previewCSV(Storage *storage, const StorageExportSettings& settings, quint32 limit)
+{
+    if(!storage->getPacket())
+        return QByteArray();
+
+    const quint32 from = (std::min)(settings.from, storage->getSize());
+    quint32 to = (std::max)(from, (std::min)(settings.to, storage->getSize()));
+    to = (std::min)(to, from + (std::min)(limit, UINT_MAX - from));
+
+    StorageExportChunk chunk;
+    const quint64 base = storage->getDropped();
+    if(!takeChunk(storage, settings, base, base + from, to - from, chunk))
+        throw tr("The data for the preview are no longer in the storage.");
+
+    StorageExportWriter writer(settings, storage->getPacket()->big_endian);
+    return writer.formatCSV(chunk);
+}
@@ -0,0 +1,238 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#ifndef STORAGEEXPORT_H
+#define STORAGEEXPORT_H
+
+#include <QObject>
+#include <QThread>
+#include <QFile>
+#include <QList>
+#include <QVector>
+#include <QBitArray>
+#include <QPointer>
+#include <QMetaType>
+#include <vector>
+#include <atomic>
+#include <climits>
+
+class Storage;
+class DataFilter;
+struct analyzer_packet;
+
+enum StorageExportFormat
+{
+    EXPORT_RAW = 0,   // packets as they were received
+    EXPORT_CSV,
+    EXPORT_BINARY,    // fixed size records, one per packet
+    EXPORT_COLUMNS
+};
+
+struct StorageExportColumn
+{
+    StorageExportColumn()
+    {
+        pos = -1;
+        type = 0;
+    }
+
+    QString name;
+    // position of the value in the packet, -1 is the index of the packet
+    qint32 pos;
+    // NumberTypes, the index is always NUM_UINT64
+    quint8 type;
+    // Packets not accepted by the filter are left empty,
+    // all packets are used if it is NULL
+    QPointer<DataFilter> filter;
+};
+
+struct StorageExportSettings
+{
+    StorageExportSettings()
+    {
+        format = EXPORT_RAW;
+        from = 0;
+        to = UINT_MAX;
+        separator = ",";
+        lineEnd = "\r\n";
+        header = true;
+        binType = 0;
+        bigEndian = true;
+        indexWidth = 4;
+    }
+
+    QString filename;
+    quint8 format;
+    std::vector<StorageExportColumn> columns;
+    // Range of packet indexes, "to" is exclusive
+    quint32 from;
+    quint32 to;
+
+    // EXPORT_CSV
+    QString separator;
+    QString lineEnd;
+    bool header;
+
+    // EXPORT_BINARY, values are written as binType (NumberTypes),
+    // the index column as an unsigned integer indexWidth bytes wide.
+    // The records have no presence flags, values a filter did not accept
+    // are written as 0 and can't be told from real zeros, use
+    // EXPORT_COLUMNS when that matters.
+    quint8 binType;
+    bool bigEndian;
+    quint8 indexWidth;
+};
+
+// Consecutive packets taken from the storage. The data are shared
+// with the storage, not copied.
+struct StorageExportChunk
+{
+    StorageExportChunk()
+    {
+        first = 0;
+    }
+
+    quint64 first;
+    QList<QByteArray> packets;
+    // one per column, empty if the column has no filter
+    QVector<QBitArray> accepted;
+};
+
+Q_DECLARE_METATYPE(StorageExportChunk)
+
+/*
+ * Decodes the columns of the chunks it gets and writes them to the file,
+ * in its own thread. Each column is decoded for the whole chunk at once,
+ * into an array of its type.
+ *
+ * EXPORT_COLUMNS files start with COLUMNS_MAGIC, a quint8 version,
+ * a quint16 column count and for each column a quint8 type (NumberTypes)
+ * and its name as a quint16 length and UTF-8 data. Blocks follow until
+ * the end of file: a quint32 row count and for each column that many
+ * quint8 flags (1 if the value is present) and that many values of
+ * the column's type. Everything is little endian.
+ */
+class StorageExportWriter : public QObject
+{
+    Q_OBJECT
+
+Q_SIGNALS:
+    void chunkWritten(quint32 packets);
+    void error(const QString& message);
+    void finished();
+
+public:
+    // packetBigEndian is the byte order of values in the packets
+    StorageExportWriter(const StorageExportSettings& settings, bool packetBigEndian);
+    ~StorageExportWriter();
+
+    // Opens the file and writes the header, throws an error message
+    // on failure. Called before the writer is moved to its thread.
+    void open();
+    // Can be called from any thread, the file is removed on finish()
+    void cancel() { m_cancel = true; }
+
+    // Formats the chunk as CSV without writing it anywhere, used for previews
+    QByteArray formatCSV(const StorageExportChunk& chunk);
+
+public slots:
+    void writeChunk(const StorageExportChunk& chunk);
+    void finish();
+
+private:
+    struct column
+    {
+        QByteArray values;
+        QByteArray present;
+    };
+
+    void writeHeader();
+    void decode(const StorageExportChunk& chunk);
+    void appendCSV();
+    void appendBinary();
+    void appendColumns();
+    void appendValue(quint8 type, const column& c, quint32 row);
+    void write(const char *data, int len);
+    void write(const QByteArray& data) { write(data.constData(), data.size()); }
+    // count values of size bytes each, in host order
+    void writeLittleEndian(const char *data, quint32 count, int size);
+    static void toLittleEndian(char *data, int size);
+    void flush();
+
+    StorageExportSettings m_settings;
+    bool m_packetBigEndian;
+    std::atomic<bool> m_cancel;
+    bool m_failed;
+
+    QFile m_file;
+    QByteArray m_buffer;
+    QByteArray m_separator;
+    QByteArray m_lineEnd;
+    std::vector<column> m_columns;
+    // rows of the decoded chunk which have at least one value
+    std::vector<quint32> m_rows;
+};
+
+/*
+ * Exports the stored packets in the background. Chunks of packets are
+ * taken from the storage in the GUI thread, because the storage and
+ * filters are not thread-safe, a few of them at a time.
+ */
+class StorageExport : public QObject
+{
+    Q_OBJECT
+
+Q_SIGNALS:
+    void progress(int percent);
+    // error is empty if the export was canceled
+    void finished(bool success, const QString& error);
+
+public:
+    explicit StorageExport(QObject *parent = NULL);
+    ~StorageExport();
+
+    // Throws an error message if the file can't be created
+    void start(Storage *storage, const StorageExportSettings& settings);
+    bool isActive() const { return m_writer != NULL; }
+    const QString& getFilename() const { return m_settings.filename; }
+
+    // Throws an error message if the packets can't be taken from the storage
+    static QByteArray previewCSV(Storage *storage, const StorageExportSettings& settings, quint32 limit);
+
+public slots:
+    void cancel();
+
+private slots:
+    void chunkWritten(quint32 packets);
+    void writerError(const QString& message);
+    void writerFinished();
+    void filterDestroyed();
+
+private:
+    static bool takeChunk(Storage *storage, const StorageExportSettings& settings,
+                          quint64 base, quint64 first, quint32 count, StorageExportChunk& chunk);
+    void sendChunks();
+    void stop(const QString& error);
+
+    QThread m_thread;
+    StorageExportWriter *m_writer;
+    Storage *m_storage;
+    StorageExportSettings m_settings;
+    QString m_error;
+
+    // storage's getDropped() when the export started
+    quint64 m_base;
+    quint64 m_next;
+    quint64 m_end;
+    quint64 m_written;
+    quint64 m_total;
+    int m_inFlight;
+    bool m_finishing;
+    bool m_canceled;
+};
+
+#endif // STORAGEEXPORT_H
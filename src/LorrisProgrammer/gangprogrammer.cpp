@@ -0,0 +1,255 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#include <QScopedPointer>
+#include <QStringBuilder>
+#include <QTimer>
+
+#include "gangprogrammer.h"
+#include "lorrisprogrammer.h"
+
+GangJob::GangJob(ConnectionPointer<Connection> const & conn, HexFile & file, quint8 memId,
+                 VerifyMode verifyMode, quint32 prog_speed_hz, QObject *parent)
+    : QObject(parent), m_conn(conn), m_file(file), m_memId(memId), m_verify_mode(verifyMode),
+      m_prog_speed_hz(prog_speed_hz), m_cancelled(false), m_success(false)
+{
+}
+
+void GangJob::cancel()
+{
+    m_cancelled = true;
+    if(m_prog)
+        m_prog->cancelRequested();
+}
+
+void GangJob::log(QString const & msg)
+{
+    emit logMessage(msg);
+}
+
+void GangJob::run()
+{
+    m_success = false;
+    m_error.clear();
+
+    try
+    {
+        if(m_cancelled)
+            throw tr("Canceled");
+
+        QScopedPointer<Programmer> prog(LorrisProgrammer::createProgrammer(m_conn, this));
+        if(!prog)
+            throw tr("No programmer is available for this connection.");
+
+        m_prog = prog.data();
+        connect(prog.data(), SIGNAL(updateProgressDialog(int)),    this, SIGNAL(progress(int)));
+        connect(prog.data(), SIGNAL(updateProgressLabel(QString)), this, SIGNAL(status(QString)));
+
+        emit status(tr("Switching to flash mode"));
+        prog->switchToFlashMode(m_prog_speed_hz);
+
+        chip_definition chip = prog->readDeviceId();
+        if(chip.getName().isEmpty())
+            throw tr("Unsupported chip: %1").arg(chip.getSign());
+
+        if(m_cancelled)
+            throw tr("Canceled");
+
+        emit status(tr("Writing %1").arg(chip.getName()));
+        prog->flashRaw(m_file, m_memId, chip, m_verify_mode);
+
+        if(m_cancelled)
+            throw tr("Canceled");
+
+        emit status(tr("Switching to run mode"));
+        prog->switchToRunMode();
+
+        m_success = true;
+    }
+    catch(QString const & ex)
+    {
+        m_error = ex;
+    }
+}
+
+GangProgrammer::GangProgrammer(HexFile const & file, quint8 memId, VerifyMode verifyMode,
+                               quint32 prog_speed_hz, QObject *parent)
+    : QObject(parent), m_file(file), m_memId(memId), m_verify_mode(verifyMode),
+      m_prog_speed_hz(prog_speed_hz), m_job(NULL), m_job_target(-1), m_cancelled(false),
+      m_running(0), m_succeeded(0), m_failed(0)
+{
+    m_file.sharePages();
+}
+
+GangProgrammer::~GangProgrammer()
+{
+    // The job is on the stack of runNext(), the owner must wait for finished()
+    Q_ASSERT(!m_job);
+
+    for(size_t i = 0; i < m_targets.size(); ++i)
+        m_targets[i].conn->disconnect(this);
+}
+
+int GangProgrammer::addTarget(ConnectionPointer<Connection> const & conn)
+{
+    Q_ASSERT(m_running == 0);
+
+    target t;
+    t.conn = conn;
+    t.done = false;
+    m_targets.push_back(t);
+    return m_targets.size() - 1;
+}
+
+QString GangProgrammer::targetName(int target) const
+{
+    return m_targets[target].conn->name();
+}
+
+int GangProgrammer::findTarget(QObject *obj) const
+{
+    for(size_t i = 0; i < m_targets.size(); ++i)
+    {
+        if(m_targets[i].conn.data() == obj)
+            return i;
+    }
+    return -1;
+}
+
+void GangProgrammer::start()
+{
+    if(m_running != 0)
+        return;
+
+    m_succeeded = 0;
+    m_failed = 0;
+    m_cancelled = false;
+
+    for(size_t i = 0; i < m_targets.size(); ++i)
+    {
+        target& t = m_targets[i];
+        t.done = false;
+        ++m_running;
+
+        if(t.conn->isOpen())
+        {
+            enqueue(i);
+            continue;
+        }
+
+        emit targetStatus(i, tr("Connecting..."));
+        connect(t.conn.data(), SIGNAL(stateChanged(ConnectionState)), this, SLOT(connStateChanged(ConnectionState)));
+        t.conn->OpenConcurrent();
+    }
+
+    if(m_targets.empty())
+        emit finished(0, 0);
+}
+
+void GangProgrammer::cancel()
+{
+    m_cancelled = true;
+    m_ready.clear();
+
+    if(m_job)
+        m_job->cancel();
+
+    for(size_t i = 0; i < m_targets.size(); ++i)
+    {
+        if(!m_targets[i].done && (int)i != m_job_target)
+            finishTarget(i, false, tr("Canceled"));
+    }
+}
+
+void GangProgrammer::connStateChanged(ConnectionState state)
+{
+    int idx = findTarget(sender());
+    if(idx < 0 || m_targets[idx].done)
+        return;
+
+    if(state == st_connected)
+        enqueue(idx);
+    else if(state == st_disconnected)
+        finishTarget(idx, false, tr("Failed to connect"));
+}
+
+void GangProgrammer::enqueue(int idx)
+{
+    m_targets[idx].conn->disconnect(this);
+
+    emit targetStatus(idx, tr("Waiting"));
+    m_ready.push_back(idx);
+
+    // A running job picks up the queue when it finishes
+    if(!m_job)
+        QTimer::singleShot(0, this, SLOT(runNext()));
+}
+
+void GangProgrammer::runNext()
+{
+    if(m_job || m_ready.empty() || m_cancelled)
+        return;
+
+    int idx = m_ready.front();
+    m_ready.pop_front();
+
+    GangJob job(m_targets[idx].conn, m_file, m_memId, m_verify_mode, m_prog_speed_hz);
+    connect(&job, SIGNAL(progress(int)),       SLOT(jobProgress(int)));
+    connect(&job, SIGNAL(status(QString)),     SLOT(jobStatus(QString)));
+    connect(&job, SIGNAL(logMessage(QString)), SLOT(jobLog(QString)));
+
+    emit targetProgress(idx, 0);
+
+    m_job = &job;
+    m_job_target = idx;
+    job.run();
+    m_job = NULL;
+    m_job_target = -1;
+
+    finishTarget(idx, job.succeeded(), job.succeeded() ? tr("Done") : job.error());
+
+    if(!m_ready.empty())
+        QTimer::singleShot(0, this, SLOT(runNext()));
+}
+
+void GangProgrammer::jobProgress(int value)
+{
+    if(m_job_target >= 0)
+        emit targetProgress(m_job_target, value);
+}
+
+void GangProgrammer::jobStatus(QString const & text)
+{
+    if(m_job_target >= 0)
+        emit targetStatus(m_job_target, text);
+}
+
+void GangProgrammer::jobLog(QString const & msg)
+{
+    if(m_job_target >= 0)
+        emit log(targetName(m_job_target) % ": " % msg);
+}
+
+void GangProgrammer::finishTarget(int idx, bool success, QString const & message)
+{
+    target& t = m_targets[idx];
+    if(t.done)
+        return;
+
+    t.done = true;
+    t.conn->disconnect(this);
+
+    if(success)
+        ++m_succeeded;
+    else
+        ++m_failed;
+
+    emit targetFinished(idx, success, message);
+
+    if(--m_running == 0)
+        emit finished(m_succeeded, m_failed);
+}
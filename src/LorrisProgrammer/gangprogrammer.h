@@ -0,0 +1,132 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#ifndef GANGPROGRAMMER_H
+#define GANGPROGRAMMER_H
+
+#include <QObject>
+#include <QPointer>
+#include <deque>
+#include <vector>
+
+#include "../connection/connection.h"
+#include "../shared/hexfile.h"
+#include "../shared/programmer.h"
+
+/*
+ * Flashes one target of the gang.
+ *
+ * The job runs in the main thread, like the programmer tab does,
+ * because the programmers and connections are not thread-safe.
+ * run() blocks in the programmer's nested event loops until
+ * the target is done.
+ */
+class GangJob : public QObject, public ProgrammerLogSink
+{
+    Q_OBJECT
+
+Q_SIGNALS:
+    void progress(int value);
+    void status(QString const & text);
+    void logMessage(QString const & msg);
+
+public:
+    GangJob(ConnectionPointer<Connection> const & conn, HexFile & file, quint8 memId,
+            VerifyMode verifyMode, quint32 prog_speed_hz, QObject *parent = 0);
+
+    bool succeeded() const { return m_success; }
+    QString const & error() const { return m_error; }
+
+    void run();
+    void cancel();
+    void log(QString const & msg);
+
+private:
+    ConnectionPointer<Connection> m_conn;
+    HexFile & m_file;
+    quint8 m_memId;
+    VerifyMode m_verify_mode;
+    quint32 m_prog_speed_hz;
+
+    QPointer<Programmer> m_prog;
+    bool m_cancelled;
+    bool m_success;
+    QString m_error;
+};
+
+/*
+ * Flashes and verifies the same image on several targets, one target
+ * at a time. All targets are connected at once and every connected
+ * target gets a GangJob.
+ *
+ * The jobs are started from the main event loop one at a time. Programmers
+ * wait for their replies in nested event loops, so a job started inside
+ * another job's loop would block it until it finishes itself. Running
+ * them side by side would need the programmers to be rewritten without
+ * the blocking waits.
+ * All jobs share the image and the pages made from it.
+ */
+class GangProgrammer : public QObject
+{
+    Q_OBJECT
+
+Q_SIGNALS:
+    void targetProgress(int target, int value);
+    void targetStatus(int target, QString const & text);
+    void targetFinished(int target, bool success, QString const & message);
+    void log(QString const & msg);
+    void finished(int succeeded, int failed);
+
+public:
+    GangProgrammer(HexFile const & file, quint8 memId, VerifyMode verifyMode,
+                   quint32 prog_speed_hz, QObject *parent = 0);
+    ~GangProgrammer();
+
+    int addTarget(ConnectionPointer<Connection> const & conn);
+    int targetCount() const { return m_targets.size(); }
+    QString targetName(int target) const;
+
+    bool isRunning() const { return m_running != 0; }
+
+public slots:
+    void start();
+    void cancel();
+
+private slots:
+    void connStateChanged(ConnectionState state);
+    void runNext();
+    void jobProgress(int value);
+    void jobStatus(QString const & text);
+    void jobLog(QString const & msg);
+
+private:
+    struct target
+    {
+        ConnectionPointer<Connection> conn;
+        bool done;
+    };
+
+    int findTarget(QObject *obj) const;
+    void enqueue(int idx);
+    void finishTarget(int idx, bool success, QString const & message);
+
+    std::vector<target> m_targets;
+    std::deque<int> m_ready;
+    HexFile m_file;
+    quint8 m_memId;
+    VerifyMode m_verify_mode;
+    quint32 m_prog_speed_hz;
+
+    GangJob *m_job;
+    int m_job_target;
+    bool m_cancelled;
+    int m_running;
+    int m_succeeded;
+    int m_failed;
+};
+
+#endif // GANGPROGRAMMER_H
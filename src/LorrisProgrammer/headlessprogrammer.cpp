@@ -0,0 +1,391 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#include <QEventLoop>
+#include <QTimer>
+#include <QFile>
+#include <QScopedPointer>
+#include <string.h>
+
+#include "headlessprogrammer.h"
+#include "lorrisprogrammer.h"
+#include "../connection/serialport.h"
+#include "../connection/shupitoconn.h"
+#include "../misc/config.h"
+#include "../misc/utils.h"
+
+// SerialPortOpenThread keeps trying until the device shows up
+#define OPEN_TIMEOUT 10000
+
+struct headless_programmer_type
+{
+    const char *name;
+    int type;
+};
+
+static const headless_programmer_type programmerTypes[] = {
+    { "shupito",    programmer_shupito },
+    { "avr232boot", programmer_avr232boot },
+    { "atsam",      programmer_atsam },
+    { "avr109",     programmer_avr109 },
+    { "arduino",    programmer_arduino },
+    { "zmodem",     programmer_zmodem },
+};
+
+// These talk to the programmer over USB, which needs the connection manager
+// and its USB enumeration, so they are only available in the GUI.
+static const char * const usbProgrammers[] = {
+    "shupito-usb", "stlink", "stm32", "flip",
+};
+
+HeadlessProgrammer::HeadlessProgrammer(QObject *parent)
+    : QObject(parent), m_baud(38400), m_type(programmer_shupito), m_memId(MEM_FLASH),
+      m_verbose(false), m_failure(EXIT_OK), m_lastProgress(-1)
+{
+}
+
+bool HeadlessProgrammer::isRequested(int argc, char *argv[])
+{
+    for(int i = 1; i < argc; ++i)
+    {
+        if(strncmp(argv[i], "--flash=", 8) == 0 ||
+           strncmp(argv[i], "--verify=", 9) == 0 ||
+           strncmp(argv[i], "--read=", 7) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *HeadlessProgrammer::helpText()
+{
+    return
+        "Command line programming:\n"
+        "           --flash=FILE                   Write FILE (*.hex or binary) to the chip\n"
+        "           --verify=FILE                  Compare the chip with FILE\n"
+        "           --read=FILE                    Read the chip to FILE (*.hex or binary)\n"
+        "           --port=DEVICE                  Serial port of the programmer, e.g. /dev/ttyUSB0 or COM3\n"
+        "           --baud=RATE                    Baud rate of the serial port, default 38400\n"
+        "           --programmer=TYPE              shupito (default), avr232boot, atsam, avr109,\n"
+        "                                          arduino or zmodem\n"
+        "           --memory=MEM                   flash (default) or eeprom\n"
+        "           --verbose                      Print the programmer's log\n"
+        "       Only programmers on a serial port are supported, USB Shupito, ST-Link\n"
+        "       and FLIP programmers need the GUI.\n"
+        "       The GUI is not started. Exit status is 0 on success, 1 on invalid arguments,\n"
+        "       2 if the programmer can't be reached, 3 if programming fails and 4\n"
+        "       if verification finds a difference.\n";
+}
+
+int HeadlessProgrammer::runFromCommandLine(QStringList const & args)
+{
+    HeadlessProgrammer prog;
+    if(!prog.parseArgs(args))
+        return EXIT_USAGE;
+    return prog.run();
+}
+
+bool HeadlessProgrammer::parseArgs(QStringList const & args)
+{
+    for(int i = 1; i < args.size(); ++i)
+    {
+        QString const & arg = args[i];
+        QString value = arg.mid(arg.indexOf('=') + 1);
+
+        if(arg.startsWith("--flash="))
+            m_flashFile = value;
+        else if(arg.startsWith("--verify="))
+            m_verifyFile = value;
+        else if(arg.startsWith("--read="))
+            m_readFile = value;
+        else if(arg.startsWith("--port="))
+            m_port = value;
+        else if(arg == "--verbose")
+            m_verbose = true;
+        else if(arg.startsWith("--baud="))
+        {
+            bool ok = false;
+            m_baud = value.toInt(&ok);
+            if(!ok || m_baud <= 0)
+            {
+                utils_printf("Invalid baud rate \"%s\"\n", value.toLocal8Bit().constData());
+                return false;
+            }
+        }
+        else if(arg.startsWith("--programmer="))
+        {
+            m_type = -1;
+            for(size_t t = 0; t < sizeof_array(programmerTypes); ++t)
+            {
+                if(value.compare(programmerTypes[t].name, Qt::CaseInsensitive) == 0)
+                    m_type = programmerTypes[t].type;
+            }
+
+            for(size_t t = 0; m_type == -1 && t < sizeof_array(usbProgrammers); ++t)
+            {
+                if(value.compare(usbProgrammers[t], Qt::CaseInsensitive) == 0)
+                {
+                    utils_printf("Programmer \"%s\" is connected over USB, which is not supported "
+                                 "from the command line, use the GUI\n", value.toLocal8Bit().constData());
+                    return false;
+                }
+            }
+
+            if(m_type == -1)
+            {
+                utils_printf("Unknown programmer \"%s\"\n", value.toLocal8Bit().constData());
+                return false;
+            }
+        }
+        else if(arg.startsWith("--memory="))
+        {
+            m_memId = chip_definition::memNameToId(value.toLower());
+            if(m_memId != MEM_FLASH && m_memId != MEM_EEPROM)
+            {
+                utils_printf("Unsupported memory \"%s\", use flash or eeprom\n", value.toLocal8Bit().constData());
+                return false;
+            }
+        }
+        else
+        {
+            utils_printf("Unknown argument \"%s\"\n\n%s", arg.toLocal8Bit().constData(), helpText());
+            return false;
+        }
+    }
+
+    if(m_port.isEmpty())
+    {
+        utils_printf("No port given, use --port=DEVICE\n");
+        return false;
+    }
+    return true;
+}
+
+int HeadlessProgrammer::run()
+{
+    QScopedPointer<Programmer> prog;
+    bool flashMode = false;
+
+    try
+    {
+        m_failure = EXIT_CONNECT;
+
+        status(tr("Connecting to %1").arg(m_port));
+        ConnectionPointer<Connection> conn = openConnection();
+
+        prog.reset(LorrisProgrammer::createProgrammer(conn, this));
+        if(!prog)
+            throw tr("No programmer is available for this connection.");
+
+        connect(prog.data(), SIGNAL(updateProgressDialog(int)),    SLOT(progress(int)));
+        connect(prog.data(), SIGNAL(updateProgressLabel(QString)), SLOT(progressLabel(QString)));
+
+        status(tr("Switching to flash mode"));
+        flashMode = true;
+        prog->switchToFlashMode(sConfig.get(CFG_QUINT32_SHUPITO_PRG_SPEED));
+
+        m_failure = EXIT_PROGRAM;
+
+        chip_definition chip = prog->readDeviceId();
+        if(chip.getName().isEmpty())
+            throw tr("Unsupported chip: %1").arg(chip.getSign());
+        status(tr("Chip %1 (%2)").arg(chip.getName(), chip.getSign()));
+
+        if(!chip.getMemDef(m_memId))
+            throw tr("Chip %1 has no %2 memory").arg(chip.getName(), chip_definition::memIdToName(m_memId));
+
+        if(!m_flashFile.isEmpty())
+            flash(prog.data(), chip);
+        if(!m_verifyFile.isEmpty())
+            verify(prog.data(), chip);
+        if(!m_readFile.isEmpty())
+            read(prog.data(), chip);
+
+        status(tr("Switching to run mode"));
+        flashMode = false;
+        prog->switchToRunMode();
+    }
+    catch(QString const & ex)
+    {
+        utils_printf("Error: %s\n", ex.toLocal8Bit().constData());
+        utils_flush();
+
+        // don't leave the target held in programming mode
+        if(flashMode)
+        {
+            try
+            {
+                prog->switchToRunMode();
+            }
+            catch(QString const & ex)
+            {
+                utils_printf("Error: %s\n", ex.toLocal8Bit().constData());
+                utils_flush();
+            }
+        }
+        return m_failure;
+    }
+
+    status(tr("Done"));
+    return EXIT_OK;
+}
+
+ConnectionPointer<Connection> HeadlessProgrammer::openConnection()
+{
+    ConnectionPointer<SerialPort> port(new SerialPort());
+    port->setDeviceName(m_port);
+    port->setFriendlyName(m_port);
+    port->setBaudRate(m_baud);
+    port->setProgrammerType(m_type);
+
+    if(!waitForOpen(port.data()))
+        throw tr("Failed to open %1").arg(m_port);
+
+    if(m_type != programmer_shupito)
+        return port;
+
+    ConnectionPointer<PortShupitoConnection> sc(new PortShupitoConnection());
+    sc->setPort(port);
+    if(!waitForOpen(sc.data()))
+        throw tr("Failed to connect to Shupito on %1").arg(m_port);
+    return sc;
+}
+
+bool HeadlessProgrammer::waitForOpen(Connection *conn)
+{
+    if(!conn->isOpen())
+    {
+        QEventLoop loop;
+        QTimer timer;
+        timer.setSingleShot(true);
+
+        connect(&timer, SIGNAL(timeout()),                      &loop, SLOT(quit()));
+        connect(conn,   SIGNAL(stateChanged(ConnectionState)),  &loop, SLOT(quit()));
+
+        conn->OpenConcurrent();
+        timer.start(OPEN_TIMEOUT);
+
+        while(conn->state() == st_connecting && timer.isActive())
+            loop.exec();
+    }
+    return conn->isOpen();
+}
+
+void HeadlessProgrammer::loadFile(HexFile& file, QString const & path, chip_definition& chip)
+{
+    if(path.endsWith(".hex"))
+        file.LoadFromFile(path);
+    else
+        file.LoadFromBin(path);
+
+    chip_definition::memorydef *memdef = chip.getMemDef(m_memId);
+    if(memdef->size != 0 && file.getTopAddress() > memdef->size)
+    {
+        throw tr("%1 does not fit into the %2 memory (%3 > %4 bytes)")
+            .arg(path, chip_definition::memIdToName(m_memId))
+            .arg(file.getTopAddress()).arg(memdef->size);
+    }
+}
+
+void HeadlessProgrammer::flash(Programmer *prog, chip_definition& chip)
+{
+    HexFile file;
+    loadFile(file, m_flashFile, chip);
+    file.setFilePath(m_flashFile);
+
+    // --verify reads the memory back, don't let the programmer verify the pages twice
+    VerifyMode mode = (VerifyMode)sConfig.get(CFG_QUINT32_SHUPITO_VERIFY);
+    if(!m_verifyFile.isEmpty() || mode >= VERIFY_MAX)
+        mode = VERIFY_NONE;
+
+    status(tr("Writing %1").arg(m_flashFile));
+    prog->flashRaw(file, m_memId, chip, mode);
+}
+
+void HeadlessProgrammer::verify(Programmer *prog, chip_definition& chip)
+{
+    HexFile file;
+    loadFile(file, m_verifyFile, chip);
+
+    status(tr("Verifying against %1").arg(m_verifyFile));
+    QByteArray mem = prog->readMemory(chip_definition::memIdToName(m_memId), chip);
+
+    // only the bytes present in the file are compared
+    HexFile::regionMap& regions = file.getData();
+    for(HexFile::regionMap::iterator itr = regions.begin(); itr != regions.end(); ++itr)
+    {
+        std::vector<quint8> const & data = itr->second;
+        for(size_t i = 0; i < data.size(); ++i)
+        {
+            quint32 addr = itr->first + i;
+            if(addr >= (quint32)mem.size() || (quint8)mem[addr] != data[i])
+            {
+                m_failure = EXIT_VERIFY;
+                throw tr("Verification failed at address 0x%1").arg(addr, 0, 16);
+            }
+        }
+    }
+}
+
+void HeadlessProgrammer::read(Programmer *prog, chip_definition& chip)
+{
+    status(tr("Reading to %1").arg(m_readFile));
+    QByteArray mem = prog->readMemory(chip_definition::memIdToName(m_memId), chip);
+
+    if(m_readFile.endsWith(".hex"))
+    {
+        HexFile file;
+        file.setData(mem);
+        file.SaveToFile(m_readFile);
+    }
+    else
+    {
+        QFile f(m_readFile);
+        if(!f.open(QIODevice::WriteOnly) || f.write(mem) != mem.size())
+            throw tr("Failed to open %1 for writing!").arg(m_readFile);
+    }
+}
+
+void HeadlessProgrammer::status(QString const & text)
+{
+    m_label.clear();
+    m_lastProgress = -1;
+
+    utils_printf("%s\n", text.toLocal8Bit().constData());
+    utils_flush();
+}
+
+void HeadlessProgrammer::log(QString const & msg)
+{
+    if(!m_verbose)
+        return;
+
+    utils_printf("  %s\n", msg.toLocal8Bit().constData());
+    utils_flush();
+}
+
+void HeadlessProgrammer::progress(int value)
+{
+    if(value < 0 || value == m_lastProgress)
+    {
+        m_lastProgress = value;
+        return;
+    }
+
+    m_lastProgress = value;
+    if(m_label.isEmpty())
+        utils_printf("%3d%%\n", value);
+    else
+        utils_printf("%3d%% %s\n", value, m_label.toLocal8Bit().constData());
+    utils_flush();
+}
+
+void HeadlessProgrammer::progressLabel(QString const & text)
+{
+    m_label = text;
+}
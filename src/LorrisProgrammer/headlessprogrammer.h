@@ -0,0 +1,77 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#ifndef HEADLESSPROGRAMMER_H
+#define HEADLESSPROGRAMMER_H
+
+#include <QObject>
+#include <QStringList>
+
+#include "../connection/connection.h"
+#include "../shared/programmer.h"
+
+/*
+ * Command line programming mode: --flash, --verify and --read run
+ * against a serial port without creating any widgets (USB programmers
+ * are refused, they need the connection manager), progress goes
+ * to stdout. main() checks isRequested() before the GUI application
+ * is constructed.
+ */
+class HeadlessProgrammer : public QObject, public ProgrammerLogSink
+{
+    Q_OBJECT
+
+public:
+    enum ExitCode
+    {
+        EXIT_OK = 0,
+        EXIT_USAGE,
+        EXIT_CONNECT,
+        EXIT_PROGRAM,
+        EXIT_VERIFY
+    };
+
+    HeadlessProgrammer(QObject *parent = 0);
+
+    static bool isRequested(int argc, char *argv[]);
+    static int runFromCommandLine(QStringList const & args);
+    static const char *helpText();
+
+    bool parseArgs(QStringList const & args);
+    int run();
+
+    void log(QString const & msg);
+
+private slots:
+    void progress(int value);
+    void progressLabel(QString const & text);
+
+private:
+    ConnectionPointer<Connection> openConnection();
+    bool waitForOpen(Connection *conn);
+    void status(QString const & text);
+
+    void flash(Programmer *prog, chip_definition& chip);
+    void verify(Programmer *prog, chip_definition& chip);
+    void read(Programmer *prog, chip_definition& chip);
+    void loadFile(HexFile& file, QString const & path, chip_definition& chip);
+
+    QString m_port;
+    int m_baud;
+    int m_type;
+    quint8 m_memId;
+    QString m_flashFile;
+    QString m_verifyFile;
+    QString m_readFile;
+    bool m_verbose;
+
+    int m_failure;
+    int m_lastProgress;
+    QString m_label;
+};
+
+#endif // HEADLESSPROGRAMMER_H
@@ -28,6 +28,7 @@
 #include "../connection/shupitoconn.h"
 #include "../connection/shupitotunnel.h"
 #include "ui/overvccdialog.h"
+#include "ui/gangdialog.h"
 #include "../ui/tooltipwarn.h"
 #include "../WorkTab/WorkTabMgr.h"
 #include "../connection/connectionmgr2.h"
@@ -150,6 +151,10 @@ void LorrisProgrammer::initMenus()
     connect(m_stop_act,   SIGNAL(triggered()), SLOT(stopChip()));
     connect(m_restart_act, SIGNAL(triggered()), SLOT(restartChip()));
 
+    chipBar->addSeparator();
+    m_gang_act = chipBar->addAction(tr("Gang programming..."));
+    connect(m_gang_act, SIGNAL(triggered()), SLOT(gangProgram()));
+
     m_modeBar = new QMenu(tr("Mode"), this);
     addTopMenu(m_modeBar);
 
@@ -594,6 +599,31 @@ void LorrisProgrammer::restartChip()
     startChip();
 }
 
+void LorrisProgrammer::gangProgram()
+{
+    tryFileReload(MEM_FLASH);
+
+    QByteArray data = ui->getHexData(MEM_FLASH);
+    if(data.isEmpty())
+    {
+        Utils::showErrorBox(tr("Load the file to write first."));
+        return;
+    }
+
+    HexFile file;
+    file.setFilePath(m_hexFilenames[MEM_FLASH]);
+    file.setData(data);
+
+    // This tab's programmer would compete with the gang job for the packets
+    // of its connection, it is recreated afterwards.
+    m_programmer.reset();
+
+    GangDialog dialog(file, MEM_FLASH, m_verify_mode, m_prog_speed_hz, this);
+    dialog.exec();
+
+    this->connectedStatus(m_con && m_con->isOpen());
+}
+
 QString LorrisProgrammer::getFileDialogFilter(int memid) {
     if(this->m_programmer && m_programmer->getType() == programmer_zmodem) {
         return QObject::tr("All files (*)");
@@ -749,56 +779,62 @@ void LorrisProgrammer::focusChanged(QWidget *prev, QWidget */*curr*/)
         tryFileReload(ui->getMemIndex());
 }
 
-void LorrisProgrammer::updateProgrammer()
+Programmer * LorrisProgrammer::createProgrammer(ConnectionPointer<Connection> const & conn, ProgrammerLogSink * logsink)
 {
-    m_programmer.reset();
-    if (m_con)
+    if (!conn)
+        return NULL;
+
+    if (ConnectionPointer<ShupitoConnection> sc = conn.dynamicCast<ShupitoConnection>())
     {
-        if (ConnectionPointer<ShupitoConnection> sc = m_con.dynamicCast<ShupitoConnection>())
-        {
-            m_programmer.reset(new ShupitoProgrammer(sc, &m_logsink));
-        }
+        return new ShupitoProgrammer(sc, logsink);
+    }
 #ifdef HAVE_LIBYB
-        else if(ConnectionPointer<STM32Connection> fc = m_con.dynamicCast<STM32Connection>())
-        {
-            m_programmer.reset(new STM32Programmer(fc, &m_logsink));
-        }
-        else if (ConnectionPointer<GenericUsbConnection> fc = m_con.dynamicCast<GenericUsbConnection>())
-        {
-            if (fc->isFlipDevice())
-                m_programmer.reset(new FlipProgrammer(fc, &m_logsink));
-        }
+    else if(ConnectionPointer<STM32Connection> fc = conn.dynamicCast<STM32Connection>())
+    {
+        return new STM32Programmer(fc, logsink);
+    }
+    else if (ConnectionPointer<GenericUsbConnection> fc = conn.dynamicCast<GenericUsbConnection>())
+    {
+        if (fc->isFlipDevice())
+            return new FlipProgrammer(fc, logsink);
+    }
 #endif
-        else if(ConnectionPointer<PortConnection> con = m_con.dynamicCast<PortConnection>())
+    else if(ConnectionPointer<PortConnection> con = conn.dynamicCast<PortConnection>())
+    {
+        switch(con->programmerType())
         {
-            switch(con->programmerType())
-            {
-            case programmer_shupito:
-                break; // morphed to ShupitoConnection in ChooseConnectionDlg::choose
-            case programmer_avr232boot:
-                m_programmer.reset(new avr232bootProgrammer(con, &m_logsink));
-                break;
-            case programmer_atsam:
-                m_programmer.reset(new AtsamProgrammer(con, &m_logsink));
-                break;
-            case programmer_avr109:
-                m_programmer.reset(new avr109Programmer(con, &m_logsink));
-                break;
-            case programmer_arduino:
-                if(con->getType() == CONNECTION_SERIAL_PORT) {
-                    m_programmer.reset(new ArduinoProgrammer(m_con.dynamicCast<SerialPort>(), &m_logsink));
-                } else {
-                    Utils::showErrorBox(tr("Arduino programmer only works with serial port connection!"));
-                }
-                break;
-            case programmer_zmodem:
-                m_programmer.reset(new ZmodemProgrammer(con, &m_logsink));
-                break;
-            default:
-                break;
-            }
+        case programmer_shupito:
+            break; // morphed to ShupitoConnection in ChooseConnectionDlg::choose
+        case programmer_avr232boot:
+            return new avr232bootProgrammer(con, logsink);
+        case programmer_atsam:
+            return new AtsamProgrammer(con, logsink);
+        case programmer_avr109:
+            return new avr109Programmer(con, logsink);
+        case programmer_arduino:
+            if(con->getType() == CONNECTION_SERIAL_PORT || con->getType() == CONNECTION_SIMULATED)
+                return new ArduinoProgrammer(con, logsink);
+            break;
+        case programmer_zmodem:
+            return new ZmodemProgrammer(con, logsink);
+        default:
+            break;
         }
     }
+    return NULL;
+}
+
+void LorrisProgrammer::updateProgrammer()
+{
+    m_programmer.reset();
+    if (m_con)
+    {
+        m_programmer.reset(createProgrammer(m_con, &m_logsink));
+
+        PortConnection *port = dynamic_cast<PortConnection *>(m_con.data());
+        if (!m_programmer && port && port->programmerType() == programmer_arduino)
+            Utils::showErrorBox(tr("Arduino programmer only works with serial port connection!"));
+    }
 
     if (!m_programmer)
     {
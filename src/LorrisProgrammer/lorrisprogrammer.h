@@ -63,6 +63,8 @@ public:
     void createConnBtn(QToolButton *btn);
     ConnectButton *getConnBtn() const { return m_connectButton; };
 
+    static Programmer *createProgrammer(ConnectionPointer<Connection> const & conn, ProgrammerLogSink *logsink);
+
 public slots:
     void setConnection(ConnectionPointer<Connection> const & con);
 
@@ -100,6 +102,7 @@ private slots:
     void stopChip();
     void restartChip();
     void updateStartStopUi(bool stopped);
+    void gangProgram();
 
     void modeSelected(int idx);
     void status(const QString& text);
@@ -145,6 +148,7 @@ private:
     QAction *m_start_act;
     QAction *m_stop_act;
     QAction *m_restart_act;
+    QAction *m_gang_act;
     QAction *m_verify[VERIFY_MAX];
     QAction *m_load_flash;
     QAction *m_save_flash;
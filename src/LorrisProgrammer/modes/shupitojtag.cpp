@@ -7,6 +7,7 @@
 
 #include "shupitojtag.h"
 #include "../shupito.h"
+#include "../shupitopipeline.h"
 #include "../../misc/utils.h"
 #include <sstream>
 #include <cassert>
@@ -121,16 +122,38 @@ struct ShupitoJtag::cost_visitor
     double total_cost;
 };
 
+// Checks the response of a TMS/shift packet, TDO is verified if tdo is not empty
+static QString checkShiftResponse(ShupitoPacket const & pkt, size_t chunk_bits,
+                                  std::vector<uint8_t> const & tdo, std::vector<uint8_t> const & mask)
+{
+    size_t chunk_bytes = (chunk_bits + 7) / 8;
+    if (pkt.size() != (tdo.empty()? 2: chunk_bytes + 2) || pkt[1] != 0)
+        return QObject::tr("Invalid response received from Shupito");
+
+    for (size_t i = 0; i < tdo.size() && i < chunk_bytes; ++i)
+    {
+        uint8_t b = pkt[i+2];
+        if (i + 1 == chunk_bytes && (chunk_bits % 8))
+            b >>= (8-(chunk_bits%8));
+
+        if ((b & mask[i]) != (tdo[i] & mask[i]))
+            return QObject::tr("Verification failed!");
+    }
+    return QString();
+}
+
 struct ShupitoJtag::play_visitor
 {
-    explicit play_visitor(ShupitoJtag & parent, double total_cost)
-        : parent(parent), current_bit_period(1.0 / parent.m_max_freq_hz), min_bit_period(current_bit_period),
-        current_cost(0), total_cost(total_cost)
+    explicit play_visitor(ShupitoJtag & parent, ShupitoPipeline & pipeline, double total_cost)
+        : parent(parent), pipeline(pipeline), current_bit_period(1.0 / parent.m_max_freq_hz), min_bit_period(current_bit_period),
+        current_cost(0), total_cost(total_cost), tms_length(0)
     {
     }
 
     void operator()(yb::svf_frequency const & stmt)
     {
+        this->sync();
+
         current_bit_period = (std::max)(1.0 / stmt.cycles_hz, min_bit_period);
 
         uint32_t cycles_hz = (std::min)((uint32_t)stmt.cycles_hz, parent.m_max_freq_hz);
@@ -139,6 +162,8 @@ struct ShupitoJtag::play_visitor
 
     void operator()(yb::svf_xxr const & stmt)
     {
+        this->flush_tms();
+
         size_t ms = parent.m_shupito->maxPacketSize();
 
         size_t length_bits = stmt.length;
@@ -159,24 +184,17 @@ struct ShupitoJtag::play_visitor
                 pkt.back() |= 0x10;
             pkt.insert(pkt.end(), tdi, tdi + chunk_bytes);
 
-            pkt = parent.m_shupito->waitForPacket(pkt, parent.m_prog_cmd_base + 1);
-            if (pkt.size() != (!verify? 2: chunk_bytes + 2) || pkt[1] != 0)
-                throw QObject::tr("Invalid response received from Shupito");
-
+            std::vector<uint8_t> exp_tdo, exp_mask;
             if (verify)
             {
-                if (chunk_bits % 8)
-                    pkt.back() >>= (8-(chunk_bits%8));
-
-                for (size_t i = 0; i < chunk_bytes; ++i)
-                {
-                    if ((pkt[i+2] & mask[i]) != (tdo[i] & mask[i]))
-                        throw QObject::tr("Verification failed!");
-                }
-
+                exp_tdo.assign(tdo, tdo + chunk_bytes);
+                exp_mask.assign(mask, mask + chunk_bytes);
                 tdo += chunk_bytes;
                 mask += chunk_bytes;
             }
+            pipeline.send(pkt, [chunk_bits, exp_tdo, exp_mask](ShupitoPacket const & resp) {
+                return checkShiftResponse(resp, chunk_bits, exp_tdo, exp_mask);
+            });
 
             length_bits -= chunk_bits;
             tdi += chunk_bytes;
@@ -188,35 +206,24 @@ struct ShupitoJtag::play_visitor
 
     void operator()(yb::svf_tms_path const & stmt)
     {
-        size_t ms = parent.m_shupito->maxPacketSize();
-
+        // Consecutive paths are merged and sent as few packets as possible
         uint8_t const * p = stmt.path.data();
-        size_t length_bits = stmt.length;
-        while (length_bits && !parent.m_cancel_requested)
+        for (size_t i = 0; i < stmt.length; ++i)
         {
-            size_t chunk_bits = (std::min)(length_bits, (ms - 1) * 8);
-            if (chunk_bits > 248)
-                chunk_bits = 248;
-
-            size_t chunk_bytes = (chunk_bits + 7) / 8;
-
-            ShupitoPacket pkt;
-            pkt.push_back(parent.m_prog_cmd_base);
-            pkt.push_back(chunk_bits);
-            pkt.insert(pkt.end(), p, p + chunk_bytes);
-
-            parent.m_shupito->waitForPacket(pkt, parent.m_prog_cmd_base);
-
-            length_bits -= chunk_bits;
-            p += chunk_bytes;
-
-            current_cost += chunk_bits * current_bit_period;
-            emit parent.updateProgressDialog((int)(current_cost * 100 / total_cost));
+            if ((tms_length % 8) == 0)
+                tms_path.push_back(0);
+            if (p[i / 8] & (1 << (i % 8)))
+                tms_path.back() |= (1 << (tms_length % 8));
+            ++tms_length;
         }
+
+        current_cost += stmt.length * current_bit_period;
     }
 
     void operator()(yb::svf_runtest const & stmt)
     {
+        this->sync();
+
         uint32_t clocks = (uint32_t)(std::min)(stmt.max_time / current_bit_period, (std::max)((double)stmt.run_count, stmt.min_time / current_bit_period));
         uint32_t max_chunk = 1 / current_bit_period;
 
@@ -257,6 +264,8 @@ struct ShupitoJtag::play_visitor
 
     void operator()(yb::svf_trst const & stmt)
     {
+        this->sync();
+
         ShupitoPacket resp = parent.m_shupito->waitForPacket(makeShupitoPacket(parent.m_prog_cmd_base + 4, 1, stmt.mode), parent.m_prog_cmd_base + 4);
         if (resp.size() != 2 || resp[1] != 0)
             throw QObject::tr("Something went wrong while executing TRST command.");
@@ -280,11 +289,51 @@ struct ShupitoJtag::play_visitor
     {
     }
 
+    void flush_tms()
+    {
+        size_t ms = parent.m_shupito->maxPacketSize();
+
+        uint8_t const * p = tms_path.data();
+        while (tms_length && !parent.m_cancel_requested)
+        {
+            size_t chunk_bits = (std::min)(tms_length, (ms - 1) * 8);
+            if (chunk_bits > 248)
+                chunk_bits = 248;
+
+            size_t chunk_bytes = (chunk_bits + 7) / 8;
+
+            ShupitoPacket pkt;
+            pkt.push_back(parent.m_prog_cmd_base);
+            pkt.push_back(chunk_bits);
+            pkt.insert(pkt.end(), p, p + chunk_bytes);
+
+            pipeline.send(pkt);
+
+            tms_length -= chunk_bits;
+            p += chunk_bytes;
+        }
+
+        tms_path.clear();
+        tms_length = 0;
+        emit parent.updateProgressDialog((int)(current_cost * 100 / total_cost));
+    }
+
+    // Commands outside of the pipeline need all TAP operations done first
+    void sync()
+    {
+        this->flush_tms();
+        pipeline.drain();
+    }
+
     ShupitoJtag & parent;
+    ShupitoPipeline & pipeline;
     double current_bit_period;
     double min_bit_period;
     double current_cost;
     double total_cost;
+
+    std::vector<uint8_t> tms_path;
+    size_t tms_length;
 };
 
 void ShupitoJtag::executeText(QByteArray const & data, quint8 memId, chip_definition & chip)
@@ -298,12 +347,14 @@ void ShupitoJtag::executeText(QByteArray const & data, quint8 memId, chip_defini
     yb::svf_visit(doc, cv);
 
     emit updateProgressDialog(0);
-    play_visitor pv(*this, cv.total_cost);
+    ShupitoPipeline pipeline(m_shupito, pipeline_window);
+    play_visitor pv(*this, pipeline, cv.total_cost);
     try
     {
         m_cancel_requested = false;
         for (size_t i = 0; !m_cancel_requested && i < doc.size(); ++i)
             svf_visit(doc[i].get(), pv);
+        pv.sync();
         emit updateProgressDialog(-1);
     }
     catch (QString const & e)
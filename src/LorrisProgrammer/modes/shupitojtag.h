@@ -38,6 +38,9 @@ private:
     struct cost_visitor;
     struct play_visitor;
 
+    // Number of TMS/shift packets sent before waiting for a response
+    static const size_t pipeline_window = 16;
+
     void cmd_frequency(uint32_t speed_hz);
 
     uint32_t m_freq_base;
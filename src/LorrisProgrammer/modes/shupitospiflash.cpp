@@ -6,39 +6,51 @@
 ***********************************************/
 
 #include "../shupito.h"
+#include "../shupitopipeline.h"
 #include "shupitospiflash.h"
 #include "../../shared/defmgr.h"
 #include "../../misc/utils.h"
+#include "../../shared/hexfile.h"
+#include <QStringList>
+#include <map>
+#include <set>
 
 void ShupitoSpiFlash::transfer(uint8_t const * out_data, uint8_t * in_data, size_t size)
+{
+    ShupitoPipeline pipe(m_shupito, pipeline_window);
+    this->queueTransfer(pipe, out_data, size, in_data, 0);
+    pipe.drain();
+}
+
+void ShupitoSpiFlash::queueTransfer(ShupitoPipeline & pipe, uint8_t const * out_data, size_t size, uint8_t * in_data, size_t in_skip)
 {
     size_t ms = m_shupito->maxPacketSize() - 1;
 
-    while (size)
+    for (size_t pos = 0; pos != size; )
     {
-        size_t chunk = (std::min)(ms, size);
+        size_t chunk = (std::min)(ms, size - pos);
 
         uint8_t flags = 0;
-        if (chunk == size)
+        if (pos + chunk == size)
             flags |= 0x02;
 
         ShupitoPacket pkt;
         pkt.push_back(m_prog_cmd_base + 2);
         pkt.push_back(flags);
-        pkt.insert(pkt.end(), out_data, out_data + chunk);
-        pkt = m_shupito->waitForPacket(pkt, m_prog_cmd_base + 2);
+        pkt.insert(pkt.end(), out_data + pos, out_data + pos + chunk);
 
-        if (pkt.size() != chunk + 2)
-            throw QString(tr("Invalid response."));
+        // The first in_skip received bytes belong to the command and are dropped
+        pipe.send(pkt, [this, pos, chunk, in_data, in_skip](ShupitoPacket const & in) -> QString {
+            if (in.size() != chunk + 2)
+                return tr("Invalid response.");
 
-        if (in_data)
-        {
-            std::copy(pkt.begin() + 2, pkt.end(), in_data);
-            in_data += chunk;
-        }
+            size_t start = (std::max)(pos, in_skip);
+            if (in_data && start < pos + chunk)
+                std::copy(in.begin() + 2 + (start - pos), in.end(), in_data + (start - in_skip));
+            return QString();
+        });
 
-        out_data += chunk;
-        size -= chunk;
+        pos += chunk;
     }
 }
 
@@ -87,12 +99,35 @@ chip_definition ShupitoSpiFlash::readDeviceId()
     if (header[0] == 'S' && header[1] == 'F' && header[2] == 'D' && header[3] == 'P')
     {
         uint32_t table_address = deserialize_le<uint32_t>(header + 0xc, 3);
+        size_t table_dwords = header[0xb];
 
-        uint8_t flash_params[16];
-        this->readSfdp(table_address, flash_params, sizeof flash_params);
+        // Only the density and the erase types (DWORDs 8 and 9) are needed
+        uint8_t flash_params[36] = {};
+        this->readSfdp(table_address, flash_params, table_dwords >= 9? sizeof flash_params: 16);
 
         uint32_t flash_size_bits = deserialize_le<uint32_t>(flash_params + 4);
-        flash_size_bytes = (flash_size_bits + 1) / 8;
+        if (flash_size_bits & 0x80000000)
+            flash_size_bytes = uint32_t(1) << ((flash_size_bits & 0x7fffffff) - 3);
+        else
+            flash_size_bytes = (flash_size_bits + 1) / 8;
+
+        QStringList erase_types;
+        if (table_dwords >= 9)
+        {
+            for (size_t i = 0; i < 4; ++i)
+            {
+                uint8_t size_exp = flash_params[28 + 2*i];
+                if (size_exp != 0 && size_exp < 32)
+                    erase_types.push_back(QString("%1:%2").arg(uint32_t(1) << size_exp).arg(flash_params[29 + 2*i], 2, 16, QChar('0')));
+            }
+        }
+        else if ((flash_params[0] & 3) == 1)
+        {
+            erase_types.push_back(QString("4096:%1").arg(flash_params[1], 2, 16, QChar('0')));
+        }
+
+        if (!erase_types.empty())
+            cd.getOptions()["erase_types"] = erase_types.join(",");
     }
 
     QHash<QString, chip_definition::memorydef> & mds = cd.getMems();
@@ -107,56 +142,330 @@ chip_definition ShupitoSpiFlash::readDeviceId()
 
 void ShupitoSpiFlash::readMemRange(quint8 memid, QByteArray& memory, quint32 address, quint32 size)
 {
-    ShupitoPacket out;
-    out.push_back(m_prog_cmd_base + 2);
-    out.push_back(0);
-    out.push_back(3);
-    out.push_back(address >> 16);
-    out.push_back(address >> 8);
-    out.push_back(address);
-
-    while (size && !m_cancel_requested)
+    int offset = memory.size();
+    memory.resize(offset + size);
+
+    // Split into several read commands, so that a cancel request
+    // doesn't have to wait for the whole range.
+    ShupitoPipeline pipe(m_shupito, pipeline_window);
+    quint32 done = 0;
+    while (done != size && !m_cancel_requested)
     {
-        size_t offset = out.size() - 2;
-        size_t chunk = (std::min)((size_t)size, m_shupito->maxPacketSize() - (out.size() - 1));
-        size -= chunk;
+        quint32 chunk = (std::min)(size - done, quint32(read_chunk_size));
+        this->queueRead(pipe, address + done, (uint8_t *)memory.data() + offset + done, chunk);
+        done += chunk;
+    }
+    pipe.drain();
+
+    memory.resize(offset + done);
+}
 
-        if (size == 0)
-            out[1] = (1<<1);
-        out.resize(chunk + offset + 2, 0);
+void ShupitoSpiFlash::queueRead(ShupitoPipeline & pipe, uint32_t address, uint8_t * data, size_t size)
+{
+    std::vector<uint8_t> out(size + 4, 0);
+    out[0] = 3;
+    out[1] = address >> 16;
+    out[2] = address >> 8;
+    out[3] = address;
+    this->queueTransfer(pipe, out.data(), out.size(), data, 4);
+}
+
+void ShupitoSpiFlash::queueReadStatus(ShupitoPipeline & pipe, std::function<QString (uint8_t)> const & handler)
+{
+    uint8_t const req[] = { uint8_t(m_prog_cmd_base + 2), (1<<1), 5, 0 };
+    pipe.send(ShupitoPacket(req, req + sizeof req), [this, handler](ShupitoPacket const & in) -> QString {
+        if (in.size() != sizeof req)
+            return tr("Invalid response.");
+        return handler(in[3]);
+    });
+}
 
-        ShupitoPacket in = m_shupito->waitForPacket(out, m_prog_cmd_base + 2);
-        if (in.size() != out.size())
-            throw QString(tr("Invalid response."));
+void ShupitoSpiFlash::queueWriteEnable(ShupitoPipeline & pipe)
+{
+    uint8_t const req[] = { uint8_t(m_prog_cmd_base + 2), (1<<1), 6 };
+    pipe.send(ShupitoPacket(req, req + sizeof req));
 
-        memory.append((char *)in.data() + offset + 2, in.size() - offset - 2);
+    this->queueReadStatus(pipe, [this](uint8_t status) -> QString {
+        if ((status & (1<<1)) == 0)
+            return tr("Failed to enable write");
+        return QString();
+    });
+}
 
-        out.clear();
-        out.push_back(m_prog_cmd_base + 2);
-        out.push_back(0);
+void ShupitoSpiFlash::waitReady(ShupitoPipeline & pipe)
+{
+    bool busy = true;
+    while (busy)
+    {
+        this->queueReadStatus(pipe, [this, &busy](uint8_t status) -> QString {
+            busy = (status & (1<<0)) != 0;
+            if (!busy && (status & (1<<1)) != 0)
+                return tr("The device didn't reset the write enable latch");
+            return QString();
+        });
+        pipe.drain();
     }
 }
 
-void ShupitoSpiFlash::flashPage(chip_definition::memorydef *memdef, std::vector<quint8>& memory, quint32 address)
+void ShupitoSpiFlash::eraseBlock(ShupitoPipeline & pipe, erase_type const & type, uint32_t address)
 {
-    this->writeEnable();
-    if ((this->readStatus() & (1<<1)) == 0)
-        throw tr("Failed to enable write");
+    this->queueWriteEnable(pipe);
+
+    uint8_t const cmd[] = { type.opcode, uint8_t(address >> 16), uint8_t(address >> 8), uint8_t(address) };
+    this->queueTransfer(pipe, cmd, sizeof cmd, 0, 0);
+    this->waitReady(pipe);
+}
+
+void ShupitoSpiFlash::programPage(ShupitoPipeline & pipe, uint32_t address, uint8_t const * data, size_t size)
+{
+    // WREN, its check and the page program go out back-to-back,
+    // only the busy polling needs a round-trip.
+    this->queueWriteEnable(pipe);
 
     std::vector<uint8_t> out;
     out.push_back(2);
     out.push_back(address >> 16);
     out.push_back(address >> 8);
     out.push_back(address);
-    out.insert(out.end(), memory.begin(), memory.end());
-    this->transfer(out.data(), 0, out.size());
+    out.insert(out.end(), data, data + size);
+    this->queueTransfer(pipe, out.data(), out.size(), 0, 0);
 
-    while (this->readStatus() & (1<<0))
+    this->waitReady(pipe);
+}
+
+void ShupitoSpiFlash::flashPage(chip_definition::memorydef *memdef, std::vector<quint8>& memory, quint32 address)
+{
+    ShupitoPipeline pipe(m_shupito, pipeline_window);
+    this->programPage(pipe, address, memory.data(), memory.size());
+}
+
+std::vector<ShupitoSpiFlash::erase_type> ShupitoSpiFlash::eraseTypes(chip_definition & chip)
+{
+    // "size:opcode,...", filled from SFDP by readDeviceId or set in chipdefs
+    QString opt = chip.getOption("erase_types");
+    if (opt.isEmpty())
+        opt = "4096:20,65536:d8";
+
+    std::vector<erase_type> res;
+    QStringList types = opt.split(',', QString::SkipEmptyParts);
+    for (int i = 0; i < types.size(); ++i)
     {
+        QStringList parts = types[i].split(':');
+        if (parts.size() != 2)
+            throw tr("Invalid erase type: %1").arg(types[i]);
+
+        bool ok1, ok2;
+        erase_type et;
+        et.size = parts[0].toUInt(&ok1);
+        et.opcode = parts[1].toUInt(&ok2, 16);
+        if (!ok1 || !ok2 || et.size == 0 || (et.size & (et.size - 1)) != 0)
+            throw tr("Invalid erase type: %1").arg(types[i]);
+
+        std::vector<erase_type>::iterator itr = res.begin();
+        while (itr != res.end() && itr->size < et.size)
+            ++itr;
+        if (itr == res.end() || itr->size != et.size)
+            res.insert(itr, et);
     }
 
-    if ((this->readStatus() & (1<<1)) != 0)
-        throw tr("The device didn't reset the write enable latch");
+    if (res.empty())
+        throw tr("The flash has no erase types");
+    return res;
+}
+
+void ShupitoSpiFlash::flashRaw(HexFile& file, quint8 memId, chip_definition& chip, VerifyMode verifyMode)
+{
+    m_cancel_requested = false;
+
+    chip_definition::memorydef *memdef = chip.getMemDef(memId);
+    if(!memdef)
+        throw QString(QObject::tr("Chip does not have mem id %1")).arg(memId);
+
+    if (memdef->size && file.getTopAddress() > memdef->size)
+        throw QString(QObject::tr("Program is too large."));
+
+    std::vector<erase_type> const types = this->eraseTypes(chip);
+    uint32_t const block_size = types[0].size;
+    uint32_t const page_size = memdef->pagesize? memdef->pagesize: 256;
+
+    // Like the other modes, only non-empty pages are written. 0xFF bytes
+    // and everything outside of these pages keep what the flash holds.
+    std::vector<page> pages;
+    std::set<quint32> skipped;
+    file.makePages(pages, memId, chip, &skipped);
+
+    std::set<uint32_t> block_set;
+    for (size_t i = 0; i < pages.size(); ++i)
+    {
+        if (skipped.find(i) != skipped.end() || pages[i].data.empty())
+            continue;
+
+        uint32_t last = (pages[i].address + pages[i].data.size() - 1) & ~(block_size - 1);
+        for (uint32_t addr = pages[i].address & ~(block_size - 1); addr <= last; addr += block_size)
+        {
+            block_set.insert(addr);
+            if (addr == last)
+                break;
+        }
+    }
+
+    std::vector<uint32_t> blocks(block_set.begin(), block_set.end());
+    std::map<uint32_t, size_t> block_index;
+    for (size_t i = 0; i < blocks.size(); ++i)
+        block_index[blocks[i]] = i;
+
+    // Read the blocks back so that the "don't care" bytes survive the erase
+    emit updateProgressLabel(tr("Reading flash contents"));
+
+    std::vector<uint8_t> current(blocks.size() * block_size);
+    {
+        ShupitoPipeline pipe(m_shupito, pipeline_window);
+        for (size_t i = 0; !m_cancel_requested && i < blocks.size(); ++i)
+        {
+            this->queueRead(pipe, blocks[i], current.data() + i * block_size, block_size);
+            emit updateProgressDialog((std::min)(size_t(99), i * 100 / blocks.size()));
+        }
+        pipe.drain();
+    }
+
+    if (m_cancel_requested)
+    {
+        m_cancel_requested = false;
+        throw QString(QObject::tr("Flashing interruped!"));
+    }
+
+    std::vector<uint8_t> wanted(current);
+    for (size_t i = 0; i < pages.size(); ++i)
+    {
+        if (skipped.find(i) != skipped.end())
+            continue;
+
+        for (size_t j = 0; j < pages[i].data.size(); ++j)
+        {
+            uint32_t addr = pages[i].address + j;
+            if (pages[i].data[j] == 0xff)
+                continue;
+
+            size_t idx = block_index[addr & ~(block_size - 1)];
+            wanted[idx * block_size + (addr & (block_size - 1))] = pages[i].data[j];
+        }
+    }
+
+    enum { block_clean, block_program, block_erase };
+    std::vector<int> state(blocks.size(), block_clean);
+    std::vector<bool> blank(blocks.size(), true);
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        uint8_t const * cur = current.data() + i * block_size;
+        uint8_t const * want = wanted.data() + i * block_size;
+        for (uint32_t j = 0; j < block_size; ++j)
+        {
+            if (cur[j] != 0xff)
+                blank[i] = false;
+            if ((cur[j] & want[j]) != want[j])
+                state[i] = block_erase;
+            else if (cur[j] != want[j] && state[i] == block_clean)
+                state[i] = block_program;
+        }
+    }
+
+    // Cover the blocks that need erasing with the largest erase types which
+    // don't touch anything else than these blocks or blocks already blank.
+    std::vector<std::pair<uint32_t, erase_type const *> > erases;
+    uint32_t erased_end = 0;
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        if (state[i] != block_erase || (!erases.empty() && blocks[i] < erased_end))
+            continue;
+
+        erase_type const * best = &types[0];
+        for (size_t t = types.size() - 1; t != 0; --t)
+        {
+            uint32_t base = blocks[i] & ~(types[t].size - 1);
+            if ((!erases.empty() && base < erased_end) || (memdef->size && base + types[t].size > memdef->size))
+                continue;
+
+            bool usable = true;
+            for (uint32_t addr = base; usable && addr - base < types[t].size; addr += block_size)
+            {
+                std::map<uint32_t, size_t>::const_iterator itr = block_index.find(addr);
+                usable = itr != block_index.end() && (state[itr->second] == block_erase || blank[itr->second]);
+            }
+
+            if (usable)
+            {
+                best = &types[t];
+                break;
+            }
+        }
+
+        uint32_t base = blocks[i] & ~(best->size - 1);
+        erases.push_back(std::make_pair(base, best));
+        erased_end = base + best->size;
+    }
+
+    ShupitoPipeline pipe(m_shupito, pipeline_window);
+
+    emit updateProgressLabel(tr("Erasing"));
+    for (size_t i = 0; !m_cancel_requested && i < erases.size(); ++i)
+    {
+        this->eraseBlock(pipe, *erases[i].second, erases[i].first);
+        emit updateProgressDialog((std::min)(size_t(99), (i + 1) * 100 / erases.size()));
+    }
+
+    emit updateProgressLabel(tr("Writing"));
+    for (size_t i = 0; !m_cancel_requested && i < blocks.size(); ++i)
+    {
+        if (state[i] == block_clean)
+            continue;
+
+        for (uint32_t offset = 0; offset < block_size; offset += page_size)
+        {
+            uint8_t const * want = wanted.data() + i * block_size + offset;
+            uint8_t const * cur = current.data() + i * block_size + offset;
+
+            bool skip = true;
+            for (uint32_t j = 0; skip && j < page_size; ++j)
+                skip = want[j] == (state[i] == block_erase? 0xff: cur[j]);
+
+            if (!skip)
+                this->programPage(pipe, blocks[i] + offset, want, page_size);
+        }
+
+        emit updateProgressDialog((std::min)(size_t(99), (i + 1) * 100 / blocks.size()));
+    }
+
+    if (m_cancel_requested)
+    {
+        m_cancel_requested = false;
+        throw QString(QObject::tr("Flashing interruped!"));
+    }
+
+    if (verifyMode == VERIFY_NONE)
+        return;
+
+    emit updateProgressLabel(QObject::tr("Verifying data"));
+
+    std::vector<uint8_t> readback(block_size);
+    for (size_t i = 0; !m_cancel_requested && i < blocks.size(); ++i)
+    {
+        if (state[i] == block_clean)
+            continue;
+
+        this->queueRead(pipe, blocks[i], readback.data(), block_size);
+        pipe.drain();
+
+        if (!std::equal(readback.begin(), readback.end(), wanted.begin() + i * block_size))
+            throw QString(QObject::tr("Verification failed!"));
+
+        emit updateProgressDialog((std::min)(size_t(99), (i + 1) * 100 / blocks.size()));
+    }
+
+    if (m_cancel_requested)
+    {
+        m_cancel_requested = false;
+        throw QString(QObject::tr("Flashing interruped!"));
+    }
 }
 
 void ShupitoSpiFlash::erase_device(chip_definition& chip)
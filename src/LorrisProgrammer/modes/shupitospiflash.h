@@ -10,6 +10,9 @@
 
 #include "shupitomode.h"
 #include <stdint.h>
+#include <functional>
+
+class ShupitoPipeline;
 
 class ShupitoSpiFlash : public ShupitoMode
 {
@@ -19,6 +22,7 @@ public:
 
     virtual chip_definition readDeviceId() override;
     virtual void erase_device(chip_definition& chip) override;
+    virtual void flashRaw(HexFile& file, quint8 memId, chip_definition& chip, VerifyMode verifyMode) override;
 
     ProgrammerCapabilities capabilities() const override;
 
@@ -28,11 +32,30 @@ protected:
     virtual void flashPage(chip_definition::memorydef *memdef, std::vector<quint8>& memory, quint32 address) override;
 
 private:
+    struct erase_type
+    {
+        uint32_t size;
+        uint8_t opcode;
+    };
+
+    static const size_t pipeline_window = 16;
+    static const size_t read_chunk_size = 4096;
+
     void writeEnable();
     uint8_t readStatus();
 
     void transfer(uint8_t const * out_data, uint8_t * in_data, size_t size);
     void readSfdp(uint32_t addr, uint8_t * data, size_t size);
+
+    std::vector<erase_type> eraseTypes(chip_definition & chip);
+
+    void queueTransfer(ShupitoPipeline & pipe, uint8_t const * out_data, size_t size, uint8_t * in_data, size_t in_skip);
+    void queueRead(ShupitoPipeline & pipe, uint32_t address, uint8_t * data, size_t size);
+    void queueReadStatus(ShupitoPipeline & pipe, std::function<QString (uint8_t)> const & handler);
+    void queueWriteEnable(ShupitoPipeline & pipe);
+    void waitReady(ShupitoPipeline & pipe);
+    void eraseBlock(ShupitoPipeline & pipe, erase_type const & type, uint32_t address);
+    void programPage(ShupitoPipeline & pipe, uint32_t address, uint8_t const * data, size_t size);
 };
 
 #endif // SHUPITOSPIFLASH_H
@@ -0,0 +1,223 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#include <QElapsedTimer>
+#include <QScopedPointer>
+#include <QStringList>
+#include <algorithm>
+
+#include "programmerbenchmark.h"
+#include "simulatedtargets.h"
+#include "lorrisprogrammer.h"
+#include "../connection/shupitoconn.h"
+#include "../shared/hexfile.h"
+#include "../misc/utils.h"
+
+// Flash images are cut to this size, so that slow links finish in a few seconds
+static const quint32 BENCHMARK_IMAGE_SIZE = 16*1024;
+
+struct benchmark_protocol
+{
+    int type;
+    const char *name;
+    const char *read_mem;
+};
+
+static const benchmark_protocol protocols[] = {
+    { programmer_shupito,    "Shupito SPI", "flash" },
+    { programmer_avr109,     "AVR109",      "flash" },
+    { programmer_avr232boot, "avr232boot",  "eeprom" },
+    { programmer_arduino,    "Arduino",     "flash" },
+    { programmer_zmodem,     "ZMODEM",      NULL },
+};
+
+ProgrammerBenchmark::ProgrammerBenchmark(SimulatedPort::link const & link, quint32 page_write_us, QObject *parent)
+    : QObject(parent), m_link(link), m_page_write_us(page_write_us), m_protocol(-1)
+{
+}
+
+void ProgrammerBenchmark::log(QString const & msg)
+{
+    // printed the same way as the results, ahead of the table
+    if(m_protocol >= 0)
+        utils_printf("  %s: %s\n", protocols[m_protocol].name, msg.toLocal8Bit().constData());
+    else
+        utils_printf("  %s\n", msg.toLocal8Bit().constData());
+    utils_flush();
+}
+
+void ProgrammerBenchmark::progressLabel(QString const & text)
+{
+    log(text);
+}
+
+std::vector<ProgrammerBenchmark::result> ProgrammerBenchmark::run()
+{
+    std::vector<result> results;
+    for(size_t i = 0; i < sizeof_array(protocols); ++i)
+        runProtocol(i, results);
+    return results;
+}
+
+SimulatedChip *ProgrammerBenchmark::createTarget(int protocol)
+{
+    switch(protocols[protocol].type)
+    {
+        case programmer_shupito:    return new SimulatedShupito(m_page_write_us);
+        case programmer_avr109:     return new SimulatedAvr109(m_page_write_us);
+        case programmer_avr232boot: return new SimulatedAvr232boot(m_page_write_us);
+        case programmer_arduino:    return new SimulatedArduino(m_page_write_us);
+        case programmer_zmodem:     return new SimulatedZmodem(m_page_write_us);
+    }
+    return NULL;
+}
+
+ProgrammerBenchmark::result ProgrammerBenchmark::makeResult(int protocol, QString const & operation, quint64 bytes,
+                                                            qint64 elapsed_ms, SimulatedPort *port)
+{
+    result res;
+    res.protocol = protocols[protocol].name;
+    res.operation = operation;
+    res.bytes = bytes;
+    res.elapsed_ms = elapsed_ms;
+    res.round_trips = port->roundTrips();
+    res.link_bytes = port->bytesSent() + port->bytesReceived();
+    return res;
+}
+
+void ProgrammerBenchmark::runProtocol(int protocol, std::vector<result>& results)
+{
+    const int type = protocols[protocol].type;
+    m_protocol = protocol;
+
+    // the port owns the target
+    SimulatedChip *target = createTarget(protocol);
+    ConnectionPointer<SimulatedPort> port(new SimulatedPort(target, m_link));
+    port->setProgrammerType(type);
+    port->OpenConcurrent();
+
+    ConnectionPointer<Connection> conn = port;
+    if(type == programmer_shupito)
+    {
+        ConnectionPointer<PortShupitoConnection> sc(new PortShupitoConnection());
+        sc->setPort(port);
+        sc->OpenConcurrent();
+        conn = sc;
+    }
+
+    QString operation = tr("connect");
+    try
+    {
+        QScopedPointer<Programmer> prog(LorrisProgrammer::createProgrammer(conn, this));
+        if(!prog)
+            throw tr("No programmer is available for this connection.");
+
+        connect(prog.data(), SIGNAL(updateProgressLabel(QString)), SLOT(progressLabel(QString)));
+        prog->switchToFlashMode(1000000);
+
+        chip_definition chip = prog->readDeviceId();
+        if(chip.getName().isEmpty())
+            throw tr("Unsupported chip: %1").arg(chip.getSign());
+
+        // Random data, so that no page is skipped as empty
+        quint32 size = BENCHMARK_IMAGE_SIZE;
+        chip_definition::memorydef *flash = chip.getMemDef(MEM_FLASH);
+        if(flash && flash->size != 0)
+            size = std::min(size, flash->size);
+
+        QByteArray image(size, 0);
+        qsrand(size);
+        for(quint32 i = 0; i < size; ++i)
+            image[i] = char(qrand());
+
+        HexFile file;
+        file.setData(image);
+
+        operation = tr("write flash");
+        port->resetCounters();
+
+        QElapsedTimer timer;
+        timer.start();
+        prog->flashRaw(file, MEM_FLASH, chip, VERIFY_NONE);
+        results.push_back(makeResult(protocol, operation, size, timer.elapsed(), port.data()));
+
+        if(target->memory(MEM_FLASH).left(size) != image)
+            results.back().error = tr("The target memory differs from the image.");
+
+        if(const char *mem = protocols[protocol].read_mem)
+        {
+            operation = tr("read %1").arg(mem);
+            port->resetCounters();
+
+            timer.restart();
+            QByteArray data = prog->readMemory(mem, chip);
+            results.push_back(makeResult(protocol, operation, data.size(), timer.elapsed(), port.data()));
+
+            if(data != target->memory(chip_definition::memNameToId(mem)))
+                results.back().error = tr("The data read differ from the target memory.");
+        }
+
+        prog->switchToRunMode();
+    }
+    catch(QString const & ex)
+    {
+        results.push_back(makeResult(protocol, operation, 0, 0, port.data()));
+        results.back().error = ex;
+    }
+}
+
+int ProgrammerBenchmark::runFromCommandLine(QString const & params)
+{
+    // 115200 baud UART behind an USB converter
+    SimulatedPort::link link;
+    link.latency_us = 1000;
+    link.bandwidth = 11520;
+    quint32 page_write_us = 4500;
+
+    QStringList parts = params.split(':');
+    bool ok = true;
+    if(parts.size() > 0 && !parts[0].isEmpty())
+        link.latency_us = parts[0].toUInt(&ok);
+    if(ok && parts.size() > 1 && !parts[1].isEmpty())
+        link.bandwidth = parts[1].toUInt(&ok);
+    if(ok && parts.size() > 2 && !parts[2].isEmpty())
+        page_write_us = parts[2].toUInt(&ok);
+
+    if(!ok || parts.size() > 3)
+    {
+        utils_printf("Invalid benchmark parameters \"%s\", expected LATENCY_US:BYTES_PER_S:PAGE_WRITE_US\n",
+                     params.toLocal8Bit().constData());
+        return 1;
+    }
+
+    utils_printf("Link latency %u us, %u B/s, page write %u us\n\n",
+                 link.latency_us, link.bandwidth, page_write_us);
+    utils_printf("%-12s %-13s %8s %10s %10s %12s %11s\n",
+                 "protocol", "operation", "bytes", "time [ms]", "B/s", "round-trips", "link bytes");
+
+    ProgrammerBenchmark bench(link, page_write_us);
+    std::vector<result> results = bench.run();
+
+    int failed = 0;
+    for(size_t i = 0; i < results.size(); ++i)
+    {
+        result const & r = results[i];
+        const quint64 rate = r.elapsed_ms > 0 ? (r.bytes * 1000) / r.elapsed_ms : 0;
+
+        utils_printf("%-12s %-13s %8llu %10lld %10llu %12llu %11llu\n",
+                     r.protocol.toLocal8Bit().constData(), r.operation.toLocal8Bit().constData(),
+                     (unsigned long long)r.bytes, (long long)r.elapsed_ms, (unsigned long long)rate,
+                     (unsigned long long)r.round_trips, (unsigned long long)r.link_bytes);
+
+        if(!r.error.isEmpty())
+        {
+            utils_printf("    FAILED: %s\n", r.error.toLocal8Bit().constData());
+            ++failed;
+        }
+    }
+    return failed;
+}
@@ -0,0 +1,66 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#ifndef PROGRAMMERBENCHMARK_H
+#define PROGRAMMERBENCHMARK_H
+
+#include <QObject>
+#include <vector>
+
+#include "../connection/simulatedport.h"
+#include "../shared/programmer.h"
+
+class SimulatedChip;
+
+/*
+ * Runs the flashRaw() and readMemory() paths of the serial programmers
+ * against simulated targets and measures them. The written data are
+ * checked against the target's memory, so the benchmark doubles as
+ * a protocol check.
+ */
+class ProgrammerBenchmark : public QObject, public ProgrammerLogSink
+{
+    Q_OBJECT
+
+public:
+    struct result
+    {
+        QString protocol;
+        QString operation;
+        quint64 bytes;
+        qint64 elapsed_ms;
+        quint64 round_trips;
+        quint64 link_bytes;
+        QString error;
+    };
+
+    ProgrammerBenchmark(SimulatedPort::link const & link, quint32 page_write_us, QObject *parent = 0);
+
+    std::vector<result> run();
+
+    void log(QString const & msg);
+
+    // params is LATENCY_US:BYTES_PER_S:PAGE_WRITE_US, empty fields keep the defaults.
+    // Prints the results to stdout, returns the number of failed runs.
+    static int runFromCommandLine(QString const & params);
+
+private slots:
+    void progressLabel(QString const & text);
+
+private:
+    void runProtocol(int protocol, std::vector<result>& results);
+    SimulatedChip *createTarget(int protocol);
+    result makeResult(int protocol, QString const & operation, quint64 bytes, qint64 elapsed_ms,
+                      SimulatedPort *port);
+
+    SimulatedPort::link m_link;
+    quint32 m_page_write_us;
+    // index into the protocol table of the run in progress, for log()
+    int m_protocol;
+};
+
+#endif // PROGRAMMERBENCHMARK_H
@@ -1,5 +1,4 @@
 #include <QTimer>
-#include <QEventLoop>
 
 #include "arduinoprogrammer.h"
 #include "../../shared/defmgr.h"
@@ -25,14 +24,13 @@ enum Commands : char {
 
 #define READ_PAGE_SIZE 256
 
-ArduinoProgrammer::ArduinoProgrammer(ConnectionPointer<SerialPort> const & conn, ProgrammerLogSink * logsink) : Programmer(logsink), m_stay_in_bl_timer(this) {
+ArduinoProgrammer::ArduinoProgrammer(ConnectionPointer<PortConnection> const & conn, ProgrammerLogSink * logsink) : Programmer(logsink), m_transport(conn), m_stay_in_bl_timer(this) {
     m_conn = conn;
     m_flash_mode = false;
     m_ignore_incoming = false;
-    m_wait_act = WAIT_NONE;
     m_cancel_requested = false;
 
-    connect(m_conn.data(), SIGNAL(dataRead(QByteArray)), this, SLOT(dataRead(QByteArray)));
+    connect(&m_transport, SIGNAL(unexpectedData(QByteArray)), this, SLOT(unexpectedData(QByteArray)));
     connect(&m_stay_in_bl_timer, SIGNAL(timeout()), this, SLOT(stayInBootloader()));
 }
 
@@ -49,28 +47,24 @@ void ArduinoProgrammer::switchToFlashMode(quint32 prog_speed_hz) {
         return;
     }
 
-    if(m_wait_act != WAIT_NONE) {
+    if(m_transport.pending() != 0) {
         throw tr("Already stopping!");
     }
 
-    m_conn->setRts(false);
-    m_conn->setDtr(false);
-    waitForAct(WAIT_RTS_DTR, 250);
-    m_conn->setRts(true);
-    m_conn->setDtr(true);
-    waitForAct(WAIT_RTS_DTR, 50);
+    resetBoard();
 
     static const char stopCmd[] = { STK_GET_SYNCH, Sync_CRC_EOP };
 
     m_ignore_incoming = true;
 
-    m_conn->SendData(QByteArray::fromRawData(stopCmd, sizeof(stopCmd)));
-    m_conn->SendData(QByteArray::fromRawData(stopCmd, sizeof(stopCmd)));
+    m_transport.send(stopCmd, sizeof(stopCmd));
+    m_transport.send(stopCmd, sizeof(stopCmd));
 
     bool synced = false;
     for(int i = 0; i < 10; ++i) {
-        m_conn->SendData(QByteArray::fromRawData(stopCmd, 2));
-        if(waitForAct(WAIT_SYNC, 100)) {
+        m_transport.send(stopCmd, 2);
+        expectSync();
+        if(m_transport.wait(0, 100)) {
             synced = true;
             break;
         }
@@ -84,8 +78,9 @@ void ArduinoProgrammer::switchToFlashMode(quint32 prog_speed_hz) {
     // TODO: Get protocol version should be here
 
     static const char enterProgMode[] = { STK_ENTER_PROGMODE, Sync_CRC_EOP };
-    m_conn->SendData(QByteArray::fromRawData(enterProgMode, 2));
-    if(!waitForAct(WAIT_SYNC, 100)) {
+    m_transport.send(enterProgMode, 2);
+    expectSync();
+    if(!m_transport.wait(0, 100)) {
         throw tr("Failed to switch to flash mode (timeout).");
     }
 
@@ -93,6 +88,22 @@ void ArduinoProgrammer::switchToFlashMode(quint32 prog_speed_hz) {
     setStayInBootloaderTimer(true);
 }
 
+// Toggling DTR and RTS resets the board into the bootloader. Ports
+// without modem control lines, e.g. the simulated target, must already
+// be running the bootloader.
+void ArduinoProgrammer::resetBoard() {
+    SerialPort *port = dynamic_cast<SerialPort*>(m_conn.data());
+    if(!port)
+        return;
+
+    port->setRts(false);
+    port->setDtr(false);
+    m_transport.sleep(250, false);
+    port->setRts(true);
+    port->setDtr(true);
+    m_transport.sleep(50, false);
+}
+
 // The bootloader times out after about 1s and runs the main program
 // if no data are received, because fuck you.
 void ArduinoProgrammer::setStayInBootloaderTimer(bool run) {
@@ -107,9 +118,30 @@ void ArduinoProgrammer::setStayInBootloaderTimer(bool run) {
 }
 
 void ArduinoProgrammer::stayInBootloader() {
+    if(m_transport.pending() != 0)
+        return;
+
     static const char syncCmd[] = { STK_GET_SYNCH, Sync_CRC_EOP };
-    m_conn->SendData(QByteArray::fromRawData(syncCmd, sizeof(syncCmd)));
-    waitForAct(WAIT_SYNC, 50);
+    m_transport.send(syncCmd, sizeof(syncCmd));
+    expectSync();
+    m_transport.wait(0, 50);
+}
+
+// Every command is answered with INSYNC, OK
+void ArduinoProgrammer::expectSync() {
+    static const char syncReply[] = { STK_INSYNC, STK_OK };
+    m_transport.expectMarker(QByteArray::fromRawData(syncReply, sizeof(syncReply)));
+}
+
+// Commands are processed much faster than the next one arrives, so the
+// load address is sent together with the command that follows it and
+// both are acked in a single round-trip.
+void ArduinoProgrammer::queueLoadAddress(quint32 address) {
+    // divide by 2 for some reason, not important enough
+    // to be mentioned in the docs
+    const char cmd[] = { STK_LOAD_ADDRESS, char((address/2) & 0xFF), char(((address/2) >> 8) & 0xFF), Sync_CRC_EOP };
+    m_transport.send(QByteArray(cmd, sizeof(cmd)));
+    expectSync();
 }
 
 void ArduinoProgrammer::switchToRunMode() {
@@ -119,30 +151,27 @@ void ArduinoProgrammer::switchToRunMode() {
     m_flash_mode = false;
     setStayInBootloaderTimer(false);
 
-    m_conn->setRts(false);
-    m_conn->setDtr(false);
-    waitForAct(WAIT_RTS_DTR, 250);
-    m_conn->setRts(true);
-    m_conn->setDtr(true);
-    waitForAct(WAIT_RTS_DTR, 50);
+    resetBoard();
 }
 
 chip_definition ArduinoProgrammer::readDeviceId() {
-    m_rec_buff.clear();
+    QByteArray reply;
 
     setStayInBootloaderTimer(false);
 
     static const char readSign[] = { STK_READ_SIGN, Sync_CRC_EOP };
-    m_conn->SendData(QByteArray::fromRawData(readSign, 2));
+    m_transport.send(readSign, 2);
+    m_transport.expectBytes(5, &reply);
 
-    if(!waitForAct(WAIT_DEVICE_ID, 200)) {
+    if(!m_transport.wait(0, 200) || reply.at(0) != STK_INSYNC || reply.at(4) != STK_OK) {
+        setStayInBootloaderTimer(true);
         throw tr("Failed to read device id (timeout)");
     }
 
     setStayInBootloaderTimer(true);
 
     QString sign("avr:");
-    sign.append(Utils::toBase16((quint8*)m_rec_buff.data()+1, (quint8*)m_rec_buff.data()+4));
+    sign.append(Utils::toBase16((quint8*)reply.data()+1, (quint8*)reply.data()+4));
     return sDefMgr.findChipdef(sign);
 }
 
@@ -154,22 +183,6 @@ QByteArray ArduinoProgrammer::readMemory(const QString& mem, chip_definition &ch
     setStayInBootloaderTimer(false);
     m_cancel_requested = false;
 
-    /*QByteArray cmd(4, '\0');
-    cmd[0] = STK_LOAD_ADDRESS;
-    cmd[1] = 0x00;
-    cmd[2] = 0x00;
-    cmd[3] = Sync_CRC_EOP;
-    m_conn->SendData(cmd);
-
-    if(!waitForAct(WAIT_SYNC, 100)) {
-        throw tr("The load address command has failed!");
-    }*/
-
-    QByteArray cmd_load_addr(4, '\0');
-    cmd_load_addr[0] = STK_LOAD_ADDRESS;
-    // addr
-    cmd_load_addr[3] = Sync_CRC_EOP;
-
     const quint32 pagesize = READ_PAGE_SIZE;
 
     QByteArray cmd(5, '\0');
@@ -181,35 +194,29 @@ QByteArray ArduinoProgrammer::readMemory(const QString& mem, chip_definition &ch
 
     auto memdef = chip.getMemDef(mem);
 
-    m_cur_page_size = pagesize;
-
     QByteArray res;
+    QByteArray reply;
     for(quint32 read = 0; !m_cancel_requested && read < memdef->size; ) {
         // Bootloader should have autoincrement. It's lying.
-        cmd_load_addr[1] = ((read/2) & 0xFF);
-        cmd_load_addr[2] = (((read/2) >> 8) & 0xFF);
-        m_conn->SendData(cmd_load_addr);
-
-        if(!waitForAct(WAIT_SYNC, 1000)) {
-            throw tr("The load address command has failed!");
-        }
+        queueLoadAddress(read);
 
         read += pagesize;
 
-        m_rec_buff.clear();
-        m_conn->SendData(cmd);
-        if(!waitForAct(WAIT_PAGE_READ, 1000)) {
+        reply.clear();
+        m_transport.send(cmd);
+        m_transport.expectBytes(pagesize + 2, &reply);
+        if(!m_transport.wait(0, 1000)) {
             emit updateProgressDialog(-1);
             setStayInBootloaderTimer(true);
             throw tr("Timeout while reading memory!");
         }
 
-        if(m_rec_buff.at(0) != STK_INSYNC || m_rec_buff.at(1+pagesize) != STK_OK) {
+        if(reply.at(0) != STK_INSYNC || reply.at(1+pagesize) != STK_OK) {
             emit updateProgressDialog(-1);
             setStayInBootloaderTimer(true);
             throw tr("Invalid response while reading memory!");
         }
-        res.append(m_rec_buff.data() + 1, pagesize);
+        res.append(reply.data() + 1, pagesize);
 
         emit updateProgressDialog((read*100)/memdef->size);
     }
@@ -241,11 +248,6 @@ void ArduinoProgrammer::flashRaw(HexFile& file, quint8 memId, chip_definition& c
 
     m_cancel_requested = false;
 
-    QByteArray cmd_load_address(4, '\0');
-    cmd_load_address[0] = STK_LOAD_ADDRESS;
-    // addr
-    cmd_load_address[3] = Sync_CRC_EOP;
-
     const quint16 pagesize = memdef->pagesize;
     QByteArray cmd_program_page(1 + 2 + 1 + pagesize + 1, '\0');
     cmd_program_page[0] = STK_PROGRAM_PAGE;
@@ -266,19 +268,16 @@ void ArduinoProgrammer::flashRaw(HexFile& file, quint8 memId, chip_definition& c
 
         const page &p = pages[i];
 
-        // divide by 2 for some reason, not important enough
-        // to be mentioned in the docs
-        cmd_load_address[1] = ((p.address/2) & 0xFF);
-        cmd_load_address[2] = ((p.address/2) >> 8) & 0xFF;
-
-        m_conn->SendData(cmd_load_address);
-        if(!waitForAct(WAIT_SYNC, 2000))
-            throw tr("Failed to write page (timeout during address set)");
+        queueLoadAddress(p.address);
 
         memcpy(cmd_program_page.data() + 4, p.data.data(), p.data.size());
-        m_conn->SendData(cmd_program_page);
-        if(!waitForAct(WAIT_SYNC, 2000))
-            throw tr("Failed to write page (timeout during address set)");
+        m_transport.send(cmd_program_page);
+        expectSync();
+
+        // The bootloader can't receive while it is writing the page,
+        // so wait for both acks before sending the next one.
+        if(!m_transport.wait(0, 2000))
+            throw tr("Failed to write page (timeout)");
 
         if(m_cancel_requested)
         {
@@ -344,46 +343,37 @@ void ArduinoProgrammer::flashRaw(HexFile& file, quint8 memId, chip_definition& c
 }
 
 QByteArray ArduinoProgrammer::readPage(quint16 address, quint16 pagesize, quint8 memId) {
-    QByteArray cmd(4, '\0');
-    cmd[0] = STK_LOAD_ADDRESS;
-    cmd[1] = (address/2) & 0xFF;
-    cmd[2] = ((address/2) >> 8) & 0xFF;
-    cmd[3] = Sync_CRC_EOP;
-    m_conn->SendData(cmd);
-
-    if(!waitForAct(WAIT_SYNC, 1000)) {
-        throw tr("The load address command has failed!");
-    }
+    queueLoadAddress(address);
 
-    cmd.resize(5);
+    QByteArray cmd(5, '\0');
     cmd[0] = STK_READ_PAGE;
     cmd[1] = (pagesize >> 8) & 0xFF;
     cmd[2] = (pagesize & 0xFF);
     cmd[3] = memId == MEM_FLASH ? 'F' : 'E';
     cmd[4] = Sync_CRC_EOP;
 
-    m_rec_buff.clear();
-    m_cur_page_size = pagesize;
-
-    m_conn->SendData(cmd);
-    if(!waitForAct(WAIT_PAGE_READ, 1000)) {
+    QByteArray reply;
+    m_transport.send(cmd);
+    m_transport.expectBytes(pagesize + 2, &reply);
+    if(!m_transport.wait(0, 1000)) {
         throw tr("Timeout while reading memory!");
     }
 
-    if(m_rec_buff.at(0) != STK_INSYNC || m_rec_buff.at(1+pagesize) != STK_OK) {
+    if(reply.at(0) != STK_INSYNC || reply.at(1+pagesize) != STK_OK) {
         throw tr("Invalid response while reading memory!");
     }
 
-    return QByteArray(m_rec_buff.data() + 1, pagesize);
+    return QByteArray(reply.data() + 1, pagesize);
 }
 
 void ArduinoProgrammer::erase_device(chip_definition& chip) {
     throw tr("Arduino bootloader does not support chip erase.");
     // Arduino ignores this.
     /*static const char eraseCmd[] = { STK_CHIP_ERASE, Sync_CRC_EOP };
-    m_conn->SendData(QByteArray::fromRawData(eraseCmd, 2));
+    m_transport.send(eraseCmd, 2);
+    expectSync();
 
-    if(!waitForAct(WAIT_SYNC, 1000)) {
+    if(!m_transport.wait(0, 1000)) {
         throw tr("Timeout during chip erase");
     }*/
 }
@@ -404,63 +394,12 @@ void ArduinoProgrammer::cancelRequested() {
     m_cancel_requested = true;
 }
 
-bool ArduinoProgrammer::waitForAct(int waitAct, int timeout)
-{
-    if(m_wait_act != WAIT_NONE)
-    {
-        Q_ASSERT(false);
-        return false;
-    }
-
-    m_wait_act = waitAct;
-
-    QEventLoop ev;
-    QTimer t;
-
-    connect(&t,   SIGNAL(timeout()), &ev, SLOT(quit()));
-    connect(this, SIGNAL(waitActDone()),  &ev, SLOT(quit()));
-
-    t.setSingleShot(true);
-    t.start(timeout);
-
-    ev.exec();
-
-    m_wait_act = WAIT_NONE;
-
-    return t.isActive();
-}
-
-void ArduinoProgrammer::dataRead(const QByteArray &data) {
-    //qWarning() << Utils::toBase16((quint8*)data.data(), (quint8*)data.data() +data.size());
-    switch(m_wait_act) {
-        case WAIT_SYNC: {
-            const int idx = data.indexOf(STK_INSYNC);
-            if(idx != -1 && idx+1 < data.size() && data[idx+1] == STK_OK)
-                emit waitActDone();
-            return;
-        }
-        case WAIT_DEVICE_ID: {
-            m_rec_buff.append(data.data(), std::min(data.size(), 5-m_rec_buff.size()));
-            if(m_rec_buff.size() == 5 && m_rec_buff.at(0) == STK_INSYNC && m_rec_buff.at(4) == STK_OK) {
-                emit waitActDone();
-            }
-            return;
-        }
-        case WAIT_PAGE_READ: {
-            m_rec_buff.append(data);
-            if(m_rec_buff.size() >= m_cur_page_size + 2) {
-                m_rec_buff.resize(m_cur_page_size + 2);
-                emit waitActDone();
-            }
-            return;
-        }
-    }
-
+void ArduinoProgrammer::unexpectedData(const QByteArray &data) {
     if(!m_ignore_incoming)
         emit tunnelData(data);
 }
 
 void ArduinoProgrammer::sendTunnelData(QString const & data)
 {
-    m_conn->SendData(data.toUtf8());
+    m_transport.send(data.toUtf8());
 }
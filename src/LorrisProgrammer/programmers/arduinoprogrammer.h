@@ -5,15 +5,13 @@
 
 #include "../../shared/programmer.h"
 #include "../../connection/serialport.h"
+#include "bootloadertransport.h"
 
 class ArduinoProgrammer : public Programmer {
     Q_OBJECT
 
-Q_SIGNALS:
-    void waitActDone();
-
 public:
-    ArduinoProgrammer(ConnectionPointer<SerialPort> const & conn, ProgrammerLogSink * logsink);
+    ArduinoProgrammer(ConnectionPointer<PortConnection> const & conn, ProgrammerLogSink * logsink);
     ~ArduinoProgrammer();
 
     virtual void stopAll(bool wait);
@@ -39,31 +37,22 @@ public slots:
     void sendTunnelData(QString const & data);
 
 private slots:
-    void dataRead(const QByteArray& data);
+    void unexpectedData(const QByteArray& data);
     void stayInBootloader();
 
 private:
-    bool waitForAct(int waitAct, int timeout);
+    void resetBoard();
+    void queueLoadAddress(quint32 address);
+    void expectSync();
     void setStayInBootloaderTimer(bool run);
     QByteArray readPage(quint16 address, quint16 pagesize, quint8 memId);
 
-    ConnectionPointer<SerialPort> m_conn;
+    ConnectionPointer<PortConnection> m_conn;
+    BootloaderTransport m_transport;
     bool m_flash_mode;
     bool m_ignore_incoming;
     bool m_cancel_requested;
 
-    enum {
-        WAIT_NONE,
-
-        WAIT_RTS_DTR,
-        WAIT_SYNC,
-        WAIT_DEVICE_ID,
-        WAIT_PAGE_READ,
-    };
-
-    int m_wait_act;
-    int m_cur_page_size;
-    QByteArray m_rec_buff;
     QTimer m_stay_in_bl_timer;
 };
 
@@ -1,6 +1,7 @@
 #include "atsamprogrammer.h"
 #include "../../shared/defmgr.h"
 #include "../../shared/hexfile.h"
+#include "zmodemprogrammer-defines.h"
 #include <QEventLoop>
 #include <QTimer>
 #include <QTime>
@@ -9,9 +10,25 @@
 #include <stdexcept>
 #include <fstream>
 #include <string>
+#include <algorithm>
+
+// XMODEM control characters
+#define XM_SOH 0x01
+#define XM_STX 0x02
+#define XM_EOT 0x04
+#define XM_ACK 0x06
+#define XM_NAK 0x15
+#define XM_CAN 0x18
+
+// Largest block read with a single SAM-BA R command
+static const uint32_t read_chunk_size = 16*1024;
+
+// Upper bound on the number of pages uploaded to SRAM at once for the applet
+static const uint32_t applet_max_batch = 16;
 
 AtsamProgrammer::AtsamProgrammer(ConnectionPointer<PortConnection> const & conn, ProgrammerLogSink * logsink)
-    : Programmer(logsink), m_cancelled(false), m_flash_mode(false), m_tunnel_enabled(false), m_applet_address(0), m_chipdef(nullptr), m_conn(conn)
+    : Programmer(logsink), m_cancelled(false), m_flash_mode(false), m_tunnel_enabled(false), m_applet_address(0), m_applet_params(0), m_applet_buffer(0), m_applet_buffer_pages(0),
+      m_xmodem_1k(true), m_xmodem_rx(false), m_xmodem_failed(false), m_xmodem_block(0), m_chipdef(nullptr), m_conn(conn)
 {
     connect(m_conn.data(), SIGNAL(dataRead(QByteArray)), this, SLOT(dataRead(QByteArray)));
 }
@@ -60,9 +77,27 @@ void AtsamProgrammer::switchToFlashMode(quint32 /*prog_speed_hz*/)
             if(loader.length() % 128)
                 loader += QByteArray(128 - (loader.length() % 128), 0);
 
-            uint32_t loader_address = m_chipdef->getMems()["sram"].start_addr + 2048 + 32 + m_chipdef->getMems()["flash"].pagesize;
+            chip_definition::memorydef const & sram = m_chipdef->getMems()["sram"];
+            uint32_t pagesize = m_chipdef->getMems()["flash"].pagesize;
+
+            // The applet has its parameter block hardwired at sram + 2048,
+            // followed by a single page buffer and the applet itself.
+            m_applet_params = sram.start_addr + 2048;
+            uint32_t loader_address = m_applet_params + 32 + pagesize;
             this->write_file(loader_address, loader);
             m_applet_address = loader_address;
+
+            // Pages are uploaded in batches right behind the applet, the upper
+            // half of SRAM is left for SAM-BA's stack.
+            m_applet_buffer = loader_address + loader.size();
+            uint32_t used = m_applet_buffer - sram.start_addr;
+            uint32_t avail = sram.size / 2 > used ? sram.size / 2 - used : 0;
+            m_applet_buffer_pages = pagesize != 0 ? std::min(applet_max_batch, avail / pagesize) : 0;
+            if(m_applet_buffer_pages == 0)
+            {
+                m_applet_buffer = loader_address - pagesize;
+                m_applet_buffer_pages = 1;
+            }
         }
     }
 }
@@ -82,7 +117,7 @@ void AtsamProgrammer::switchToRunMode()
     }
     else
     {
-        this->write_word(m_applet_address - m_chipdef->getMems()["flash"].pagesize - 12, 2); // reboot to flash cmd
+        this->write_word(m_applet_params + 0x14, 2); // reboot to flash cmd
         QString cmd = QString("G%1#").arg(m_applet_address, 0, 16);
         m_conn->SendData(cmd.toLatin1());
         this->debug_output("<-", cmd);
@@ -157,7 +192,7 @@ chip_definition AtsamProgrammer::readDeviceId()
     return cd;
 }
 
-QByteArray AtsamProgrammer::readMemory(const QString& mem, chip_definition &chip) // FIX ME: should use xmodem protocol
+QByteArray AtsamProgrammer::readMemory(const QString& mem, chip_definition &chip)
 {
     QByteArray res;
 
@@ -168,11 +203,10 @@ QByteArray AtsamProgrammer::readMemory(const QString& mem, chip_definition &chip
         return res;
 
     uint32_t size = md->size;
-    for (uint32_t addr = 0; !m_cancelled && addr < size; addr += 4)
+    for (uint32_t addr = 0; !m_cancelled && addr < size; addr += read_chunk_size)
     {
-        uint32_t value = this->read_word(md->start_addr + addr);
-        res.append((char const *)&value, 4);
-        emit updateProgressDialog((addr*100)/md->size);
+        emit updateProgressDialog((quint64(addr)*100)/size);
+        res.append(this->read_file(md->start_addr + addr, std::min(read_chunk_size, size - addr)));
     }
     emit updateProgressDialog(-1);
 
@@ -221,49 +255,70 @@ void AtsamProgrammer::flashRaw(HexFile& file, quint8 memId, chip_definition& chi
     file.makePages(pages, memId, chip, &skip);
 
     int max = pages.size()-skip.size();
+    int done = 0;
 
-    uint32_t source_address = 0;
     if(m_applet_address != 0)
     {
-        source_address = m_applet_address - chip.getMems()["flash"].pagesize;
-        this->write_word(source_address - 32, source_address); // source address
-        this->write_word(source_address - 28, md->start_addr); // destination address
-        this->write_word(source_address - 24, 0); // start page
-        this->write_word(source_address - 20, 1); // pages count
-        this->write_word(source_address - 16, md->pagesize); // page size
-        this->write_word(source_address - 12, 1); // write cmd
+        this->write_word(m_applet_params + 0x0C, 1); // pages count
+        this->write_word(m_applet_params + 0x10, md->pagesize); // page size
+        this->write_word(m_applet_params + 0x14, 1); // write cmd
     }
 
     m_cancelled = false;
-    for (uint32_t addr = 0; !m_cancelled && addr < pages.size(); ++addr)
+    for (size_t i = 0; !m_cancelled && i < pages.size(); )
     {
-
-        if(skip.find(addr) != skip.end())
+        if(skip.find(i) != skip.end())
+        {
+            ++i;
             continue;
+        }
 
         if(m_applet_address != 0)
         {
-            this->write_file(m_applet_address - md->pagesize, QByteArray((char *)(&pages[addr].data[0]), pages[addr].data.size()));
-            this->transact(QString("G%1#").arg(m_applet_address, 0, 16));
+            // Upload a run of consecutive pages with a single XMODEM-1K transfer
+            size_t first = i;
+            QByteArray batch;
+            do
+            {
+                batch.append((char const *)pages[i].data.data(), pages[i].data.size());
+                ++i;
+            }
+            while(i < pages.size() && i - first < m_applet_buffer_pages && skip.find(i) == skip.end()
+                  && pages[i].address == pages[i-1].address + md->pagesize);
+
+            this->write_file(m_applet_buffer, batch);
+
+            // The applet advances destination and start page on its own,
+            // only the source pointer has to move between runs.
+            this->write_word(m_applet_params + 0x04, md->start_addr + pages[first].address); // destination address
+            this->write_word(m_applet_params + 0x08, pages[first].address / md->pagesize); // start page
+            for(size_t p = 0; !m_cancelled && p != i - first; ++p)
+            {
+                this->write_word(m_applet_params + 0x00, m_applet_buffer + p * md->pagesize); // source address
+                this->transact(QString("G%1#").arg(m_applet_address, 0, 16));
+                emit updateProgressDialog((++done*100)/max);
+            }
         }
         else
         {
+            uint32_t page_addr = md->start_addr + pages[i].address;
             this->wait_eefc_ready();
 
             for (size_t page_offset = 0; page_offset < md->pagesize; page_offset += 4)
             {
                 uint32_t value
-                    = (pages[addr].data[page_offset+0])
-                    | (pages[addr].data[page_offset+1] << 8)
-                    | (pages[addr].data[page_offset+2] << 16)
-                    | (pages[addr].data[page_offset+3] << 24);
-                this->write_word(md->start_addr + addr * md->pagesize + page_offset, value);
+                    = (pages[i].data[page_offset+0])
+                    | (pages[i].data[page_offset+1] << 8)
+                    | (pages[i].data[page_offset+2] << 16)
+                    | (pages[i].data[page_offset+3] << 24);
+                this->write_word(page_addr + page_offset, value);
             }
             this->wait_eefc_ready();
-            this->write_word(0x400E0804, 0x5A000003/*EWP*/ | (addr << 8));
-        }
+            this->write_word(0x400E0804, 0x5A000003/*EWP*/ | ((pages[i].address / md->pagesize) << 8));
 
-        emit updateProgressDialog((addr*100)/max);
+            ++i;
+            emit updateProgressDialog((++done*100)/max);
+        }
     }
 
     emit updateProgressDialog(-1);
@@ -271,34 +326,33 @@ void AtsamProgrammer::flashRaw(HexFile& file, quint8 memId, chip_definition& chi
 
 quint16 AtsamProgrammer::crc16(QByteArray const & data, quint32 crc = 0)
 {
-    crc &= 0xFFFF;
-    for(size_t i = 0; i != data.size(); ++i)
-    {
-        crc ^= (data.at(i) << 8);
-        for(int j = 0; j != 8; ++j)
-        {
-            crc <<= 1;
-            if(crc & 0x10000)
-                crc ^= 0x11021;
-        }
-    }
-    return quint16(crc);
+    quint16 res = crc;
+    for(int i = 0; i != data.size(); ++i)
+        res = ucrc16(data[i], res);
+    return res;
 }
 
 void AtsamProgrammer::write_file(const uint32_t& address, QByteArray const & data)
 {
+    QByteArray padded = data;
+    if(padded.size() % 128)
+        padded.append(QByteArray(128 - (padded.size() % 128), 0));
+
     int attempts = 0;
+    quint8 num = 1;
     this->transact(QString("S%1,#").arg(address, 0, 16), "C");
-    for(size_t i = 0; i != data.size() / 128 + 1; ++i)
+    for(int offset = 0; offset <= padded.size(); )
     {
+        // XMODEM-1K: full 1024 byte blocks while they fit, 128 byte blocks for the tail
+        int len = 0;
         QByteArray packet;
-        if(i != data.size() / 128)
+        if(offset != padded.size())
         {
-            packet.append('\x01'); // SOH
-            char num = (i + 1) & 0xFF;
-            packet.append(num);
-            packet.append(~num);
-            QByteArray payload = data.mid(128 * i, 128);
+            len = (m_xmodem_1k && padded.size() - offset >= 1024) ? 1024 : 128;
+            packet.append(char(len == 1024 ? XM_STX : XM_SOH));
+            packet.append(char(num));
+            packet.append(char(~num));
+            QByteArray payload = padded.mid(offset, len);
             quint16 crc = this->crc16(payload);
             packet.append(payload);
             packet.append(char(crc>>8));
@@ -306,35 +360,180 @@ void AtsamProgrammer::write_file(const uint32_t& address, QByteArray const & dat
         }
         else
         {
-            packet.append('\x04'); // EOT
+            packet.append(char(XM_EOT));
+        }
+
+        QString res;
+        try
+        {
+            res = this->transact(packet, "\x06\x15>", true);
+        }
+        catch(QString const &)
+        {
+            // SAM-BA versions without XMODEM-1K support stay silent on STX blocks
+            if(len != 1024)
+                throw;
+            res = QString(QChar(XM_NAK));
         }
-        QString res = this->transact(packet, "\x06\x15>", true);
+
         if(res.size() == 0)
             res = "\x00";
         switch(res.at(0).toLatin1())
         {
-        case '\x06': // ACK
-            attempts = 0;
+        case XM_ACK:
             this->debug_output(">>", "ACK");
+            attempts = 0;
+            ++num;
+            if(len == 0)
+                offset = padded.size() + 1;
+            else
+                offset += len;
             break;
-        case '\x15': // NACK
+        case XM_NAK:
             this->debug_output(">>", "NACK");
-            if(++attempts == 3)
+            if(len == 1024)
+            {
+                this->debug_output("!!", "falling back to 128 byte XMODEM blocks");
+                m_xmodem_1k = false;
+            }
+            else if(++attempts == 3)
                 throw tr("Unable to send packet");
-            else
-                --i;
-            continue;
+            break;
         case '>':
             this->debug_output(">>", ">");
             throw tr("SAM-BA timeout");
-            break;
         default:
             this->debug_output(">>", res.toLatin1().toHex());
-            break;
+            throw tr("Failed to get proper response from SAM-BA (write_file)");
+        }
+    }
+    this->wait_prompt();
+}
+
+QByteArray AtsamProgrammer::read_file(uint32_t address, uint32_t size)
+{
+    m_xmodem_buffer.clear();
+    m_xmodem_data.clear();
+    m_xmodem_block = 1;
+    m_xmodem_failed = false;
+    m_xmodem_rx = true;
+    m_recvBuffer1.clear();
+
+    QString cmd = QString("R%1,%2#").arg(address, 0, 16).arg(size, 0, 16);
+    this->debug_output("<-", cmd);
+    m_conn->SendData(cmd.toLatin1());
+    m_conn->SendData(QByteArray(1, 'C'));
+
+    // xmodem_receive quits the loop after every block, so the timeout
+    // only has to cover a single block.
+    int retries = 0;
+    while(m_xmodem_rx)
+    {
+        int received = m_xmodem_data.size();
+
+        QTimer t;
+        connect(&t, SIGNAL(timeout()), &m_waitLoop, SLOT(quit()));
+        t.setSingleShot(true);
+        t.start(1000);
+        m_waitLoop.exec();
+
+        if(!m_xmodem_rx || t.isActive() || m_xmodem_data.size() != received)
+            continue;
+
+        if(received == 0 && ++retries < 3)
+        {
+            m_conn->SendData(QByteArray(1, 'C'));
+            continue;
         }
+
+        m_xmodem_rx = false;
+        throw tr("SAM-BA timeout");
     }
-    while(!(m_recvBuffer.contains('>') || m_recvBuffer1.contains('>')))
+
+    if(m_xmodem_failed)
+        throw tr("Failed to get proper response from SAM-BA (read_file)");
+
+    this->wait_prompt();
+
+    if((uint32_t)m_xmodem_data.size() < size)
+        throw tr("SAM-BA sent less data than requested");
+    m_xmodem_data.truncate(size);
+    return m_xmodem_data;
+}
+
+void AtsamProgrammer::xmodem_receive(QByteArray const & data)
+{
+    m_xmodem_buffer.append(data);
+    while(m_xmodem_rx && !m_xmodem_buffer.isEmpty())
+    {
+        quint8 type = m_xmodem_buffer[0];
+        if(type == XM_EOT)
+        {
+            m_conn->SendData(QByteArray(1, char(XM_ACK)));
+            m_xmodem_rx = false;
+            m_recvBuffer = m_xmodem_buffer.mid(1);
+            m_xmodem_buffer.clear();
+            m_waitLoop.quit();
+            return;
+        }
+
+        if(type == XM_CAN)
+        {
+            m_xmodem_rx = false;
+            m_xmodem_failed = true;
+            m_waitLoop.quit();
+            return;
+        }
+
+        int len = type == XM_STX ? 1024 : (type == XM_SOH ? 128 : 0);
+        if(len == 0)
+        {
+            m_xmodem_buffer.remove(0, 1);
+            continue;
+        }
+
+        if(m_xmodem_buffer.size() < len + 5)
+            return;
+
+        quint8 num = m_xmodem_buffer[1];
+        quint8 inv = m_xmodem_buffer[2];
+        QByteArray payload = m_xmodem_buffer.mid(3, len);
+        quint16 crc = (quint8(m_xmodem_buffer[3 + len]) << 8) | quint8(m_xmodem_buffer[4 + len]);
+        m_xmodem_buffer.remove(0, len + 5);
+
+        if(quint8(num ^ inv) != 0xFF || this->crc16(payload) != crc)
+        {
+            m_xmodem_buffer.clear();
+            m_conn->SendData(QByteArray(1, char(XM_NAK)));
+            continue;
+        }
+
+        if(num == m_xmodem_block)
+        {
+            m_xmodem_data.append(payload);
+            ++m_xmodem_block;
+        }
+        else if(num != quint8(m_xmodem_block - 1))
+        {
+            // out of sequence, the transfer can't be recovered
+            m_conn->SendData(QByteArray(8, char(XM_CAN)));
+            m_xmodem_rx = false;
+            m_xmodem_failed = true;
+            m_waitLoop.quit();
+            return;
+        }
+
+        // duplicates of the previous block are acknowledged and dropped
+        m_conn->SendData(QByteArray(1, char(XM_ACK)));
+        m_waitLoop.quit();
+    }
+}
+
+void AtsamProgrammer::wait_prompt()
+{
+    for(int i = 0; i != 2 && !(m_recvBuffer.contains('>') || m_recvBuffer1.contains('>')); ++i)
     {
+        m_recvDelimiter = ">";
         QTimer t;
         connect(&t, SIGNAL(timeout()), &m_waitLoop, SLOT(quit()));
         t.setSingleShot(true);
@@ -342,7 +541,7 @@ void AtsamProgrammer::write_file(const uint32_t& address, QByteArray const & dat
         m_waitLoop.exec();
     }
     if(!(m_recvBuffer.contains('>') || m_recvBuffer1.contains('>')))
-        throw tr("Failed to get proper response from SAM-BA (write_file)"); // XXX: should throw something derived from std::exception
+        throw tr("Failed to get proper response from SAM-BA (prompt)"); // XXX: should throw something derived from std::exception
 }
 
 void AtsamProgrammer::erase_device(chip_definition& chip)
@@ -421,6 +620,8 @@ void AtsamProgrammer::dataRead(const QByteArray & data)
 {
     if(m_tunnel_enabled)
         emit tunnelData(data);
+    else if(m_xmodem_rx)
+        this->xmodem_receive(data);
     else
     {
         this->debug_output("!>", data.toHex());
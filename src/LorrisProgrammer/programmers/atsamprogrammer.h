@@ -46,6 +46,9 @@ private:
 
     quint16 crc16(const QByteArray & data, quint32 crc);
     void write_file(const uint32_t& address, const QByteArray & data);
+    QByteArray read_file(uint32_t address, uint32_t size);
+    void xmodem_receive(const QByteArray & data);
+    void wait_prompt();
 
     uint32_t read_word(uint32_t address);
     void write_word(uint32_t address, uint32_t data);
@@ -62,6 +65,16 @@ private:
     bool m_flash_mode;
     bool m_tunnel_enabled;
     uint32_t m_applet_address;
+    uint32_t m_applet_params;
+    uint32_t m_applet_buffer;
+    uint32_t m_applet_buffer_pages;
+
+    bool m_xmodem_1k;
+    bool m_xmodem_rx;
+    bool m_xmodem_failed;
+    quint8 m_xmodem_block;
+    QByteArray m_xmodem_buffer;
+    QByteArray m_xmodem_data;
     chip_definition* m_chipdef;
 
     ConnectionPointer<PortConnection> m_conn;
@@ -5,9 +5,6 @@
 **    See README and COPYING
 ***********************************************/
 
-#include <QTimer>
-#include <QEventLoop>
-
 #include "avr109programmer.h"
 #include "../../shared/defmgr.h"
 #include "../../misc/config.h"
@@ -33,15 +30,23 @@ static const char ERASE_CHIP = 'e';
 static const char WRITE_PAGE = 'm';
 static const char FLASH_BLOCK = 'B';
 
+// Replies that may be outstanding at once. Byte reads are limited by
+// the bootloader's UART FIFO, it can't receive while it is sending.
+static const size_t READ_WINDOW = 2;
+static const size_t WRITE_WINDOW = 16;
+
 avr109Programmer::avr109Programmer(const ConnectionPointer<PortConnection> &conn, ProgrammerLogSink *logsink) :
-    Programmer(logsink)
+    Programmer(logsink), m_transport(conn)
 {
     m_conn = conn;
     m_bootseq = sConfig.get(CFG_STRING_AVR109_BOOTSEQ);
-    m_wait_act = WAIT_NONE;
+    m_caps_valid = false;
+    m_block_size = 0;
+    m_autoincrement = false;
     m_flash_mode = false;
+    m_cancel_requested = false;
 
-    connect(m_conn.data(), SIGNAL(dataRead(QByteArray)), this, SLOT(dataRead(QByteArray)));
+    connect(&m_transport, SIGNAL(unexpectedData(QByteArray)), this, SIGNAL(tunnelData(QByteArray)));
 }
 
 int avr109Programmer::getType()
@@ -70,21 +75,22 @@ void avr109Programmer::switchToFlashMode(quint32 /*prog_speed_hz*/)
     if(bootseq.isEmpty())
         throw tr("Empty bootloader sequence!");
 
-    m_conn->SendData(bootseq);
+    m_transport.send(bootseq);
+    m_transport.sleep(100, true);
 
-    waitForAct(WAIT_EMPTY, 100);
+    m_transport.send(&SUPPORTED_DEVS, 1);
+    m_transport.expectMarker(QByteArray(1, 0));
 
-    m_conn->SendData(QByteArray::fromRawData(&SUPPORTED_DEVS, 1));
-
-    if(!waitForAct(WAIT_SUPPORTED))
+    if(!m_transport.wait())
         throw tr("Failed to switch to flash mode (timeout).");
 
+    m_caps_valid = false;
     m_flash_mode = true;
 }
 
 void avr109Programmer::switchToRunMode()
 {
-    m_conn->SendData(QByteArray::fromRawData(&BOOTLOADER_EXIT, 1));
+    m_transport.send(&BOOTLOADER_EXIT, 1);
     m_flash_mode = false;
 }
 
@@ -95,20 +101,19 @@ bool avr109Programmer::isInFlashMode()
 
 chip_definition avr109Programmer::readDeviceId()
 {
-    m_rec_buff.clear();
-    m_conn->SendData(QByteArray::fromRawData(&ID_REQ, 1));
-
-    waitForAct(WAIT_CHAR3);
+    QByteArray sign;
+    m_transport.send(&ID_REQ, 1);
+    m_transport.expectBytes(3, &sign);
 
-    if(m_rec_buff.size() != 3)
+    if(!m_transport.wait())
         throw tr("Failed to read device id (timeout)");
 
     QString id = "avr:";
-    for(int i = m_rec_buff.size(); i > 0; )
+    for(int i = sign.size(); i > 0; )
     {
         static const char* hex = "0123456789abcdef";
 
-        quint8 c = m_rec_buff[--i];
+        quint8 c = sign[--i];
         id.append(hex[c >> 4]);
         id.append(hex[c & 0x0F]);
     }
@@ -121,6 +126,8 @@ QByteArray avr109Programmer::readMemory(const QString& mem, chip_definition &chi
     if(mem != "flash" && mem != "eeprom")
         throw tr("Unsupported memory type: %1").arg(mem);
 
+    m_cancel_requested = false;
+
     quint32 size = chip.getMemDef(mem)->size;
     quint8 id = chip_definition::memNameToId(mem);
     return readMem(id, 0, size);
@@ -143,32 +150,31 @@ void avr109Programmer::flashRaw(HexFile& file, quint8 memId, chip_definition& ch
     if(memId != MEM_FLASH && memId != MEM_EEPROM)
         throw tr("Unsupported memory type: %1").arg(memId);
 
-    int block_size = 0;
-
-    bool has_block = checkBlockSupport(block_size);
-    bool autoincrement = checkAutoIncrement();
+    checkCapabilities();
 
     std::vector<page> pages;
     std::set<quint32> skip;
 
     file.makePages(pages, memId, chip, &skip);
 
+    m_cancel_requested = false;
+
     switch(memId)
     {
         case MEM_FLASH:
             // avr109 needs to erase chip before flashing!
             erase_device(chip);
 
-            if(has_block)
-                writeFlashMemBlock(pages, skip);
+            if(m_block_size)
+                writeMemBlock(BLOCK_FLASH, pages, skip);
             else
-                writeFlashMem(pages, skip, autoincrement);
+                writeFlashMem(pages, skip);
             break;
         case MEM_EEPROM:
-            if(has_block)
-                writeEEPROMBlock(pages);
+            if(m_block_size)
+                writeMemBlock(BLOCK_EEPROM, pages, std::set<quint32>());
             else
-                writeEEPROM(pages, autoincrement);
+                writeEEPROM(pages);
             break;
     }
 
@@ -182,24 +188,41 @@ void avr109Programmer::flashRaw(HexFile& file, quint8 memId, chip_definition& ch
 
     quint32 verCnt = pages.size() - skip.size();
 
+    // Read runs of adjacent pages at once, so that the whole
+    // bootloader block size is used.
     QByteArray block;
-    for(size_t i = 0; i < pages.size() && !m_cancel_requested; ++i)
+    for(size_t i = 0; i < pages.size() && !m_cancel_requested; )
     {
         if(skip.find(i) != skip.end())
+        {
+            ++i;
             continue;
+        }
 
-        const page& p = pages[i];
+        size_t last = i;
+        quint32 size = pages[i].data.size();
+        while(last + 1 < pages.size() && skip.find(last + 1) == skip.end() &&
+              pages[last + 1].address == pages[last].address + pages[last].data.size())
+        {
+            ++last;
+            size += pages[last].data.size();
+        }
 
         block.clear();
 
         try {
-            block = readMem(memId, p.address, p.data.size());
+            block = readMem(memId, pages[i].address, size);
         } catch(QString) {}
 
-        if ((size_t)block.size() != p.data.size() ||
-            !std::equal(p.data.data(), p.data.data()+p.data.size(), (quint8*)block.data()))
-        {
+        if((quint32)block.size() != size)
             throw tr("Verification failed!");
+
+        for(const quint8 *data = (const quint8*)block.constData(); i <= last; ++i)
+        {
+            const page& p = pages[i];
+            if(!std::equal(p.data.data(), p.data.data()+p.data.size(), data))
+                throw tr("Verification failed!");
+            data += p.data.size();
         }
 
         emit updateProgressDialog((i*100)/verCnt);
@@ -208,9 +231,9 @@ void avr109Programmer::flashRaw(HexFile& file, quint8 memId, chip_definition& ch
 
 void avr109Programmer::erase_device(chip_definition& /*chip*/)
 {
-    m_conn->SendData(QByteArray::fromRawData(&ERASE_CHIP, 1));
-    waitForAct(WAIT_CHAR1);
-    if(m_rec_buff.size() != 1 || m_rec_buff[0] != '\r')
+    m_transport.send(&ERASE_CHIP, 1);
+    m_transport.expectReply("\r");
+    if(!m_transport.wait())
         throw tr("Failed to erase chip!");
 }
 
@@ -219,30 +242,31 @@ void avr109Programmer::cancelRequested()
     m_cancel_requested = true;
 }
 
-bool avr109Programmer::checkBlockSupport(int& block_size)
+void avr109Programmer::checkCapabilities()
 {
-    m_conn->SendData(QByteArray::fromRawData(&HAS_BLOCK, 1));
-    waitForAct(WAIT_CHAR3);
-    if(m_rec_buff.size() != 3)
-        throw tr("Failed to check for block support");
+    if(m_caps_valid)
+        return;
 
-    block_size = quint8(m_rec_buff[1]) << 8;
-    block_size |= quint8(m_rec_buff[2]);
+    QByteArray autoinc, block;
 
-    return (m_rec_buff[0] == 'Y');
-}
+    m_transport.send(&HAS_AUTOINCREMENT, 1);
+    m_transport.expectBytes(1, &autoinc);
+    m_transport.send(&HAS_BLOCK, 1);
+    m_transport.expectBytes(3, &block);
 
-bool avr109Programmer::checkAutoIncrement()
-{
-    m_conn->SendData(QByteArray::fromRawData(&HAS_AUTOINCREMENT, 1));
-    waitForAct(WAIT_CHAR1);
-    if(m_rec_buff.size() != 1)
-        throw tr("Failed to check for autoincrement support");
+    if(!m_transport.wait())
+        throw tr("Failed to check for block and autoincrement support");
+
+    m_autoincrement = (autoinc[0] == 'Y');
 
-    return (m_rec_buff[0] == 'Y');
+    m_block_size = 0;
+    if(block[0] == 'Y')
+        m_block_size = (quint8(block[1]) << 8) | quint8(block[2]);
+
+    m_caps_valid = true;
 }
 
-void avr109Programmer::setAddress(quint32 address)
+void avr109Programmer::queueAddress(quint32 address)
 {
     QByteArray cmd;
     if(address < 0x10000)
@@ -259,179 +283,138 @@ void avr109Programmer::setAddress(quint32 address)
         cmd[3] = address & 0xFF;
     }
 
-    m_conn->SendData(cmd);
+    m_transport.send(cmd);
+    m_transport.expectReply("\r");
+}
 
-    waitForAct(WAIT_CHAR1);
-    if(m_rec_buff.size() != 1 || m_rec_buff[0] != '\r')
+void avr109Programmer::setAddress(quint32 address)
+{
+    queueAddress(address);
+    if(!m_transport.wait())
         throw tr("Could not set address!");
 }
 
 QByteArray avr109Programmer::readMem(quint8 id, quint32 start, quint32 size)
 {
-    int block_size = 0;
-    bool has_block = checkBlockSupport(block_size);
-    bool autoincrement = checkAutoIncrement();
+    checkCapabilities();
 
     switch(id)
     {
         case MEM_FLASH:
-            if(has_block)
-                return readFlashMemBlock(start, size, block_size);
+            if(m_block_size)
+                return readMemBlock(BLOCK_FLASH, start, size);
             else
-                return readFlashMem(start, size, autoincrement);
+                return readFlashMem(start, size);
         case MEM_EEPROM:
-            if(has_block)
-                return readEEPROMBlock(start, size, block_size);
+            if(m_block_size)
+                return readMemBlock(BLOCK_EEPROM, start, size);
             else
-                return readEEPROM(start, size, autoincrement);
+                return readEEPROM(start, size);
     }
     return QByteArray();
 }
 
-QByteArray avr109Programmer::readFlashMem(quint32 start, quint32 size, bool autoincrement)
+QByteArray avr109Programmer::readMemBlock(char memtype, quint32 start, quint32 size)
 {
-    Q_ASSERT((start % 2) == 0);
-
-    quint32 address = start;
-    if(autoincrement)
-        setAddress(address >> 1);
+    // flash is addressed by words
+    quint32 addr_shift = (memtype == BLOCK_FLASH) ? 1 : 0;
 
     QByteArray res;
     res.reserve(size);
 
-    QByteArray cmd = QByteArray::fromRawData(&READ_FLASH, 1);
-
-    m_cancel_requested = false;
-    while(address < size && !m_cancel_requested)
-    {
-        if(!autoincrement)
-            setAddress(address >> 1);
-
-        m_conn->SendData(cmd);
-        waitForAct(WAIT_CHAR2);
-        if(m_rec_buff.size() != 2)
-            throw tr("Failed to read memory page (timeout)");
-
-        res.append(m_rec_buff[2]); // high
-        res.append(m_rec_buff[1]); // low
-        address += 2;
-
-        emit updateProgressDialog((address*100)/size);
-    }
-
-    return res;
-}
-
-QByteArray avr109Programmer::readFlashMemBlock(quint32 start, quint32 size, int block_size)
-{
-    Q_ASSERT((start % block_size) == 0);
-
-    quint32 address = start;
-    setAddress(address >> 1);
-
-    QByteArray res;
-    res.reserve(size);
+    // Block reads auto-increment the address, it is set only once
+    // and sent together with the first block request.
+    queueAddress(start >> addr_shift);
 
     QByteArray cmd(4, 0);
     cmd[0] = READ_BLOCK;
-    cmd[3] = BLOCK_FLASH;
+    cmd[3] = memtype;
 
-    m_cancel_requested = false;
-    while(address < size && !m_cancel_requested)
+    for(quint32 done = 0; done < size && !m_cancel_requested; )
     {
-        setAddress(address >> 1);
-
-        m_block_size = std::min(block_size, int(size-address));
-        cmd[1] = (m_block_size >> 8) & 0xFF;
-        cmd[2] = m_block_size & 0xFF;
+        int len = std::min(quint32(m_block_size), size - done);
+        cmd[1] = (len >> 8) & 0xFF;
+        cmd[2] = len & 0xFF;
 
-        m_conn->SendData(cmd);
+        m_transport.send(cmd);
+        m_transport.expectBytes(len, &res);
 
-        waitForAct(WAIT_BLOCK);
-        if(m_rec_buff.size() != m_block_size)
+        if(!m_transport.wait())
             throw tr("Failed to read mem block (timeout)");
 
-        res.append(m_rec_buff);
-
-        address += m_block_size;
-
-        emit updateProgressDialog((address*100)/size);
+        done += len;
+        emit updateProgressDialog((done*100)/size);
     }
 
     return res;
 }
 
-QByteArray avr109Programmer::readEEPROM(quint32 start, quint32 size, bool autoincrement)
+QByteArray avr109Programmer::readFlashMem(quint32 start, quint32 size)
 {
     Q_ASSERT((start % 2) == 0);
 
-    quint32 address = start;
-    if(autoincrement)
-        setAddress(address);
-
-    QByteArray res;
-    res.reserve(size);
+    QByteArray words;
+    words.reserve(size);
 
-    QByteArray cmd = QByteArray::fromRawData(&READ_EEPROM, 1);
+    if(m_autoincrement)
+        queueAddress(start >> 1);
 
-    m_cancel_requested = false;
-    while(address < size && !m_cancel_requested)
+    for(quint32 address = start; address < start + size && !m_cancel_requested; address += 2)
     {
-        if(!autoincrement)
-            setAddress(address);
+        if(!m_autoincrement)
+            queueAddress(address >> 1);
+
+        m_transport.send(&READ_FLASH, 1);
+        m_transport.expectBytes(2, &words);
 
-        m_conn->SendData(cmd);
-        waitForAct(WAIT_CHAR1);
-        if(m_rec_buff.size() != 1)
+        if(!m_transport.wait(READ_WINDOW))
             throw tr("Failed to read memory page (timeout)");
 
-        res.append(m_rec_buff);
-        ++address;
+        emit updateProgressDialog(((address - start)*100)/size);
+    }
+
+    if(!m_transport.wait())
+        throw tr("Failed to read memory page (timeout)");
 
-        emit updateProgressDialog((address*100)/size);
+    // the bootloader sends high byte first
+    QByteArray res;
+    res.reserve(words.size());
+    for(int i = 0; i + 1 < words.size(); i += 2)
+    {
+        res.append(words[i+1]);
+        res.append(words[i]);
     }
     return res;
 }
 
-QByteArray avr109Programmer::readEEPROMBlock(quint32 start, quint32 size, int block_size)
+QByteArray avr109Programmer::readEEPROM(quint32 start, quint32 size)
 {
-    Q_ASSERT((start % block_size) == 0);
-
-    quint32 address = start;
-    setAddress(address);
-
     QByteArray res;
     res.reserve(size);
 
-    QByteArray cmd(4, 0);
-    cmd[0] = READ_BLOCK;
-    cmd[3] = BLOCK_EEPROM;
+    if(m_autoincrement)
+        queueAddress(start);
 
-    m_cancel_requested = false;
-    while(address < size && !m_cancel_requested)
+    for(quint32 address = start; address < start + size && !m_cancel_requested; ++address)
     {
-        setAddress(address);
-
-        m_block_size = std::min(block_size, int(size-address));
-        cmd[1] = (m_block_size >> 8) & 0xFF;
-        cmd[2] = m_block_size & 0xFF;
-
-        m_conn->SendData(cmd);
+        if(!m_autoincrement)
+            queueAddress(address);
 
-        waitForAct(WAIT_BLOCK);
-        if(m_rec_buff.size() != m_block_size)
-            throw tr("Failed to read mem block (timeout)");
-
-        res.append(m_rec_buff);
+        m_transport.send(&READ_EEPROM, 1);
+        m_transport.expectBytes(1, &res);
 
-        address += m_block_size;
+        if(!m_transport.wait(READ_WINDOW))
+            throw tr("Failed to read memory page (timeout)");
 
-        emit updateProgressDialog((address*100)/size);
+        emit updateProgressDialog(((address - start)*100)/size);
     }
+
+    if(!m_transport.wait())
+        throw tr("Failed to read memory page (timeout)");
     return res;
 }
 
-void avr109Programmer::writeFlashMem(const std::vector<page> &pages, const std::set<quint32> &skip, bool autoincrement)
+void avr109Programmer::writeFlashMem(const std::vector<page> &pages, const std::set<quint32> &skip)
 {
     quint32 address = 0;
 
@@ -439,11 +422,8 @@ void avr109Programmer::writeFlashMem(const std::vector<page> &pages, const std::
     cmd[0] = WRITE_FLASH_LOW;
     cmd[2] = WRITE_FLASH_HIGH;
 
-    QByteArray writePage = QByteArray::fromRawData(&WRITE_PAGE, 1);
-
     quint32 cntNoSkip = pages.size() - skip.size();
 
-    m_cancel_requested = false;
     for(size_t i = 0; i < pages.size() && !m_cancel_requested; ++i)
     {
         if(skip.find(i) != skip.end())
@@ -452,74 +432,76 @@ void avr109Programmer::writeFlashMem(const std::vector<page> &pages, const std::
         const page& p = pages[i];
         address = p.address;
 
-        setAddress(address >> 1);
+        queueAddress(address >> 1);
 
+        // Filling the page buffer is fast, the words are sent without
+        // waiting for each of the acks.
         for(size_t x = 0; x < p.data.size(); address+=2)
         {
-            if(!autoincrement)
-                setAddress(address >> 1);
+            if(!m_autoincrement)
+                queueAddress(address >> 1);
 
             cmd[1] = p.data[x++];
             cmd[3] = p.data[x++];
 
-            m_conn->SendData(cmd);
-            waitForAct(WAIT_CHAR2);
-            if(m_rec_buff.size() != 2 || m_rec_buff[0] != '\r' || m_rec_buff[1] != '\r')
+            m_transport.send(cmd);
+            m_transport.expectReply("\r\r");
+
+            if(!m_transport.wait(WRITE_WINDOW))
                 throw tr("Failed to write memory page (timeout)");
         }
 
-        m_conn->SendData(writePage);
-        waitForAct(WAIT_CHAR1);
-        if(m_rec_buff.size() != 1 || m_rec_buff[0] != '\r')
+        m_transport.send(&WRITE_PAGE, 1);
+        m_transport.expectReply("\r");
+        if(!m_transport.wait())
             throw tr("Failed to write memory page (timeout)");
 
         emit updateProgressDialog((i*100)/cntNoSkip);
     }
 }
 
-void avr109Programmer::writeFlashMemBlock(const std::vector<page> &pages, const std::set<quint32> &skip)
+void avr109Programmer::writeMemBlock(char memtype, const std::vector<page> &pages, const std::set<quint32> &skip)
 {
-    quint32 address = 0;
+    quint32 addr_shift = (memtype == BLOCK_FLASH) ? 1 : 0;
 
     QByteArray cmd(4, 0);
     cmd[0] = FLASH_BLOCK;
-    cmd[3] = BLOCK_FLASH;
+    cmd[3] = memtype;
 
-    quint32 cntNoSkip = pages.size() - skip.size();
+    quint32 cnt = pages.size() - skip.size();
 
-    m_cancel_requested = false;
     for(size_t i = 0; i < pages.size() && !m_cancel_requested; ++i)
     {
         if(skip.find(i) != skip.end())
             continue;
 
         const page& p = pages[i];
-        address = p.address;
 
-        setAddress(address >> 1);
+        // The address and the block go out in one round-trip. The next
+        // block can't be sent before the ack, because the bootloader
+        // does not receive while it is writing the page.
+        queueAddress(p.address >> addr_shift);
 
         cmd[1] = (p.data.size() >> 8) & 0xFF;
         cmd[2] = p.data.size() & 0xFF;
 
-        m_conn->SendData(cmd);
-        m_conn->SendData(QByteArray::fromRawData((char*)p.data.data(), p.data.size()));
+        m_transport.send(cmd + QByteArray::fromRawData((char*)p.data.data(), p.data.size()));
+        m_transport.expectReply("\r");
 
-        waitForAct(WAIT_CHAR1);
-        if(m_rec_buff.size() != 1 || m_rec_buff[0] != '\r')
+        if(!m_transport.wait())
             throw tr("Failed to write memory block (timeout)");
 
-        emit updateProgressDialog((i*100)/cntNoSkip);
+        emit updateProgressDialog((i*100)/cnt);
     }
 }
 
-void avr109Programmer::writeEEPROM(const std::vector<page> &pages, bool autoincrement)
+void avr109Programmer::writeEEPROM(const std::vector<page> &pages)
 {
     quint32 address = 0;
 
     QByteArray cmd(2, 0);
     cmd[0] = WRITE_EEPROM;
 
-    m_cancel_requested = false;
     for(size_t i = 0; i < pages.size() && !m_cancel_requested; ++i)
     {
         const page& p = pages[i];
@@ -529,125 +511,23 @@ void avr109Programmer::writeEEPROM(const std::vector<page> &pages, bool autoincr
 
         for(size_t x = 0; x < p.data.size(); ++address, ++x)
         {
-            if(!autoincrement)
+            if(!m_autoincrement)
                 setAddress(address);
 
             cmd[1] = p.data[x];
-            m_conn->SendData(cmd);
+            m_transport.send(cmd);
 
             // FIXME: xboot has bug, it does not return ACK
-            //waitForAct(WAIT_CHAR1);
-            //if(m_rec_buff.size() != 1 || m_rec_buff[0] != '\r')
-                //throw tr("Failed to write memory page (timeout)");
-            waitForAct(WAIT_EMPTY, 30);
+            m_transport.sleep(30, true);
         }
 
         emit updateProgressDialog((i*100)/pages.size());
     }
 }
 
-void avr109Programmer::writeEEPROMBlock(const std::vector<page> &pages)
-{
-    quint32 address = 0;
-
-    QByteArray cmd(4, 0);
-    cmd[0] = FLASH_BLOCK;
-    cmd[3] = BLOCK_EEPROM;
-
-    m_cancel_requested = false;
-
-    for(size_t i = 0; i < pages.size() && !m_cancel_requested; ++i)
-    {
-        const page& p = pages[i];
-        address = p.address;
-
-        setAddress(address);
-
-        cmd[1] = (p.data.size() >> 8) & 0xFF;
-        cmd[2] = p.data.size() & 0xFF;
-
-        m_conn->SendData(cmd);
-        m_conn->SendData(QByteArray::fromRawData((char*)p.data.data(), p.data.size()));
-
-        waitForAct(WAIT_CHAR1);
-        if(m_rec_buff.size() != 1 || m_rec_buff[0] != '\r')
-            throw tr("Failed to write memory block (timeout)");
-
-        emit updateProgressDialog((i*100)/pages.size());
-    }
-}
-
-bool avr109Programmer::waitForAct(int waitAct, int timeout)
-{
-    if(m_wait_act != WAIT_NONE)
-    {
-        Q_ASSERT(false);
-        return false;
-    }
-
-    m_rec_buff.clear();
-    m_wait_act = waitAct;
-
-    QEventLoop ev;
-    QTimer t;
-
-    connect(&t,   SIGNAL(timeout()), &ev, SLOT(quit()));
-    connect(this, SIGNAL(waitActDone()),  &ev, SLOT(quit()));
-
-    t.setSingleShot(true);
-    t.start(timeout);
-
-    ev.exec();
-
-    m_wait_act = WAIT_NONE;
-
-    return t.isActive();
-}
-
-void avr109Programmer::dataRead(const QByteArray &data)
-{
-    switch(m_wait_act)
-    {
-        case WAIT_NONE:
-            emit tunnelData(data);
-            break;
-        case WAIT_EMPTY:
-            return;
-        case WAIT_SUPPORTED:
-            if(data.indexOf(char(0)) != -1)
-                emit waitActDone();
-            return;
-        case WAIT_CHAR1:
-        case WAIT_CHAR2:
-        case WAIT_CHAR3:
-        {
-            m_rec_buff.append(data);
-
-            int n = m_wait_act - WAIT_CHAR1 + 1;
-            if(m_rec_buff.size() >= n)
-            {
-                m_rec_buff.resize(n);
-                emit waitActDone();
-            }
-            return;
-        }
-        case WAIT_BLOCK:
-        {
-            m_rec_buff.append(data);
-
-            if(m_rec_buff.size() >= m_block_size)
-            {
-                m_rec_buff.resize(m_block_size);
-                emit waitActDone();
-            }
-            return;
-        }
-    }
-}
-
 void avr109Programmer::sendTunnelData(QString const & data)
 {
-    m_conn->SendData(data.toUtf8());
+    m_transport.send(data.toUtf8());
 }
 
 ProgrammerCapabilities avr109Programmer::capabilities() const
@@ -10,14 +10,12 @@
 
 #include "../../shared/programmer.h"
 #include "../../connection/serialport.h"
+#include "bootloadertransport.h"
 
 class avr109Programmer : public Programmer
 {
     Q_OBJECT
 
-Q_SIGNALS:
-    void waitActDone();
-
 public:
     avr109Programmer(ConnectionPointer<PortConnection> const & conn, ProgrammerLogSink * logsink);
 
@@ -47,39 +45,23 @@ public slots:
     void sendTunnelData(QString const & data);
     void setBootseq(const QString& seq);
 
-private slots:
-    void dataRead(const QByteArray& data);
-
 private:
-    bool waitForAct(int waitAct, int timeout = 1000);
-    bool checkBlockSupport(int &block_size);
-    bool checkAutoIncrement();
+    void checkCapabilities();
+    void queueAddress(quint32 address);
     void setAddress(quint32 address);
     QByteArray readMem(quint8 id, quint32 start, quint32 size);
-    QByteArray readFlashMem(quint32 start, quint32 size, bool autoincrement);
-    QByteArray readFlashMemBlock(quint32 start, quint32 size, int block_size);
-    QByteArray readEEPROM(quint32 start, quint32 size, bool autoincrement);
-    QByteArray readEEPROMBlock(quint32 start, quint32 size, int block_size);
-    void writeFlashMem(const std::vector<page>& pages, const std::set<quint32>& skip, bool autoincrement);
-    void writeFlashMemBlock(const std::vector<page>& pages, const std::set<quint32>& skip);
-    void writeEEPROM(const std::vector<page>& pages, bool autoincrement);
-    void writeEEPROMBlock(const std::vector<page>& pages);
-
-    enum {
-        WAIT_NONE,
-
-        WAIT_EMPTY,
-        WAIT_SUPPORTED,
-        WAIT_CHAR1,
-        WAIT_CHAR2,
-        WAIT_CHAR3,
-        WAIT_BLOCK
-    };
+    QByteArray readMemBlock(char memtype, quint32 start, quint32 size);
+    QByteArray readFlashMem(quint32 start, quint32 size);
+    QByteArray readEEPROM(quint32 start, quint32 size);
+    void writeFlashMem(const std::vector<page>& pages, const std::set<quint32>& skip);
+    void writeMemBlock(char memtype, const std::vector<page>& pages, const std::set<quint32>& skip);
+    void writeEEPROM(const std::vector<page>& pages);
 
     ConnectionPointer<PortConnection> m_conn;
-    QByteArray m_rec_buff;
-    int m_wait_act;
+    BootloaderTransport m_transport;
+    bool m_caps_valid;
     int m_block_size;
+    bool m_autoincrement;
     bool m_flash_mode;
     bool m_cancel_requested;
     QString m_bootseq;
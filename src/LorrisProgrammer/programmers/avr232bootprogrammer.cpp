@@ -5,9 +5,6 @@
 **    See README and COPYING
 ***********************************************/
 
-#include <QEventLoop>
-#include <QTimer>
-
 #include "avr232bootprogrammer.h"
 #include "../../shared/defmgr.h"
 #include "../../shared/hexfile.h"
@@ -15,13 +12,12 @@
 #define EEPROM_READ_PAGE 128
 
 avr232bootProgrammer::avr232bootProgrammer(ConnectionPointer<PortConnection> const & conn, ProgrammerLogSink * logsink)
-    : Programmer(logsink), m_conn(conn)
+    : Programmer(logsink), m_conn(conn), m_transport(conn)
 {
-    m_wait_act = WAIT_NONE;
     m_flash_mode = false;
     m_cancel_requested = false;
 
-    connect(m_conn.data(), SIGNAL(dataRead(QByteArray)), this, SLOT(dataRead(QByteArray)));
+    connect(&m_transport, SIGNAL(unexpectedData(QByteArray)), this, SIGNAL(tunnelData(QByteArray)));
 }
 
 int avr232bootProgrammer::getType()
@@ -40,14 +36,16 @@ void avr232bootProgrammer::switchToFlashMode(quint32 /*prog_speed_hz*/)
 
     static const char stopCmd[4] = { 0x74, 0x7E, 0x7A, 0x33 };
 
-    m_conn->SendData(QByteArray::fromRawData(stopCmd, 4));
+    m_transport.send(stopCmd, 4);
     // First sequence restarts chip to bootloader,
     // but I won't get the ack byte. But when chip is already stopped,
     // the first ack is sent, so we have to enter event loop to receive it
-    waitForAct(WAIT_ACK, 100);
+    expectAck();
+    m_transport.wait(0, 100);
 
-    m_conn->SendData(QByteArray::fromRawData(stopCmd, 4));
-    if(!waitForAct(WAIT_ACK))
+    m_transport.send(stopCmd, 4);
+    expectAck();
+    if(!m_transport.wait())
         throw tr("Failed to switch to flash mode (timeout).");
 
     m_flash_mode = true;
@@ -55,7 +53,7 @@ void avr232bootProgrammer::switchToFlashMode(quint32 /*prog_speed_hz*/)
 
 void avr232bootProgrammer::switchToRunMode()
 {
-    m_conn->SendData(QByteArray(1, 0x11));
+    m_transport.send(QByteArray(1, 0x11));
     m_flash_mode = false;
 }
 
@@ -66,15 +64,15 @@ bool avr232bootProgrammer::isInFlashMode()
 
 chip_definition avr232bootProgrammer::readDeviceId()
 {
-    m_rec_buff.clear();
+    QByteArray id;
 
-    m_conn->SendData(QByteArray(1, 0x12));
-    waitForAct(WAIT_DEV_ID);
+    m_transport.send(QByteArray(1, 0x12));
+    m_transport.expectBytes(4, &id);
 
-    if(m_rec_buff.size() != 4)
+    if(!m_transport.wait())
         throw tr("Failed to read device id (timeout)");
 
-    return sDefMgr.findChipdef("avr232boot:" + QString(m_rec_buff));
+    return sDefMgr.findChipdef("avr232boot:" + QString(id));
 }
 
 QByteArray avr232bootProgrammer::readMemory(const QString& mem, chip_definition &chip)
@@ -86,36 +84,34 @@ QByteArray avr232bootProgrammer::readMemory(const QString& mem, chip_definition
     if(!md)
         throw tr("Chip %1 does not have memory type: %2").arg(chip.getName()).arg(mem);
 
-    m_rec_buff.clear();
     m_cancel_requested = false;
 
-    quint16 itr = 0;
-    do
-    {
-        if((quint32)m_rec_buff.size() >= md->size)
-            goto success;
-
-        QByteArray cmd(1, 0x13);
-        m_conn->SendData(cmd);
-
-        cmd[0] = (itr >> 8);
-        cmd[1] = quint8(itr);
-        cmd[2] = EEPROM_READ_PAGE;
-        m_conn->SendData(cmd);
+    QByteArray res;
+    res.reserve(md->size);
 
-        itr += EEPROM_READ_PAGE;
-        emit updateProgressDialog((itr*100)/md->size);
-    } while(!m_cancel_requested && waitForAct(WAIT_EEPROM_READ));
+    QByteArray cmd(4, 0x13);
+    for(quint32 itr = 0; itr < md->size && !m_cancel_requested; itr += EEPROM_READ_PAGE)
+    {
+        cmd[1] = quint8(itr >> 8);
+        cmd[2] = quint8(itr);
+        cmd[3] = EEPROM_READ_PAGE;
+        m_transport.send(cmd);
+        m_transport.expectBytes(EEPROM_READ_PAGE, &res);
 
-    emit updateProgressDialog(-1);
+        if(!m_transport.wait())
+        {
+            emit updateProgressDialog(-1);
+            throw tr("Failed to read EEPROM (timeout)");
+        }
 
-    if(!m_cancel_requested)
-        throw tr("Failed to read EEPROM (timeout)");
-    m_cancel_requested = false;
+        emit updateProgressDialog(((itr + EEPROM_READ_PAGE)*100)/md->size);
+    }
 
-success:
-    QByteArray res = m_rec_buff;
-    m_rec_buff.clear();
+    if(m_cancel_requested)
+    {
+        emit updateProgressDialog(-1);
+        m_cancel_requested = false;
+    }
     return res;
 }
 
@@ -157,7 +153,10 @@ void avr232bootProgrammer::flashRaw(HexFile& file, quint8 memId, chip_definition
                 break;
         }
 
-        if(!waitForAct(WAIT_ACK))
+        // The bootloader acks once the page is written, it can't
+        // receive the next one before that.
+        expectAck();
+        if(!m_transport.wait())
             throw tr("Failed to write page (timeout)");
 
         if(m_cancel_requested)
@@ -173,32 +172,21 @@ void avr232bootProgrammer::flashRaw(HexFile& file, quint8 memId, chip_definition
 
 void avr232bootProgrammer::writeFlashPage(page& p)
 {
-    QByteArray cmd(1, 0x10);
-    m_conn->SendData(cmd);
-
-    cmd[0] = quint8(p.address >> 8);
-    cmd[1] = quint8(p.address);
-    m_conn->SendData(cmd);
-
-    for(quint16 i = 0; i < p.data.size(); ++i)
-        cmd[i] = p.data[i];
-    m_conn->SendData(cmd);
+    QByteArray cmd(3, 0x10);
+    cmd[1] = quint8(p.address >> 8);
+    cmd[2] = quint8(p.address);
+    cmd.append((const char*)p.data.data(), p.data.size());
+    m_transport.send(cmd);
 }
 
 void avr232bootProgrammer::writeEEPROMPage(page& p)
 {
-    QByteArray cmd(1, 0x14);
-    m_conn->SendData(cmd);
-
-    cmd[0] = quint8(p.address >> 8);
-    cmd[1] = quint8(p.address);
-    cmd[2] = p.data.size();
-    m_conn->SendData(cmd);
-
-    cmd.clear();
-    for(quint8 i = 0; i < p.data.size(); ++i)
-        cmd[i] = p.data[i];
-    m_conn->SendData(cmd);
+    QByteArray cmd(4, 0x14);
+    cmd[1] = quint8(p.address >> 8);
+    cmd[2] = quint8(p.address);
+    cmd[3] = quint8(p.data.size());
+    cmd.append((const char*)p.data.data(), p.data.size());
+    m_transport.send(cmd);
 }
 
 void avr232bootProgrammer::erase_device(chip_definition& /*chip*/)
@@ -212,63 +200,14 @@ void avr232bootProgrammer::cancelRequested()
     m_cancel_requested = true;
 }
 
-bool avr232bootProgrammer::waitForAct(int waitAct, int timeout)
-{
-    if(m_wait_act != WAIT_NONE)
-    {
-        Q_ASSERT(false);
-        return false;
-    }
-
-    m_wait_act = waitAct;
-
-    QEventLoop ev;
-    QTimer t;
-
-    connect(&t,   SIGNAL(timeout()), &ev, SLOT(quit()));
-    connect(this, SIGNAL(waitActDone()),  &ev, SLOT(quit()));
-
-    t.setSingleShot(true);
-    t.start(timeout);
-
-    ev.exec();
-
-    m_wait_act = WAIT_NONE;
-
-    return t.isActive();
-}
-
-void avr232bootProgrammer::dataRead(const QByteArray &data)
+void avr232bootProgrammer::expectAck()
 {
-    switch(m_wait_act)
-    {
-        case WAIT_NONE:
-            break;
-        case WAIT_ACK:
-            if(data.indexOf(char(20)) != -1)
-                emit waitActDone();
-            return;
-        case WAIT_DEV_ID:
-            m_rec_buff.append(data);
-            if(m_rec_buff.size() >= 4)
-            {
-                m_rec_buff.resize(4);
-                emit waitActDone();
-            }
-            return;
-        case WAIT_EEPROM_READ:
-            m_rec_buff.append(data);
-            if(m_rec_buff.size()%EEPROM_READ_PAGE == 0)
-                emit waitActDone();
-            return;
-    }
-
-    emit tunnelData(data);
+    m_transport.expectMarker(QByteArray(1, 20));
 }
 
 void avr232bootProgrammer::sendTunnelData(QString const & data)
 {
-    m_conn->SendData(data.toUtf8());
+    m_transport.send(data.toUtf8());
 }
 
 ProgrammerCapabilities avr232bootProgrammer::capabilities() const
@@ -10,14 +10,12 @@
 
 #include "../../shared/programmer.h"
 #include "../../connection/serialport.h"
+#include "bootloadertransport.h"
 
 class avr232bootProgrammer : public Programmer
 {
     Q_OBJECT
 
-Q_SIGNALS:
-    void waitActDone();
-
 public:
     avr232bootProgrammer(ConnectionPointer<PortConnection> const & conn, ProgrammerLogSink * logsink);
 
@@ -43,25 +41,13 @@ public slots:
     void cancelRequested();
     void sendTunnelData(QString const & data);
 
-private slots:
-    void dataRead(const QByteArray& data);
-
 private:
-    bool waitForAct(int waitAct, int timeout = 1000);
+    void expectAck();
     void writeFlashPage(page& p);
     void writeEEPROMPage(page& p);
 
-    enum {
-        WAIT_NONE,
-
-        WAIT_DEV_ID,
-        WAIT_ACK,
-        WAIT_EEPROM_READ
-    };
-
     ConnectionPointer<PortConnection> m_conn;
-    QByteArray m_rec_buff;
-    int m_wait_act;
+    BootloaderTransport m_transport;
     bool m_flash_mode;
     bool m_cancel_requested;
 };
@@ -0,0 +1,163 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#include <QEventLoop>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <algorithm>
+
+#include "bootloadertransport.h"
+
+BootloaderTransport::BootloaderTransport(ConnectionPointer<PortConnection> const & conn, QObject *parent)
+    : QObject(parent), m_conn(conn)
+{
+    m_failed = false;
+    m_discard = false;
+    m_loop = NULL;
+    m_wait_limit = 0;
+
+    connect(m_conn.data(), SIGNAL(dataRead(QByteArray)), this, SLOT(dataRead(QByteArray)));
+}
+
+void BootloaderTransport::send(const QByteArray& data)
+{
+    m_conn->SendData(data);
+}
+
+void BootloaderTransport::expectBytes(int len, QByteArray *dest)
+{
+    if(len <= 0)
+        return;
+
+    reply r;
+    r.type = REPLY_BYTES;
+    r.size = len;
+    r.matched = 0;
+    r.dest = dest;
+    m_pending.push_back(r);
+}
+
+void BootloaderTransport::expectReply(const QByteArray& data)
+{
+    reply r;
+    r.type = REPLY_EXACT;
+    r.size = data.size();
+    r.matched = 0;
+    r.data = data;
+    r.dest = NULL;
+    m_pending.push_back(r);
+}
+
+void BootloaderTransport::expectMarker(const QByteArray& marker)
+{
+    reply r;
+    r.type = REPLY_MARKER;
+    r.size = marker.size();
+    r.matched = 0;
+    r.data = marker;
+    r.dest = NULL;
+    m_pending.push_back(r);
+}
+
+void BootloaderTransport::clear()
+{
+    m_pending.clear();
+    m_failed = false;
+}
+
+bool BootloaderTransport::wait(size_t max_pending, int timeout)
+{
+    Q_ASSERT(!m_loop);
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    while(m_pending.size() > max_pending && !m_failed)
+    {
+        qint64 remaining = timeout - elapsed.elapsed();
+        if(remaining <= 0)
+            break;
+
+        QEventLoop ev;
+        QTimer t;
+
+        connect(&t, SIGNAL(timeout()), &ev, SLOT(quit()));
+
+        t.setSingleShot(true);
+        t.start(int(remaining));
+
+        m_loop = &ev;
+        m_wait_limit = max_pending;
+        ev.exec();
+        m_loop = NULL;
+    }
+
+    if(m_failed || m_pending.size() > max_pending)
+    {
+        clear();
+        return false;
+    }
+    return true;
+}
+
+void BootloaderTransport::sleep(int timeout, bool discard)
+{
+    QEventLoop ev;
+    QTimer::singleShot(timeout, &ev, SLOT(quit()));
+
+    m_discard = discard;
+    ev.exec();
+    m_discard = false;
+}
+
+void BootloaderTransport::dataRead(const QByteArray &data)
+{
+    if(m_discard)
+        return;
+
+    const char *itr = data.constData();
+    const char *end = itr + data.size();
+    while(itr != end)
+    {
+        if(m_pending.empty())
+        {
+            emit unexpectedData(QByteArray(itr, end - itr));
+            break;
+        }
+
+        reply& r = m_pending.front();
+        switch(r.type)
+        {
+            case REPLY_BYTES:
+            {
+                int len = std::min(int(end - itr), r.size - r.matched);
+                if(r.dest)
+                    r.dest->append(itr, len);
+                r.matched += len;
+                itr += len;
+                break;
+            }
+            case REPLY_EXACT:
+                if(*itr++ != r.data[r.matched++])
+                    m_failed = true;
+                break;
+            case REPLY_MARKER:
+                if(*itr == r.data[r.matched])
+                    ++r.matched;
+                else
+                    r.matched = (*itr == r.data[0]) ? 1 : 0;
+                ++itr;
+                break;
+        }
+
+        if(r.matched == r.size)
+            m_pending.pop_front();
+    }
+
+    if(m_loop && (m_failed || m_pending.size() <= m_wait_limit))
+        m_loop->quit();
+}
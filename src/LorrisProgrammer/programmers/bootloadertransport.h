@@ -0,0 +1,89 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#ifndef BOOTLOADERTRANSPORT_H
+#define BOOTLOADERTRANSPORT_H
+
+#include <QObject>
+#include <QByteArray>
+#include <deque>
+
+#include "../../connection/connection.h"
+
+class QEventLoop;
+
+/*
+ * Request/response transport shared by the serial bootloader programmers.
+ *
+ * The replies a bootloader will send are queued with the expect* methods
+ * before (or right after) the matching command is sent. Incoming bytes are
+ * fed through the queue by a small parser, so several commands can be
+ * in flight and wait() only has to spin an event loop once per window
+ * instead of once per command. Bytes that arrive when nothing is expected
+ * are passed on through unexpectedData(), e.g. to the terminal tunnel.
+ */
+class BootloaderTransport : public QObject
+{
+    Q_OBJECT
+
+Q_SIGNALS:
+    void unexpectedData(const QByteArray& data);
+
+public:
+    BootloaderTransport(ConnectionPointer<PortConnection> const & conn, QObject *parent = 0);
+
+    void send(const QByteArray& data);
+    void send(const char *data, int len) { send(QByteArray::fromRawData(data, len)); }
+
+    // Reply of exactly len bytes, appended to dest if not NULL
+    void expectBytes(int len, QByteArray *dest = NULL);
+    // Reply that must match data exactly
+    void expectReply(const QByteArray& data);
+    // Skips everything up to and including the marker sequence
+    void expectMarker(const QByteArray& marker);
+
+    // Waits until at most max_pending replies are outstanding, for at most
+    // timeout ms in total. Returns false on timeout or mismatched reply,
+    // the outstanding replies are dropped in that case.
+    bool wait(size_t max_pending = 0, int timeout = 1000);
+
+    // Runs the event loop for timeout ms, incoming data is dropped if discard is set
+    void sleep(int timeout, bool discard);
+
+    size_t pending() const { return m_pending.size(); }
+    void clear();
+
+private slots:
+    void dataRead(const QByteArray& data);
+
+private:
+    enum {
+        REPLY_BYTES,
+        REPLY_EXACT,
+        REPLY_MARKER
+    };
+
+    struct reply
+    {
+        int type;
+        int size;
+        int matched;
+        QByteArray data;
+        QByteArray *dest;
+    };
+
+    ConnectionPointer<PortConnection> m_conn;
+    std::deque<reply> m_pending;
+
+    bool m_failed;
+    bool m_discard;
+
+    QEventLoop *m_loop;
+    size_t m_wait_limit;
+};
+
+#endif // BOOTLOADERTRANSPORT_H
@@ -15,6 +15,7 @@
  */
 
 #include <QApplication>
+#include <QElapsedTimer>
 
 #include "stm32programmer.h"
 #include "../../connection/stm32defines.h"
@@ -23,6 +24,10 @@
 
 #include <libyb/usb/usb_descriptors.hpp>
 
+// ms, the slowest are 128 KB sectors of F2/F4 and mass erase of 2 MB parts
+#define STM32_PAGE_ERASE_TIMEOUT 10000
+#define STM32_MASS_ERASE_TIMEOUT 60000
+
 STM32Programmer::STM32Programmer(const ConnectionPointer<STM32Connection> &conn, ProgrammerLogSink *logsink) :
     Programmer(logsink), m_conn(conn), m_cancel_req(false)
 {
@@ -107,7 +112,8 @@ chip_definition STM32Programmer::readDeviceId()
         if(!ok)
             throw tr("Invalid chip definition %1!").arg(sign);
 
-        flash->size = (m_conn->c_read_debug32(reg) & 0xFFFF) * 1024;
+        uint32_t shift = def.getOptionUInt("flash_size_shift");
+        flash->size = ((m_conn->c_read_debug32(reg) >> shift) & 0xFFFF) * 1024;
     }
 
     return def;
@@ -120,28 +126,40 @@ QByteArray STM32Programmer::readMemory(const QString& mem, chip_definition &chip
     if(mem != "flash")
         throw tr("Unsupported memory type");
 
-    size_t addr = STM32_FLASH_BASE;
-    size_t size = chip.getMemDef(MEM_FLASH)->size;
-
-    QByteArray res;
-    res.reserve(size);
+    uint32_t addr = STM32_FLASH_BASE;
+    uint32_t size = chip.getMemDef(MEM_FLASH)->size;
 
     emit updateProgressDialog(0);
-    for(size_t off = 0; off < size && !m_cancel_req; off += 1024)
+    return this->readRange(addr, size);
+}
+
+QByteArray STM32Programmer::readRange(uint32_t addr, uint32_t size)
+{
+    // Every read in one queue is pipelined, progress is reported per queue
+    static const uint32_t read_chunk = 0x1800;
+    static const uint32_t chunks_per_queue = 16;
+
+    QByteArray res(int((size + 3) & ~3), 0);
+    STM32Connection::cmd_queue queue;
+
+    for(uint32_t off = 0; off < size && !m_cancel_req;)
     {
-        size_t read_size = 1024;
-        size_t rounded_size;
-        if ((off + read_size) > size)
-            read_size = size - off;
-
-        /* round size if needed */
-        rounded_size = read_size;
-        if (rounded_size & 3)
-            rounded_size = (rounded_size + 4) & ~(3);
-
-        res.append(m_conn->c_read_mem32(addr + off, rounded_size));
-        emit updateProgressDialog((off*100)/size);
+        for(uint32_t i = 0; i < chunks_per_queue && off < size; ++i)
+        {
+            uint32_t read_size = (std::min)(read_chunk, size - off);
+
+            /* round size if needed */
+            if (read_size & 3)
+                read_size = (read_size + 4) & ~(3);
+
+            queue.read_mem32(addr + off, read_size, (uint8_t*)res.data() + off);
+            off += read_size;
+        }
+
+        m_conn->c_execute(queue);
+        emit updateProgressDialog((quint64(off)*100)/size);
     }
+    res.resize(size);
     return res;
 }
 
@@ -174,30 +192,16 @@ void STM32Programmer::flashRaw(HexFile& file, quint8 memId, chip_definition& chi
         }
     }
 
-    chip_definition::memorydef *flash_mem = chip.getMemDef(MEM_FLASH);
-
     flash_ptr flash(STM32FlashController::getController(chip.getOption("flash_controller"), m_conn));
     connect(flash.data(), SIGNAL(updateProgressDialog(int)), SIGNAL(updateProgressDialog(int)));
 
     emit updateProgressLabel(tr("Waiting for flash operations to finish..."));
-    while(flash->is_busy())
-    {
-        emit updateProgressDialog(0);
-        Utils::msleep(50);
-    }
+    flash->wait_while_busy(STM32_MASS_ERASE_TIMEOUT, 0);
 
     // Erase affected pages
     emit updateProgressLabel(tr("Erasing flash pages..."));
     emit updateProgressDialog(0);
-    for(uint32_t off = 0; off < (uint32_t)data.size() && !m_cancel_req; off += flash_mem->pagesize)
-    {
-        flash->unlock();
-        flash->erase_page(addr+off);
-        do {
-            emit updateProgressDialog((off*100)/data.size());
-        } while(flash->is_busy());
-        flash->lock();
-    }
+    this->erase_range(flash.data(), chip, addr, data.size());
 
     if(m_cancel_req)
         return;
@@ -220,21 +224,14 @@ void STM32Programmer::flashRaw(HexFile& file, quint8 memId, chip_definition& chi
         emit updateProgressLabel(tr("Verifying data..."));
         emit updateProgressDialog(0);
 
-        QByteArray mem;
-        int cmp, aligned;
-        int block_size = flash_mem->pagesize > 0x1800 ? 0x1800 : flash_mem->pagesize;
-        for(int off = 0; off < data.size() && !m_cancel_req; off += cmp)
-        {
-            cmp = (std::min)(block_size, data.size() - off);
-            aligned = cmp;
-            if(aligned & (4 - 1))
-                aligned = (cmp + 4) & ~(4 - 1);
+        QByteArray mem = this->readRange(addr, data.size());
+        if(m_cancel_req)
+            return;
 
-            mem = m_conn->c_read_mem32(addr + off, aligned);
-            if(memcmp(data.data()+off, mem.data(), cmp) != 0)
+        for(int off = 0; off < data.size(); ++off)
+        {
+            if(data[off] != mem[off])
                 throw tr("Verification failed at offset 0x%1!").arg(off, 0, 16);
-
-            emit updateProgressDialog((off*100)/data.size());
         }
     }
 }
@@ -242,32 +239,48 @@ void STM32Programmer::flashRaw(HexFile& file, quint8 memId, chip_definition& chi
 void STM32Programmer::erase_device(chip_definition& chip)
 {
     flash_ptr flash(STM32FlashController::getController(chip.getOption("flash_controller"), m_conn));
+    connect(flash.data(), SIGNAL(updateProgressDialog(int)), SIGNAL(updateProgressDialog(int)));
+
+    emit updateProgressLabel(tr("Waiting for flash operations to finish..."));
+    flash->wait_while_busy(STM32_MASS_ERASE_TIMEOUT, 0);
 
-    if(flash->supports_mass_erase())
+    emit updateProgressLabel(tr("Erasing memory.."));
+    this->erase_range(flash.data(), chip, STM32_FLASH_BASE, chip.getMemDef(MEM_FLASH)->size);
+}
+
+void STM32Programmer::erase_range(STM32FlashController *flash, chip_definition& chip, uint32_t addr, uint32_t size)
+{
+    chip_definition::memorydef *flash_mem = chip.getMemDef(MEM_FLASH);
+    const uint32_t flash_end = STM32_FLASH_BASE + flash_mem->size;
+
+    std::vector<uint32_t> pages;
+    if(flash_mem->pagesize > 0)
     {
-        emit updateProgressLabel(tr("Waiting for flash operations to finish..."));
-        while(flash->is_busy())
+        for(uint32_t page = addr - (addr - STM32_FLASH_BASE) % flash_mem->pagesize;
+            page < addr + size && page < flash_end; page += flash_mem->pagesize)
         {
-            emit updateProgressDialog(0);
-            Utils::msleep(50);
+            pages.push_back(page);
         }
+    }
 
+    // Mass erase when it would clear the same pages as the page list,
+    // it takes one command instead of one command and busy-wait per page
+    if(flash->supports_mass_erase() && (pages.empty() || pages.size()*flash_mem->pagesize >= flash_mem->size))
+    {
         flash->unlock();
         flash->erase_mass();
-
-        emit updateProgressLabel(tr("Erasing memory.."));
-        while(flash->is_busy())
-        {
-            emit updateProgressDialog(50);
-            Utils::msleep(50);
-        }
+        flash->wait_while_busy(STM32_MASS_ERASE_TIMEOUT, 50);
 
         flash->lock();
         //FIXME: verify?
     }
+    else if(!pages.empty())
+    {
+        flash->erase_pages(pages, m_cancel_req);
+    }
     else
     {
-        throw tr("This flash does not support mass erase and individual page erase is not yet implemented");
+        throw tr("This flash does not support mass erase and the chip definition has no page size");
     }
 }
 
@@ -287,6 +300,8 @@ STM32FlashController *STM32FlashController::getController(const QString& name, c
 
     if(name == "stm32vl")
         return new STM32VLFlash(conn);
+    else if(name == "stm32f4" || name == "stm32f2")
+        return new STM32F4Flash(conn);
 
     throw STM32Programmer::tr("Unknown flash controller (\"%1\")").arg(name);
 }
@@ -302,6 +317,32 @@ STM32FlashController::~STM32FlashController()
 
 }
 
+void STM32FlashController::erase_pages(const std::vector<uint32_t>& pages, const bool& cancel)
+{
+    unlock();
+    for(size_t i = 0; i < pages.size() && !cancel; ++i)
+    {
+        erase_page(pages[i]);
+        wait_while_busy(STM32_PAGE_ERASE_TIMEOUT, (i*100)/pages.size());
+    }
+    lock();
+}
+
+void STM32FlashController::wait_while_busy(int timeout, int pct, bool busy)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while(busy)
+    {
+        if(timer.elapsed() > timeout)
+            throw STM32Programmer::tr("Flash operation did not finish in time, try to reset the device!");
+
+        emit updateProgressDialog(pct);
+        Utils::msleep(1);
+        busy = is_busy();
+    }
+}
+
 /* stm32f FPEC flash controller interface, pm0063 manual */
 // STM32F05x is identical, based on RM0091 (DM00031936, Doc ID 018940 Rev 2, August 2012)
 #define FLASH_REGS_ADDR 0x40022000
@@ -435,59 +476,242 @@ void STM32VLFlash::erase_page(uint32_t addr)
     add_cr_bit(FLASH_CR_STRT);
 }
 
+void STM32VLFlash::erase_pages(const std::vector<uint32_t>& pages, const bool& cancel)
+{
+    unlock();
+
+    // Setting PER, the address and STRT is pipelined together with
+    // the first busy-poll, so every page costs a single round-trip
+    // unless the erase itself is slower than USB.
+    uint32_t sr = 0;
+    STM32Connection::cmd_queue queue;
+    for(size_t i = 0; i < pages.size() && !cancel; ++i)
+    {
+        queue.write_debug32(FLASH_CR, (1 << FLASH_CR_PER));
+        queue.write_debug32(FLASH_AR, pages[i]);
+        queue.write_debug32(FLASH_CR, (1 << FLASH_CR_PER) | (1 << FLASH_CR_STRT));
+        queue.read_debug32(FLASH_SR, &sr);
+        m_conn->c_execute(queue);
+
+        wait_while_busy(STM32_PAGE_ERASE_TIMEOUT, (i*100)/pages.size(), sr & (1 << FLASH_SR_BSY));
+    }
+
+    lock();
+}
+
 void STM32VLFlash::write(chip_definition& chip, uint32_t addr, const char *data, int size)
 {
     flash_loader loader;
-    init_flash_loader(loader);
+    init_flash_loader(loader, chip, loader_code_stm32vl, sizeof(loader_code_stm32vl), sizeof(uint16_t));
 
-    int write_len = 0;
-    int page_size = chip.getMemDef(MEM_FLASH)->pagesize;
+    // the loader sets PG itself before every half word
+    unlock();
+    write_with_loader(loader, addr, (const uint8_t*)data, size);
+    lock();
+}
 
-    uint8_t *data_itr = (uint8_t*)data;
-    for(int off = 0; off < size;)
-    {
-        write_len = (std::min)(page_size, size - off);
+//----------------------------------------------------------------------------
 
-        unlock();
-        set_cr_bit(FLASH_CR_PG);
+/* stm32f2/f4 flash controller interface, RM0090 */
+#define FLASH_F4_REGS_ADDR 0x40023c00
+
+#define FLASH_F4_KEYR (FLASH_F4_REGS_ADDR + 0x04)
+#define FLASH_F4_SR (FLASH_F4_REGS_ADDR + 0x0c)
+#define FLASH_F4_CR (FLASH_F4_REGS_ADDR + 0x10)
+
+#define FLASH_F4_SR_BSY 16
+
+#define FLASH_F4_CR_PG 0
+#define FLASH_F4_CR_SER 1
+#define FLASH_F4_CR_MER 2
+#define FLASH_F4_CR_SNB 3
+#define FLASH_F4_CR_PSIZE 8
+#define FLASH_F4_CR_STRT 16
+#define FLASH_F4_CR_LOCK 31
+
+// program/erase by 32 bits, requires 2.7V - 3.6V supply
+#define FLASH_F4_CR_PSIZE_X32 (2 << FLASH_F4_CR_PSIZE)
+
+/* from stlink, flashloaders/stm32f4.s */
+static const uint8_t loader_code_stm32f4[] = {
+    0x07, 0x4b, /* ldr	r3, STM32_FLASH_BASE */
+    /* write_word: */
+    0x62, 0xb1, /* cbz	r2, exit */
+    0x04, 0x68, /* ldr	r4, [r0] */
+    0x0c, 0x60, /* str	r4, [r1] */
+    /* busy: */
+    0xdc, 0x89, /* ldrh	r4, [r3, #STM32_FLASH_SR_OFFSET + 2] */
+    0x14, 0xf0, 0x01, 0x0f, /* tst	r4, #0x01 */
+    0xfb, 0xd1, /* bne	busy */
+    0x00, 0xf1, 0x04, 0x00, /* add	r0, r0, #4 */
+    0x01, 0xf1, 0x04, 0x01, /* add	r1, r1, #4 */
+    0xa2, 0xf1, 0x01, 0x02, /* sub	r2, r2, #1 */
+    0xf1, 0xe7, /* b	write_word */
+    /* exit: */
+    0x00, 0xbe, /* bkpt	#0x00 */
+    0x00, 0x3c, 0x02, 0x40, /* STM32_FLASH_BASE: .word 0x40023c00 */
+};
 
-        write_data_for_loader(loader, data_itr, write_len);
-        run_flash_loader(loader, addr, write_len);
+STM32F4Flash::STM32F4Flash(const ConnectionPointer<STM32Connection> &conn) : STM32FlashController(conn)
+{
+    m_lock_on_destroy = false;
+}
 
+STM32F4Flash::~STM32F4Flash()
+{
+    if(m_lock_on_destroy)
         lock();
+}
 
-        off += write_len;
-        addr += write_len;
-        data_itr += write_len;
+uint32_t STM32F4Flash::read_cr()
+{
+    return m_conn->c_read_debug32(FLASH_F4_CR);
+}
 
-        emit updateProgressDialog((off*100)/size);
+uint32_t STM32F4Flash::sector_for_addr(uint32_t addr)
+{
+    uint32_t off = addr - STM32_FLASH_BASE;
+
+    // second bank of 2 MB parts has sectors 12-23, encoded as 0x10 + n
+    uint32_t bank = 0;
+    if(off >= 0x100000)
+    {
+        bank = 0x10;
+        off -= 0x100000;
     }
+
+    // 4x 16 KB, 1x 64 KB, then 128 KB sectors
+    if(off < 0x10000)
+        return bank | (off / 0x4000);
+    if(off < 0x20000)
+        return bank | 4;
+    return bank | (4 + off / 0x20000);
 }
 
-void STM32VLFlash::init_flash_loader(flash_loader &loader)
+void STM32F4Flash::erase_mass()
 {
+    STM32Connection::cmd_queue queue;
+    uint32_t cr = (1 << FLASH_F4_CR_MER) | FLASH_F4_CR_PSIZE_X32;
+    queue.write_debug32(FLASH_F4_CR, cr);
+    queue.write_debug32(FLASH_F4_CR, cr | (1 << FLASH_F4_CR_STRT));
+    m_conn->c_execute(queue);
+}
+
+bool STM32F4Flash::is_busy()
+{
+    return (m_conn->c_read_debug32(FLASH_F4_SR) & (1 << FLASH_F4_SR_BSY));
+}
+
+void STM32F4Flash::unlock(bool guard)
+{
+    if(!is_locked())
+        return;
+
+    m_conn->c_write_debug32(FLASH_F4_KEYR, FLASH_KEY1);
+    m_conn->c_write_debug32(FLASH_F4_KEYR, FLASH_KEY2);
+
+    if(is_locked())
+        throw STM32Programmer::tr("Failed to unlock flash memory, try to reset the device!");
+
+    if(guard)
+        m_lock_on_destroy = true;
+}
+
+void STM32F4Flash::lock()
+{
+    /* leave no programming or erase operation selected */
+    uint32_t cr = this->read_cr() & ~((1u << FLASH_F4_CR_PG) | (1u << FLASH_F4_CR_SER) | (1u << FLASH_F4_CR_MER));
+    m_conn->c_write_debug32(FLASH_F4_CR, cr | (1u << FLASH_F4_CR_LOCK));
+    m_lock_on_destroy = false;
+}
+
+bool STM32F4Flash::is_locked()
+{
+    return (this->read_cr() & (1u << FLASH_F4_CR_LOCK));
+}
+
+void STM32F4Flash::erase_page(uint32_t addr)
+{
+    STM32Connection::cmd_queue queue;
+    uint32_t cr = (1 << FLASH_F4_CR_SER) | (sector_for_addr(addr) << FLASH_F4_CR_SNB) | FLASH_F4_CR_PSIZE_X32;
+    queue.write_debug32(FLASH_F4_CR, cr);
+    queue.write_debug32(FLASH_F4_CR, cr | (1 << FLASH_F4_CR_STRT));
+    m_conn->c_execute(queue);
+}
+
+void STM32F4Flash::erase_pages(const std::vector<uint32_t>& pages, const bool& cancel)
+{
+    // Sectors are bigger than the pages from chip definition,
+    // erase each of them only once
+    std::vector<uint32_t> sectors;
+    for(size_t i = 0; i < pages.size(); ++i)
+    {
+        if(sectors.empty() || sector_for_addr(sectors.back()) != sector_for_addr(pages[i]))
+            sectors.push_back(pages[i]);
+    }
+    STM32FlashController::erase_pages(sectors, cancel);
+}
+
+void STM32F4Flash::write(chip_definition& chip, uint32_t addr, const char *data, int size)
+{
+    flash_loader loader;
+    init_flash_loader(loader, chip, loader_code_stm32f4, sizeof(loader_code_stm32f4), sizeof(uint32_t));
+
+    unlock();
+    m_conn->c_write_debug32(FLASH_F4_CR, (1 << FLASH_F4_CR_PG) | FLASH_F4_CR_PSIZE_X32);
+    write_with_loader(loader, addr, (const uint8_t*)data, size);
+    lock();
+}
+
+//----------------------------------------------------------------------------
+
+void STM32FlashController::init_flash_loader(flash_loader &loader, chip_definition& chip, const uint8_t *code, size_t code_len, uint32_t unit)
+{
+    bool ok;
+    loader.buff_size = chip.getOptionUInt("loader_buffer_size", &ok);
+    if(!ok || loader.buff_size == 0)
+        loader.buff_size = 1024;
+    loader.buff_size = (loader.buff_size + 3) & ~3;
+
     loader.addr = STM32_SRAM_BASE;
-    loader.buff_addr = loader.addr + sizeof(loader_code_stm32vl);
-    m_conn->c_write_mem32(loader.addr, loader_code_stm32vl, sizeof(loader_code_stm32vl));
+    loader.buff_addr[0] = (loader.addr + code_len + 3) & ~3;
+    loader.buff_addr[1] = loader.buff_addr[0] + loader.buff_size;
+    loader.unit = unit;
+
+    STM32Connection::cmd_queue queue;
+    std::vector<uint8_t> aligned_code(code, code + code_len);
+    aligned_code.resize((code_len + 3) & ~3, 0);
+    queue.write_mem32(loader.addr, aligned_code.data(), aligned_code.size());
+    m_conn->c_execute(queue);
+}
+
+void STM32FlashController::queue_loader_data(STM32Connection::cmd_queue& queue, const flash_loader& loader, int buff, const uint8_t *data, int len)
+{
+    // pad the chunk with erased pattern so that it can be sent by 32bit writes
+    // and the loader never programs garbage from the end of the buffer
+    std::vector<uint8_t> chunk(data, data + len);
+    chunk.resize((len + 3) & ~3, 0xFF);
+    queue.write_mem32(loader.buff_addr[buff], chunk.data(), chunk.size());
 }
 
-void STM32VLFlash::run_flash_loader(const flash_loader &loader, uint32_t target, int size)
+void STM32FlashController::start_flash_loader(const flash_loader &loader, int buff, uint32_t target, int size)
 {
     // setup the core
-    size_t count = size / sizeof(uint16_t);
-    if (size % sizeof(uint16_t))
-        ++count;
-
-    // fill registers for loader
-    m_conn->c_write_reg(loader.buff_addr, 0); // source
-    m_conn->c_write_reg(target, 1);           // target
-    m_conn->c_write_reg(count, 2);            // count in 16 bit half words
-    m_conn->c_write_reg(0, 3);                // flash bank 0 (input)
-    m_conn->c_write_reg(loader.addr, 15);     // PC
-
-    // run the loader
-    m_conn->c_run();
+    uint32_t count = (size + loader.unit - 1) / loader.unit;
+
+    // fill registers for loader and run it
+    STM32Connection::cmd_queue queue;
+    queue.write_reg(loader.buff_addr[buff], 0); // source
+    queue.write_reg(target, 1);                 // target
+    queue.write_reg(count, 2);                  // count in loader units
+    queue.write_reg(0, 3);                      // flash bank 0 (input)
+    queue.write_reg(loader.addr, 15);           // PC
+    queue.run();
+    m_conn->c_execute(queue);
+}
 
+void STM32FlashController::wait_flash_loader()
+{
     // wait until it is done (reaches breakpoint)
     int i;
     const int rounds = 10000;
@@ -507,14 +731,38 @@ void STM32VLFlash::run_flash_loader(const flash_loader &loader, uint32_t target,
         throw tr("Flash loader write error (count: %1)").arg(reg);
 }
 
-void STM32VLFlash::write_data_for_loader(const flash_loader& loader, const uint8_t *data, int len)
+/*
+ * The loader runs from one SRAM buffer while the next chunk is uploaded
+ * to the other one, so SWD transfer time is hidden behind flash
+ * programming time.
+ */
+void STM32FlashController::write_with_loader(const flash_loader& loader, uint32_t addr, const uint8_t *data, int size)
 {
-    size_t chunk = len & ~0x03;
-    size_t rem = len & 0x03;
+    STM32Connection::cmd_queue queue;
 
-    if(chunk)
-        m_conn->c_write_mem32(loader.buff_addr, data, chunk);
+    int len = (std::min)((int)loader.buff_size, size);
+    queue_loader_data(queue, loader, 0, data, len);
+    m_conn->c_execute(queue);
 
-    if(rem)
-        m_conn->c_write_mem8(loader.buff_addr+chunk, data+chunk, rem);
+    int buff = 0;
+    for(int off = 0; off < size;)
+    {
+        start_flash_loader(loader, buff, addr + off, len);
+
+        int next_off = off + len;
+        int next_len = (std::min)((int)loader.buff_size, size - next_off);
+        if(next_len > 0)
+        {
+            queue_loader_data(queue, loader, buff ^ 1, data + next_off, next_len);
+            m_conn->c_execute(queue);
+        }
+
+        wait_flash_loader();
+
+        off = next_off;
+        len = next_len;
+        buff ^= 1;
+
+        emit updateProgressDialog((quint64(off)*100)/size);
+    }
 }
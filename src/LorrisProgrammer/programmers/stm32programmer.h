@@ -48,6 +48,8 @@ public:
 private:
     typedef QScopedPointer<STM32FlashController> flash_ptr;
     uint32_t readChipId();
+    QByteArray readRange(uint32_t addr, uint32_t size);
+    void erase_range(STM32FlashController *flash, chip_definition& chip, uint32_t addr, uint32_t size);
 
     ConnectionPointer<STM32Connection> m_conn;
     bool m_cancel_req;
@@ -74,17 +76,33 @@ public:
     virtual void lock() = 0;
     virtual bool is_locked() = 0;
     virtual void erase_page(uint32_t addr) = 0;
+    virtual void erase_pages(const std::vector<uint32_t>& pages, const bool& cancel);
     virtual void write(chip_definition& chip, uint32_t addr, const char* data, int size) = 0;
 
+    // Polls the busy flag until the current operation finishes and throws
+    // if it takes longer than timeout ms. The progress dialog is updated
+    // with pct while waiting, so it stays responsive.
+    void wait_while_busy(int timeout, int pct, bool busy = true);
+
 protected:
     struct flash_loader
     {
         uint32_t addr;
-        uint32_t buff_addr;
+        uint32_t buff_addr[2];
+        uint32_t buff_size;
+        uint32_t unit;
     };
 
+    void init_flash_loader(flash_loader& loader, chip_definition& chip, const uint8_t *code, size_t code_len, uint32_t unit);
+    void write_with_loader(const flash_loader& loader, uint32_t addr, const uint8_t *data, int size);
+
     ConnectionPointer<STM32Connection> m_conn;
     QByteArray m_flash_loader;
+
+private:
+    void queue_loader_data(STM32Connection::cmd_queue& queue, const flash_loader& loader, int buff, const uint8_t *data, int len);
+    void start_flash_loader(const flash_loader& loader, int buff, uint32_t target, int size);
+    void wait_flash_loader();
 };
 
 
@@ -103,6 +121,7 @@ public:
     virtual void lock();
     virtual bool is_locked();
     virtual void erase_page(uint32_t addr);
+    virtual void erase_pages(const std::vector<uint32_t>& pages, const bool& cancel);
     virtual void write(chip_definition &chip, uint32_t addr, const char* data, int size);
 
 private:
@@ -110,9 +129,31 @@ private:
     uint32_t read_cr();
     void set_cr_bit(uint8_t bit);
     void add_cr_bit(uint8_t bit);
-    void init_flash_loader(flash_loader& loader);
-    void run_flash_loader(const flash_loader& loader, uint32_t target, int size);
-    void write_data_for_loader(const flash_loader& loader, const uint8_t *data, int len);
+
+    bool m_lock_on_destroy;
+};
+
+class STM32F4Flash : public STM32FlashController
+{
+    Q_OBJECT
+public:
+    STM32F4Flash(ConnectionPointer<STM32Connection> const & conn);
+    ~STM32F4Flash();
+
+    virtual bool supports_mass_erase() { return true; }
+
+    virtual void erase_mass();
+    virtual bool is_busy();
+    virtual void unlock(bool guard = true);
+    virtual void lock();
+    virtual bool is_locked();
+    virtual void erase_page(uint32_t addr);
+    virtual void erase_pages(const std::vector<uint32_t>& pages, const bool& cancel);
+    virtual void write(chip_definition &chip, uint32_t addr, const char* data, int size);
+
+private:
+    uint32_t read_cr();
+    static uint32_t sector_for_addr(uint32_t addr);
 
     bool m_lock_on_destroy;
 };
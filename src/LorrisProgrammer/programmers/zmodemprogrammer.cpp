@@ -27,12 +27,70 @@ enum recv_state {
     st_hdr_hex,
 };
 
+enum sender_event {
+    ev_none,
+    ev_rpos,
+    ev_rinit,
+};
+
+// waitForPkt() returns on any received header
+static const int ANY_PKT = -1;
+
+// How many times may the receiver ask for a retransmission from the same position
+static const int MAX_RPOS_RETRIES = 10;
+
+// Slice-by-8 CRC-32, the data subpackets are checksummed with this
+// instead of the byte-wise ucrc32. Table 0 is crc32tbl.
+namespace {
+class Crc32Slicer
+{
+public:
+    Crc32Slicer()
+    {
+        for(int i = 0; i < 256; ++i)
+            m_tbl[0][i] = crc32tbl[i];
+        for(int i = 0; i < 256; ++i)
+            for(int k = 1; k < 8; ++k)
+                m_tbl[k][i] = (m_tbl[k-1][i] >> 8) ^ m_tbl[0][m_tbl[k-1][i] & 0xFF];
+    }
+
+    quint32 update(quint32 crc, const quint8 *data, size_t len) const
+    {
+        for(; len >= 8; data += 8, len -= 8)
+        {
+            quint32 lo = crc ^ (data[0] | (data[1] << 8) | (data[2] << 16) | (quint32(data[3]) << 24));
+            quint32 hi = data[4] | (data[5] << 8) | (data[6] << 16) | (quint32(data[7]) << 24);
+            crc = m_tbl[7][lo & 0xFF] ^ m_tbl[6][(lo >> 8) & 0xFF] ^
+                  m_tbl[5][(lo >> 16) & 0xFF] ^ m_tbl[4][lo >> 24] ^
+                  m_tbl[3][hi & 0xFF] ^ m_tbl[2][(hi >> 8) & 0xFF] ^
+                  m_tbl[1][(hi >> 16) & 0xFF] ^ m_tbl[0][hi >> 24];
+        }
+
+        for(; len != 0; ++data, --len)
+            crc = ucrc32(*data, crc);
+        return crc;
+    }
+
+private:
+    quint32 m_tbl[8][256];
+};
+
+static const Crc32Slicer crc32Slicer;
+}
+
+static quint32 hdrPos(const QByteArray& hdr)
+{
+    return quint8(hdr[ZP0]) | (quint8(hdr[ZP1]) << 8) |
+            (quint8(hdr[ZP2]) << 16) | (quint32(quint8(hdr[ZP3])) << 24);
+}
+
 ZmodemProgrammer::ZmodemProgrammer(const ConnectionPointer<PortConnection> &conn, ProgrammerLogSink *logsink) :
     Programmer(logsink), m_conn(conn)
 {
     m_conn = conn;
     m_flash_mode = false;
     m_cancel_requested = false;
+    m_queue_headers = false;
     m_bootseq = sConfig.get(CFG_STRING_ZMODEM_BOOTSEQ);
     m_recv_state = st_idle;
     m_escape_ctrl_chars = false;
@@ -40,7 +98,8 @@ ZmodemProgrammer::ZmodemProgrammer(const ConnectionPointer<PortConnection> &conn
     m_drop_newline = false;
     m_recv_32bit_data = false;
     m_wait_pkt = 0;
-    m_send_bufsize = 4096;
+    m_send_bufsize = 0;
+    m_rx_can_stream = false;
 
     connect(m_conn.data(), SIGNAL(dataRead(QByteArray)), this, SLOT(dataRead(QByteArray)));
 }
@@ -129,6 +188,31 @@ void ZmodemProgrammer::erase_device(chip_definition& chip)
     throw tr("Zmodem protocol cannot erase the device.");
 }
 
+// Headers are queued for takeHeaders() only while a transfer runs,
+// the terminal traffic in between would just pile up.
+namespace {
+class HeaderQueueScope
+{
+public:
+    HeaderQueueScope(bool& enabled, QList<QByteArray>& headers)
+        : m_enabled(enabled), m_headers(headers)
+    {
+        m_headers.clear();
+        m_enabled = true;
+    }
+
+    ~HeaderQueueScope()
+    {
+        m_enabled = false;
+        m_headers.clear();
+    }
+
+private:
+    bool& m_enabled;
+    QList<QByteArray>& m_headers;
+};
+}
+
 void ZmodemProgrammer::flashRaw(HexFile& file, quint8 memId, chip_definition& chip, VerifyMode verifyMode)
 {
     sendHexHeader(ZRQINIT);
@@ -151,43 +235,143 @@ void ZmodemProgrammer::flashRaw(HexFile& file, quint8 memId, chip_definition& ch
     buf.append('\0');
     sendBin32Data(ZCRCW, buf);
 
+    m_wait_hdr.clear();
     if(!waitForPkt(ZRPOS, 2000))
         qDebug() << tr("Timeout while waiting for ZRPOS.");
 
     m_cancel_requested = false;
 
-    int sent = 0;
-    while(sent < data.size()) {
-        int chunk = (std::min)(m_send_bufsize, data.size() - sent);
-        buf = data.mid(sent, chunk);
-
-        sendBin32Header(ZDATA, sent, sent >> 8, sent >> 16, sent >> 24);
-
-        sent += chunk;
+    const quint32 size = data.size();
+    quint32 pos = m_wait_hdr.isEmpty() ? 0 : hdrPos(m_wait_hdr);
+    if(pos > size)
+        pos = 0;
+    quint32 acked = pos;
+    quint32 rpos = pos;
+
+    // Receivers that can overlap disk and serial I/O get a continuous
+    // stream of ZCRCG subpackets with a ZCRCQ every quarter of the window,
+    // sending stops when the window of unacknowledged data is full.
+    // Receivers with a limited buffer get ZCRCW at the end of each buffer,
+    // others one subpacket at a time.
+    const quint32 window = sConfig.get(CFG_QUINT32_ZMODEM_WINDOW);
+    const quint32 bufsize = m_send_bufsize;
+    const bool streaming = bufsize == 0 && m_rx_can_stream;
+
+    // stop-and-wait, keep the subpackets as large as they always were
+    const quint32 sublen = (bufsize == 0 && !streaming) ? 4096 : ZBLOCKLEN;
+
+    HeaderQueueScope queue(m_queue_headers, m_rx_headers);
+
+    int retries = 0;
+    quint32 err_pos = pos;
+    bool new_frame = true;
+    quint32 frame_bytes = 0;
+    quint32 since_ack_req = 0;
+
+    for(;;)
+    {
+        while(pos < size && !m_cancel_requested)
+        {
+            if(new_frame)
+            {
+                sendBin32Header(ZDATA, pos, pos >> 8, pos >> 16, pos >> 24);
+                new_frame = false;
+                frame_bytes = 0;
+                since_ack_req = 0;
+            }
 
-        quint8 type = ZCRCW;
-        if(sent >= data.size())
-            type = ZCRCE;
+            quint32 chunk = (std::min)(sublen, size - pos);
+            if(bufsize != 0)
+                chunk = (std::min)(chunk, bufsize - frame_bytes);
+
+            const quint32 start = pos;
+            pos += chunk;
+            frame_bytes += chunk;
+            since_ack_req += chunk;
+
+            quint8 type = ZCRCG;
+            if(pos >= size)
+                type = ZCRCE;
+            else if(bufsize != 0 ? frame_bytes >= bufsize : !streaming)
+                type = ZCRCW;
+            else if(window != 0 && since_ack_req >= window/4)
+                type = ZCRCQ;
+
+            if(type == ZCRCQ)
+                since_ack_req = 0;
+
+            sendBin32Data(type, QByteArray::fromRawData(data.constData() + start, chunk));
+
+            if(type == ZCRCW || type == ZCRCE)
+                new_frame = true;
+
+            int ev = ev_none;
+            if(type == ZCRCW)
+            {
+                while((ev = takeHeaders(acked, rpos)) != ev_rpos && acked < pos)
+                {
+                    if(!waitForPkt(ANY_PKT, 2000))
+                        throw tr("Timeout while waiting for ZACK.");
+                }
+            }
+            else if(streaming)
+            {
+                // ZACKs and ZRPOS sent while we were streaming are picked up
+                // once the window is full, the event loop only runs there
+                while((ev = takeHeaders(acked, rpos)) != ev_rpos && window != 0 && pos - acked > window)
+                {
+                    if(!waitForPkt(ANY_PKT, 2000))
+                        throw tr("Timeout while waiting for ZACK.");
+                }
+            }
 
-        sendBin32Data(type, buf);
+            if(ev == ev_rpos)
+            {
+                if(rpos != err_pos)
+                {
+                    err_pos = rpos;
+                    retries = 0;
+                }
+                if(++retries > MAX_RPOS_RETRIES)
+                    throw tr("Too many errors, the transfer has failed.");
+                pos = rpos;
+                new_frame = true;
+            }
 
-        if(type == ZCRCW && !waitForPkt(ZACK, 2000))
-            throw tr("Timeout while waiting for ZACK.");
+            emit updateProgressDialog(double(pos)/size*100);
+        }
 
         if(m_cancel_requested)
         {
-            qDebug() << "cancel";
             emit updateProgressDialog(-1);
             m_cancel_requested = false;
-            break;
+            sendCancel();
+            return;
         }
 
-        emit updateProgressDialog(double(sent)/data.size()*100);
-    }
+        sendHexHeader(ZEOF, pos, pos >> 8, pos >> 16, pos >> 24);
 
-    sendHexHeader(ZEOF, sent, sent >> 8, sent >> 16, sent >> 24);
-    if(!waitForPkt(ZRINIT, 2000))
-        throw tr("Timeout while waiting for ZRINIT.");
+        // The receiver may still ask for a part of the file it did not get
+        int ev;
+        while((ev = takeHeaders(acked, rpos)) == ev_none)
+        {
+            if(!waitForPkt(ANY_PKT, 2000))
+                throw tr("Timeout while waiting for ZRINIT.");
+        }
+
+        if(ev == ev_rinit)
+            break;
+
+        if(rpos != err_pos)
+        {
+            err_pos = rpos;
+            retries = 0;
+        }
+        if(++retries > MAX_RPOS_RETRIES)
+            throw tr("Too many errors, the transfer has failed.");
+        pos = rpos;
+        new_frame = true;
+    }
 
     sendHexHeader(ZFIN);
     if(!waitForPkt(ZFIN, 2000))
@@ -195,6 +379,45 @@ void ZmodemProgrammer::flashRaw(HexFile& file, quint8 memId, chip_definition& ch
     m_conn->SendData(QByteArray("OO"));
 }
 
+int ZmodemProgrammer::takeHeaders(quint32& acked, quint32& rpos)
+{
+    int res = ev_none;
+    while(!m_rx_headers.isEmpty())
+    {
+        const QByteArray hdr = m_rx_headers.takeFirst();
+        const quint32 pos = hdrPos(hdr);
+        switch(hdr[0])
+        {
+            case ZACK:
+                if(pos > acked)
+                    acked = pos;
+                break;
+            case ZRPOS:
+                rpos = acked = pos;
+                res = ev_rpos;
+                break;
+            case ZRINIT:
+                if(res == ev_none)
+                    res = ev_rinit;
+                break;
+            case ZSKIP:
+            case ZABORT:
+            case ZFERR:
+                throw tr("The receiver has aborted the transfer.");
+        }
+    }
+    return res;
+}
+
+void ZmodemProgrammer::sendCancel()
+{
+    // 8 CANs abort the session, the backspaces erase them if the other
+    // side is not in ZMODEM mode anymore
+    QByteArray seq(8, ZDLE);
+    seq.append(QByteArray(8, '\b'));
+    m_conn->SendData(seq);
+}
+
 bool ZmodemProgrammer::waitForPkt(int waitPkt, int timeout)
 {
     if(m_wait_pkt != 0)
@@ -203,6 +426,10 @@ bool ZmodemProgrammer::waitForPkt(int waitPkt, int timeout)
         return false;
     }
 
+    // Headers may already be waiting
+    if(waitPkt == ANY_PKT && !m_rx_headers.isEmpty())
+        return true;
+
     m_wait_pkt = waitPkt;
 
     QEventLoop ev;
@@ -329,12 +556,12 @@ void ZmodemProgrammer::sendBin32Header(quint8 type, quint8 a1, quint8 a2, quint8
 void ZmodemProgrammer::sendBin32Data(quint8 type, const QByteArray& data)
 {
     QByteArray buf;
-    quint32 crc = 0xffffffffL;
+    buf.reserve(data.size() + data.size()/16 + 16);
+
+    quint32 crc = crc32Slicer.update(0xffffffffL, (const quint8*)data.constData(), data.size());
 
-    for(int i = 0; i < data.size(); ++i) {
-        crc = ucrc32((quint8)data[i], crc);
+    for(int i = 0; i < data.size(); ++i)
         appendEscapedByte(buf, data[i]);
-    }
 
     crc = ucrc32(type, crc);
     buf.append(ZDLE);
@@ -580,20 +807,26 @@ void ZmodemProgrammer::processHeader(const QByteArray& hdr) {
     case ZRINIT:
         // Ignoring most flags
         m_escape_ctrl_chars = (hdr[ZF0] & ZF0_ESCCTL) != 0;
+        m_rx_can_stream = (hdr[ZF0] & (ZF0_CANFDX | ZF0_CANOVIO)) == (ZF0_CANFDX | ZF0_CANOVIO);
 
-        m_send_bufsize = hdr[ZP0] | (hdr[ZP1] << 8);
-        if(m_send_bufsize <= 0 || m_send_bufsize > 32*1024*1024)
-            m_send_bufsize = 4096;
+        // zero means the receiver can take the whole file nonstop
+        m_send_bufsize = quint8(hdr[ZP0]) | (quint8(hdr[ZP1]) << 8);
         break;
     case ZRPOS:
     case ZACK:
     case ZFIN:
+    case ZSKIP:
+    case ZABORT:
+    case ZFERR:
         break;
     default:
         qDebug() << "zmodem: got unhandled header " << frame_type;
     }
 
-    if(m_wait_pkt == frame_type) {
+    if(m_queue_headers)
+        m_rx_headers.append(hdr);
+
+    if(m_wait_pkt == frame_type || m_wait_pkt == ANY_PKT) {
         m_wait_hdr = hdr;
         emit waitPktDone();
     }
@@ -60,6 +60,8 @@ private:
     bool rx_hex_byte(int &c);
     void processHeader(const QByteArray& hdr);
     bool waitForPkt(int waitPkt, int timeout);
+    int takeHeaders(quint32& acked, quint32& rpos);
+    void sendCancel();
 
     ConnectionPointer<PortConnection> m_conn;
     QString m_bootseq;
@@ -67,6 +69,8 @@ private:
     bool m_cancel_requested;
     int m_wait_pkt;
     QByteArray m_wait_hdr;
+    QList<QByteArray> m_rx_headers;
+    bool m_queue_headers;
 
     int m_recv_state;
     bool m_escape_ctrl_chars;
@@ -76,6 +80,7 @@ private:
     QByteArray m_recv_buff;
     QByteArray m_hex_nibble_buff;
     int m_send_bufsize;
+    bool m_rx_can_stream;
 };
 
 
@@ -7,6 +7,7 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <algorithm>
 #include <QEventLoop>
 
 #include "shupito.h"
@@ -16,6 +17,9 @@
 #include "../connection/connectionmgr2.h"
 #include "../connection/shupitoconn.h"
 
+// Incoming tunnel data are emitted right away once there is this much of them
+static const int TUNNEL_FLUSH_SIZE = 16*1024;
+
 Shupito::Shupito(QObject *parent) :
     QObject(parent)
 {
@@ -27,7 +31,9 @@ Shupito::Shupito(QObject *parent) :
     m_tunnel_pipe = 0;
     m_tunnel_speed = 0;
 
-    m_tunnel_timer.setInterval(50);
+    m_tunnel_timer.setInterval(0);
+    m_tunnel_timer.setSingleShot(true);
+    connect(&m_tunnel_timer, SIGNAL(timeout()), SLOT(flushTunnelData()));
 
     responseTimer = NULL;
     m_wait_cmd = 0xFF;
@@ -208,23 +214,28 @@ void Shupito::sendTunnelData(const QByteArray &data)
     quint8 cmd = getTunnelCmd();
     char pipe = getTunnelId();
 
+    // one byte of the payload is taken by the pipe id
+    const int max_chunk = int(maxPacketSize()) - 1;
+    quint8 const * d = (quint8 const *)data.constData();
+
+    ShupitoPacket packet;
+    packet.reserve(std::min(data_len, max_chunk) + 2);
     while(sent != data_len)
     {
-        int chunk = data_len - sent;
-        if(chunk > 14)
-            chunk = 14;
+        const int chunk = std::min(data_len - sent, max_chunk);
 
-        ShupitoPacket packet;
+        packet.clear();
         packet.push_back(cmd);
         packet.push_back(pipe);
-
-        quint8 const * d = (quint8 const *)data.constData();
         packet.insert(packet.end(), d + sent, d + sent + chunk);
 
         m_con->sendPacket(packet);
 
         sent += chunk;
     }
+
+    if(m_tunnel_conn)
+        m_tunnel_conn->stats().sent(data_len);
 }
 
 void Shupito::handleVccPacket(ShupitoPacket const & p)
@@ -348,8 +359,6 @@ void Shupito::handleTunnelPacket(ShupitoPacket const & p)
                     emit tunnelStatus(true);
 
                     m_tunnel_data.clear();
-                    connect(&m_tunnel_timer, SIGNAL(timeout()), SLOT(tunnelDataSend()));
-                    m_tunnel_timer.start();
                     return;
                 }
                 break;
@@ -361,10 +370,8 @@ void Shupito::handleTunnelPacket(ShupitoPacket const & p)
                 {
                     m_tunnel_pipe = 0;
 
+                    flushTunnelData();
                     emit tunnelStatus(false);
-
-                    disconnect(&m_tunnel_timer, SIGNAL(timeout()), this, SLOT(tunnelDataSend()));
-                    m_tunnel_timer.stop();
                     return;
                 }
                 break;
@@ -374,7 +381,15 @@ void Shupito::handleTunnelPacket(ShupitoPacket const & p)
     // Tunnel incoming data
     if (m_tunnel_pipe && p[1] == m_tunnel_pipe)
     {
+        if(m_tunnel_data.isEmpty())
+        {
+            m_tunnel_data_age.start();
+            m_tunnel_timer.start();
+        }
+
         m_tunnel_data.append((char const *)p.data() + 2, p.size() - 2);
+        if(m_tunnel_data.size() >= TUNNEL_FLUSH_SIZE)
+            flushTunnelData();
     }
 }
 
@@ -457,14 +472,19 @@ qint16 Shupito::getTunnelCmd()
     return -1;
 }
 
-void Shupito::tunnelDataSend()
+void Shupito::flushTunnelData()
 {
-    if(m_tunnel_data.size() > 0)
-    {
-        emit tunnelData(m_tunnel_data);
-        m_tunnel_data.clear();
-    }
-    m_tunnel_timer.start();
+    m_tunnel_timer.stop();
+    if(m_tunnel_data.isEmpty())
+        return;
+
+    if(m_tunnel_conn)
+        m_tunnel_conn->stats().dispatchLatency(m_tunnel_data_age.nsecsElapsed() / 1000);
+
+    // emitted data are shared by the receivers, start a new buffer
+    const QByteArray data = m_tunnel_data;
+    m_tunnel_data = QByteArray();
+    emit tunnelData(data);
 }
 
 void Shupito::setTunnelState(bool enable, bool wait)
@@ -12,6 +12,7 @@
 #include <QByteArray>
 #include <QMutex>
 #include <QTimer>
+#include <QElapsedTimer>
 
 #include "../shared/programmer.h"
 #include "../shared/chipdefs.h"
@@ -106,7 +107,7 @@ public slots:
     void sendTunnelData(const QByteArray& data);
 
 private slots:
-    void tunnelDataSend();
+    void flushTunnelData();
     void descReceived(ShupitoDesc const & desc);
 
 private:
@@ -127,8 +128,10 @@ private:
 
     quint8 m_tunnel_pipe;
     quint32 m_tunnel_speed;
+    // Incoming tunnel data, emitted once the event loop gets idle
     QByteArray m_tunnel_data;
     QTimer m_tunnel_timer;
+    QElapsedTimer m_tunnel_data_age;
     size_t m_max_packet_size;
 
     QTimer *responseTimer;
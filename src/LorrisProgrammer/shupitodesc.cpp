@@ -29,7 +29,7 @@ void ShupitoDesc::AddData(const QByteArray& data)
     quint8 *last = (quint8*)(first + m_data.size());
 
     if((last - first) < 17 || *first++ != 1)
-        return Utils::showErrorBox("Invalid descriptor.");
+        throw QString(QObject::tr("Invalid descriptor."));
 
     m_guid = makeGuid(first);
     first += 16;
@@ -59,7 +59,7 @@ QString ShupitoDesc::makeGuid(quint8 *data)
 void ShupitoDesc::parseGroupConfig(quint8 *& first, quint8 *& last, quint8& base_cmd, std::vector<quint8>& actseq)
 {
     if(first == last)
-        return Utils::showErrorBox("Invalid descriptor.");
+        throw QString(QObject::tr("Invalid descriptor."));
 
     if(*first == 0)
     {
@@ -100,7 +100,7 @@ void ShupitoDesc::parseGroupConfig(quint8 *& first, quint8 *& last, quint8& base
 void ShupitoDesc::parseConfig(quint8 *& first, quint8 *& last, quint8& base_cmd, std::vector<quint8>& actseq)
 {
     if ((last - first) < 19)
-        return Utils::showErrorBox("Invalid descriptor.");
+        throw QString(QObject::tr("Invalid descriptor."));
 
     config cfg;
     cfg.flags = *first++;
@@ -115,7 +115,7 @@ void ShupitoDesc::parseConfig(quint8 *& first, quint8 *& last, quint8& base_cmd,
 
     quint8 data_len = *first++;
     if (last - first < data_len)
-        return Utils::showErrorBox("Invalid descriptor.");
+        throw QString(QObject::tr("Invalid descriptor."));
 
     cfg.data.assign(first, first + data_len);
     first += data_len;
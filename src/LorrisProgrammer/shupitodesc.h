@@ -40,6 +40,7 @@ public:
     bool isEmpty() const { return m_guid.isEmpty(); }
     void Clear();
 
+    // Throws an error message if the descriptor is invalid
     void AddData(const QByteArray &data);
     QString makeGuid(quint8 *data);
     void parseGroupConfig(quint8 *& first, quint8 *& last, quint8& base_cmd, std::vector<quint8>& actseq);
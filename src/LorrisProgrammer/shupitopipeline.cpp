@@ -0,0 +1,88 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#include <QEventLoop>
+#include <QTimer>
+
+#include "shupitopipeline.h"
+
+ShupitoPipeline::ShupitoPipeline(Shupito *shupito, size_t window)
+    : m_shupito(shupito), m_window(window ? window : 1), m_loop(NULL), m_wait_limit(0)
+{
+}
+
+ShupitoPipeline::~ShupitoPipeline()
+{
+    for(std::set<quint8>::iterator itr = m_cmds.begin(); itr != m_cmds.end(); ++itr)
+        m_shupito->unregisterCapture(*itr);
+}
+
+void ShupitoPipeline::send(ShupitoPacket const & pkt, handler_t const & handler)
+{
+    Q_ASSERT(!pkt.empty());
+
+    this->wait(m_window - 1);
+
+    if(m_cmds.insert(pkt[0]).second)
+        m_shupito->registerCapture(pkt[0], *this);
+
+    entry e;
+    e.cmd = pkt[0];
+    e.handler = handler;
+    m_queue.push_back(e);
+
+    m_shupito->sendPacket(pkt);
+}
+
+void ShupitoPipeline::wait(size_t max_pending)
+{
+    while(m_queue.size() > max_pending && m_error.isEmpty())
+    {
+        QEventLoop loop;
+        QTimer timer;
+        timer.setSingleShot(true);
+        QObject::connect(&timer, SIGNAL(timeout()), &loop, SLOT(quit()));
+        timer.start(1000);
+
+        size_t before = m_queue.size();
+        m_loop = &loop;
+        m_wait_limit = max_pending;
+        loop.exec();
+        m_loop = NULL;
+
+        if(m_queue.size() == before && m_error.isEmpty())
+            m_error = QObject::tr("Shupito did not respond in time");
+    }
+
+    if(!m_error.isEmpty())
+    {
+        QString error = m_error;
+        m_error.clear();
+        m_queue.clear();
+        throw error;
+    }
+}
+
+void ShupitoPipeline::onPacket(ShupitoPacket const & pkt)
+{
+    if(m_queue.empty() || m_queue.front().cmd != pkt[0])
+    {
+        if(m_error.isEmpty())
+            m_error = QObject::tr("Invalid response received from Shupito");
+    }
+    else
+    {
+        entry e = m_queue.front();
+        m_queue.pop_front();
+
+        if(e.handler && m_error.isEmpty())
+            m_error = e.handler(pkt);
+    }
+
+    if(m_loop && (m_queue.size() <= m_wait_limit || !m_error.isEmpty()))
+        m_loop->quit();
+}
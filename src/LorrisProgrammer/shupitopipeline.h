@@ -0,0 +1,64 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#ifndef SHUPITOPIPELINE_H
+#define SHUPITOPIPELINE_H
+
+#include <QString>
+#include <deque>
+#include <set>
+#include <functional>
+
+#include "shupito.h"
+
+class QEventLoop;
+
+/*
+ * Sends packets to Shupito without waiting for each response.
+ *
+ * Shupito answers commands in the order it has received them, so responses
+ * are matched against the queue of sent packets as they arrive. Up to
+ * `window` packets are in flight, send() blocks in a nested event loop
+ * when the window is full. Errors reported by handlers are thrown
+ * as QString from the next send() or wait().
+ */
+class ShupitoPipeline
+    : public ShupitoPacketCapture
+{
+public:
+    // Returns an error message or an empty string
+    typedef std::function<QString (ShupitoPacket const &)> handler_t;
+
+    ShupitoPipeline(Shupito *shupito, size_t window);
+    ~ShupitoPipeline();
+
+    void send(ShupitoPacket const & pkt, handler_t const & handler = handler_t());
+    void wait(size_t max_pending);
+    void drain() { this->wait(0); }
+
+    size_t pending() const { return m_queue.size(); }
+
+    void onPacket(ShupitoPacket const & pkt) override;
+
+private:
+    struct entry
+    {
+        quint8 cmd;
+        handler_t handler;
+    };
+
+    Shupito *m_shupito;
+    size_t m_window;
+    std::set<quint8> m_cmds;
+    std::deque<entry> m_queue;
+    QString m_error;
+
+    QEventLoop *m_loop;
+    size_t m_wait_limit;
+};
+
+#endif // SHUPITOPIPELINE_H
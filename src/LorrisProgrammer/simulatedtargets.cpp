@@ -0,0 +1,832 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#include <algorithm>
+
+#include "simulatedtargets.h"
+#include "shupito.h"
+#include "../shared/defmgr.h"
+#include "../shared/hexfile.h"
+#include "programmers/zmodemprogrammer-defines.h"
+
+SimulatedChip::SimulatedChip(QString const & sign, quint32 page_write_us)
+    : m_chip(sDefMgr.findChipdef(sign)), m_page_write_us(page_write_us)
+{
+    QHash<QString, chip_definition::memorydef>& mems = m_chip.getMems();
+    for(QHash<QString, chip_definition::memorydef>::iterator itr = mems.begin(); itr != mems.end(); ++itr)
+        m_mems[chip_definition::memNameToId(itr.key())] = QByteArray(itr->size, (char)0xFF);
+}
+
+void SimulatedChip::received(SimulatedPort *port, const QByteArray& data)
+{
+    m_rx.append(data);
+
+    int pos = 0;
+    while(pos < m_rx.size())
+    {
+        int used = command(port, m_rx.constData() + pos, m_rx.size() - pos);
+        if(used == 0)
+            break;
+        pos += used;
+    }
+    m_rx.remove(0, pos);
+}
+
+void SimulatedChip::write(quint8 memId, quint32 address, const char *data, int len)
+{
+    QByteArray& mem = m_mems[memId];
+    if(address >= (quint32)mem.size())
+        return;
+
+    len = std::min(len, int(mem.size() - address));
+    std::copy(data, data + len, mem.begin() + address);
+}
+
+QByteArray SimulatedChip::read(quint8 memId, quint32 address, int len)
+{
+    QByteArray res(len, (char)0xFF);
+
+    QByteArray const & mem = m_mems[memId];
+    if(address < (quint32)mem.size())
+    {
+        int avail = std::min(len, int(mem.size() - address));
+        std::copy(mem.constData() + address, mem.constData() + address + avail, res.begin());
+    }
+    return res;
+}
+
+void SimulatedChip::erase(quint8 memId)
+{
+    m_mems[memId].fill((char)0xFF);
+}
+
+quint16 SimulatedChip::pageSize(quint8 memId)
+{
+    chip_definition::memorydef *memdef = m_chip.getMemDef(memId);
+    if(!memdef || memdef->pagesize == 0)
+        return 1;
+    return memdef->pagesize;
+}
+
+quint32 SimulatedChip::writeTime(quint8 memId, int len)
+{
+    const quint16 pagesize = pageSize(memId);
+    return m_page_write_us * std::max(1, (len + pagesize - 1) / pagesize);
+}
+
+QByteArray SimulatedChip::signature()
+{
+    QString const & sign = m_chip.getSign();
+    return QByteArray::fromHex(sign.mid(sign.indexOf(':') + 1).toLatin1());
+}
+
+// --- Shupito ---
+
+// The descriptor announces one configuration, AVR SPI programming,
+// with commands starting at SPI_CMD.
+static const quint8 SPI_CMD = 1;
+static const quint8 SPI_CMD_COUNT = 8;
+static const char SHUPITO_GUID[] = "093d7f32cdc64928955d513d17a85358";
+static const char SPI_GUID[] = "46dbc865b4d0466b9b702f3f5b264e65";
+
+SimulatedShupito::SimulatedShupito(quint32 page_write_us)
+    : SimulatedChip("avr:1e950f", page_write_us)
+{
+    m_page_mem = MEM_NONE;
+}
+
+int SimulatedShupito::command(SimulatedPort *port, const char *data, int len)
+{
+    // resync on the packet start
+    if(quint8(data[0]) != 0x80)
+        return 1;
+
+    if(len < 2)
+        return 0;
+
+    const int size = data[1] & 0x0F;
+    if(len < 2 + size)
+        return 0;
+
+    packet(port, quint8(data[1]) >> 4, QByteArray(data + 2, size));
+    return 2 + size;
+}
+
+void SimulatedShupito::appendPacket(QByteArray& dest, quint8 cmd, const QByteArray& payload)
+{
+    Q_ASSERT(payload.size() <= 15);
+
+    dest.append((char)0x80);
+    dest.append(char((cmd << 4) | payload.size()));
+    dest.append(payload);
+}
+
+void SimulatedShupito::sendStatus(SimulatedPort *port, quint8 cmd, quint8 status, quint32 busy_us)
+{
+    QByteArray pkt;
+    appendPacket(pkt, cmd, QByteArray(1, status));
+    port->reply(pkt, busy_us);
+}
+
+void SimulatedShupito::sendDescriptor(SimulatedPort *port)
+{
+    QByteArray desc;
+    desc.append(char(1));
+    desc.append(QByteArray::fromHex(SHUPITO_GUID));
+    desc.append(char(0)); // single config
+    desc.append(char(0)); // flags
+    desc.append(QByteArray::fromHex(SPI_GUID));
+    desc.append(char(SPI_CMD));
+    desc.append(char(SPI_CMD_COUNT));
+    desc.append(char(0)); // no data
+
+    // Full packets mean that the descriptor continues
+    QByteArray res;
+    for(int i = 0; i <= desc.size(); i += 15)
+        appendPacket(res, MSG_INFO, desc.mid(i, 15));
+    port->reply(res);
+}
+
+void SimulatedShupito::packet(SimulatedPort *port, quint8 cmd, const QByteArray& args)
+{
+    const quint8 *a = (const quint8*)args.constData();
+
+    if(cmd == MSG_INFO)
+    {
+        if(args.size() == 1 && a[0] == 0)
+            sendDescriptor(port);
+        else
+            sendStatus(port, cmd, 0); // configuration (de)activation
+        return;
+    }
+
+    if(cmd < SPI_CMD || cmd >= SPI_CMD + SPI_CMD_COUNT)
+        return;
+
+    switch(cmd - SPI_CMD)
+    {
+        case 0: // enter programming mode
+        case 1: // leave programming mode
+            sendStatus(port, cmd, 0);
+            break;
+        case 2: // signature
+        {
+            QByteArray res;
+            appendPacket(res, cmd, signature() + QByteArray(1, 0));
+            port->reply(res);
+            break;
+        }
+        case 3: // read, answered with a stream
+        {
+            if(args.size() != 7)
+                return sendStatus(port, cmd, 1);
+
+            const quint32 address = a[1] | (a[2] << 8) | (a[3] << 16) | (quint32(a[4]) << 24);
+            const int size = a[5] | (a[6] << 8);
+            const QByteArray data = read(a[0], address, size);
+
+            QByteArray res;
+            for(int i = 0; i <= data.size(); i += 15)
+                appendPacket(res, cmd, data.mid(i, 15));
+            port->reply(res);
+            break;
+        }
+        case 4: // chip erase, or prepare memory for writing
+            if(args.isEmpty())
+            {
+                erase(MEM_FLASH);
+                return sendStatus(port, cmd, 0, m_page_write_us*2);
+            }
+            sendStatus(port, cmd, 0);
+            break;
+        case 5: // start page
+            if(args.size() != 5)
+                return sendStatus(port, cmd, 1);
+            m_page_mem = a[0];
+            m_page.clear();
+            sendStatus(port, cmd, 0);
+            break;
+        case 6: // page data
+            if(args.isEmpty() || a[0] != m_page_mem)
+                return sendStatus(port, cmd, 1);
+            m_page.append(args.constData() + 1, args.size() - 1);
+            sendStatus(port, cmd, 0);
+            break;
+        case 7: // write page
+        {
+            if(args.size() != 5 || a[0] != m_page_mem)
+                return sendStatus(port, cmd, 1);
+
+            const quint32 address = a[1] | (a[2] << 8) | (a[3] << 16) | (quint32(a[4]) << 24);
+            write(m_page_mem, address, m_page.constData(), m_page.size());
+            sendStatus(port, cmd, 0, writeTime(m_page_mem, m_page.size()));
+            m_page.clear();
+            break;
+        }
+    }
+}
+
+// --- AVR109 ---
+
+SimulatedAvr109::SimulatedAvr109(quint32 page_write_us)
+    : SimulatedChip("avr:1e950f", page_write_us)
+{
+    m_address = 0;
+    m_page_addr = 0;
+    m_page = QByteArray(pageSize(MEM_FLASH), (char)0xFF);
+}
+
+int SimulatedAvr109::command(SimulatedPort *port, const char *data, int len)
+{
+    const quint8 *d = (const quint8*)data;
+    const quint16 pagesize = pageSize(MEM_FLASH);
+
+    switch(data[0])
+    {
+        case 't': // supported devices, terminated by 0
+            port->reply(QByteArray("\x44\x00", 2));
+            return 1;
+        case 'S':
+            port->reply("AVRBOOT");
+            return 1;
+        case 'V':
+            port->reply("10");
+            return 1;
+        case 'p':
+            port->reply("S");
+            return 1;
+        case 'a':
+            port->reply("Y");
+            return 1;
+        case 'b':
+        {
+            const char res[] = { 'Y', char(pagesize >> 8), char(pagesize) };
+            port->reply(QByteArray(res, sizeof(res)));
+            return 1;
+        }
+        case 's':
+        {
+            // low byte first
+            QByteArray sign = signature();
+            std::reverse(sign.begin(), sign.end());
+            port->reply(sign);
+            return 1;
+        }
+        case 'A':
+            if(len < 3)
+                return 0;
+            m_address = (d[1] << 8) | d[2];
+            port->reply("\r");
+            return 3;
+        case 'H':
+            if(len < 4)
+                return 0;
+            m_address = (d[1] << 16) | (d[2] << 8) | d[3];
+            port->reply("\r");
+            return 4;
+        case 'e':
+            erase(MEM_FLASH);
+            port->reply("\r", m_page_write_us*2);
+            return 1;
+        case 'E':
+        case 'P':
+        case 'L':
+            port->reply("\r");
+            return 1;
+        case 'x':
+        case 'y':
+        case 'T':
+            if(len < 2)
+                return 0;
+            port->reply("\r");
+            return 2;
+        case 'R':
+        {
+            // high byte first
+            const QByteArray word = read(MEM_FLASH, m_address*2, 2);
+            const char res[] = { word[1], word[0] };
+            port->reply(QByteArray(res, 2));
+            ++m_address;
+            return 1;
+        }
+        case 'c':
+        case 'C':
+        {
+            if(len < 2)
+                return 0;
+
+            const quint32 addr = m_address*2;
+            m_page_addr = addr - (addr % pagesize);
+            m_page[int(addr % pagesize) + (data[0] == 'C')] = data[1];
+            if(data[0] == 'C')
+                ++m_address;
+            port->reply("\r");
+            return 2;
+        }
+        case 'm':
+            write(MEM_FLASH, m_page_addr, m_page.constData(), m_page.size());
+            m_page.fill((char)0xFF);
+            port->reply("\r", m_page_write_us);
+            return 1;
+        case 'd':
+            port->reply(read(MEM_EEPROM, m_address++, 1));
+            return 1;
+        case 'D':
+            if(len < 2)
+                return 0;
+            write(MEM_EEPROM, m_address++, data + 1, 1);
+            port->reply("\r", m_page_write_us);
+            return 2;
+        case 'g':
+        {
+            if(len < 4)
+                return 0;
+
+            const int size = (d[1] << 8) | d[2];
+            if(data[3] == 'F')
+            {
+                port->reply(read(MEM_FLASH, m_address*2, size));
+                m_address += size/2;
+            }
+            else
+            {
+                port->reply(read(MEM_EEPROM, m_address, size));
+                m_address += size;
+            }
+            return 4;
+        }
+        case 'B':
+        {
+            if(len < 4)
+                return 0;
+
+            const int size = (d[1] << 8) | d[2];
+            if(len < 4 + size)
+                return 0;
+
+            const quint8 memId = (data[3] == 'F') ? MEM_FLASH : MEM_EEPROM;
+            if(memId == MEM_FLASH)
+            {
+                write(memId, m_address*2, data + 4, size);
+                m_address += size/2;
+            }
+            else
+            {
+                write(memId, m_address, data + 4, size);
+                m_address += size;
+            }
+            port->reply("\r", writeTime(memId, size));
+            return 4 + size;
+        }
+        default:
+            port->reply("?");
+            return 1;
+    }
+}
+
+// --- avr232boot ---
+
+SimulatedAvr232boot::SimulatedAvr232boot(quint32 page_write_us)
+    : SimulatedChip("avr232boot:m328", page_write_us)
+{
+}
+
+int SimulatedAvr232boot::command(SimulatedPort *port, const char *data, int len)
+{
+    static const char stopCmd[4] = { 0x74, 0x7E, 0x7A, 0x33 };
+    static const char ack = 20;
+
+    const quint8 *d = (const quint8*)data;
+
+    switch(data[0])
+    {
+        case 0x74:
+            if(len < 4)
+                return 0;
+            if(!std::equal(stopCmd, stopCmd + 4, data))
+                return 1;
+            port->reply(QByteArray(1, ack));
+            return 4;
+        case 0x10: // flash page
+        {
+            const int pagesize = pageSize(MEM_FLASH);
+            if(len < 3 + pagesize)
+                return 0;
+            write(MEM_FLASH, (d[1] << 8) | d[2], data + 3, pagesize);
+            port->reply(QByteArray(1, ack), m_page_write_us);
+            return 3 + pagesize;
+        }
+        case 0x11: // run the application
+            return 1;
+        case 0x12:
+        {
+            QString const & sign = m_chip.getSign();
+            port->reply(sign.mid(sign.indexOf(':') + 1).toLatin1());
+            return 1;
+        }
+        case 0x13: // read EEPROM
+            if(len < 4)
+                return 0;
+            port->reply(read(MEM_EEPROM, (d[1] << 8) | d[2], d[3]));
+            return 4;
+        case 0x14: // write EEPROM
+            if(len < 4 || len < 4 + d[3])
+                return 0;
+            write(MEM_EEPROM, (d[1] << 8) | d[2], data + 4, d[3]);
+            port->reply(QByteArray(1, ack), writeTime(MEM_EEPROM, d[3]));
+            return 4 + d[3];
+        default:
+            return 1;
+    }
+}
+
+// --- Arduino ---
+
+enum stk500
+{
+    STK_OK            = 0x10,
+    STK_INSYNC        = 0x14,
+    CRC_EOP           = 0x20,
+    STK_GET_SYNC      = 0x30,
+    STK_GET_PARAMETER = 0x41,
+    STK_ENTER_PROGMODE= 0x50,
+    STK_LEAVE_PROGMODE= 0x51,
+    STK_CHIP_ERASE    = 0x52,
+    STK_LOAD_ADDRESS  = 0x55,
+    STK_PROG_PAGE     = 0x64,
+    STK_READ_PAGE     = 0x74,
+    STK_READ_SIGN     = 0x75
+};
+
+SimulatedArduino::SimulatedArduino(quint32 page_write_us)
+    : SimulatedChip("avr:1e950f", page_write_us)
+{
+    m_address = 0;
+}
+
+int SimulatedArduino::command(SimulatedPort *port, const char *data, int len)
+{
+    const quint8 *d = (const quint8*)data;
+
+    // length of the command including CRC_EOP
+    int size;
+    switch(d[0])
+    {
+        case STK_GET_SYNC:
+        case STK_ENTER_PROGMODE:
+        case STK_LEAVE_PROGMODE:
+        case STK_CHIP_ERASE:
+        case STK_READ_SIGN:
+            size = 2;
+            break;
+        case STK_GET_PARAMETER:
+            size = 3;
+            break;
+        case STK_LOAD_ADDRESS:
+            size = 4;
+            break;
+        case STK_READ_PAGE:
+            size = 5;
+            break;
+        case STK_PROG_PAGE:
+            if(len < 4)
+                return 0;
+            size = 5 + ((d[1] << 8) | d[2]);
+            break;
+        default:
+            return 1;
+    }
+
+    if(len < size)
+        return 0;
+
+    // optiboot does not answer malformed commands
+    if(d[size-1] != CRC_EOP)
+        return size;
+
+    QByteArray res(1, STK_INSYNC);
+    quint32 busy_us = 0;
+    switch(d[0])
+    {
+        case STK_GET_PARAMETER:
+            res.append(char(0x03));
+            break;
+        case STK_READ_SIGN:
+            res.append(signature());
+            break;
+        case STK_LOAD_ADDRESS:
+            // word address
+            m_address = (d[1] | (d[2] << 8)) * 2;
+            break;
+        case STK_READ_PAGE:
+            res.append(read(d[3] == 'F' ? MEM_FLASH : MEM_EEPROM, m_address, (d[1] << 8) | d[2]));
+            break;
+        case STK_PROG_PAGE:
+        {
+            const quint8 memId = (d[3] == 'F') ? MEM_FLASH : MEM_EEPROM;
+            write(memId, m_address, data + 4, size - 5);
+            busy_us = writeTime(memId, size - 5);
+            break;
+        }
+    }
+    res.append(char(STK_OK));
+    port->reply(res, busy_us);
+    return size;
+}
+
+// --- ZMODEM ---
+
+enum zmodem_rx_state
+{
+    zst_idle,
+    zst_pad,
+    zst_type,
+    zst_hex,
+    zst_bin32,
+    zst_data,
+    zst_crc
+};
+
+// Longest subpacket accepted before the frame is considered broken
+static const int ZMODEM_MAX_SUBPACKET = 8192;
+
+static quint32 zmodemCrc32(const QByteArray& data, quint8 frame_end)
+{
+    quint32 crc = 0xFFFFFFFF;
+    for(int i = 0; i < data.size(); ++i)
+        crc = ucrc32(quint8(data[i]), crc);
+    crc = ucrc32(frame_end, crc);
+    return ~crc;
+}
+
+SimulatedZmodem::SimulatedZmodem(quint32 page_write_us)
+    : SimulatedChip("zmodem:00", page_write_us)
+{
+    m_state = zst_idle;
+    m_escape = false;
+    m_frame = 0;
+    m_frame_end = 0;
+    m_pos = 0;
+}
+
+void SimulatedZmodem::received(SimulatedPort *port, const QByteArray& data)
+{
+    for(int i = 0; i < data.size(); ++i)
+        rxByte(port, quint8(data[i]));
+}
+
+int SimulatedZmodem::unescape(quint8 c)
+{
+    if(!m_escape)
+    {
+        if(c == ZDLE)
+        {
+            m_escape = true;
+            return -1;
+        }
+        // flow control characters are never sent unescaped
+        if((c & 0x7F) == XON || (c & 0x7F) == XOFF)
+            return -1;
+        return c;
+    }
+
+    m_escape = false;
+    switch(c)
+    {
+        case ZCRCE:
+        case ZCRCG:
+        case ZCRCQ:
+        case ZCRCW:
+            return c | ZDLEESC;
+        case ZRUB0:
+            return 0x7F;
+        case ZRUB1:
+            return 0xFF;
+        default:
+            return c ^ 0x40;
+    }
+}
+
+void SimulatedZmodem::rxByte(SimulatedPort *port, quint8 c)
+{
+    switch(m_state)
+    {
+        case zst_idle:
+            if(c == ZPAD)
+                m_state = zst_pad;
+            return;
+        case zst_pad:
+            if(c != ZPAD)
+                m_state = (c == ZDLE) ? zst_type : zst_idle;
+            return;
+        case zst_type:
+            m_buf.clear();
+            m_escape = false;
+            if(c == ZHEX)
+                m_state = zst_hex;
+            else if(c == ZBIN32)
+                m_state = zst_bin32;
+            else
+                m_state = zst_idle;
+            return;
+        case zst_hex:
+        {
+            m_buf.append(c);
+            if(m_buf.size() != (HDRLEN + 2)*2)
+                return;
+
+            m_state = zst_idle;
+
+            const QByteArray hdr = QByteArray::fromHex(m_buf);
+            quint16 crc = 0;
+            for(int i = 0; i < HDRLEN; ++i)
+                crc = ucrc16(quint8(hdr[i]), crc);
+            if(crc == ((quint8(hdr[HDRLEN]) << 8) | quint8(hdr[HDRLEN+1])))
+                header(port, hdr.left(HDRLEN));
+            return;
+        }
+        case zst_bin32:
+        {
+            const int v = unescape(c);
+            if(v < 0)
+                return;
+            if(v & ZDLEESC)
+            {
+                m_state = zst_idle;
+                return;
+            }
+
+            m_buf.append(char(v));
+            if(m_buf.size() != HDRLEN + 4)
+                return;
+
+            m_state = zst_idle;
+
+            quint32 crc = 0xFFFFFFFF;
+            for(int i = 0; i < HDRLEN; ++i)
+                crc = ucrc32(quint8(m_buf[i]), crc);
+            const quint32 expected = quint8(m_buf[HDRLEN]) | (quint8(m_buf[HDRLEN+1]) << 8) |
+                    (quint8(m_buf[HDRLEN+2]) << 16) | (quint32(quint8(m_buf[HDRLEN+3])) << 24);
+            if(~crc == expected)
+                header(port, m_buf.left(HDRLEN));
+            return;
+        }
+        case zst_data:
+        {
+            const int v = unescape(c);
+            if(v < 0)
+                return;
+            if(v & ZDLEESC)
+            {
+                m_frame_end = v & 0xFF;
+                m_crc.clear();
+                m_state = zst_crc;
+                return;
+            }
+
+            m_buf.append(char(v));
+            if(m_buf.size() > ZMODEM_MAX_SUBPACKET)
+                subpacket(port, false);
+            return;
+        }
+        case zst_crc:
+        {
+            const int v = unescape(c);
+            if(v < 0)
+                return;
+
+            m_crc.append(char(v));
+            if(m_crc.size() != 4)
+                return;
+
+            const quint32 expected = quint8(m_crc[0]) | (quint8(m_crc[1]) << 8) |
+                    (quint8(m_crc[2]) << 16) | (quint32(quint8(m_crc[3])) << 24);
+            subpacket(port, zmodemCrc32(m_buf, m_frame_end) == expected);
+            return;
+        }
+    }
+}
+
+void SimulatedZmodem::header(SimulatedPort *port, const QByteArray& hdr)
+{
+    const quint32 pos = quint8(hdr[ZP0]) | (quint8(hdr[ZP1]) << 8) |
+            (quint8(hdr[ZP2]) << 16) | (quint32(quint8(hdr[ZP3])) << 24);
+
+    switch(hdr[0])
+    {
+        case ZRQINIT:
+        case ZSINIT:
+            sendHexHeader(port, ZRINIT, quint32(ZF0_CANFDX | ZF0_CANOVIO | ZF0_CANFC32) << 24);
+            break;
+        case ZFILE:
+            m_frame = ZFILE;
+            m_buf.clear();
+            m_state = zst_data;
+            break;
+        case ZDATA:
+            if(pos != m_pos)
+            {
+                sendHexHeader(port, ZRPOS, m_pos);
+                break;
+            }
+            m_frame = ZDATA;
+            m_buf.clear();
+            m_state = zst_data;
+            break;
+        case ZEOF:
+            if(pos == m_pos)
+                sendHexHeader(port, ZRINIT, quint32(ZF0_CANFDX | ZF0_CANOVIO | ZF0_CANFC32) << 24);
+            else
+                sendHexHeader(port, ZRPOS, m_pos);
+            break;
+        case ZFIN:
+            sendHexHeader(port, ZFIN);
+            break;
+    }
+}
+
+void SimulatedZmodem::subpacket(SimulatedPort *port, bool crc_ok)
+{
+    if(!crc_ok)
+    {
+        // the data that follow are dropped until a ZDATA from m_pos
+        m_state = zst_idle;
+        m_buf.clear();
+        sendHexHeader(port, ZRPOS, m_pos);
+        return;
+    }
+
+    if(m_frame == ZFILE)
+    {
+        // "name\0size mtime mode ..."
+        const int sep = m_buf.indexOf('\0');
+        const quint32 size = m_buf.mid(sep + 1).split(' ').value(0).toUInt();
+
+        m_mems[MEM_FLASH] = QByteArray(size, (char)0xFF);
+        m_pos = 0;
+        m_state = zst_idle;
+        m_buf.clear();
+
+        sendHexHeader(port, ZRPOS, m_pos);
+        return;
+    }
+
+    QByteArray& mem = m_mems[MEM_FLASH];
+    if(m_pos + m_buf.size() > (quint32)mem.size())
+        mem.resize(m_pos + m_buf.size());
+    write(MEM_FLASH, m_pos, m_buf.constData(), m_buf.size());
+
+    // pages are written as they fill up
+    const quint16 pagesize = pageSize(MEM_FLASH);
+    const quint32 pages = (m_pos + m_buf.size())/pagesize - m_pos/pagesize;
+    port->busy(pages * m_page_write_us);
+
+    m_pos += m_buf.size();
+    m_buf.clear();
+
+    switch(m_frame_end)
+    {
+        case ZCRCQ:
+            sendHexHeader(port, ZACK, m_pos);
+            break;
+        case ZCRCW:
+            sendHexHeader(port, ZACK, m_pos);
+            m_state = zst_idle;
+            break;
+        case ZCRCE:
+            m_state = zst_idle;
+            break;
+        default: // ZCRCG, frame continues
+            m_state = zst_data;
+            break;
+    }
+}
+
+void SimulatedZmodem::sendHexHeader(SimulatedPort *port, quint8 type, quint32 arg)
+{
+    QByteArray hdr;
+    hdr.append(char(type));
+    for(int i = 0; i < 4; ++i)
+        hdr.append(char(arg >> (i*8)));
+
+    quint16 crc = 0;
+    for(int i = 0; i < HDRLEN; ++i)
+        crc = ucrc16(quint8(hdr[i]), crc);
+    hdr.append(char(crc >> 8));
+    hdr.append(char(crc));
+
+    QByteArray res;
+    res.append(ZPAD);
+    res.append(ZPAD);
+    res.append(ZDLE);
+    res.append(ZHEX);
+    res.append(hdr.toHex());
+    res.append("\r\n");
+    if(type != ZACK && type != ZFIN)
+        res.append(XON);
+    port->reply(res);
+}
@@ -0,0 +1,144 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#ifndef SIMULATEDTARGETS_H
+#define SIMULATEDTARGETS_H
+
+#include <QHash>
+#include <QByteArray>
+
+#include "../connection/simulatedport.h"
+#include "../shared/chipdefs.h"
+
+/*
+ * Chip behind a bootloader or programmer protocol, see SimulatedPort.
+ *
+ * The memories are taken from the chip definition and start erased.
+ * Every page write keeps the target busy for page_write_us.
+ */
+class SimulatedChip : public SimulatedTarget
+{
+public:
+    SimulatedChip(QString const & sign, quint32 page_write_us);
+
+    void received(SimulatedPort *port, const QByteArray& data);
+
+    chip_definition& chip() { return m_chip; }
+    QByteArray& memory(quint8 memId) { return m_mems[memId]; }
+
+protected:
+    // Handles the command at the start of data. Returns the number of bytes
+    // used, or 0 if the command is not complete yet.
+    virtual int command(SimulatedPort *port, const char *data, int len) = 0;
+
+    void write(quint8 memId, quint32 address, const char *data, int len);
+    QByteArray read(quint8 memId, quint32 address, int len);
+    void erase(quint8 memId);
+
+    // Time it takes to write len bytes starting at a page boundary
+    quint32 writeTime(quint8 memId, int len);
+    quint16 pageSize(quint8 memId);
+    // Signature bytes as in the chip definition, e.g. 1e 95 0f for avr:1e950f
+    QByteArray signature();
+
+    chip_definition m_chip;
+    quint32 m_page_write_us;
+    QHash<quint8, QByteArray> m_mems;
+
+private:
+    QByteArray m_rx;
+};
+
+// Shupito with the AVR SPI mode only
+class SimulatedShupito : public SimulatedChip
+{
+public:
+    SimulatedShupito(quint32 page_write_us);
+
+protected:
+    int command(SimulatedPort *port, const char *data, int len);
+
+private:
+    void packet(SimulatedPort *port, quint8 cmd, const QByteArray& args);
+    void appendPacket(QByteArray& dest, quint8 cmd, const QByteArray& payload);
+    void sendStatus(SimulatedPort *port, quint8 cmd, quint8 status, quint32 busy_us = 0);
+    void sendDescriptor(SimulatedPort *port);
+
+    quint8 m_page_mem;
+    QByteArray m_page;
+};
+
+class SimulatedAvr109 : public SimulatedChip
+{
+public:
+    SimulatedAvr109(quint32 page_write_us);
+
+protected:
+    int command(SimulatedPort *port, const char *data, int len);
+
+private:
+    // word address for flash, byte address for EEPROM
+    quint32 m_address;
+    quint32 m_page_addr;
+    QByteArray m_page;
+};
+
+class SimulatedAvr232boot : public SimulatedChip
+{
+public:
+    SimulatedAvr232boot(quint32 page_write_us);
+
+protected:
+    int command(SimulatedPort *port, const char *data, int len);
+};
+
+// Optiboot, the STK500 subset used by ArduinoProgrammer
+class SimulatedArduino : public SimulatedChip
+{
+public:
+    SimulatedArduino(quint32 page_write_us);
+
+protected:
+    int command(SimulatedPort *port, const char *data, int len);
+
+private:
+    quint32 m_address;
+};
+
+/*
+ * ZMODEM receiver, the file is stored to the flash memory. It advertises
+ * full duplex and overlapped I/O, so the sender streams the data.
+ * Damaged subpackets are answered with ZRPOS.
+ */
+class SimulatedZmodem : public SimulatedChip
+{
+public:
+    SimulatedZmodem(quint32 page_write_us);
+
+    void received(SimulatedPort *port, const QByteArray& data);
+
+protected:
+    int command(SimulatedPort *, const char *, int) { return 1; }
+
+private:
+    void rxByte(SimulatedPort *port, quint8 c);
+    int unescape(quint8 c);
+    void header(SimulatedPort *port, const QByteArray& hdr);
+    void subpacket(SimulatedPort *port, bool crc_ok);
+    // arg goes to the header bytes 1-4, little-endian
+    void sendHexHeader(SimulatedPort *port, quint8 type, quint32 arg = 0);
+
+    int m_state;
+    bool m_escape;
+    quint8 m_frame;
+    int m_frame_end;
+    quint32 m_pos;
+    QByteArray m_buf;
+    QByteArray m_crc;
+};
+
+#endif // SIMULATEDTARGETS_H
@@ -0,0 +1,206 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#include <QVBoxLayout>
+#include <QHBoxLayout>
+#include <QTreeWidget>
+#include <QHeaderView>
+#include <QPlainTextEdit>
+#include <QPushButton>
+#include <QProgressBar>
+#include <QLabel>
+
+#include "gangdialog.h"
+#include "../gangprogrammer.h"
+#include "../../connection/connectionmgr2.h"
+#include "../../connection/shupitoconn.h"
+
+#ifdef HAVE_LIBYB
+#include "../../connection/stm32connection.h"
+#include "../../connection/genericusbconn.h"
+#endif
+
+enum gang_columns
+{
+    COL_TARGET = 0,
+    COL_PROGRESS,
+    COL_STATUS
+};
+
+static bool isProgrammable(Connection *conn)
+{
+    if(dynamic_cast<ShupitoConnection *>(conn) || dynamic_cast<PortConnection *>(conn))
+        return true;
+#ifdef HAVE_LIBYB
+    if(dynamic_cast<STM32Connection *>(conn))
+        return true;
+    if(GenericUsbConnection *uc = dynamic_cast<GenericUsbConnection *>(conn))
+        return uc->isFlipDevice();
+#endif
+    return false;
+}
+
+GangDialog::GangDialog(HexFile const & file, quint8 memId, VerifyMode verifyMode,
+                       quint32 prog_speed_hz, QWidget *parent)
+    : QDialog(parent), m_file(file), m_memId(memId), m_verify_mode(verifyMode),
+      m_prog_speed_hz(prog_speed_hz), m_gang(NULL)
+{
+    setWindowTitle(tr("Gang programming"));
+    resize(600, 450);
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->addWidget(new QLabel(tr("Check the targets to write the loaded file to.\n"
+                                    "They are connected together and written one after another."), this));
+
+    m_targetList = new QTreeWidget(this);
+    m_targetList->setRootIsDecorated(false);
+    m_targetList->setHeaderLabels(QStringList() << tr("Target") << tr("Progress") << tr("Status"));
+    layout->addWidget(m_targetList, 2);
+
+    m_log = new QPlainTextEdit(this);
+    m_log->setReadOnly(true);
+    m_log->setMaximumBlockCount(1000);
+    layout->addWidget(m_log, 1);
+
+    QHBoxLayout *btnLayout = new QHBoxLayout;
+    btnLayout->addStretch(1);
+    m_startBtn = new QPushButton(QIcon(":/actions/start"), tr("Start"), this);
+    m_closeBtn = new QPushButton(tr("Close"), this);
+    btnLayout->addWidget(m_startBtn);
+    btnLayout->addWidget(m_closeBtn);
+    layout->addLayout(btnLayout);
+
+    connect(m_startBtn, SIGNAL(clicked()), SLOT(start()));
+    connect(m_closeBtn, SIGNAL(clicked()), SLOT(reject()));
+
+    loadConnections();
+}
+
+GangDialog::~GangDialog()
+{
+    delete m_gang;
+}
+
+void GangDialog::loadConnections()
+{
+    QList<Connection *> const & conns = sConMgr2.connections();
+    for(int i = 0; i < conns.size(); ++i)
+    {
+        if(!isProgrammable(conns[i]))
+            continue;
+
+        QTreeWidgetItem *item = new QTreeWidgetItem(m_targetList);
+        item->setText(COL_TARGET, conns[i]->name());
+        item->setFlags(item->flags() | Qt::ItemIsUserCheckable);
+        item->setCheckState(COL_TARGET, Qt::Unchecked);
+        item->setData(COL_TARGET, Qt::UserRole, (int)m_conns.size());
+
+        m_conns.push_back(ConnectionPointer<Connection>::fromPtr(conns[i]));
+    }
+    m_targetList->resizeColumnToContents(COL_TARGET);
+}
+
+void GangDialog::start()
+{
+    delete m_gang;
+    m_gang = new GangProgrammer(m_file, m_memId, m_verify_mode, m_prog_speed_hz, this);
+    m_items.clear();
+    m_bars.clear();
+
+    for(int i = 0; i < m_targetList->topLevelItemCount(); ++i)
+    {
+        QTreeWidgetItem *item = m_targetList->topLevelItem(i);
+        m_targetList->removeItemWidget(item, COL_PROGRESS);
+        item->setText(COL_STATUS, QString());
+
+        if(item->checkState(COL_TARGET) != Qt::Checked)
+            continue;
+
+        ConnectionPointer<Connection> conn = m_conns[item->data(COL_TARGET, Qt::UserRole).toInt()];
+
+        // Serial Shupitos are driven through their packet connection
+        PortConnection *pc = dynamic_cast<PortConnection *>(conn.data());
+        if(pc && pc->programmerType() == programmer_shupito)
+            conn = sConMgr2.createAutoShupito(pc);
+
+        m_gang->addTarget(conn);
+
+        QProgressBar *bar = new QProgressBar;
+        bar->setRange(0, 100);
+        bar->setValue(0);
+        m_targetList->setItemWidget(item, COL_PROGRESS, bar);
+
+        m_items.push_back(item);
+        m_bars.push_back(bar);
+    }
+
+    if(m_gang->targetCount() == 0)
+    {
+        appendLog(tr("No target is checked."));
+        return;
+    }
+
+    connect(m_gang, SIGNAL(targetProgress(int,int)),              SLOT(targetProgress(int,int)));
+    connect(m_gang, SIGNAL(targetStatus(int,QString)),            SLOT(targetStatus(int,QString)));
+    connect(m_gang, SIGNAL(targetFinished(int,bool,QString)),     SLOT(targetFinished(int,bool,QString)));
+    connect(m_gang, SIGNAL(finished(int,int)),                    SLOT(finished(int,int)));
+    connect(m_gang, SIGNAL(log(QString)),                         SLOT(appendLog(QString)));
+
+    m_startBtn->setEnabled(false);
+    m_closeBtn->setText(tr("Cancel"));
+
+    appendLog(tr("Writing %1 targets, one at a time").arg(m_gang->targetCount()));
+    m_gang->start();
+}
+
+void GangDialog::reject()
+{
+    if(m_gang && m_gang->isRunning())
+    {
+        m_closeBtn->setEnabled(false);
+        appendLog(tr("Waiting for pending operations to finish..."));
+        m_gang->cancel();
+        return;
+    }
+    QDialog::reject();
+}
+
+void GangDialog::targetProgress(int target, int value)
+{
+    // -1 is sent when a programmer closes its progress dialog
+    if(value >= 0)
+        m_bars[target]->setValue(value);
+}
+
+void GangDialog::targetStatus(int target, QString const & text)
+{
+    m_items[target]->setText(COL_STATUS, text);
+}
+
+void GangDialog::targetFinished(int target, bool success, QString const & message)
+{
+    m_items[target]->setText(COL_STATUS, message);
+    m_items[target]->setForeground(COL_STATUS, success ? Qt::darkGreen : Qt::red);
+    if(success)
+        m_bars[target]->setValue(100);
+
+    appendLog(QString("%1: %2").arg(m_gang->targetName(target), message));
+}
+
+void GangDialog::finished(int succeeded, int failed)
+{
+    appendLog(tr("Finished, %1 succeeded, %2 failed").arg(succeeded).arg(failed));
+
+    m_startBtn->setEnabled(true);
+    m_closeBtn->setEnabled(true);
+    m_closeBtn->setText(tr("Close"));
+}
+
+void GangDialog::appendLog(QString const & msg)
+{
+    m_log->appendPlainText(msg);
+}
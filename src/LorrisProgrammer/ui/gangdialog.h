@@ -0,0 +1,64 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#ifndef GANGDIALOG_H
+#define GANGDIALOG_H
+
+#include <QDialog>
+#include <vector>
+
+#include "../../connection/connection.h"
+#include "../../shared/hexfile.h"
+#include "../../shared/programmer.h"
+
+class QTreeWidget;
+class QTreeWidgetItem;
+class QPlainTextEdit;
+class QPushButton;
+class QProgressBar;
+class GangProgrammer;
+
+class GangDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    GangDialog(HexFile const & file, quint8 memId, VerifyMode verifyMode,
+               quint32 prog_speed_hz, QWidget *parent = 0);
+    ~GangDialog();
+
+protected:
+    void reject();
+
+private slots:
+    void start();
+    void targetProgress(int target, int value);
+    void targetStatus(int target, QString const & text);
+    void targetFinished(int target, bool success, QString const & message);
+    void finished(int succeeded, int failed);
+    void appendLog(QString const & msg);
+
+private:
+    void loadConnections();
+
+    HexFile m_file;
+    quint8 m_memId;
+    VerifyMode m_verify_mode;
+    quint32 m_prog_speed_hz;
+
+    QTreeWidget *m_targetList;
+    QPlainTextEdit *m_log;
+    QPushButton *m_startBtn;
+    QPushButton *m_closeBtn;
+
+    std::vector<ConnectionPointer<Connection> > m_conns;
+    std::vector<QTreeWidgetItem *> m_items;
+    std::vector<QProgressBar *> m_bars;
+    GangProgrammer *m_gang;
+};
+
+#endif // GANGDIALOG_H
@@ -6,8 +6,6 @@
 ***********************************************/
 
 #include <QMessageBox>
-#include <QTcpSocket>
-#include <QHostAddress>
 
 #include "lorrisproxy.h"
 #include "tcpserver.h"
@@ -26,7 +24,7 @@ LorrisProxy::LorrisProxy()
     connect(ui->tunnelName,    SIGNAL(editingFinished()),    SLOT(tunnelNameEditFinished()));
     connect(ui->tunnelName,    SIGNAL(textEdited(QString)),  SLOT(tunnelNameEdited(QString)));
     connect(ui->tunnelBox,     SIGNAL(toggled(bool)),        SLOT(tunnelToggled(bool)));
-    connect(&m_server,         SIGNAL(newConnection(QTcpSocket*,quint32)), SLOT(addConnection(QTcpSocket*,quint32)));
+    connect(&m_server,         SIGNAL(clientConnected(quint32,QString)), SLOT(addConnection(quint32,QString)));
     connect(&m_server,         SIGNAL(removeConnection(quint32)), SLOT(removeConnection(quint32)));
 
     ui->addressEdit->setText(sConfig.get(CFG_STRING_PROXY_ADDR));
@@ -105,11 +103,11 @@ void LorrisProxy::listenChanged()
     updateAddressText();
 }
 
-void LorrisProxy::addConnection(QTcpSocket *connection, quint32 id)
+void LorrisProxy::addConnection(quint32 id, const QString& address)
 {
     QTreeWidgetItem *item = new QTreeWidgetItem(ui->connections);
     item->setText(0, QString::number(id));
-    item->setText(1, connection->peerAddress().toString());
+    item->setText(1, address);
 }
 
 void LorrisProxy::removeConnection(quint32 id)
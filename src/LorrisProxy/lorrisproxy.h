@@ -16,8 +16,6 @@ namespace Ui {
     class LorrisProxy;
 }
 
-class QTcpSocket;
-
 class LorrisProxy : public PortConnWorkTab
 {
     Q_OBJECT
@@ -38,7 +36,7 @@ public:
 private slots:
     void updateAddressText();
     void listenChanged();
-    void addConnection(QTcpSocket *connection, quint32 id);
+    void addConnection(quint32 id, const QString& address);
     void removeConnection(quint32 id);
     void connectionMenu(const QPoint& pos);
     void tunnelNameEditFinished();
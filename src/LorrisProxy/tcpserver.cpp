@@ -8,17 +8,150 @@
 #include <QTcpServer>
 #include <QTcpSocket>
 #include <QNetworkInterface>
-#include <QSignalMapper>
 
 #include "../connection/connectionmgr2.h"
+#include "../connection/networkthread.h"
 
 #include "tcpserver.h"
 
+// Data queued for a client, above which it is disconnected
+#define MAX_CLIENT_BACKLOG (1024*1024)
+// The socket's own buffer is refilled from the queue below this size
+#define WRITE_CHUNK (64*1024)
+
+TcpServerHub::TcpServerHub() : QObject(NULL)
+{
+}
+
+void TcpServerHub::addClient(qlonglong descriptor, quint32 id)
+{
+    QTcpSocket *socket = new QTcpSocket(this);
+    if(!socket->setSocketDescriptor(descriptor))
+    {
+        delete socket;
+        return;
+    }
+
+    connect(socket, SIGNAL(readyRead()),         SLOT(readyRead()));
+    connect(socket, SIGNAL(bytesWritten(qint64)), SLOT(bytesWritten()));
+    connect(socket, SIGNAL(disconnected()),      SLOT(disconnected()));
+
+    client& c = m_clients[id];
+    c.socket = socket;
+    c.queued = 0;
+
+    emit clientAdded(id, socket->peerAddress().toString());
+}
+
+TcpServerHub::client *TcpServerHub::findClient(QObject *socket)
+{
+    for(clientMap::iterator itr = m_clients.begin(); itr != m_clients.end(); ++itr)
+        if(itr->socket == socket)
+            return &(*itr);
+    return NULL;
+}
+
+void TcpServerHub::removeClient(quint32 id)
+{
+    clientMap::iterator itr = m_clients.find(id);
+    if(itr == m_clients.end())
+        return;
+
+    itr->socket->deleteLater();
+    m_clients.erase(itr);
+
+    emit clientRemoved(id);
+}
+
+void TcpServerHub::closeClient(quint32 id)
+{
+    clientMap::iterator itr = m_clients.find(id);
+    if(itr == m_clients.end())
+        return;
+
+    // the rest is done in disconnected()
+    itr->socket->close();
+}
+
+void TcpServerHub::closeAll()
+{
+    QList<quint32> ids = m_clients.keys();
+    for(int i = 0; i < ids.size(); ++i)
+    {
+        clientMap::iterator itr = m_clients.find(ids[i]);
+        if(itr == m_clients.end())
+            continue;
+
+        itr->socket->abort();
+        removeClient(ids[i]);
+    }
+}
+
+void TcpServerHub::broadcast(const QByteArray& data)
+{
+    QList<quint32> slow;
+    for(clientMap::iterator itr = m_clients.begin(); itr != m_clients.end(); ++itr)
+    {
+        client& c = *itr;
+        c.queue.push_back(data);
+        c.queued += data.size();
+
+        if(c.queued + c.socket->bytesToWrite() > MAX_CLIENT_BACKLOG)
+            slow.push_back(itr.key());
+        else
+            flush(c);
+    }
+
+    for(int i = 0; i < slow.size(); ++i)
+    {
+        qWarning("TcpServer: client %u can't keep up, disconnecting it", slow[i]);
+        m_clients[slow[i]].socket->abort();
+        removeClient(slow[i]);
+    }
+}
+
+void TcpServerHub::flush(client& c)
+{
+    while(!c.queue.empty() && c.socket->bytesToWrite() < WRITE_CHUNK)
+    {
+        c.socket->write(c.queue.front());
+        c.queued -= c.queue.front().size();
+        c.queue.pop_front();
+    }
+}
+
+void TcpServerHub::readyRead()
+{
+    QTcpSocket *socket = (QTcpSocket*)sender();
+    emit dataRead(socket->readAll());
+}
+
+void TcpServerHub::bytesWritten()
+{
+    if(client *c = findClient(sender()))
+        flush(*c);
+}
+
+void TcpServerHub::disconnected()
+{
+    for(clientMap::iterator itr = m_clients.begin(); itr != m_clients.end(); ++itr)
+    {
+        if(itr->socket == sender())
+        {
+            removeClient(itr.key());
+            return;
+        }
+    }
+}
+
 TcpServer::TcpServer(QObject *parent) : QTcpServer(parent)
 {
-    connect(this,              SIGNAL(newConnection()), SLOT(newConnection()));
-    connect(&m_disconnect_map, SIGNAL(mapped(int)),     SLOT(disconnected(int)));
-    connect(&m_ready_map,      SIGNAL(mapped(int)),     SLOT(readyRead(int)));
+    m_hub = new TcpServerHub();
+    NetworkThread::adopt(m_hub);
+
+    connect(m_hub, SIGNAL(clientAdded(quint32,QString)), SIGNAL(clientConnected(quint32,QString)));
+    connect(m_hub, SIGNAL(clientRemoved(quint32)),       SIGNAL(removeConnection(quint32)));
+    connect(m_hub, SIGNAL(dataRead(QByteArray)),         SIGNAL(newData(QByteArray)));
 
     m_con_counter = 0;
 }
@@ -28,20 +161,17 @@ TcpServer::~TcpServer()
     if(m_tunnel_conn)
         m_tunnel_conn->setTcpServer(NULL);
     stopListening();
+    m_hub->deleteLater();
 }
 
-void TcpServer::newConnection()
+#if QT_VERSION >= 0x050000
+void TcpServer::incomingConnection(qintptr handle)
+#else
+void TcpServer::incomingConnection(int handle)
+#endif
 {
-    QTcpSocket *socket = nextPendingConnection();
-    m_socket_map[m_con_counter] = socket;
-
-    m_disconnect_map.setMapping(socket, m_con_counter);
-    m_ready_map.setMapping(socket, m_con_counter);
-    connect(socket, SIGNAL(disconnected()), &m_disconnect_map, SLOT(map()));
-    connect(socket, SIGNAL(readyRead()),    &m_ready_map,      SLOT(map()));
-
-    emit newConnection(socket, m_con_counter);
-
+    QMetaObject::invokeMethod(m_hub, "addClient", Qt::QueuedConnection,
+                              Q_ARG(qlonglong, handle), Q_ARG(quint32, m_con_counter));
     ++m_con_counter;
 }
 
@@ -50,21 +180,7 @@ void TcpServer::SendData(const QByteArray& data)
     if(!isListening())
         return;
 
-    for(socketMap::iterator itr = m_socket_map.begin(); itr != m_socket_map.end(); ++itr)
-        (*itr)->write(data);
-}
-
-void TcpServer::disconnected(int con)
-{
-    socketMap::iterator itr = m_socket_map.find((quint32)con);
-    if(itr == m_socket_map.end())
-        return;
-
-    (*itr)->deleteLater();
-
-    m_socket_map.erase(itr);
-
-    emit removeConnection(con);
+    QMetaObject::invokeMethod(m_hub, "broadcast", Qt::QueuedConnection, Q_ARG(QByteArray, data));
 }
 
 bool TcpServer::listen(const QString& address, quint16 port)
@@ -80,21 +196,8 @@ bool TcpServer::listen(const QString& address, quint16 port)
 
 void TcpServer::stopListening()
 {
-    // Socket is deleted in void TcpServer::disconnected(int con)
-    socketMap tmpMap = m_socket_map;
-    for(socketMap::iterator itr = tmpMap.begin(); itr != tmpMap.end(); ++itr)
-        (*itr)->close();
-
     close();
-}
-
-void TcpServer::readyRead(int con)
-{
-    socketMap::iterator itr = m_socket_map.find((quint32)con);
-    if(itr == m_socket_map.end())
-        return;
-
-    emit newData((*itr)->readAll());
+    QMetaObject::invokeMethod(m_hub, "closeAll", Qt::BlockingQueuedConnection);
 }
 
 QString TcpServer::getAddress()
@@ -120,11 +223,7 @@ QString TcpServer::getAddress()
 
 void TcpServer::closeConnection(quint32 id)
 {
-    socketMap::iterator itr = m_socket_map.find(id);
-    if(itr == m_socket_map.end())
-        return;
-
-    (*itr)->close();
+    QMetaObject::invokeMethod(m_hub, "closeClient", Qt::QueuedConnection, Q_ARG(quint32, id));
 }
 
 void TcpServer::createProxyTunnel(const QString &name)
@@ -11,24 +11,69 @@
 #include <QObject>
 #include <QHash>
 #include <QTcpServer>
-#include <QSignalMapper>
+#include <deque>
 
 #include "../connection/proxytunnel.h"
 
 class QTcpSocket;
 
+/*
+ * Owns the client sockets of TcpServer in NetworkThread. Data sent to the
+ * clients is queued per client as implicitly shared QByteArrays, so one
+ * buffer is shared by all of them, and is moved to the socket only while
+ * its write buffer is short. A client which does not keep up is
+ * disconnected, instead of letting its backlog grow without bounds or
+ * dropping parts of the stream.
+ */
+class TcpServerHub : public QObject
+{
+    Q_OBJECT
+
+Q_SIGNALS:
+    void clientAdded(quint32 id, const QString& address);
+    void clientRemoved(quint32 id);
+    void dataRead(const QByteArray& data);
+
+public:
+    TcpServerHub();
+
+public slots:
+    void addClient(qlonglong descriptor, quint32 id);
+    void closeClient(quint32 id);
+    void closeAll();
+    void broadcast(const QByteArray& data);
+
+private slots:
+    void readyRead();
+    void bytesWritten();
+    void disconnected();
+
+private:
+    struct client
+    {
+        QTcpSocket *socket;
+        std::deque<QByteArray> queue;
+        qint64 queued;
+    };
+    typedef QHash<quint32, client> clientMap;
+
+    client *findClient(QObject *socket);
+    void flush(client& c);
+    void removeClient(quint32 id);
+
+    clientMap m_clients;
+};
+
 class TcpServer : public QTcpServer
 {
     Q_OBJECT
 
 Q_SIGNALS:
     void newData(const QByteArray& data);
-    void newConnection(QTcpSocket *socket, quint32 id);
+    void clientConnected(quint32 id, const QString& address);
     void removeConnection(quint32 id);
 
 public:
-    typedef QHash<quint32, QTcpSocket*> socketMap;
-
     TcpServer(QObject *parent = NULL);
     ~TcpServer();
 
@@ -44,16 +89,15 @@ public:
 public slots:
     void SendData(const QByteArray& data);
 
-private slots:
-    void newConnection();
-    void disconnected(int con);
-    void readyRead(int con);
+protected:
+#if QT_VERSION >= 0x050000
+    void incomingConnection(qintptr handle);
+#else
+    void incomingConnection(int handle);
+#endif
 
 private:
-    QSignalMapper m_disconnect_map;
-    QSignalMapper m_ready_map;
-    socketMap m_socket_map;
-
+    TcpServerHub *m_hub;
     quint32 m_con_counter;
 
     ConnectionPointer<ProxyTunnel> m_tunnel_conn;
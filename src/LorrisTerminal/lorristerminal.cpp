@@ -26,6 +26,7 @@
 #include "../ui/chooseconnectiondlg.h"
 #include "../ui/tooltipwarn.h"
 #include "../connection/serialport.h"
+#include "terminallogger.h"
 
 LorrisTerminal::LorrisTerminal()
     : ui(new Ui::LorrisTerminal)
@@ -66,6 +67,10 @@ void LorrisTerminal::initUI()
     binSave->setShortcut(QKeySequence("Ctrl+S"));
     binSave->setShortcutContext(Qt::WidgetWithChildrenShortcut);
 
+    m_logAct = dataMenu->addAction(tr("Log received data to file..."));
+    m_logAct->setCheckable(true);
+    m_logger = new TerminalLogger(this);
+
     dataMenu->addSeparator();
 
     QMenu *inputMenu = new QMenu(tr("Input handling"), this);
@@ -107,6 +112,8 @@ void LorrisTerminal::initUI()
     connect(termLoad,          SIGNAL(triggered()),                 SLOT(loadText()));
     connect(termSave,          SIGNAL(triggered()),                 SLOT(saveText()));
     connect(binSave,           SIGNAL(triggered()),                 SLOT(saveBin()));
+    connect(m_logAct,          SIGNAL(triggered(bool)),             SLOT(logToFile(bool)));
+    connect(m_logger,          SIGNAL(error(QString)),              SLOT(logError(QString)));
     connect(chgSettings,       SIGNAL(triggered()),   ui->terminal, SLOT(showSettings()));
     connect(ui->terminal,      SIGNAL(fmtSelected(int)),            SLOT(checkFmtAct(int)));
     connect(ui->terminal,      SIGNAL(paused(bool)),                SLOT(setPauseBtnText(bool)));
@@ -162,6 +169,8 @@ void LorrisTerminal::connectedStatus(bool connected)
 
 void LorrisTerminal::readData(const QByteArray& data)
 {
+    // The log is independent of the terminal's scrollback
+    m_logger->write(data);
     ui->terminal->appendText(data);
 }
 
@@ -199,13 +208,20 @@ void LorrisTerminal::loadText()
         return;
 
     QFile file(filename);
-    if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
+    if(!file.open(QIODevice::ReadOnly))
     {
         Utils::showErrorBox(tr("Can't open file \"%1\"!").arg(filename), this);
         return;
     }
 
-    ui->terminal->appendText(file.readAll());
+    // Logs written with compression are read as they were received
+    if(TerminalLogger::isCompressed(file.peek(16)))
+        ui->terminal->appendText(TerminalLogger::decompress(file.readAll()));
+    else
+    {
+        file.setTextModeEnabled(true);
+        ui->terminal->appendText(file.readAll());
+    }
     file.close();
 
     sConfig.set(CFG_STRING_TERMINAL_TEXTFILE, filename);
@@ -254,6 +270,35 @@ void LorrisTerminal::saveBin()
     sConfig.set(CFG_STRING_TERMINAL_TEXTFILE, filename);
 }
 
+void LorrisTerminal::logToFile(bool enable)
+{
+    if(!enable)
+    {
+        m_logger->stop();
+        return;
+    }
+
+    TerminalLogDialog dialog(this);
+    if(dialog.exec() != QDialog::Accepted)
+    {
+        m_logAct->setChecked(false);
+        return;
+    }
+
+    try {
+        m_logger->start(dialog.settings());
+    } catch(const QString& ex) {
+        m_logAct->setChecked(false);
+        Utils::showErrorBox(ex, this);
+    }
+}
+
+void LorrisTerminal::logError(const QString& message)
+{
+    m_logAct->setChecked(false);
+    Utils::showErrorBox(message, this);
+}
+
 void LorrisTerminal::inputAct(int act)
 {
     for(quint8 i = 0; i < INPUT_MAX; ++i)
@@ -21,6 +21,7 @@
 
 class QVBoxLayout;
 class QTextEdit;
+class TerminalLogger;
 
 namespace Ui {
     class LorrisTerminal;
@@ -50,6 +51,8 @@ private slots:
     void loadText();
     void saveText();
     void saveBin();
+    void logToFile(bool enable);
+    void logError(const QString& message);
     void inputAct(int act);
     void sendButton();
     void spRtsToggled(bool);
@@ -68,6 +71,9 @@ private:
     QAction *m_import_eeprom;
     QAction *m_fmt_act[FMT_MAX];
     QAction *m_input[INPUT_MAX];
+    QAction *m_logAct;
+
+    TerminalLogger *m_logger;
 
     ConnectButton * m_connectButton;
     Ui::LorrisTerminal *ui;
@@ -0,0 +1,349 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#include <QDateTime>
+#include <QFileInfo>
+#include <QDir>
+#include <QtEndian>
+#include <QLineEdit>
+#include <QCheckBox>
+#include <QSpinBox>
+#include <QPushButton>
+#include <QFormLayout>
+#include <QHBoxLayout>
+#include <QVBoxLayout>
+#include <QDialogButtonBox>
+#include <QFileDialog>
+#include <string.h>
+
+#include "terminallogger.h"
+#include "../misc/config.h"
+#include "../misc/utils.h"
+
+static const char LOG_MAGIC[] = "LORRISLZ";
+static const int LOG_MAGIC_LEN = sizeof(LOG_MAGIC) - 1;
+
+static const int COMPRESS_BLOCK = 256*1024;
+static const int FLUSH_INTERVAL = 2000; // ms
+
+TerminalLogWriter::TerminalLogWriter(const TerminalLogSettings& settings)
+    : m_settings(settings), m_file(this), m_flushTimer(this)
+{
+    m_fileSize = 0;
+    m_fileOpened = 0;
+    m_lineStart = true;
+
+    connect(&m_flushTimer, SIGNAL(timeout()), SLOT(flush()));
+}
+
+void TerminalLogWriter::open()
+{
+    openFile(QDateTime::currentMSecsSinceEpoch());
+}
+
+QString TerminalLogWriter::fileName(qint64 time) const
+{
+    if(m_settings.rotateSize == 0 && m_settings.rotateTime == 0)
+        return m_settings.path;
+
+    QFileInfo info(m_settings.path);
+    const QString base = info.absolutePath() + "/" + info.completeBaseName() + "-" +
+            QDateTime::fromMSecsSinceEpoch(time).toString("yyyyMMdd-hhmmss");
+    const QString suffix = info.suffix().isEmpty() ? QString() : "." + info.suffix();
+
+    QString res = base + suffix;
+    for(int i = 2; QFile::exists(res); ++i)
+        res = base + "-" + QString::number(i) + suffix;
+    return res;
+}
+
+void TerminalLogWriter::openFile(qint64 time)
+{
+    m_file.setFileName(fileName(time));
+    if(!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        throw tr("Can't open/create file \"%1\"!").arg(m_file.fileName());
+
+    m_fileSize = 0;
+    m_fileOpened = time;
+
+    if(m_settings.compress)
+        writeFile(LOG_MAGIC, LOG_MAGIC_LEN);
+}
+
+void TerminalLogWriter::write(const QByteArray& data, qint64 time)
+{
+    if(!m_file.isOpen())
+        return;
+
+    if(!m_flushTimer.isActive())
+        m_flushTimer.start(FLUSH_INTERVAL);
+
+    if((m_settings.rotateSize != 0 && m_fileSize >= m_settings.rotateSize) ||
+       (m_settings.rotateTime != 0 && time - m_fileOpened >= qint64(m_settings.rotateTime)*1000))
+    {
+        compressBlock();
+        m_file.close();
+        try {
+            openFile(time);
+        } catch(const QString& ex) {
+            emit error(ex);
+            return;
+        }
+    }
+
+    if(m_settings.timestamps)
+        writeTimestamped(data, time);
+    else
+        append(data.data(), data.size());
+}
+
+void TerminalLogWriter::writeTimestamped(const QByteArray& data, qint64 time)
+{
+    const QByteArray stamp = "[" + QDateTime::fromMSecsSinceEpoch(time)
+            .toString("yyyy-MM-dd hh:mm:ss.zzz").toLatin1() + "] ";
+
+    const char *itr = data.data();
+    const char *end = itr + data.size();
+    while(itr != end)
+    {
+        if(m_lineStart)
+        {
+            append(stamp.data(), stamp.size());
+            m_lineStart = false;
+        }
+
+        const char *nl = (const char*)memchr(itr, '\n', end - itr);
+        if(nl)
+        {
+            ++nl;
+            m_lineStart = true;
+        }
+        else
+            nl = end;
+
+        append(itr, nl - itr);
+        itr = nl;
+    }
+}
+
+void TerminalLogWriter::append(const char *data, int len)
+{
+    if(!m_settings.compress)
+    {
+        writeFile(data, len);
+        return;
+    }
+
+    m_block.append(data, len);
+    if(m_block.size() >= COMPRESS_BLOCK)
+        compressBlock();
+}
+
+void TerminalLogWriter::writeFile(const char *data, int len)
+{
+    if(!m_file.isOpen())
+        return;
+
+    if(m_file.write(data, len) != len)
+    {
+        const QString msg = tr("Can't write to file \"%1\": %2").arg(m_file.fileName(), m_file.errorString());
+        m_file.close();
+        emit error(msg);
+        return;
+    }
+    m_fileSize += len;
+}
+
+void TerminalLogWriter::compressBlock()
+{
+    if(m_block.isEmpty())
+        return;
+
+    const QByteArray data = qCompress(m_block);
+    m_block.clear();
+
+    uchar size[4];
+    qToLittleEndian<quint32>(data.size(), size);
+    writeFile((const char*)size, sizeof(size));
+    writeFile(data.data(), data.size());
+}
+
+void TerminalLogWriter::flush()
+{
+    compressBlock();
+    if(m_file.isOpen())
+        m_file.flush();
+}
+
+void TerminalLogWriter::close()
+{
+    m_flushTimer.stop();
+    compressBlock();
+    m_file.close();
+}
+
+TerminalLogger::TerminalLogger(QObject *parent) : QObject(parent)
+{
+    m_writer = NULL;
+    m_thread.setObjectName("TerminalLogger");
+}
+
+TerminalLogger::~TerminalLogger()
+{
+    stop();
+}
+
+void TerminalLogger::start(const TerminalLogSettings& settings)
+{
+    stop();
+
+    TerminalLogWriter *writer = new TerminalLogWriter(settings);
+    try {
+        writer->open();
+    } catch(...) {
+        delete writer;
+        throw;
+    }
+
+    m_writer = writer;
+    m_writer->moveToThread(&m_thread);
+    connect(m_writer, SIGNAL(error(QString)), SLOT(writerError(QString)));
+    m_thread.start();
+}
+
+void TerminalLogger::stop()
+{
+    if(!m_writer)
+        return;
+
+    QMetaObject::invokeMethod(m_writer, "close", Qt::BlockingQueuedConnection);
+    m_thread.quit();
+    m_thread.wait();
+
+    delete m_writer;
+    m_writer = NULL;
+}
+
+void TerminalLogger::write(const QByteArray& data)
+{
+    if(!m_writer)
+        return;
+
+    // The data are shared with the caller, not copied
+    QMetaObject::invokeMethod(m_writer, "write", Qt::QueuedConnection, Q_ARG(QByteArray, data),
+                              Q_ARG(qint64, QDateTime::currentMSecsSinceEpoch()));
+}
+
+void TerminalLogger::writerError(const QString& message)
+{
+    stop();
+    emit error(message);
+}
+
+bool TerminalLogger::isCompressed(const QByteArray& header)
+{
+    return header.startsWith(LOG_MAGIC);
+}
+
+QByteArray TerminalLogger::decompress(const QByteArray& data)
+{
+    QByteArray res;
+    int pos = LOG_MAGIC_LEN;
+    while(pos + 4 <= data.size())
+    {
+        const quint32 size = qFromLittleEndian<quint32>((const uchar*)data.data() + pos);
+        pos += 4;
+        if(size > quint32(data.size() - pos))
+            break;
+
+        res.append(qUncompress((const uchar*)data.data() + pos, size));
+        pos += size;
+    }
+    return res;
+}
+
+TerminalLogDialog::TerminalLogDialog(QWidget *parent) : QDialog(parent)
+{
+    setWindowTitle(tr("Log received data"));
+
+    m_path = new QLineEdit(sConfig.get(CFG_STRING_TERMINAL_LOG_FILE), this);
+    QPushButton *browseBtn = new QPushButton(tr("Browse..."), this);
+
+    m_timestamps = new QCheckBox(tr("Prefix lines with the time they were received"), this);
+    m_timestamps->setChecked(sConfig.get(CFG_BOOL_TERMINAL_LOG_TIMESTAMPS));
+
+    m_compress = new QCheckBox(tr("Compress the data"), this);
+    m_compress->setChecked(sConfig.get(CFG_BOOL_TERMINAL_LOG_COMPRESS));
+
+    m_rotateSize = new QSpinBox(this);
+    m_rotateSize->setRange(0, 1024*1024);
+    m_rotateSize->setSuffix(tr(" MiB"));
+    m_rotateSize->setSpecialValueText(tr("Never"));
+    m_rotateSize->setValue(sConfig.get(CFG_QUINT32_TERMINAL_LOG_SIZE));
+
+    m_rotateTime = new QSpinBox(this);
+    m_rotateTime->setRange(0, 30*24*60);
+    m_rotateTime->setSuffix(tr(" min"));
+    m_rotateTime->setSpecialValueText(tr("Never"));
+    m_rotateTime->setValue(sConfig.get(CFG_QUINT32_TERMINAL_LOG_TIME));
+
+    QHBoxLayout *pathLayout = new QHBoxLayout;
+    pathLayout->addWidget(m_path, 1);
+    pathLayout->addWidget(browseBtn);
+
+    QFormLayout *form = new QFormLayout;
+    form->addRow(tr("File:"), pathLayout);
+    form->addRow(m_timestamps);
+    form->addRow(m_compress);
+    form->addRow(tr("New file after:"), m_rotateSize);
+    form->addRow(tr("New file every:"), m_rotateTime);
+
+    QDialogButtonBox *box = new QDialogButtonBox((QDialogButtonBox::Ok | QDialogButtonBox::Cancel), Qt::Horizontal, this);
+    QVBoxLayout *mainLayout = new QVBoxLayout(this);
+    mainLayout->addLayout(form);
+    mainLayout->addWidget(box);
+
+    connect(browseBtn, SIGNAL(clicked()),  SLOT(browse()));
+    connect(box,       SIGNAL(accepted()), SLOT(accept()));
+    connect(box,       SIGNAL(rejected()), SLOT(reject()));
+}
+
+void TerminalLogDialog::browse()
+{
+    QString filename = QFileDialog::getSaveFileName(this, tr("Log file"), m_path->text(),
+                                                    tr("Log file (*.log);;Any file (*.*)"));
+    if(!filename.isEmpty())
+        m_path->setText(filename);
+}
+
+void TerminalLogDialog::accept()
+{
+    if(m_path->text().isEmpty())
+    {
+        Utils::showErrorBox(tr("Choose the file to log into."), this);
+        return;
+    }
+
+    sConfig.set(CFG_STRING_TERMINAL_LOG_FILE, m_path->text());
+    sConfig.set(CFG_BOOL_TERMINAL_LOG_TIMESTAMPS, m_timestamps->isChecked());
+    sConfig.set(CFG_BOOL_TERMINAL_LOG_COMPRESS, m_compress->isChecked());
+    sConfig.set(CFG_QUINT32_TERMINAL_LOG_SIZE, m_rotateSize->value());
+    sConfig.set(CFG_QUINT32_TERMINAL_LOG_TIME, m_rotateTime->value());
+
+    QDialog::accept();
+}
+
+TerminalLogSettings TerminalLogDialog::settings() const
+{
+    TerminalLogSettings res;
+    res.path = m_path->text();
+    res.timestamps = m_timestamps->isChecked();
+    res.compress = m_compress->isChecked();
+    res.rotateSize = quint64(m_rotateSize->value())*1024*1024;
+    res.rotateTime = m_rotateTime->value()*60;
+    return res;
+}
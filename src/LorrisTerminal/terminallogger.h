@@ -0,0 +1,137 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#ifndef TERMINALLOGGER_H
+#define TERMINALLOGGER_H
+
+#include <QObject>
+#include <QThread>
+#include <QTimer>
+#include <QFile>
+#include <QDialog>
+
+class QLineEdit;
+class QCheckBox;
+class QSpinBox;
+
+struct TerminalLogSettings
+{
+    TerminalLogSettings()
+    {
+        timestamps = false;
+        compress = false;
+        rotateSize = 0;
+        rotateTime = 0;
+    }
+
+    QString path;
+    // Prefix each line with the time it was received
+    bool timestamps;
+    bool compress;
+    // Start a new file after this many bytes/seconds, 0 means never
+    quint64 rotateSize;
+    quint32 rotateTime;
+};
+
+/*
+ * Writes the received data to disk in its own thread. When rotation is
+ * enabled, each file gets the time it was started appended to its name.
+ *
+ * Compressed logs start with LOG_MAGIC, followed by blocks of a quint32
+ * size (little endian) and qCompress()-ed data of that size.
+ */
+class TerminalLogWriter : public QObject
+{
+    Q_OBJECT
+
+Q_SIGNALS:
+    void error(const QString& message);
+
+public:
+    explicit TerminalLogWriter(const TerminalLogSettings& settings);
+
+    // Opens the first file, throws an error message on failure.
+    // Called before the writer is moved to its thread.
+    void open();
+
+public slots:
+    void write(const QByteArray& data, qint64 time);
+    void close();
+
+private slots:
+    void flush();
+
+private:
+    void openFile(qint64 time);
+    QString fileName(qint64 time) const;
+    void writeTimestamped(const QByteArray& data, qint64 time);
+    void append(const char *data, int len);
+    void writeFile(const char *data, int len);
+    void compressBlock();
+
+    TerminalLogSettings m_settings;
+    QFile m_file;
+    QTimer m_flushTimer;
+    QByteArray m_block;
+    quint64 m_fileSize;
+    qint64 m_fileOpened;
+    bool m_lineStart;
+};
+
+class TerminalLogger : public QObject
+{
+    Q_OBJECT
+
+Q_SIGNALS:
+    // Logging was stopped because of a write error
+    void error(const QString& message);
+
+public:
+    explicit TerminalLogger(QObject *parent = NULL);
+    ~TerminalLogger();
+
+    // Throws an error message if the file can't be opened
+    void start(const TerminalLogSettings& settings);
+    void stop();
+    bool isActive() const { return m_writer != NULL; }
+
+    void write(const QByteArray& data);
+
+    static bool isCompressed(const QByteArray& header);
+    static QByteArray decompress(const QByteArray& data);
+
+private slots:
+    void writerError(const QString& message);
+
+private:
+    QThread m_thread;
+    TerminalLogWriter *m_writer;
+};
+
+class TerminalLogDialog : public QDialog
+{
+    Q_OBJECT
+public:
+    explicit TerminalLogDialog(QWidget *parent);
+
+    TerminalLogSettings settings() const;
+
+public slots:
+    void accept();
+
+private slots:
+    void browse();
+
+private:
+    QLineEdit *m_path;
+    QCheckBox *m_timestamps;
+    QCheckBox *m_compress;
+    QSpinBox *m_rotateSize;
+    QSpinBox *m_rotateTime;
+};
+
+#endif // TERMINALLOGGER_H
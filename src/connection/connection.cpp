@@ -36,6 +36,9 @@ void Connection::SetState(ConnectionState state)
 
     if(state != m_state)
     {
+        if (newOpen && !oldOpen)
+            m_stats.reset();
+
         m_state = state;
         if (oldOpen != newOpen)
             emit connected(newOpen);
@@ -192,6 +195,13 @@ void Connection::setCompanionId(const QString &name, qint64 id)
 PortConnection::PortConnection(ConnectionType type) : Connection(type)
 {
     m_programmer_type = programmer_avr232boot;
+
+    connect(this, SIGNAL(dataRead(QByteArray)), SLOT(countReceived(QByteArray)));
+}
+
+void PortConnection::countReceived(const QByteArray& data)
+{
+    this->stats().received(data.size());
 }
 
 QHash<QString, QVariant> PortConnection::config() const
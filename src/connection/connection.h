@@ -16,6 +16,8 @@
 #include <QVector>
 #include <QMetaType>
 
+#include "connectionstats.h"
+
 enum ConnectionState {
     st_disconnected,
     st_connecting,
@@ -41,6 +43,7 @@ enum ConnectionType
     CONNECTION_STM32               = 11,
     CONNECTION_SHUPITO_SPI_TUNNEL  = 12,
     CONNECTION_UDP_SOCKET          = 13,
+    CONNECTION_SIMULATED           = 14,
 
     MAX_CON_TYPE
 };
@@ -119,6 +122,10 @@ public:
     virtual bool isNamePersistable() const { return false; }
     virtual void persistName() {}
 
+    // Reset whenever the connection opens
+    ConnectionStats& stats() { return m_stats; }
+    ConnectionStats const & stats() const { return m_stats; }
+
 signals:
     void connected(bool connected);
     void stateChanged(ConnectionState state);
@@ -153,6 +160,7 @@ private:
     bool m_persistent;
     quint8 m_type;
     QHash<QString, qint64> m_companionIds;
+    ConnectionStats m_stats;
 };
 
 Q_DECLARE_METATYPE(Connection *)
@@ -177,6 +185,9 @@ public:
 public slots:
     virtual void SendData(const QByteArray & /*data*/) {}
 
+private slots:
+    void countReceived(const QByteArray& data);
+
 protected:
     int m_programmer_type;
 };
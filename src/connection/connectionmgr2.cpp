@@ -30,16 +30,25 @@ ConnectionManager2 * psConMgr2 = 0;
 
 SerialPortEnumerator::SerialPortEnumerator()
 {
-    connect(&m_refreshTimer, SIGNAL(timeout()), this, SLOT(refresh()));
-    m_refreshTimer.start(1000);
-
     QVariant cfg = sConfig.get(CFG_VARIANT_SERIAL_CONNECTIONS);
     if(cfg.type() == QVariant::Hash)
         m_connCfg = cfg.toHash();
+
+    // The first enumeration is synchronous, so that the ports are available
+    // right away, e.g. to sessions loaded on startup.
+    const QList<QextPortInfo> ports = m_monitor.initialScan();
+    for(int i = 0; i < ports.size(); ++i)
+        addPort(ports[i]);
+
+    connect(&m_monitor, SIGNAL(portsChanged(QList<QextPortInfo>,QStringList)),
+            this,       SLOT(portsChanged(QList<QextPortInfo>,QStringList)));
+    m_monitor.start();
 }
 
 SerialPortEnumerator::~SerialPortEnumerator()
 {
+    m_monitor.stop();
+
     std::set<SerialPort *> portsToClear;
     portsToClear.swap(m_ownedPorts);
 
@@ -51,60 +60,70 @@ SerialPortEnumerator::~SerialPortEnumerator()
 
 void SerialPortEnumerator::refresh()
 {
-    std::set<SerialPort *> portsToDisown = m_ownedPorts;
+    // The monitor reports changes on its own, this only makes it look now
+    // instead of waiting for the next event or poll.
+    m_monitor.rescanNow();
+}
+
+void SerialPortEnumerator::portsChanged(const QList<QextPortInfo>& added, const QStringList& removed)
+{
+    for(int i = 0; i < removed.size(); ++i)
+        removePort(removed[i]);
 
-    QList<QextPortInfo> ports = QextSerialEnumerator::getPorts();
-    for (int i = 0; i < ports.size(); ++i)
+    for(int i = 0; i < added.size(); ++i)
+        addPort(added[i]);
+}
+
+void SerialPortEnumerator::addPort(const QextPortInfo& info)
+{
+    QHash<QString, SerialPort *>::const_iterator it = m_portMap.find(info.physName);
+    if (it == m_portMap.end())
     {
-        QextPortInfo info = ports[i];
+        ConnectionPointer<SerialPort> portGuard(new SerialPort());
+        portGuard->setName(info.portName, /*isDefault=*/true);
+        portGuard->setDeviceName(info.physName);
+        portGuard->setFriendlyName(info.friendName);
+        portGuard->setBaudRate(38400);
+        portGuard->setDevNameEditable(false);
 
-        QHash<QString, SerialPort *>::const_iterator it = m_portMap.find(ports[i].physName);
-        if (it == m_portMap.end())
-        {
-            ConnectionPointer<SerialPort> portGuard(new SerialPort());
-            portGuard->setName(info.portName, /*isDefault=*/true);
-            portGuard->setDeviceName(info.physName);
-            portGuard->setFriendlyName(info.friendName);
-            portGuard->setBaudRate(38400);
-            portGuard->setDevNameEditable(false);
+        QHash<QString, QVariant>::iterator cfgIt = m_connCfg.find(info.physName);
+        if(cfgIt != m_connCfg.end() && (*cfgIt).type() == QVariant::Hash)
+            portGuard->applyConfig((*cfgIt).toHash());
 
-            QHash<QString, QVariant>::iterator cfgIt = m_connCfg.find(info.physName);
-            if(cfgIt != m_connCfg.end() && (*cfgIt).type() == QVariant::Hash)
-                portGuard->applyConfig((*cfgIt).toHash());
+        connect(portGuard.data(), SIGNAL(destroyed()), this, SLOT(connectionDestroyed()));
+        m_portMap[info.physName] = portGuard.data();
 
-            connect(portGuard.data(), SIGNAL(destroyed()), this, SLOT(connectionDestroyed()));
-            m_portMap[info.physName] = portGuard.data();
+        sConMgr2.addConnection(portGuard.data());
 
-            sConMgr2.addConnection(portGuard.data());
+        m_ownedPorts.insert(portGuard.data());
+        portGuard->setRemovable(false);
+        portGuard.take();
+    }
+    else
+    {
+        SerialPort * port = it.value();
 
-            m_ownedPorts.insert(portGuard.data());
-            portGuard->setRemovable(false);
-            portGuard.take();
-        }
-        else
+        if (m_ownedPorts.find(port) == m_ownedPorts.end())
         {
-            SerialPort * port = it.value();
-
-            if (m_ownedPorts.find(port) == m_ownedPorts.end())
-            {
-                m_ownedPorts.insert(port);
-                port->setRemovable(false);
-                port->addRef();
-            }
-            else
-            {
-                portsToDisown.erase(port);
-            }
+            m_ownedPorts.insert(port);
+            port->setRemovable(false);
+            port->addRef();
         }
     }
+}
 
-    for (std::set<SerialPort *>::const_iterator it = portsToDisown.begin(); it != portsToDisown.end(); ++it)
-    {
-        SerialPort * port = *it;
-        m_ownedPorts.erase(port);
-        port->setRemovable(true);
-        port->release();
-    }
+void SerialPortEnumerator::removePort(const QString& physName)
+{
+    QHash<QString, SerialPort *>::const_iterator it = m_portMap.find(physName);
+    if (it == m_portMap.end())
+        return;
+
+    SerialPort * port = it.value();
+    if (m_ownedPorts.erase(port) == 0)
+        return;
+
+    port->setRemovable(true);
+    port->release();
 }
 
 void SerialPortEnumerator::connectionDestroyed()
@@ -487,6 +506,7 @@ QVariant ConnectionManager2::config() const
             "stm32",           // CONNECTION_STM32
             "",                // CONNECTION_SHUPITO_SPI_TUNNEL
             "udp_socket",      // CONNECTION_UDP_SOCKET
+            "",                // CONNECTION_SIMULATED
         };
 
         Q_ASSERT(conn->getType() < sizeof_array(connTypes));
@@ -11,6 +11,7 @@
 #include "../connection/connection.h"
 #include "../connection/shupitoconn.h"
 #include "../connection/usbshupito23conn.h"
+#include "../connection/serialportmonitor.h"
 #include <QString>
 #include <QTimer>
 #include <QHash>
@@ -34,9 +35,12 @@ public slots:
     void refresh();
 
 private slots:
+    void portsChanged(const QList<QextPortInfo>& added, const QStringList& removed);
     void connectionDestroyed();
 
 private:
+    void addPort(const QextPortInfo& info);
+    void removePort(const QString& physName);
     QHash<QString, QVariant> config(const std::set<SerialPort *>& ports);
 
     std::set<SerialPort *> m_ownedPorts;
@@ -44,7 +48,7 @@ private:
 
     QHash<QString, QVariant> m_connCfg;
 
-    QTimer m_refreshTimer;
+    SerialPortMonitor m_monitor;
 };
 
 #ifdef HAVE_LIBYB
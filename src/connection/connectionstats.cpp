@@ -0,0 +1,151 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#include <QObject>
+#include <QStringList>
+
+#include "connectionstats.h"
+
+static void storeMax(std::atomic<quint64>& target, quint64 value)
+{
+    quint64 cur = target.load(std::memory_order_relaxed);
+    while(value > cur && !target.compare_exchange_weak(cur, value, std::memory_order_relaxed)) { }
+}
+
+ConnectionStats::ConnectionStats()
+{
+    reset();
+}
+
+void ConnectionStats::reset()
+{
+    m_bytesIn = 0;
+    m_bytesOut = 0;
+    m_reads = 0;
+    m_writes = 0;
+    m_overflows = 0;
+    m_sendQueue = 0;
+    m_sendQueueMax = 0;
+    m_latencyCount = 0;
+    m_latencySum = 0;
+    m_latencyMax = 0;
+    for(int i = 0; i < chunk_buckets; ++i)
+        m_chunkSizes[i] = 0;
+    for(int i = 0; i < latency_buckets; ++i)
+        m_latencies[i] = 0;
+
+    m_timer.start();
+}
+
+int ConnectionStats::bucket(quint64 value)
+{
+    int res = 0;
+    for(; value != 0; value >>= 1)
+        ++res;
+    return res;
+}
+
+void ConnectionStats::received(quint64 bytes)
+{
+    m_bytesIn.fetch_add(bytes, std::memory_order_relaxed);
+    m_reads.fetch_add(1, std::memory_order_relaxed);
+    m_chunkSizes[qMin(bucket(bytes), chunk_buckets-1)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void ConnectionStats::sent(quint64 bytes)
+{
+    m_bytesOut.fetch_add(bytes, std::memory_order_relaxed);
+    m_writes.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ConnectionStats::dispatchLatency(qint64 us)
+{
+    quint64 value = us > 0 ? us : 0;
+    m_latencyCount.fetch_add(1, std::memory_order_relaxed);
+    m_latencySum.fetch_add(value, std::memory_order_relaxed);
+    storeMax(m_latencyMax, value);
+    m_latencies[qMin(bucket(value), latency_buckets-1)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void ConnectionStats::overflow(quint64 count)
+{
+    m_overflows.fetch_add(count, std::memory_order_relaxed);
+}
+
+void ConnectionStats::sendQueueDepth(quint64 bytes)
+{
+    m_sendQueue.store(bytes, std::memory_order_relaxed);
+    storeMax(m_sendQueueMax, bytes);
+}
+
+double ConnectionStats::elapsedSeconds() const
+{
+    return m_timer.isValid() ? qMax<qint64>(m_timer.elapsed(), 1) / 1000.0 : 1.0;
+}
+
+QString ConnectionStats::formatBytes(double bytes)
+{
+    if(bytes >= 1024*1024)
+        return QObject::tr("%1 MiB").arg(bytes / (1024*1024), 0, 'f', 2);
+    if(bytes >= 1024)
+        return QObject::tr("%1 KiB").arg(bytes / 1024, 0, 'f', 1);
+    return QObject::tr("%1 B").arg(bytes, 0, 'f', 0);
+}
+
+QString ConnectionStats::summary() const
+{
+    const double secs = elapsedSeconds();
+    QString res = QObject::tr("In: %1 (%2/s), out: %3 (%4/s)")
+            .arg(formatBytes(bytesIn()), formatBytes(bytesIn() / secs))
+            .arg(formatBytes(bytesOut()), formatBytes(bytesOut() / secs));
+
+    quint64 reads = m_reads.load(std::memory_order_relaxed);
+    res += "\n" + QObject::tr("Reads: %1, avg. %2, overflows: %3")
+            .arg(reads)
+            .arg(formatBytes(reads ? double(bytesIn()) / reads : 0))
+            .arg(overflows());
+
+    quint64 latencies = m_latencyCount.load(std::memory_order_relaxed);
+    if(latencies != 0)
+    {
+        res += QObject::tr(", latency avg. %1 us, max %2 us")
+                .arg(m_latencySum.load(std::memory_order_relaxed) / latencies)
+                .arg(m_latencyMax.load(std::memory_order_relaxed));
+    }
+    return res;
+}
+
+QString ConnectionStats::report() const
+{
+    QStringList lines;
+    lines << QString("seconds_open %1").arg(elapsedSeconds(), 0, 'f', 3)
+          << QString("bytes_in %1").arg(bytesIn())
+          << QString("bytes_out %1").arg(bytesOut())
+          << QString("reads %1").arg(m_reads.load(std::memory_order_relaxed))
+          << QString("writes %1").arg(m_writes.load(std::memory_order_relaxed))
+          << QString("overflows %1").arg(overflows())
+          << QString("send_queue_bytes %1").arg(m_sendQueue.load(std::memory_order_relaxed))
+          << QString("send_queue_max_bytes %1").arg(m_sendQueueMax.load(std::memory_order_relaxed))
+          << QString("latency_samples %1").arg(m_latencyCount.load(std::memory_order_relaxed))
+          << QString("latency_sum_us %1").arg(m_latencySum.load(std::memory_order_relaxed))
+          << QString("latency_max_us %1").arg(m_latencyMax.load(std::memory_order_relaxed));
+
+    // "name upper_bound count", the last bucket has no upper bound
+    for(int i = 0; i < chunk_buckets; ++i)
+    {
+        lines << QString("read_size_lt %1 %2")
+                 .arg(i+1 < chunk_buckets ? QString::number(quint64(1) << i) : QString("inf"))
+                 .arg(m_chunkSizes[i].load(std::memory_order_relaxed));
+    }
+    for(int i = 0; i < latency_buckets; ++i)
+    {
+        lines << QString("latency_us_lt %1 %2")
+                 .arg(i+1 < latency_buckets ? QString::number(quint64(1) << i) : QString("inf"))
+                 .arg(m_latencies[i].load(std::memory_order_relaxed));
+    }
+    return lines.join("\n") + "\n";
+}
@@ -0,0 +1,73 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#ifndef CONNECTIONSTATS_H
+#define CONNECTIONSTATS_H
+
+#include <QString>
+#include <QElapsedTimer>
+#include <atomic>
+
+/*
+ * Traffic counters of one connection. Recording is a few relaxed atomic
+ * increments, so it is always on and can be done from the connection's
+ * worker threads. Sizes and latencies go into power-of-two histograms.
+ */
+class ConnectionStats
+{
+public:
+    enum {
+        // bucket i holds values in [2^(i-1), 2^i), bucket 0 holds zero
+        chunk_buckets = 18,   // up to 64 KiB and more
+        latency_buckets = 22  // up to ~1 s and more, in microseconds
+    };
+
+    ConnectionStats();
+
+    // Called when the connection opens
+    void reset();
+
+    void received(quint64 bytes);
+    void sent(quint64 bytes);
+    // Time from the device handing over the data to dataRead being emitted
+    void dispatchLatency(qint64 us);
+    // Data the connection lost before it could dispatch them
+    void overflow(quint64 count);
+    // Data accepted by SendData but not yet written to the device
+    void sendQueueDepth(quint64 bytes);
+
+    quint64 bytesIn() const { return m_bytesIn.load(std::memory_order_relaxed); }
+    quint64 bytesOut() const { return m_bytesOut.load(std::memory_order_relaxed); }
+    quint64 overflows() const { return m_overflows.load(std::memory_order_relaxed); }
+
+    // Two lines for the connection chooser
+    QString summary() const;
+    // Everything, including the histograms, as plain text
+    QString report() const;
+
+private:
+    static int bucket(quint64 value);
+    static QString formatBytes(double bytes);
+    double elapsedSeconds() const;
+
+    std::atomic<quint64> m_bytesIn;
+    std::atomic<quint64> m_bytesOut;
+    std::atomic<quint64> m_reads;
+    std::atomic<quint64> m_writes;
+    std::atomic<quint64> m_overflows;
+    std::atomic<quint64> m_sendQueue;
+    std::atomic<quint64> m_sendQueueMax;
+    std::atomic<quint64> m_latencyCount;
+    std::atomic<quint64> m_latencySum;
+    std::atomic<quint64> m_latencyMax;
+    std::atomic<quint64> m_chunkSizes[chunk_buckets];
+    std::atomic<quint64> m_latencies[latency_buckets];
+
+    QElapsedTimer m_timer;
+};
+
+#endif // CONNECTIONSTATS_H
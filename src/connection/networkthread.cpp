@@ -0,0 +1,33 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#include <QMetaType>
+#include <QList>
+#include <QByteArray>
+
+#include "networkthread.h"
+
+NetworkThread::NetworkThread() : QThread(NULL)
+{
+    qRegisterMetaType<QList<QByteArray> >("QList<QByteArray>");
+    start();
+}
+
+NetworkThread *NetworkThread::instance()
+{
+    // Never stopped: connections are closed with blocking calls to their
+    // workers and some are destroyed only after the application's event
+    // loop has finished.
+    static NetworkThread *thread = new NetworkThread();
+    return thread;
+}
+
+void NetworkThread::adopt(QObject *worker)
+{
+    Q_ASSERT(!worker->parent());
+    worker->moveToThread(instance());
+}
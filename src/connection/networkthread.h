@@ -0,0 +1,33 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#ifndef NETWORKTHREAD_H
+#define NETWORKTHREAD_H
+
+#include <QThread>
+
+/*
+ * Event loop thread shared by the network connections. Their sockets live
+ * in worker objects moved to this thread, so that reads and writes go on
+ * while the GUI thread is busy. The connections talk to the workers
+ * through queued calls only.
+ */
+class NetworkThread : public QThread
+{
+    Q_OBJECT
+
+public:
+    static NetworkThread *instance();
+
+    // Moves a parentless worker to the thread
+    static void adopt(QObject *worker);
+
+private:
+    NetworkThread();
+};
+
+#endif // NETWORKTHREAD_H
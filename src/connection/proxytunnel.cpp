@@ -44,7 +44,10 @@ void ProxyTunnel::setTcpServer(TcpServer *server)
 void ProxyTunnel::SendData(const QByteArray &data)
 {
     if(isOpen())
+    {
         m_server->SendData(data);
+        stats().sent(data.size());
+    }
 }
 
 QHash<QString, QVariant> ProxyTunnel::config() const
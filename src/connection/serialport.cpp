@@ -25,6 +25,9 @@
 SerialPort::SerialPort() : PortConnection(CONNECTION_SERIAL_PORT),
       m_devNameEditable(true), m_parity(PAR_NONE), m_stopBits(STOP_1), m_dataBits(DATA_8),
       m_flowControl(FLOW_OFF), m_rtsToggled(true), m_dtrToggled(true)
+#ifdef Q_OS_LINUX
+      , m_readChannel(1024)
+#endif
 {
     m_port = NULL;
     m_openThread = NULL;
@@ -34,6 +37,12 @@ SerialPort::SerialPort() : PortConnection(CONNECTION_SERIAL_PORT),
 #ifdef Q_OS_WIN
     m_thread = new SerialPortThread(this);
 #endif
+#ifdef Q_OS_LINUX
+    m_lastReceiveTime = 0;
+    m_readThread = new SerialPortReadThread(m_readChannel, this);
+    connect(&m_readChannel, SIGNAL(dataReceived()), SLOT(readChunks()));
+    connect(m_readThread, SIGNAL(readError()), SLOT(readThreadError()), Qt::QueuedConnection);
+#endif
 }
 
 SerialPort::~SerialPort()
@@ -89,6 +98,9 @@ void SerialPort::doClose()
         QMutexLocker l(&m_port_mutex);
 #ifdef Q_OS_WIN
         m_thread->setPort(NULL);
+#endif
+#ifdef Q_OS_LINUX
+        m_readThread->close();
 #endif
         if(m_port)
         {
@@ -107,6 +119,9 @@ void SerialPort::SendData(const QByteArray& data)
     {
         QMutexLocker l(&m_port_mutex);
         m_port->write(data);
+
+        this->stats().sent(data.size());
+        this->stats().sendQueueDepth(m_port->bytesToWrite());
     }
 }
 
@@ -140,9 +155,22 @@ void SerialPort::openResult()
     delete m_openThread;
     m_openThread = NULL;
 
+#ifdef Q_OS_LINUX
+    if(m_port && !m_readThread->open(m_port->handle()))
+    {
+        m_port->close();
+        delete m_port;
+        m_port = NULL;
+    }
+#endif
+
     if(m_port)
     {
+#ifdef Q_OS_LINUX
+        applyBaudRate();
+#else
         connect(m_port, SIGNAL(readyRead()),              SLOT(readyRead()));
+#endif
         connect(m_port, SIGNAL(socketError(SocketError)), SLOT(socketError(SocketError)));
     }
 
@@ -184,7 +212,12 @@ void SerialPort::setBaudRate(int value)
 {
     m_rate = value;
     if(isOpen())
+    {
         m_port->setBaudRate(value);
+#ifdef Q_OS_LINUX
+        applyBaudRate();
+#endif
+    }
     emit changed();
 }
 
@@ -192,7 +225,12 @@ void SerialPort::setParity(ParityType p)
 {
     m_parity = p;
     if(isOpen())
+    {
         m_port->setParity(p);
+#ifdef Q_OS_LINUX
+        applyBaudRate();
+#endif
+    }
     emit changed();
 }
 
@@ -200,7 +238,12 @@ void SerialPort::setStopBits(StopBitsType st)
 {
     m_stopBits = st;
     if(isOpen())
+    {
         m_port->setStopBits(st);
+#ifdef Q_OS_LINUX
+        applyBaudRate();
+#endif
+    }
     emit changed();
 }
 
@@ -208,7 +251,12 @@ void SerialPort::setDataBits(DataBitsType dt)
 {
     m_dataBits = dt;
     if(isOpen())
+    {
         m_port->setDataBits(dt);
+#ifdef Q_OS_LINUX
+        applyBaudRate();
+#endif
+    }
     emit changed();
 }
 
@@ -229,7 +277,12 @@ void SerialPort::setRts(bool set) {
 void SerialPort::setFlowControl(FlowType type) {
     m_flowControl = type;
     if(isOpen())
+    {
         m_port->setFlowControl(type);
+#ifdef Q_OS_LINUX
+        applyBaudRate();
+#endif
+    }
     emit changed();
 }
 
@@ -242,6 +295,46 @@ void SerialPort::socketError(SocketError err)
     }
 }
 
+#ifdef Q_OS_LINUX
+// QextSerialPort knows only the Bxxx rates and rewrites the whole termios
+// on every change, so the rate is set again through termios2 afterwards.
+void SerialPort::applyBaudRate()
+{
+    if(!m_readThread->setBaudRate(m_rate))
+        qWarning("%s: failed to set baud rate %d", qPrintable(m_deviceName), m_rate);
+}
+
+void SerialPort::readChunks()
+{
+    std::vector<SerialPortChunk> chunks;
+    m_readChannel.receive(chunks);
+
+    if(size_t dropped = m_readChannel.takeOverflows())
+    {
+        qWarning("%s: receive queue overflow, %u reads dropped", qPrintable(m_deviceName), (unsigned)dropped);
+        this->stats().overflow(dropped);
+    }
+
+    const qint64 now = SerialPortReadThread::monotonicTime();
+    for(size_t i = 0; i < chunks.size() && isOpen(); ++i)
+    {
+        m_lastReceiveTime = chunks[i].timestamp_us;
+        this->stats().dispatchLatency(now - chunks[i].timestamp_us);
+        emit dataRead(chunks[i].data);
+    }
+}
+
+void SerialPort::readThreadError()
+{
+    if(isOpen())
+    {
+        sWorkTabMgr.printToAllStatusBars(tr("Connection to %1 lost!").arg(m_deviceName));
+        Close();
+    }
+}
+
+#endif // Q_OS_LINUX
+
 QHash<QString, QVariant> SerialPort::config() const
 {
     QHash<QString, QVariant> res = this->PortConnection::config();
@@ -293,9 +386,13 @@ void SerialPortOpenThread::run()
 
     m_conn->lockMutex();
 
-#ifdef Q_OS_WIN
+#if defined(Q_OS_WIN)
     m_port = new QextSerialPort(m_conn->deviceName(), QextSerialPort::Polling);
     m_port->setTimeout(-1);
+#elif defined(Q_OS_LINUX)
+    // SerialPortReadThread polls the descriptor of this port and reads it
+    m_port = new QextSerialPort(m_conn->deviceName(), QextSerialPort::Polling);
+    m_port->setTimeout(0);
 #else
     m_port = new QextSerialPort(m_conn->deviceName(), QextSerialPort::EventDriven);
     m_port->setTimeout(500);
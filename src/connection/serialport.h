@@ -14,6 +14,9 @@
 #include <qextserialport.h>
 
 #include "connection.h"
+#ifdef Q_OS_LINUX
+    #include "serialportlinux.h"
+#endif
 
 class QComboBox;
 class SerialPortOpenThread;
@@ -79,6 +82,12 @@ public:
     bool clonable() const { return true; }
     ConnectionPointer<Connection> clone();
 
+#ifdef Q_OS_LINUX
+    // CLOCK_MONOTONIC time in us at which the data passed to the
+    // current dataRead() were received
+    qint64 lastReceiveTime() const { return m_lastReceiveTime; }
+#endif
+
 protected:
     ~SerialPort();
     void doClose();
@@ -89,6 +98,10 @@ private slots:
     void openResult();
     void readyRead();
     void socketError(SocketError err);
+#ifdef Q_OS_LINUX
+    void readChunks();
+    void readThreadError();
+#endif
 
 private:
     QString m_deviceName;
@@ -109,6 +122,13 @@ private:
 
 #ifdef Q_OS_WIN
     SerialPortThread *m_thread;
+#endif
+#ifdef Q_OS_LINUX
+    void applyBaudRate();
+
+    ThreadRingChannel<SerialPortChunk> m_readChannel;
+    SerialPortReadThread *m_readThread;
+    qint64 m_lastReceiveTime;
 #endif
     SerialPortOpenThread *m_openThread;
 };
@@ -0,0 +1,140 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#include <asm/termbits.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "serialportlinux.h"
+
+// Large enough for ~100 ms at 4 Mbaud
+#define READ_BUFFER_SIZE (64*1024)
+
+SerialPortReadThread::SerialPortReadThread(ThreadRingChannel<SerialPortChunk>& channel, QObject *parent)
+    : QThread(parent), m_channel(channel), m_buffer(READ_BUFFER_SIZE), m_fd(-1)
+{
+    m_wake[0] = m_wake[1] = -1;
+}
+
+SerialPortReadThread::~SerialPortReadThread()
+{
+    close();
+}
+
+bool SerialPortReadThread::open(int fd)
+{
+    Q_ASSERT(m_fd == -1);
+
+    if(fd == -1)
+        return false;
+    m_fd = fd;
+
+    if(::pipe2(m_wake, O_NONBLOCK | O_CLOEXEC) == -1)
+    {
+        m_wake[0] = m_wake[1] = -1;
+        close();
+        return false;
+    }
+
+    start(QThread::TimeCriticalPriority);
+    return true;
+}
+
+void SerialPortReadThread::close()
+{
+    if(isRunning())
+    {
+        char c = 0;
+        while(::write(m_wake[1], &c, 1) == -1 && errno == EINTR) { }
+        wait();
+    }
+
+    for(int i = 0; i < 2; ++i)
+    {
+        if(m_wake[i] != -1)
+            ::close(m_wake[i]);
+        m_wake[i] = -1;
+    }
+
+    // the descriptor belongs to QextSerialPort
+    m_fd = -1;
+}
+
+bool SerialPortReadThread::setBaudRate(int rate)
+{
+    if(m_fd == -1 || rate <= 0)
+        return false;
+
+    struct termios2 tio;
+    if(::ioctl(m_fd, TCGETS2, &tio) == -1)
+        return false;
+
+    tio.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+    tio.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+    tio.c_ispeed = rate;
+    tio.c_ospeed = rate;
+    return ::ioctl(m_fd, TCSETS2, &tio) != -1;
+}
+
+qint64 SerialPortReadThread::monotonicTime()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return qint64(ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+}
+
+void SerialPortReadThread::run()
+{
+    struct pollfd fds[2];
+    fds[0].fd = m_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = m_wake[0];
+    fds[1].events = POLLIN;
+
+    for(;;)
+    {
+        fds[0].revents = fds[1].revents = 0;
+        if(::poll(fds, 2, -1) == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            emit readError();
+            return;
+        }
+
+        if(fds[1].revents)
+            return;
+
+        const qint64 timestamp = monotonicTime();
+
+        if(fds[0].revents & (POLLERR | POLLHUP | POLLNVAL))
+        {
+            emit readError();
+            return;
+        }
+
+        // QextSerialPort sets VMIN and VTIME to 0, the read never blocks
+        ssize_t r = ::read(m_fd, m_buffer.data(), m_buffer.size());
+        if(r == -1 && (errno == EAGAIN || errno == EINTR))
+            continue;
+        if(r <= 0)
+        {
+            // POLLIN with no data means the device is gone
+            emit readError();
+            return;
+        }
+
+        SerialPortChunk chunk;
+        chunk.data = QByteArray(m_buffer.data(), r);
+        chunk.timestamp_us = timestamp;
+        m_channel.send(std::move(chunk));
+    }
+}
@@ -0,0 +1,63 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#ifndef SERIALPORTLINUX_H
+#define SERIALPORTLINUX_H
+
+#include <QThread>
+#include <QByteArray>
+#include <QString>
+#include <vector>
+
+#include "../misc/threadchannel.h"
+
+// Must not include <termios.h>, serialportlinux.cpp uses the kernel's termios2.
+
+struct SerialPortChunk
+{
+    QByteArray data;
+    // CLOCK_MONOTONIC, taken when poll() woke up
+    qint64 timestamp_us;
+};
+
+/*
+ * Reads a serial port in its own thread, so that stalls of the GUI thread
+ * don't delay the reads and overrun the kernel's buffer. It polls the
+ * descriptor of the QextSerialPort, which still configures the port
+ * and writes to it.
+ */
+class SerialPortReadThread : public QThread
+{
+    Q_OBJECT
+
+Q_SIGNALS:
+    void readError();
+
+public:
+    SerialPortReadThread(ThreadRingChannel<SerialPortChunk>& channel, QObject *parent = 0);
+    ~SerialPortReadThread();
+
+    // fd must stay open until close() returns
+    bool open(int fd);
+    void close();
+
+    // Sets any baud rate through termios2, even the ones without a Bxxx constant
+    bool setBaudRate(int rate);
+
+    static qint64 monotonicTime();
+
+protected:
+    void run();
+
+private:
+    ThreadRingChannel<SerialPortChunk>& m_channel;
+    std::vector<char> m_buffer;
+    int m_fd;
+    int m_wake[2];
+};
+
+#endif // SERIALPORTLINUX_H
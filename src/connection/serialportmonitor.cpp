@@ -0,0 +1,214 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#include <QMetaType>
+
+#ifdef Q_OS_LINUX
+#include <QElapsedTimer>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#endif
+
+#include "serialportmonitor.h"
+
+static const int REFRESH_INTERVAL = 1000; // ms, without inotify
+#ifdef Q_OS_LINUX
+// udev creates the node and its links in a burst, the scan waits for it to end
+static const int SETTLE_TIME = 200; // ms
+#endif
+
+SerialPortMonitor::SerialPortMonitor(QObject *parent) : QThread(parent), m_stopping(false)
+{
+    qRegisterMetaType<QList<QextPortInfo> >("QList<QextPortInfo>");
+
+#ifdef Q_OS_LINUX
+    if(::pipe2(m_wake, O_NONBLOCK | O_CLOEXEC) == -1)
+        m_wake[0] = m_wake[1] = -1;
+#endif
+}
+
+SerialPortMonitor::~SerialPortMonitor()
+{
+    stop();
+
+#ifdef Q_OS_LINUX
+    for(int i = 0; i < 2; ++i)
+        if(m_wake[i] != -1)
+            ::close(m_wake[i]);
+#endif
+}
+
+QList<QextPortInfo> SerialPortMonitor::initialScan()
+{
+    Q_ASSERT(!isRunning());
+
+    const QList<QextPortInfo> list = QextSerialEnumerator::getPorts();
+    m_ports.clear();
+    for(int i = 0; i < list.size(); ++i)
+        m_ports.insert(list[i].physName, list[i]);
+    return list;
+}
+
+void SerialPortMonitor::stop()
+{
+    if(!isRunning())
+        return;
+
+    m_stopping = true;
+    rescanNow();
+    wait();
+    m_stopping = false;
+}
+
+void SerialPortMonitor::rescanNow()
+{
+#ifdef Q_OS_LINUX
+    char c = 0;
+    while(::write(m_wake[1], &c, 1) == -1 && errno == EINTR) { }
+#else
+    m_wake.release();
+#endif
+}
+
+void SerialPortMonitor::rescan()
+{
+    QHash<QString, QextPortInfo> ports;
+    QList<QextPortInfo> added;
+
+    const QList<QextPortInfo> list = QextSerialEnumerator::getPorts();
+    for(int i = 0; i < list.size(); ++i)
+    {
+        ports.insert(list[i].physName, list[i]);
+        if(!m_ports.contains(list[i].physName))
+            added.append(list[i]);
+    }
+
+    QStringList removed;
+    for(QHash<QString, QextPortInfo>::const_iterator itr = m_ports.constBegin(); itr != m_ports.constEnd(); ++itr)
+    {
+        if(!ports.contains(itr.key()))
+            removed.append(itr.key());
+    }
+
+    m_ports = ports;
+
+    if(!added.isEmpty() || !removed.isEmpty())
+        emit portsChanged(added, removed);
+}
+
+#ifdef Q_OS_LINUX
+
+bool SerialPortMonitor::isPortNode(const char *name)
+{
+    // the same names QextSerialEnumerator looks for
+    static const char *prefixes[] = { "ttyS", "ttyACM", "ttyUSB", "rfcomm" };
+    for(size_t i = 0; i < sizeof(prefixes)/sizeof(prefixes[0]); ++i)
+        if(strncmp(name, prefixes[i], strlen(prefixes[i])) == 0)
+            return true;
+    return false;
+}
+
+void SerialPortMonitor::run()
+{
+    rescan();
+    if(m_wake[0] == -1)
+        return;
+
+    int fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(fd != -1 && ::inotify_add_watch(fd, "/dev", IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO) == -1)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+
+    struct pollfd fds[2];
+    fds[0].fd = m_wake[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = fd; // ignored by poll() when negative
+    fds[1].events = POLLIN;
+
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    QElapsedTimer settle;
+    bool pending = false;
+
+    for(;;)
+    {
+        int timeout = -1;
+        if(fd == -1)
+            timeout = REFRESH_INTERVAL;
+        else if(pending)
+            timeout = std::max<qint64>(0, SETTLE_TIME - settle.elapsed());
+
+        fds[0].revents = fds[1].revents = 0;
+        const int res = ::poll(fds, 2, timeout);
+        if(res == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+
+        if(fds[0].revents)
+        {
+            char c[16];
+            while(::read(m_wake[0], c, sizeof(c)) > 0) { }
+            if(m_stopping)
+                break;
+        }
+
+        if(res == 0 || fds[0].revents)
+        {
+            pending = false;
+            rescan();
+            continue;
+        }
+
+        if(fds[1].revents & (POLLERR | POLLNVAL))
+        {
+            // fall back to periodic enumeration
+            ::close(fd);
+            fd = fds[1].fd = -1;
+            continue;
+        }
+
+        ssize_t len;
+        while((len = ::read(fd, buf, sizeof(buf))) > 0)
+        {
+            for(char *p = buf; p < buf + len; )
+            {
+                const struct inotify_event *ev = (const struct inotify_event*)p;
+                if(!pending && ((ev->mask & IN_Q_OVERFLOW) || (ev->len != 0 && isPortNode(ev->name))))
+                {
+                    pending = true;
+                    settle.start();
+                }
+                p += sizeof(struct inotify_event) + ev->len;
+            }
+        }
+    }
+
+    if(fd != -1)
+        ::close(fd);
+}
+
+#else
+
+void SerialPortMonitor::run()
+{
+    while(!m_stopping)
+    {
+        rescan();
+        m_wake.tryAcquire(1, REFRESH_INTERVAL);
+    }
+}
+
+#endif // Q_OS_LINUX
@@ -0,0 +1,65 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#ifndef SERIALPORTMONITOR_H
+#define SERIALPORTMONITOR_H
+
+#include <QThread>
+#include <QHash>
+#include <QList>
+#include <QStringList>
+#include <QSemaphore>
+#include <atomic>
+#include <qextserialenumerator.h>
+
+/*
+ * Enumerates serial ports in its own thread and reports only the ports
+ * which were added or removed since the last time. On Linux, /dev is
+ * watched with inotify and the ports are enumerated only after a serial
+ * device node appears or disappears. Elsewhere, the enumeration runs
+ * periodically.
+ */
+class SerialPortMonitor : public QThread
+{
+    Q_OBJECT
+
+Q_SIGNALS:
+    // removed holds physical names of the ports
+    void portsChanged(const QList<QextPortInfo>& added, const QStringList& removed);
+
+public:
+    explicit SerialPortMonitor(QObject *parent = 0);
+    ~SerialPortMonitor();
+
+    // Enumerates the ports in the calling thread, must be called
+    // before the thread is started. Later changes are reported by portsChanged.
+    QList<QextPortInfo> initialScan();
+
+    void stop();
+    // Enumerates the ports as soon as possible
+    void rescanNow();
+
+protected:
+    void run();
+
+private:
+    void rescan();
+#ifdef Q_OS_LINUX
+    static bool isPortNode(const char *name);
+#endif
+
+    QHash<QString, QextPortInfo> m_ports;
+    std::atomic<bool> m_stopping;
+
+#ifdef Q_OS_LINUX
+    int m_wake[2];
+#else
+    QSemaphore m_wake;
+#endif
+};
+
+#endif // SERIALPORTMONITOR_H
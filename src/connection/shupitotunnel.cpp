@@ -73,5 +73,6 @@ void ShupitoTunnel::SendData(const QByteArray &data)
     if(!this->isOpen() || !m_shupito)
         return;
 
+    // counted by Shupito, which also sends the tunnel data typed in the programmer's terminal
     m_shupito->sendTunnelData(data);
 }
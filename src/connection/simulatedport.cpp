@@ -0,0 +1,173 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#include <QStringBuilder>
+#include <algorithm>
+
+#include "simulatedport.h"
+
+SimulatedPort::SimulatedPort(SimulatedTarget *target, link const & l)
+    : PortConnection(CONNECTION_SIMULATED), m_target(target), m_link(l)
+{
+    m_tx_free = 0;
+    m_rx_free = 0;
+    m_target_time = 0;
+    m_sent_since_reply = false;
+    resetCounters();
+
+    m_clock.start();
+
+    m_timer.setSingleShot(true);
+#if QT_VERSION >= 0x050000
+    m_timer.setTimerType(Qt::PreciseTimer);
+#endif
+    connect(&m_timer, SIGNAL(timeout()), SLOT(deliver()));
+
+    setName(tr("Simulated target"), /*isDefault=*/true);
+}
+
+SimulatedPort::~SimulatedPort()
+{
+    Close();
+    delete m_target;
+}
+
+QString SimulatedPort::details() const
+{
+    QString res = Connection::details();
+    if (!res.isEmpty())
+        res += ", ";
+    return res % tr("%1 us latency, %2 B/s").arg(m_link.latency_us).arg(m_link.bandwidth);
+}
+
+void SimulatedPort::doOpen()
+{
+    m_tx_free = m_rx_free = m_target_time = now();
+    this->SetState(st_connected);
+}
+
+void SimulatedPort::doClose()
+{
+    m_timer.stop();
+    m_to_target.clear();
+    m_to_host.clear();
+
+    this->SetState(st_disconnected);
+}
+
+void SimulatedPort::resetCounters()
+{
+    m_bytes_sent = 0;
+    m_bytes_received = 0;
+    m_round_trips = 0;
+}
+
+qint64 SimulatedPort::now() const
+{
+    return m_clock.nsecsElapsed() / 1000;
+}
+
+qint64 SimulatedPort::transferTime(int len) const
+{
+    if(m_link.bandwidth == 0)
+        return 0;
+    return (qint64(len) * 1000000) / m_link.bandwidth;
+}
+
+void SimulatedPort::SendData(const QByteArray &data)
+{
+    if(!this->isOpen() || data.isEmpty())
+        return;
+
+    m_tx_free = std::max(m_tx_free, now()) + transferTime(data.size());
+
+    transfer t;
+    t.due = m_tx_free + m_link.latency_us;
+    t.data = data;
+    m_to_target.push_back(t);
+
+    m_bytes_sent += data.size();
+    m_sent_since_reply = true;
+    this->stats().sent(data.size());
+
+    schedule();
+}
+
+void SimulatedPort::busy(quint32 busy_us)
+{
+    m_target_time += busy_us;
+}
+
+void SimulatedPort::reply(const QByteArray& data, quint32 busy_us)
+{
+    busy(busy_us);
+    if(data.isEmpty())
+        return;
+
+    m_rx_free = std::max(m_rx_free, m_target_time) + transferTime(data.size());
+
+    transfer t;
+    t.due = m_rx_free + m_link.latency_us;
+    t.data = data;
+    m_to_host.push_back(t);
+
+    schedule();
+}
+
+void SimulatedPort::deliver()
+{
+    const qint64 t = now();
+
+    // Transfers are popped before they are processed, the slots
+    // connected to dataRead() may send more data.
+    while(!m_to_target.empty() && m_to_target.front().due <= t)
+    {
+        transfer xfer = m_to_target.front();
+        m_to_target.pop_front();
+
+        m_target_time = std::max(m_target_time, xfer.due);
+        m_target->received(this, xfer.data);
+    }
+
+    while(!m_to_host.empty() && m_to_host.front().due <= t)
+    {
+        QByteArray data = m_to_host.front().data;
+        m_to_host.pop_front();
+
+        m_bytes_received += data.size();
+        if(m_sent_since_reply)
+        {
+            ++m_round_trips;
+            m_sent_since_reply = false;
+        }
+
+        emit dataRead(data);
+
+        if(!this->isOpen())
+            return;
+    }
+
+    schedule();
+}
+
+void SimulatedPort::schedule()
+{
+    qint64 next = -1;
+    if(!m_to_target.empty())
+        next = m_to_target.front().due;
+    if(!m_to_host.empty() && (next == -1 || m_to_host.front().due < next))
+        next = m_to_host.front().due;
+
+    if(next == -1)
+    {
+        m_timer.stop();
+        return;
+    }
+
+    const qint64 wait_us = std::max(qint64(0), next - now());
+    m_timer.start(int((wait_us + 999) / 1000));
+}
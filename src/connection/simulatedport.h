@@ -0,0 +1,113 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#ifndef SIMULATEDPORT_H
+#define SIMULATEDPORT_H
+
+#include <QTimer>
+#include <QElapsedTimer>
+#include <deque>
+
+#include "connection.h"
+
+class SimulatedPort;
+
+/*
+ * Device on the other end of a SimulatedPort, e.g. a bootloader model.
+ */
+class SimulatedTarget
+{
+public:
+    virtual ~SimulatedTarget() { }
+
+    // Called with the bytes sent by the host once they have crossed the
+    // link. Answers are queued with SimulatedPort::reply().
+    virtual void received(SimulatedPort *port, const QByteArray& data) = 0;
+};
+
+/*
+ * In-process loopback port with a modelled link, for benchmarking the
+ * programmers without hardware.
+ *
+ * Each direction is serialized at the configured bandwidth and delayed
+ * by the one-way latency. The target processes the data in the order it
+ * arrives and can stay busy for a while (e.g. writing a page), which
+ * delays all its later replies. The port is not registered with the
+ * connection manager and is not saved to sessions.
+ */
+class SimulatedPort : public PortConnection
+{
+    Q_OBJECT
+
+public:
+    struct link
+    {
+        link() : latency_us(0), bandwidth(0) { }
+
+        quint32 latency_us; // one-way
+        quint32 bandwidth;  // bytes per second in each direction, 0 is unlimited
+    };
+
+    // Takes ownership of the target
+    SimulatedPort(SimulatedTarget *target, link const & l);
+
+    virtual QString details() const;
+
+    void SendData(const QByteArray &data);
+
+    // Sends data to the host after the target has been busy for busy_us
+    void reply(const QByteArray& data, quint32 busy_us = 0);
+    // Keeps the target busy without sending anything
+    void busy(quint32 busy_us);
+
+    link const & linkParams() const { return m_link; }
+
+    void resetCounters();
+    quint64 bytesSent() const { return m_bytes_sent; }
+    quint64 bytesReceived() const { return m_bytes_received; }
+    // Replies received after something was sent
+    quint64 roundTrips() const { return m_round_trips; }
+
+protected:
+    ~SimulatedPort();
+    void doOpen();
+    void doClose();
+
+private slots:
+    void deliver();
+
+private:
+    struct transfer
+    {
+        qint64 due;
+        QByteArray data;
+    };
+
+    qint64 now() const;
+    qint64 transferTime(int len) const;
+    void schedule();
+
+    SimulatedTarget *m_target;
+    link m_link;
+
+    QElapsedTimer m_clock;
+    QTimer m_timer;
+
+    // all times are in us of m_clock
+    std::deque<transfer> m_to_target;
+    std::deque<transfer> m_to_host;
+    qint64 m_tx_free;
+    qint64 m_rx_free;
+    qint64 m_target_time;
+
+    quint64 m_bytes_sent;
+    quint64 m_bytes_received;
+    quint64 m_round_trips;
+    bool m_sent_since_reply;
+};
+
+#endif // SIMULATEDPORT_H
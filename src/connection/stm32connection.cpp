@@ -383,3 +383,167 @@ void STM32Connection::c_force_reset()
 
     c_write_debug32(DHCSR, DBGKEY | DHCSR_C_DEBUGEN);
 }
+
+STM32Connection::cmd_queue::cmd_queue()
+{
+}
+
+STM32Connection::cmd_queue::op& STM32Connection::cmd_queue::add(const stm32_cmd& cmd, size_t reply_len)
+{
+    m_ops.push_back(op(cmd));
+    m_ops.back().reply_len = reply_len;
+    return m_ops.back();
+}
+
+void STM32Connection::cmd_queue::read_debug32(uint32_t address, uint32_t *dest)
+{
+    stm32_cmd cmd(STLINK_DEBUG_COMMAND, STLINK_JTAG_READDEBUG_32BIT);
+    memcpy(&cmd.data[2], &address, sizeof(address));
+
+    // reply is status word followed by the value
+    add(cmd, 8).debug32_dest = dest;
+}
+
+void STM32Connection::cmd_queue::read_mem32(uint32_t address, uint16_t len, uint8_t *dest)
+{
+    if (len % 4 != 0)
+        throw STM32Connection::tr("STM32Connection::c_read_mem32: read len is not 32bit aligned!");
+
+    stm32_cmd cmd(STLINK_DEBUG_COMMAND, STLINK_DEBUG_READMEM_32BIT);
+    memcpy(&cmd.data[2], &address, sizeof(address));
+    memcpy(&cmd.data[6], &len, sizeof(len));
+
+    add(cmd, len).reply = dest;
+}
+
+void STM32Connection::cmd_queue::write_debug32(uint32_t address, uint32_t val)
+{
+    stm32_cmd cmd(STLINK_DEBUG_COMMAND, STLINK_JTAG_WRITEDEBUG_32BIT);
+    memcpy(&cmd.data[2], &address, sizeof(address));
+    memcpy(&cmd.data[6], &val, sizeof(val));
+
+    add(cmd, 2);
+}
+
+void STM32Connection::cmd_queue::write_mem32(uint32_t address, const uint8_t *data, uint16_t size)
+{
+    if(size % 4 != 0)
+        throw STM32Connection::tr("STM32Connection::c_write_mem32: write len is not 32bit aligned!");
+
+    stm32_cmd cmd(STLINK_DEBUG_COMMAND, STLINK_DEBUG_WRITEMEM_32BIT);
+    memcpy(&cmd.data[2], &address, sizeof(address));
+    memcpy(&cmd.data[6], &size, sizeof(size));
+
+    add(cmd, 0).out_data.assign(data, data + size);
+}
+
+void STM32Connection::cmd_queue::write_mem8(uint32_t address, const uint8_t *data, uint16_t size)
+{
+    if(size > 64)
+        throw STM32Connection::tr("STM32Connection::c_write_mem8: can't write more than 64 bytes at once!");
+
+    stm32_cmd cmd(STLINK_DEBUG_COMMAND, STLINK_DEBUG_WRITEMEM_8BIT);
+    memcpy(&cmd.data[2], &address, sizeof(address));
+    memcpy(&cmd.data[6], &size, sizeof(size));
+
+    add(cmd, 0).out_data.assign(data, data + size);
+}
+
+void STM32Connection::cmd_queue::write_reg(uint32_t val, uint8_t idx)
+{
+    if(idx > 20)
+        throw STM32Connection::tr("STM32Connection::c_write_reg: reg idx must be in range 0..20");
+
+    stm32_cmd cmd(STLINK_DEBUG_COMMAND, STLINK_DEBUG_WRITEREG);
+    cmd.data[2] = idx;
+    memcpy(&cmd.data[3], &val, sizeof(val));
+
+    add(cmd, 2);
+}
+
+void STM32Connection::cmd_queue::run()
+{
+    add(stm32_cmd(STLINK_DEBUG_COMMAND, STLINK_DEBUG_RUNCORE), 2);
+}
+
+yb::task<void> STM32Connection::queue_writer(std::shared_ptr<queue_state> st)
+{
+    return yb::loop([this, st](yb::cancel_level cl) -> yb::task<void> {
+        if (cl >= yb::cl_abort || st->write_idx >= st->ops.size())
+            return yb::nulltask;
+
+        cmd_queue::op& o = st->ops[st->write_idx];
+        if (st->write_data)
+        {
+            st->write_data = false;
+            ++st->write_idx;
+            return m_dev.bulk_write(m_out_ep, o.out_data.data(), o.out_data.size()).ignore_result();
+        }
+
+        if (o.out_data.empty())
+            ++st->write_idx;
+        else
+            st->write_data = true;
+        return m_dev.bulk_write(m_out_ep, o.cmd.data, sizeof(o.cmd.data)).ignore_result();
+    });
+}
+
+yb::task<void> STM32Connection::queue_reader(std::shared_ptr<queue_state> st)
+{
+    return yb::loop([this, st](yb::cancel_level cl) -> yb::task<void> {
+        while (st->read_idx < st->ops.size() && st->ops[st->read_idx].reply_len == 0)
+            ++st->read_idx;
+
+        if (cl >= yb::cl_abort || st->read_idx >= st->ops.size())
+            return yb::nulltask;
+
+        cmd_queue::op& o = st->ops[st->read_idx++];
+        uint8_t *dest = o.reply ? o.reply : o.status;
+        return m_dev.bulk_read(m_in_ep, dest, o.reply_len).ignore_result();
+    });
+}
+
+std::shared_ptr<STM32Connection::pending_queue> STM32Connection::c_submit(cmd_queue &queue)
+{
+    std::shared_ptr<queue_state> st(new queue_state());
+    st->ops.swap(queue.m_ops);
+    st->write_idx = 0;
+    st->write_data = false;
+    st->read_idx = 0;
+
+    std::shared_ptr<pending_queue> p(new pending_queue());
+    p->m_state = st;
+    p->m_reader = m_runner.post(this->queue_reader(st));
+    p->m_writer = m_runner.post(this->queue_writer(st));
+    return p;
+}
+
+void STM32Connection::c_wait(const std::shared_ptr<pending_queue>& p)
+{
+    yb::task_result<void> wres = p->m_writer.try_get();
+    if (wres.has_exception())
+    {
+        // the reader would wait for replies which will never come
+        p->m_reader.cancel(yb::cl_abort);
+        p->m_reader.try_get();
+        wres.rethrow();
+    }
+
+    yb::task_result<void> rres = p->m_reader.try_get();
+    if (rres.has_exception())
+        rres.rethrow();
+
+    std::vector<cmd_queue::op>& ops = p->m_state->ops;
+    for (size_t i = 0; i < ops.size(); ++i)
+    {
+        if (ops[i].debug32_dest)
+            memcpy(ops[i].debug32_dest, &ops[i].status[4], sizeof(uint32_t));
+    }
+}
+
+void STM32Connection::c_execute(cmd_queue &queue)
+{
+    if (queue.empty())
+        return;
+    c_wait(c_submit(queue));
+}
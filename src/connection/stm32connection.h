@@ -11,13 +11,90 @@
 #include <libyb/usb/usb_device.hpp>
 #include <libyb/usb/interface_guard.hpp>
 #include <libyb/async/async_runner.hpp>
+#include <memory>
 
 #include "genericusbconn.h"
 
 class STM32Connection : public GenericUsbConnection
 {
     Q_OBJECT
+
+    struct stm32_cmd
+    {
+        stm32_cmd(uint8_t b1);
+        stm32_cmd(uint8_t b1, uint8_t b2);
+        stm32_cmd(uint8_t b1, uint8_t b2, uint8_t b3);
+        uint8_t data[16];
+    };
+
 public:
+    /*
+     * Queue of ST-Link commands which are sent to the device in one go.
+     *
+     * Commands are written to the OUT endpoint by one task while replies
+     * are collected from the IN endpoint by another one, so the USB round-trip
+     * of command N+1 overlaps with the execution of command N. The buffers
+     * passed to read_* methods must stay valid until the queue is finished.
+     */
+    class cmd_queue
+    {
+        friend class STM32Connection;
+    public:
+        cmd_queue();
+
+        bool empty() const { return m_ops.empty(); }
+        size_t size() const { return m_ops.size(); }
+        void clear() { m_ops.clear(); }
+
+        void read_debug32(uint32_t address, uint32_t *dest);
+        void read_mem32(uint32_t address, uint16_t len, uint8_t *dest);
+        void write_debug32(uint32_t address, uint32_t val);
+        void write_mem32(uint32_t address, const uint8_t *data, uint16_t size);
+        void write_mem8(uint32_t address, const uint8_t *data, uint16_t size);
+        void write_reg(uint32_t val, uint8_t idx);
+        void run();
+
+        struct op
+        {
+            op(const stm32_cmd& c) : cmd(c), reply(NULL), reply_len(0), debug32_dest(NULL) { }
+
+            stm32_cmd cmd;
+            std::vector<uint8_t> out_data;
+            uint8_t *reply;
+            size_t reply_len;
+            uint32_t *debug32_dest;
+            uint8_t status[8];
+        };
+
+    private:
+        op& add(const stm32_cmd& cmd, size_t reply_len);
+
+        std::vector<op> m_ops;
+    };
+
+private:
+    struct queue_state
+    {
+        std::vector<cmd_queue::op> ops;
+        size_t write_idx;
+        bool write_data;
+        size_t read_idx;
+    };
+
+public:
+    // Handle for a cmd_queue which is being executed by the runner
+    class pending_queue
+    {
+        friend class STM32Connection;
+    public:
+        bool empty() const { return m_writer.empty(); }
+
+    private:
+        std::shared_ptr<queue_state> m_state;
+        yb::async_future<void> m_writer;
+        yb::async_future<void> m_reader;
+    };
+
     explicit STM32Connection(yb::async_runner & runner);
     
     void setEnumeratedIntf(yb::usb_device_interface const & intf);
@@ -56,18 +133,16 @@ public:
 
     void c_force_reset();
 
+    // Asynchronous command pipeline
+    void c_execute(cmd_queue& queue);
+    std::shared_ptr<pending_queue> c_submit(cmd_queue& queue);
+    void c_wait(const std::shared_ptr<pending_queue>& pending);
+
 protected:
     virtual void doOpen();
     virtual void doClose();
     
 private:
-    struct stm32_cmd
-    {
-        stm32_cmd(uint8_t b1);
-        stm32_cmd(uint8_t b1, uint8_t b2);
-        stm32_cmd(uint8_t b1, uint8_t b2, uint8_t b3);
-        uint8_t data[16];
-    };
     struct stlink_version
     {
         uint32_t stlink_v;
@@ -83,6 +158,9 @@ private:
     void send_data(const uint8_t *data, size_t len);
     int send_recv_cmd(const stm32_cmd& cmd, uint8_t *reply, size_t reply_len);
 
+    yb::task<void> queue_writer(std::shared_ptr<queue_state> st);
+    yb::task<void> queue_reader(std::shared_ptr<queue_state> st);
+
     bool m_enumerated;
     int m_vid;
     int m_pid;
@@ -6,7 +6,6 @@
 ***********************************************/
 
 #include <QtNetwork/QTcpSocket>
-#include <QtConcurrentRun>
 #include <QLabel>
 #include <QLineEdit>
 #include <QSpinBox>
@@ -14,28 +13,129 @@
 
 #include "../common.h"
 #include "tcpsocket.h"
+#include "networkthread.h"
 #include "../WorkTab/WorkTabInfo.h"
 #include "../WorkTab/WorkTab.h"
 #include "../WorkTab/WorkTabMgr.h"
 
-static const int CONNECT_TIMEOUT = 10000 / 50; // 10s
+static const int CONNECT_TIMEOUT = 10000; // ms
+
+TcpSocketWorker::TcpSocketWorker()
+    : m_socket(NULL), m_timeout(this), m_connecting(false), m_connected(false)
+{
+    m_timeout.setSingleShot(true);
+    connect(&m_timeout, SIGNAL(timeout()), SLOT(timeout()));
+}
+
+void TcpSocketWorker::open(const QString& address, int port)
+{
+    // created here, so that it belongs to the network thread
+    if(!m_socket)
+    {
+        m_socket = new QTcpSocket(this);
+        connect(m_socket, SIGNAL(connected()),                                SLOT(connected()));
+        connect(m_socket, SIGNAL(error(QAbstractSocket::SocketError)),        SLOT(socketError()));
+        connect(m_socket, SIGNAL(stateChanged(QAbstractSocket::SocketState)), SLOT(stateChanged(QAbstractSocket::SocketState)));
+        connect(m_socket, SIGNAL(readyRead()),                                SLOT(readyRead()));
+    }
+
+    // a previous connection may still be flushing its writes
+    if(m_socket->state() != QAbstractSocket::UnconnectedState)
+        m_socket->abort();
+
+    m_connecting = true;
+    m_timeout.start(CONNECT_TIMEOUT);
+    m_socket->connectToHost(address, port);
+}
+
+void TcpSocketWorker::close()
+{
+    m_timeout.stop();
+    m_connecting = false;
+    m_connected = false;
+    if(!m_socket)
+        return;
+
+    // The data written so far are still sent before the socket disconnects
+    if(m_socket->state() == QAbstractSocket::ConnectedState)
+        m_socket->disconnectFromHost();
+    else
+        m_socket->abort();
+}
+
+void TcpSocketWorker::write(const QByteArray& data)
+{
+    if(m_socket && m_socket->state() == QAbstractSocket::ConnectedState)
+    {
+        m_socket->write(data);
+        emit sendQueueChanged(m_socket->bytesToWrite());
+    }
+}
+
+void TcpSocketWorker::finishConnecting(bool connected)
+{
+    m_timeout.stop();
+    m_connecting = false;
+    m_connected = connected;
+    emit connectResult(connected);
+}
+
+void TcpSocketWorker::connected()
+{
+    if(m_connecting)
+        finishConnecting(true);
+}
+
+void TcpSocketWorker::socketError()
+{
+    if(!m_connecting)
+        return;
+
+    m_socket->abort();
+    finishConnecting(false);
+}
+
+void TcpSocketWorker::stateChanged(QAbstractSocket::SocketState state)
+{
+    if(m_connected && state != QAbstractSocket::ConnectedState)
+    {
+        m_connected = false;
+        emit connectionLost();
+    }
+}
+
+void TcpSocketWorker::timeout()
+{
+    if(!m_connecting)
+        return;
+
+    m_socket->abort();
+    finishConnecting(false);
+}
+
+void TcpSocketWorker::readyRead()
+{
+    emit dataRead(m_socket->readAll());
+}
 
 TcpSocket::TcpSocket()
     : PortConnection(CONNECTION_TCP_SOCKET)
 {
     m_port = 0;
 
-    m_socket = new QTcpSocket(this);
+    m_worker = new TcpSocketWorker();
+    NetworkThread::adopt(m_worker);
 
-    connect(m_socket,   SIGNAL(readyRead()),                                SLOT(readyRead()));
-    connect(m_socket,   SIGNAL(stateChanged(QAbstractSocket::SocketState)), SLOT(stateChanged()));
-    connect(&m_watcher, SIGNAL(finished()),                                 SLOT(tcpConnectResult()));
+    connect(m_worker, SIGNAL(connectResult(bool)),       SLOT(connectResultSer(bool)));
+    connect(m_worker, SIGNAL(dataRead(QByteArray)),      SLOT(workerDataRead(QByteArray)));
+    connect(m_worker, SIGNAL(sendQueueChanged(qint64)),  SLOT(sendQueueChanged(qint64)));
+    connect(m_worker, SIGNAL(connectionLost()),          SLOT(connectionLost()));
 }
 
 TcpSocket::~TcpSocket()
 {
     Close();
-    delete m_socket;
+    m_worker->deleteLater();
 }
 
 QString TcpSocket::details() const
@@ -48,66 +148,49 @@ QString TcpSocket::details() const
 
 void TcpSocket::doClose()
 {
-    if (m_future.isRunning())
-    {
-        m_future.cancel();
-        m_future.waitForFinished();
-    }
-
-    m_socket->close();
-
+    QMetaObject::invokeMethod(m_worker, "close", Qt::BlockingQueuedConnection);
     this->SetState(st_disconnected);
 }
 
 void TcpSocket::connectResultSer(bool opened)
 {
+    // the result of an attempt which was closed in the meantime
+    if(this->state() != st_connecting)
+        return;
+
     this->SetState(opened? st_connected: st_disconnected);
 }
 
 void TcpSocket::doOpen()
 {
     this->SetState(st_connecting);
-    m_socket->connectToHost(m_address, m_port);
-
-    m_future = QtConcurrent::run(this, &TcpSocket::connectToHost);
-    m_watcher.setFuture(m_future);
+    QMetaObject::invokeMethod(m_worker, "open", Qt::QueuedConnection,
+                              Q_ARG(QString, m_address), Q_ARG(int, m_port));
 }
 
-bool TcpSocket::connectToHost()
+void TcpSocket::SendData(const QByteArray &data)
 {
-    int time = 0;
-    for(; !m_future.isCanceled() && time < CONNECT_TIMEOUT && m_socket->state() == QAbstractSocket::HostLookupState; ++time)
-    {
-        Utils::msleep(50);
-    }
-
-    for(; !m_future.isCanceled() && time < CONNECT_TIMEOUT && m_socket->state() == QAbstractSocket::ConnectingState; ++time)
+    if(this->isOpen())
     {
-        Utils::msleep(50);
+        QMetaObject::invokeMethod(m_worker, "write", Qt::QueuedConnection, Q_ARG(QByteArray, data));
+        this->stats().sent(data.size());
     }
-
-    return (m_socket->state() == QAbstractSocket::ConnectedState);
 }
 
-void TcpSocket::tcpConnectResult()
-{
-    connectResultSer(m_future.result());
-}
-
-void TcpSocket::SendData(const QByteArray &data)
+void TcpSocket::workerDataRead(const QByteArray& data)
 {
-    m_socket->write(data);
+    if(this->isOpen())
+        emit dataRead(data);
 }
 
-void TcpSocket::readyRead()
+void TcpSocket::sendQueueChanged(qint64 bytes)
 {
-    QByteArray data = m_socket->readAll();
-    emit dataRead(data);
+    this->stats().sendQueueDepth(bytes);
 }
 
-void TcpSocket::stateChanged()
+void TcpSocket::connectionLost()
 {
-    if(this->isOpen() && m_socket->state() != QAbstractSocket::ConnectedState)
+    if(this->isOpen())
     {
         sWorkTabMgr.printToAllStatusBars(tr("Connection to %1:%2 lost!").arg(m_address).arg(m_port));
         Close();
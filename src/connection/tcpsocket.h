@@ -8,8 +8,8 @@
 #ifndef TCPSOCKET_H
 #define TCPSOCKET_H
 
-#include <QFuture>
-#include <QFutureWatcher>
+#include <QTimer>
+#include <QAbstractSocket>
 
 #include "connection.h"
 
@@ -17,6 +17,42 @@ class QSpinBox;
 class QLineEdit;
 class QTcpSocket;
 
+// Owns the QTcpSocket in NetworkThread
+class TcpSocketWorker : public QObject
+{
+    Q_OBJECT
+
+Q_SIGNALS:
+    void connectResult(bool connected);
+    void dataRead(const QByteArray& data);
+    void connectionLost();
+    // Bytes written to the socket but not yet sent
+    void sendQueueChanged(qint64 bytes);
+
+public:
+    TcpSocketWorker();
+
+public slots:
+    void open(const QString& address, int port);
+    void close();
+    void write(const QByteArray& data);
+
+private slots:
+    void connected();
+    void socketError();
+    void stateChanged(QAbstractSocket::SocketState state);
+    void timeout();
+    void readyRead();
+
+private:
+    void finishConnecting(bool connected);
+
+    QTcpSocket *m_socket;
+    QTimer m_timeout;
+    bool m_connecting;
+    bool m_connected;
+};
+
 class TcpSocket : public PortConnection
 {
     Q_OBJECT
@@ -47,9 +83,11 @@ public:
 
 public slots:
     void connectResultSer(bool opened);
-    void tcpConnectResult();
-    void readyRead();
-    void stateChanged();
+
+private slots:
+    void workerDataRead(const QByteArray& data);
+    void sendQueueChanged(qint64 bytes);
+    void connectionLost();
 
 protected:
     ~TcpSocket();
@@ -57,14 +95,9 @@ protected:
     void doClose();
 
 private:
-    bool connectToHost();
-
-    QTcpSocket *m_socket;
+    TcpSocketWorker *m_worker;
     quint16 m_port;
     QString m_address;
-    
-    QFuture<bool> m_future;
-    QFutureWatcher<bool> m_watcher;
 };
 
 #endif // TCPSOCKET_H
@@ -7,7 +7,6 @@
 
 #include <QUdpSocket>
 #include <QStringBuilder>
-#include <QtConcurrent>
 
 #include "../common.h"
 #include "../WorkTab/WorkTabInfo.h"
@@ -15,20 +14,92 @@
 #include "../WorkTab/WorkTabMgr.h"
 
 #include "udpsocket.h"
+#include "networkthread.h"
+
+// Largest possible UDP payload
+#define MAX_DATAGRAM_SIZE 65536
+// Datagrams read in one go before they are passed to the GUI thread
+#define MAX_DATAGRAM_BATCH 256
+
+UdpSocketWorker::UdpSocketWorker()
+    : m_socket(NULL), m_bound(false), m_buffer(MAX_DATAGRAM_SIZE)
+{
+}
+
+void UdpSocketWorker::open(int port)
+{
+    // created here, so that it belongs to the network thread
+    if(!m_socket)
+    {
+        m_socket = new QUdpSocket(this);
+        connect(m_socket, SIGNAL(readyRead()),                                SLOT(readyRead()));
+        connect(m_socket, SIGNAL(stateChanged(QAbstractSocket::SocketState)), SLOT(stateChanged(QAbstractSocket::SocketState)));
+    }
+
+    m_bound = m_socket->bind(port);
+    emit bindResult(m_bound);
+}
+
+void UdpSocketWorker::close()
+{
+    m_bound = false;
+    if(m_socket)
+        m_socket->close();
+}
+
+void UdpSocketWorker::write(const QByteArray& data, const QString& address, int port)
+{
+    if(!m_socket)
+        m_socket = new QUdpSocket(this);
+    m_socket->writeDatagram(data, QHostAddress(address), port);
+}
+
+void UdpSocketWorker::readyRead()
+{
+    // Drain the socket into the preallocated buffer and hand the datagrams
+    // over in batches, one queued signal per batch instead of per datagram.
+    QList<QByteArray> batch;
+    while(m_socket->hasPendingDatagrams())
+    {
+        qint64 len = m_socket->readDatagram(m_buffer.data(), m_buffer.size());
+        if(len > 0)
+            batch.append(QByteArray(m_buffer.data(), len));
+
+        if(batch.size() >= MAX_DATAGRAM_BATCH)
+        {
+            emit datagramsRead(batch);
+            batch.clear();
+        }
+    }
+
+    if(!batch.isEmpty())
+        emit datagramsRead(batch);
+}
+
+void UdpSocketWorker::stateChanged(QAbstractSocket::SocketState state)
+{
+    if(m_bound && state != QAbstractSocket::BoundState)
+    {
+        m_bound = false;
+        emit connectionLost();
+    }
+}
 
 UdpSocket::UdpSocket() : PortConnection(CONNECTION_UDP_SOCKET)
 {
     m_port = 0;
-    m_socket = new QUdpSocket(this);
 
-    connect(m_socket,   SIGNAL(readyRead()),                                SLOT(readyRead()));
-    connect(m_socket,   SIGNAL(stateChanged(QAbstractSocket::SocketState)), SLOT(stateChanged()));
-    connect(&m_watcher, SIGNAL(finished()),                                 SLOT(connectResult()));
+    m_worker = new UdpSocketWorker();
+    NetworkThread::adopt(m_worker);
+
+    connect(m_worker, SIGNAL(bindResult(bool)),                  SLOT(bindResult(bool)));
+    connect(m_worker, SIGNAL(datagramsRead(QList<QByteArray>)),  SLOT(datagramsRead(QList<QByteArray>)));
+    connect(m_worker, SIGNAL(connectionLost()),                  SLOT(connectionLost()));
 }
 
 UdpSocket::~UdpSocket() {
     Close();
-    delete m_socket;
+    m_worker->deleteLater();
 }
 
 QString UdpSocket::details() const
@@ -41,56 +112,50 @@ QString UdpSocket::details() const
 
 void UdpSocket::doClose()
 {
-    if (m_future.isRunning())
-    {
-        m_future.cancel();
-        m_future.waitForFinished();
-    }
-
-    m_socket->close();
-
+    QMetaObject::invokeMethod(m_worker, "close", Qt::BlockingQueuedConnection);
     this->SetState(st_disconnected);
 }
 
-void UdpSocket::connectResultSer(bool opened)
+void UdpSocket::doOpen()
 {
-    this->SetState(opened? st_connected: st_disconnected);
+    this->SetState(st_connecting);
+    QMetaObject::invokeMethod(m_worker, "open", Qt::QueuedConnection, Q_ARG(int, m_port));
 }
 
-void UdpSocket::doOpen()
+void UdpSocket::bindResult(bool bound)
 {
-    this->SetState(st_connecting);
-    if(!m_socket->bind(m_port)) {
+    if(this->state() != st_connecting)
+        return;
+
+    if(!bound) {
         // even if the bind fails, we can still send data.
         sWorkTabMgr.printToAllStatusBars(tr("Failed to bind UDP socket to port %1 (\"%2\")").arg(m_port).arg(name()));
     }
     this->SetState(st_connected);
 }
 
-void UdpSocket::connectResult()
-{
-    connectResultSer(m_future.result());
-}
-
 void UdpSocket::SendData(const QByteArray &data)
 {
     if(this->isOpen())
-        m_socket->writeDatagram(data, QHostAddress(m_address), m_port);
+    {
+        QMetaObject::invokeMethod(m_worker, "write", Qt::QueuedConnection,
+                                  Q_ARG(QByteArray, data), Q_ARG(QString, m_address), Q_ARG(int, m_port));
+        this->stats().sent(data.size());
+    }
 }
 
-void UdpSocket::readyRead()
+void UdpSocket::datagramsRead(const QList<QByteArray>& datagrams)
 {
-    QByteArray data;
-    while(m_socket->hasPendingDatagrams()) {
-        data.resize(m_socket->pendingDatagramSize());
-        if(m_socket->readDatagram(data.data(), data.size()) > 0)
-            emit dataRead(data);
-    }
+    if(!this->isOpen())
+        return;
+
+    for(int i = 0; i < datagrams.size(); ++i)
+        emit dataRead(datagrams[i]);
 }
 
-void UdpSocket::stateChanged()
+void UdpSocket::connectionLost()
 {
-    if(this->isOpen() && m_socket->state() != QAbstractSocket::BoundState)
+    if(this->isOpen())
     {
         sWorkTabMgr.printToAllStatusBars(tr("Connection to %1:%2 lost!").arg(m_address).arg(m_port));
         Close();
@@ -8,8 +8,10 @@
 #ifndef UDPSOCKET_H
 #define UDPSOCKET_H
 
-#include <QFuture>
-#include <QFutureWatcher>
+#include <QList>
+#include <QByteArray>
+#include <QAbstractSocket>
+#include <vector>
 
 #include "connection.h"
 
@@ -17,6 +19,34 @@ class QSpinBox;
 class QLineEdit;
 class QUdpSocket;
 
+// Owns the QUdpSocket in NetworkThread
+class UdpSocketWorker : public QObject
+{
+    Q_OBJECT
+
+Q_SIGNALS:
+    void bindResult(bool bound);
+    void datagramsRead(const QList<QByteArray>& datagrams);
+    void connectionLost();
+
+public:
+    UdpSocketWorker();
+
+public slots:
+    void open(int port);
+    void close();
+    void write(const QByteArray& data, const QString& address, int port);
+
+private slots:
+    void readyRead();
+    void stateChanged(QAbstractSocket::SocketState state);
+
+private:
+    QUdpSocket *m_socket;
+    bool m_bound;
+    std::vector<char> m_buffer;
+};
+
 class UdpSocket : public PortConnection
 {
     Q_OBJECT
@@ -45,11 +75,10 @@ public:
     bool clonable() const { return true; }
     ConnectionPointer<Connection> clone();
 
-public slots:
-    void connectResultSer(bool opened);
-    void connectResult();
-    void readyRead();
-    void stateChanged();
+private slots:
+    void bindResult(bool bound);
+    void datagramsRead(const QList<QByteArray>& datagrams);
+    void connectionLost();
 
 protected:
     ~UdpSocket();
@@ -57,14 +86,9 @@ protected:
     void doClose();
 
 private:
-    bool connectToHost();
-
-    QUdpSocket *m_socket;
+    UdpSocketWorker *m_worker;
     quint16 m_port;
     QString m_address;
-
-    QFuture<bool> m_future;
-    QFutureWatcher<bool> m_watcher;
 };
 
 #endif // TCPSOCKET_H
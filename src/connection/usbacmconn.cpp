@@ -11,7 +11,6 @@
 #include <QStringList>
 #include <QVariant>
 #include <libyb/async/sync_runner.hpp>
-#include <libyb/async/double_buffer.hpp>
 
 #include "usbacmconn.h"
 #include "genericusbconn.h"
@@ -20,7 +19,8 @@
 
 UsbAcmConnection2::UsbAcmConnection2(yb::async_runner & runner)
     : PortConnection(CONNECTION_USB_ACM2), m_runner(runner), m_enumerated(false), m_vid(0), m_pid(0),
-    m_baudrate(115200), m_stop_bits(sb_one), m_parity(pp_none), m_data_bits(8)
+    m_baudrate(115200), m_stop_bits(sb_one), m_parity(pp_none), m_data_bits(8),
+    m_read_queue_depth(default_read_queue_depth), m_incomingDataChannel(incoming_data_capacity)
 {
     connect(&m_incomingDataChannel, SIGNAL(dataReceived()), this, SLOT(incomingDataReady()));
     connect(&m_sendCompleted, SIGNAL(dataReceived()), this, SLOT(sendCompleted()));
@@ -211,35 +211,41 @@ void UsbAcmConnection2::doOpen()
     size_t inepsize;
     extractEndpoints(m_intf.descriptor(), inep, inepsize, outep);
 
-    Q_ASSERT(inepsize <= sizeof m_read_buffers[0]);
-
     if (!m_intf.device().claim_interface(m_intf.interface_index()))
         return Utils::showErrorBox(tr("Cannot open the USB interface."), 0);
 
-    assert(m_receive_worker.empty());
+    assert(m_receive_workers.empty());
     assert(m_send_worker.empty());
 
     if (inep)
     {
-#if 0
+        // Keep several transfers queued, so that the host controller always
+        // has a buffer to fill while the previous one is being handed over.
+        // Each transfer is a single packet. A longer one would only complete
+        // on a short packet, and CDC devices don't always send a zero-length
+        // packet after data that fill whole packets, so it could sit on
+        // received data until more traffic arrives.
+        // The transfers complete in the order they were queued and all
+        // the loops run on m_runner, so the data stay in order.
+        //
         // Note that double buffering seems to work, but
         // quadruple buffering will sometimes kill the driver (a bug perhaps?)
         // so that no more transactions on the pipe go through
         // until the device is reconnected.
         // EDIT: actually, double buffering seems to kill the driver just as well...
-        m_receive_worker = m_runner.post(yb::double_buffer<size_t>([this, inep, inepsize](size_t i) {
-            return m_intf.device().bulk_read(inep, m_read_buffers[i], inepsize);
-        }, [this](size_t i, size_t r) {
-            if (r > 0)
-                m_incomingDataChannel.send(m_read_buffers[i], m_read_buffers[i] + r);
-        }, read_buffer_count));
-#else
-        m_receive_worker = m_runner.post(yb::loop<size_t>(yb::async::value((size_t)0), [this, inep, inepsize](size_t r, yb::cancel_level cl) -> yb::task<size_t> {
-            if (r > 0)
-                m_incomingDataChannel.send(m_read_buffers[0], m_read_buffers[0] + r);
-            return cl >= yb::cl_quit? yb::nulltask: m_intf.device().bulk_read(inep, m_read_buffers[0], inepsize);
-        }));
-#endif
+        // That's why only one transfer is queued unless read_queue_depth says otherwise.
+        size_t transfer_size = inepsize & 0x7ff;
+        m_read_buffers.assign(m_read_queue_depth * transfer_size, 0);
+
+        for (int i = 0; i < m_read_queue_depth; ++i)
+        {
+            uint8_t * buffer = m_read_buffers.data() + i * transfer_size;
+            m_receive_workers.push_back(m_runner.post(yb::loop<size_t>(yb::async::value((size_t)0), [this, inep, buffer, transfer_size](size_t r, yb::cancel_level cl) -> yb::task<size_t> {
+                if (r > 0)
+                    m_incomingDataChannel.send(buffer, buffer + r);
+                return cl >= yb::cl_quit? yb::nulltask: m_intf.device().bulk_read(inep, buffer, transfer_size);
+            })));
+        }
     }
 
     if (outep)
@@ -285,8 +291,8 @@ void UsbAcmConnection2::doClose()
         Q_ASSERT(this->state() == st_connected);
         this->SetState(st_disconnecting);
         emit disconnecting();
-        if (!m_receive_worker.empty())
-            m_receive_worker.cancel(yb::cl_abort);
+        for (size_t i = 0; i < m_receive_workers.size(); ++i)
+            m_receive_workers[i].cancel(yb::cl_abort);
         if (!m_send_worker.empty())
             m_send_worker.cancel(yb::cl_quit);
     }
@@ -294,11 +300,12 @@ void UsbAcmConnection2::doClose()
 
 void UsbAcmConnection2::cleanupWorkers()
 {
-    if (!m_receive_worker.empty())
+    for (size_t i = 0; i < m_receive_workers.size(); ++i)
     {
-        m_receive_worker.cancel(yb::cl_abort);
-        m_receive_worker.try_get();
+        m_receive_workers[i].cancel(yb::cl_abort);
+        m_receive_workers[i].try_get();
     }
+    m_receive_workers.clear();
 
     if (!m_send_worker.empty())
     {
@@ -312,15 +319,26 @@ void UsbAcmConnection2::cleanupWorkers()
 
 void UsbAcmConnection2::incomingDataReady()
 {
-    std::vector<uint8_t> data;
-    m_incomingDataChannel.receive(data);
-    emit this->dataRead(QByteArray((char const *)data.data(), data.size()));
+    if (size_t dropped = m_incomingDataChannel.takeOverflows())
+    {
+        qWarning("%s: receive buffer overflow, %u bytes dropped", qPrintable(this->name()), (unsigned)dropped);
+        this->stats().overflow(dropped);
+    }
+
+    QByteArray data;
+    data.resize(m_incomingDataChannel.size());
+    data.resize(m_incomingDataChannel.receive((uint8_t *)data.data(), data.size()));
+    if (!data.isEmpty())
+        emit this->dataRead(data);
 }
 
 void UsbAcmConnection2::SendData(const QByteArray & data)
 {
     if (!m_send_worker.empty() && this->state() == st_connected)
+    {
         m_send_channel.send(yb::buffer_ref((uint8_t const *)data.data(), data.size()));
+        this->stats().sent(data.size());
+    }
 }
 
 ConnectionPointer<Connection> UsbAcmConnection2::clone()
@@ -335,6 +353,7 @@ ConnectionPointer<Connection> UsbAcmConnection2::clone()
     conn->m_data_bits = m_data_bits;
     conn->m_parity = m_parity;
     conn->m_stop_bits = m_stop_bits;
+    conn->m_read_queue_depth = m_read_queue_depth;
     return conn;
 }
 
@@ -349,6 +368,7 @@ QHash<QString, QVariant> UsbAcmConnection2::config() const
     res["stop_bits"] = (int)this->stopBits();
     res["parity"] = (int)this->parity();
     res["data_bits"] = this->dataBits();
+    res["read_queue_depth"] = this->readQueueDepth();
     return res;
 }
 
@@ -366,6 +386,7 @@ bool UsbAcmConnection2::applyConfig(QHash<QString, QVariant> const & config)
     m_stop_bits = (stop_bits_t)config.value("stop_bits", 0).toInt();
     m_parity = (parity_t)config.value("parity", 0).toInt();
     m_data_bits = config.value("data_bits", 8).toInt();
+    this->setReadQueueDepth(config.value("read_queue_depth", (int)default_read_queue_depth).toInt());
     emit changed();
     this->update_line_control();
 
@@ -394,6 +415,12 @@ void UsbAcmConnection2::setBaudRate(int value)
     }
 }
 
+void UsbAcmConnection2::setReadQueueDepth(int value)
+{
+    // applied on the next open
+    m_read_queue_depth = qBound(1, value, (int)max_read_queue_depth);
+}
+
 void UsbAcmConnection2::setStopBits(stop_bits_t value)
 {
     if (m_stop_bits != value)
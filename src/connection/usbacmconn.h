@@ -52,6 +52,10 @@ public:
     int dataBits() const { return m_data_bits; }
     void setDataBits(int value);
 
+    // Number of bulk reads kept queued on the IN endpoint
+    int readQueueDepth() const { return m_read_queue_depth; }
+    void setReadQueueDepth(int value);
+
     int vid() const { return m_vid; }
     int pid() const { return m_pid; }
     QString serialNumber() const { return m_serialNumber; }
@@ -96,7 +100,7 @@ private:
     void updateIntf();
 
     yb::async_runner & m_runner;
-    yb::async_future<void> m_receive_worker;
+    std::vector<yb::async_future<void> > m_receive_workers;
     yb::async_future<void> m_send_worker;
 
     bool m_enumerated;
@@ -118,8 +122,14 @@ private:
 
     bool m_configurable;
 
-    static size_t const read_buffer_count = 2;
-    uint8_t m_read_buffers[read_buffer_count][64];
+    // Deeper queues are opt-in through the read_queue_depth config value,
+    // see the note in UsbAcmConnection2::doOpen
+    static size_t const default_read_queue_depth = 1;
+    static size_t const max_read_queue_depth = 32;
+    // about a second of full-speed USB, in case the GUI thread stalls
+    static size_t const incoming_data_capacity = 1024*1024;
+    int m_read_queue_depth;
+    std::vector<uint8_t> m_read_buffers;
 
     yb::async_channel<uint8_t> m_send_channel;
     std::vector<uint8_t> m_write_buffer;
@@ -129,7 +139,7 @@ private:
     yb::task<void> send_loop(int outep);
     void cleanupWorkers();
 
-    ThreadChannel<uint8_t> m_incomingDataChannel;
+    ThreadRingChannel<uint8_t> m_incomingDataChannel;
     ThreadChannel<void> m_sendCompleted;
 };
 
@@ -5,7 +5,7 @@
 #include <QCoreApplication>
 
 UsbShupito23Connection::UsbShupito23Connection(yb::async_runner & runner)
-    : ShupitoConnection(CONNECTION_SHUPITO23), m_runner(runner)
+    : ShupitoConnection(CONNECTION_SHUPITO23), m_runner(runner), m_incomingPackets(4096)
 {
     connect(&m_incomingPackets, SIGNAL(dataReceived()), this, SLOT(incomingPacketsReceived()));
     connect(&m_sendCompleted, SIGNAL(dataReceived()), this, SLOT(sendCompleted()));
@@ -63,7 +63,15 @@ void UsbShupito23Connection::setup(yb::usb_device_interface const & intf)
     }
 
     m_desc.Clear();
-    m_desc.AddData(raw_desc);
+    try
+    {
+        m_desc.AddData(raw_desc);
+    }
+    catch (QString const &)
+    {
+        // an empty descriptor makes Shupito report the failure
+        m_desc.Clear();
+    }
     emit descRead(m_desc);
 
     this->markPresent();
@@ -106,15 +114,37 @@ void UsbShupito23Connection::doOpen()
 
     m_read_loops.reset(new read_loop_ctx[m_in_eps.size()]);
     for (size_t i = 0; i < m_in_eps.size(); ++i)
-    {
-        m_read_loops[i].read_loop = m_runner.post(yb::loop([this, i](yb::cancel_level cl) -> yb::task<void> {
-            return cl < yb::cl_quit? this->read_loop(i): yb::nulltask;
-        }));
-    }
+        this->startReadLoop(i);
 
     this->SetState(st_connected);
 }
 
+void UsbShupito23Connection::startReadLoop(size_t i)
+{
+    m_read_loops[i].paused = false;
+    m_read_loops[i].read_loop = m_runner.post(yb::loop([this, i](yb::cancel_level cl) -> yb::task<void> {
+        if (cl >= yb::cl_quit)
+            return yb::nulltask;
+
+        // Every loop has at most one read in flight, keep room for all of them.
+        // Shupito is not read from until the GUI thread takes the packets,
+        // the endpoint NAKs in the meantime.
+        if (m_incomingPackets.space() < m_in_eps.size())
+        {
+            m_read_loops[i].paused = true;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            // The queue may have been emptied in the meantime,
+            // whoever clears the flag keeps reading.
+            bool paused = true;
+            if (m_incomingPackets.space() < m_in_eps.size()
+                    || !m_read_loops[i].paused.compare_exchange_strong(paused, false))
+                return yb::nulltask;
+        }
+        return this->read_loop(i);
+    }));
+}
+
 void UsbShupito23Connection::doClose()
 {
     if (this->state() == st_disconnecting)
@@ -133,6 +163,7 @@ void UsbShupito23Connection::doClose()
 void UsbShupito23Connection::sendPacket(ShupitoPacket const & packet)
 {
     m_write_channel.send(packet);
+    this->stats().sent(packet.size());
 }
 
 void UsbShupito23Connection::requestDesc()
@@ -177,10 +208,36 @@ yb::task<void> UsbShupito23Connection::read_loop(uint8_t i)
 
 void UsbShupito23Connection::incomingPacketsReceived()
 {
+    if (size_t dropped = m_incomingPackets.takeOverflows())
+    {
+        qWarning("%s: receive queue overflow, %u packets dropped", qPrintable(this->name()), (unsigned)dropped);
+        this->stats().overflow(dropped);
+    }
+
     std::vector<ShupitoPacket> packets;
     m_incomingPackets.receive(packets);
+
+    // There is room again, resume the reads stopped by a full queue
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (this->state() == st_connected && m_read_loops)
+    {
+        for (size_t i = 0; i < m_in_eps.size(); ++i)
+        {
+            bool paused = true;
+            if (!m_read_loops[i].paused.compare_exchange_strong(paused, false))
+                continue;
+
+            // the loop is finishing, if it has not finished already
+            m_read_loops[i].read_loop.wait(yb::cl_abort);
+            this->startReadLoop(i);
+        }
+    }
+
     for (size_t i = 0; i < packets.size(); ++i)
+    {
+        this->stats().received(packets[i].size());
         emit this->packetRead(packets[i]);
+    }
 }
 
 bool UsbShupito23Connection::getFirmwareDetails(ShupitoFirmwareDetails & details) const
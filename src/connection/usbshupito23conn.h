@@ -8,6 +8,7 @@
 #include <libyb/usb/interface_guard.hpp>
 #include <libyb/async/async_channel.hpp>
 #include <libyb/async/async_runner.hpp>
+#include <atomic>
 
 class UsbShupito23Connection
     : public ShupitoConnection
@@ -57,7 +58,8 @@ private:
     QString m_details;
     ShupitoDesc m_desc;
 
-    ThreadChannel<ShupitoPacket> m_incomingPackets;
+    // all read loops run on m_runner, so there is a single producer
+    ThreadRingChannel<ShupitoPacket> m_incomingPackets;
     ThreadChannel<void> m_sendCompleted;
 
     yb::async_channel<std::vector<uint8_t> > m_write_channel;
@@ -76,11 +78,16 @@ private:
 
     struct read_loop_ctx
     {
+        read_loop_ctx() : paused(false) {}
+
         uint8_t read_buffer[256];
         yb::async_future<void> read_loop;
+        // set by the loop when it stops because m_incomingPackets is full
+        std::atomic<bool> paused;
     };
 
     std::unique_ptr<read_loop_ctx[]> m_read_loops;
+    void startReadLoop(size_t i);
     yb::task<void> read_loop(uint8_t i);
 };
 
@@ -25,12 +25,16 @@
 // metatypes
 #include "ui/colorbutton.h"
 #include "LorrisAnalyzer/DataWidgets/GraphWidget/graphcurve.h"
+#include "LorrisProgrammer/shupitopacket.h"
+#include "LorrisProgrammer/shupitodesc.h"
+#include "LorrisProgrammer/programmerbenchmark.h"
+#include "LorrisProgrammer/headlessprogrammer.h"
 
 #ifdef Q_OS_WIN
  #include "misc/updater.h"
 #endif
 
-static bool checkArgs(const QStringList& args, QStringList& openFiles, QString& session)
+static bool checkArgs(const QStringList& args, QStringList& openFiles, QString& session, int& exitCode)
 {
     for(int i = 1; i < args.size(); ++i)
     {
@@ -44,12 +48,15 @@ static bool checkArgs(const QStringList& args, QStringList& openFiles, QString&
             utils_printf("Usage: %s [ARGUMENTS...] [*.cldta file]\n\n"
                 "Lorris, GUI tool for robotics - https://github.com/Tasssadar/Lorris\n\n"
                 "Command line argumens:\n"
+                "           --benchmark-programmers[=LATENCY_US:BYTES_PER_S:PAGE_WRITE_US]\n"
+                "                                          Measure the programmers against simulated targets and exit\n"
                 "           --dump-cldta=FILE              Dump contents of *.cldta file and exit\n"
                 "           --move-data                    Move config.ini and sessions to user's documents folder\n"
                 "       -h, --help                         Display this help and exit\n"
                 "       -s NAME|FILE, --session=NAME|FILE  Open session NAME or FILE\n"
-                "       -v, --version                      Display version info and exit\n",
-                args[0].toStdString().c_str());
+                "       -v, --version                      Display version info and exit\n\n"
+                "%s",
+                args[0].toStdString().c_str(), HeadlessProgrammer::helpText());
             return false;
         }
         else if(args[i].startsWith("--dump-cldta="))
@@ -59,6 +66,12 @@ static bool checkArgs(const QStringList& args, QStringList& openFiles, QString&
             DataFileBuilder::dumpFileInfo(args[i].mid(idx+1));
             return false;
         }
+        else if(args[i] == "--benchmark-programmers" || args[i].startsWith("--benchmark-programmers="))
+        {
+            int idx = args[i].indexOf('=');
+            exitCode = ProgrammerBenchmark::runFromCommandLine(idx != -1 ? args[i].mid(idx+1) : QString());
+            return false;
+        }
         else if(args[i] == "--move-data")
         {
             Utils::moveDataFolder();
@@ -126,6 +139,8 @@ static void registerMetaTypes()
 {
     qRegisterMetaType<ColorButton>("ColorButton");
     qRegisterMetaType<GraphCurve>("GraphCurve");
+    qRegisterMetaType<ShupitoPacket>("ShupitoPacket");
+    qRegisterMetaType<ShupitoDesc>("ShupitoDesc");
 }
 
 int main(int argc, char *argv[])
@@ -139,14 +154,26 @@ int main(int argc, char *argv[])
     // Also adds handled filetypes, so must be before checkArgs
     sWorkTabMgr.SortTabInfos();
 
+    // Programming from scripts does not need the GUI, translations nor sessions
+    if(HeadlessProgrammer::isRequested(argc, argv))
+    {
+        QCoreApplication a(argc, argv);
+        registerMetaTypes();
+
+        int res = HeadlessProgrammer::runFromCommandLine(a.arguments());
+        utils_flush();
+        return res;
+    }
+
     QtSingleApplication a(argc, argv);
 
     QStringList openFiles;
     QString session;
-    if(!checkArgs(a.arguments(), openFiles, session))
+    int exitCode = 0;
+    if(!checkArgs(a.arguments(), openFiles, session, exitCode))
     {
         utils_flush();
-        return 0;
+        return exitCode;
     }
 
     if(a.isRunning() && sConfig.get(CFG_BOOL_ONE_INSTANCE) && a.sendMessage("newWindow|" + openFiles.join(";")))
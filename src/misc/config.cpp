@@ -37,6 +37,9 @@ static const QString keys_quint32[] =
     "shupito/spi_tunnel_speed",  // CFG_QUINT32_SPI_TUNNEL_SPEED
     "shupito/spi_tunnel_modes",  // CFG_QUINT32_SPI_TUNNEL_MODES
     "main/freeze_timeout",    // CFG_QUINT32_SCRIPT_FREEZE_TIMEOUT
+    "shupito/zmodem_window",     // CFG_QUINT32_ZMODEM_WINDOW
+    "terminal/log_rotate_size",  // CFG_QUINT32_TERMINAL_LOG_SIZE
+    "terminal/log_rotate_time",  // CFG_QUINT32_TERMINAL_LOG_TIME
 };
 
 static const quint32 def_quint32[] =
@@ -63,6 +66,9 @@ static const quint32 def_quint32[] =
     500000,                      // CFG_QUINT32_SPI_TUNNEL_SPEED
     0x200,                       // CFG_QUINT32_SPI_TUNNEL_MODES
     15000,                       // CFG_QUINT32_SCRIPT_FREEZE_TIMEOUT
+    16*1024,                     // CFG_QUINT32_ZMODEM_WINDOW
+    0,                           // CFG_QUINT32_TERMINAL_LOG_SIZE
+    0,                           // CFG_QUINT32_TERMINAL_LOG_TIME
 };
 
 static const QString keys_string[] =
@@ -86,6 +92,7 @@ static const QString keys_string[] =
     "proxy/tunnel_name",          // CFG_STRING_PROXY_TUNNEL_NAME
     "shupito/avr109_bootseq",     // CFG_STRING_AVR109_BOOTSEQ
     "shupito/zmodem_bootseq",     // CFG_STRING_ZMODEM_BOOTSEQ
+    "terminal/log_file",          // CFG_STRING_TERMINAL_LOG_FILE
 };
 
 static const QString def_string[] =
@@ -109,6 +116,7 @@ static const QString def_string[] =
     "Proxy tunnel",               // CFG_STRING_PROXY_TUNNEL_NAME
     "0x74 0x7E 0x7A 0x33",        // CFG_STRING_AVR109_BOOTSEQ
     "" /*"0x74 0x7E 0x7A 0x33"*/, // CFG_STRING_ZMODEM_BOOTSEQ
+    "",                           // CFG_STRING_TERMINAL_LOG_FILE
 };
 
 static const QString keys_bool[] =
@@ -141,6 +149,8 @@ static const QString keys_bool[] =
     "main/enable_sounds",      // CFG_BOOL_ENABLE_SOUNDS
     "analyzer/enable_search",     // CFG_BOOL_ANALYZER_SEARCH_WIDGET
     "shupito/spi_tunnel_lsb",     // CFG_BOOL_SPI_TUNNEL_LSB_FIRST
+    "terminal/log_timestamps",    // CFG_BOOL_TERMINAL_LOG_TIMESTAMPS
+    "terminal/log_compress",      // CFG_BOOL_TERMINAL_LOG_COMPRESS
 };
 
 static const bool def_bool[] =
@@ -173,6 +183,8 @@ static const bool def_bool[] =
     true,                         // CFG_BOOL_ENABLE_SOUNDS
     true,                         // CFG_BOOL_ANALYZER_SEARCH_WIDGET
     false,                        // CFG_BOOL_SPI_TUNNEL_LSB_FIRST
+    false,                        // CFG_BOOL_TERMINAL_LOG_TIMESTAMPS
+    false,                        // CFG_BOOL_TERMINAL_LOG_COMPRESS
 };
 
 static const QString keys_variant[] =
@@ -38,6 +38,9 @@ enum cfg_quint32
     CFG_QUINT32_SPI_TUNNEL_SPEED,
     CFG_QUINT32_SPI_TUNNEL_MODES,
     CFG_QUINT32_SCRIPT_FREEZE_TIMEOUT,
+    CFG_QUINT32_ZMODEM_WINDOW,
+    CFG_QUINT32_TERMINAL_LOG_SIZE,
+    CFG_QUINT32_TERMINAL_LOG_TIME,
 
     CFG_QUINT32_NUM
 };
@@ -63,6 +66,7 @@ enum cfg_string
     CFG_STRING_PROXY_TUNNEL_NAME,
     CFG_STRING_AVR109_BOOTSEQ,
     CFG_STRING_ZMODEM_BOOTSEQ,
+    CFG_STRING_TERMINAL_LOG_FILE,
 
     CFG_STRING_NUM
 };
@@ -97,6 +101,8 @@ enum cfg_bool
     CFG_BOOL_ENABLE_SOUNDS,
     CFG_BOOL_ANALYZER_SEARCH_WIDGET,
     CFG_BOOL_SPI_TUNNEL_LSB_FIRST,
+    CFG_BOOL_TERMINAL_LOG_TIMESTAMPS,
+    CFG_BOOL_TERMINAL_LOG_COMPRESS,
 
     CFG_BOOL_NUM
 };
@@ -5,6 +5,9 @@
 #include <QMutex>
 #include <QAtomicPointer>
 #include <vector>
+#include <atomic>
+#include <algorithm>
+#include <utility>
 
 class ThreadChannelBase
     : public QObject
@@ -60,6 +63,144 @@ private:
     std::vector<T> m_data;
 };
 
+#define THREADCHANNEL_CACHE_LINE 64
+
+// Bounded single-producer/single-consumer channel. send() must only be
+// called from one thread (e.g. the libyb runner) and receive() from the
+// thread the channel lives in. Neither side locks, so the producer never
+// waits for a busy GUI thread; when the ring is full, the items that
+// don't fit are dropped and counted in takeOverflows().
+template <typename T>
+class ThreadRingChannel
+    : public ThreadChannelBase
+{
+public:
+    explicit ThreadRingChannel(size_t capacity)
+        : m_head(0), m_tailCache(0), m_tail(0), m_headCache(0), m_overflows(0)
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+        m_data.resize(size);
+        m_mask = size - 1;
+    }
+
+    size_t capacity() const { return m_data.size(); }
+
+    bool send(T const & v)
+    {
+        return this->send(&v, &v + 1) == 1;
+    }
+
+    bool send(T && v)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (!this->reserve(tail, 1))
+            return false;
+
+        m_data[tail & m_mask] = std::move(v);
+        this->publish(tail + 1);
+        return true;
+    }
+
+    // Returns the number of items queued, the rest was dropped.
+    size_t send(T const * first, T const * last)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t count = this->reserve(tail, last - first);
+        if (count == 0)
+            return 0;
+
+        for (size_t i = 0; i < count; ++i)
+            m_data[(tail + i) & m_mask] = first[i];
+        this->publish(tail + count);
+        return count;
+    }
+
+    // Free slots, a lower bound when called by the consumer
+    size_t space() const
+    {
+        return m_data.size() - (m_tail.load(std::memory_order_relaxed) - m_head.load(std::memory_order_acquire));
+    }
+
+    // Number of items ready for the consumer
+    size_t size() const
+    {
+        return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_relaxed);
+    }
+
+    // Moves up to max items to out, returns their count
+    size_t receive(T * out, size_t max)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        m_tailCache = m_tail.load(std::memory_order_acquire);
+
+        size_t count = (std::min)(m_tailCache - head, max);
+        for (size_t i = 0; i < count; ++i)
+            out[i] = std::move(m_data[(head + i) & m_mask]);
+
+        m_head.store(head + count, std::memory_order_release);
+        return count;
+    }
+
+    // Replaces the content of v with all the queued items
+    void receive(std::vector<T> & v)
+    {
+        v.clear();
+
+        size_t head = m_head.load(std::memory_order_relaxed);
+        m_tailCache = m_tail.load(std::memory_order_acquire);
+
+        v.reserve(m_tailCache - head);
+        for (; head != m_tailCache; ++head)
+            v.push_back(std::move(m_data[head & m_mask]));
+
+        m_head.store(head, std::memory_order_release);
+    }
+
+    // Number of items dropped since the last call
+    size_t takeOverflows()
+    {
+        return m_overflows.exchange(0, std::memory_order_relaxed);
+    }
+
+private:
+    // Producer side; returns how many of count items fit in
+    size_t reserve(size_t tail, size_t count)
+    {
+        if (m_data.size() - (tail - m_headCache) < count)
+            m_headCache = m_head.load(std::memory_order_acquire);
+
+        size_t space = m_data.size() - (tail - m_headCache);
+        if (count > space)
+        {
+            m_overflows.fetch_add(count - space, std::memory_order_relaxed);
+            count = space;
+        }
+        return count;
+    }
+
+    void publish(size_t tail)
+    {
+        m_tail.store(tail, std::memory_order_release);
+        this->notifyDataReady();
+    }
+
+    std::vector<T> m_data;
+    size_t m_mask;
+
+    // The indexes only grow, each side owns one of them and keeps a cached
+    // copy of the other. Every pair lives on its own cache line.
+    char m_pad0[THREADCHANNEL_CACHE_LINE];
+    std::atomic<size_t> m_head;
+    size_t m_tailCache;
+    char m_pad1[THREADCHANNEL_CACHE_LINE - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+    std::atomic<size_t> m_tail;
+    size_t m_headCache;
+    std::atomic<size_t> m_overflows;
+    char m_pad2[THREADCHANNEL_CACHE_LINE - 2*sizeof(std::atomic<size_t>) - sizeof(size_t)];
+};
+
 template <>
 class ThreadChannel<void>
     : public ThreadChannelBase
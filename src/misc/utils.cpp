@@ -127,6 +127,13 @@ QFont Utils::getMonospaceFont(int size)
 
 void Utils::showErrorBox(const QString& text, QWidget* parent)
 {
+    // There are no widgets in the command line mode
+    if(!qobject_cast<QApplication*>(QCoreApplication::instance()))
+    {
+        qWarning("%s", qPrintable(text));
+        return;
+    }
+
     QMessageBox box(parent);
     box.setIcon(QMessageBox::Critical);
     box.setWindowTitle(tr("Error!"));
@@ -60,6 +60,7 @@ void HexFile::LoadFromBin(const QString &path)
     QByteArray data = file.readAll();
     m_data.clear();
     m_data[0].assign(data.data(), data.data() + data.size());
+    invalidatePages();
 }
 
 void HexFile::LoadFromFile(const QString &path)
@@ -170,6 +171,7 @@ void HexFile::addRegion(quint32 pos, quint8 const * first, quint8 const * last,
         throw QString(QObject::tr("Memory location was defined twice (line %1)")).arg(lineno);
 
     m_data[pos] = std::vector<quint8>(first, last);
+    invalidatePages();
 }
 
 void HexFile::SaveToFile(const QString &path)
@@ -275,6 +277,8 @@ void HexFile::setData(const QByteArray &data)
         base = itr;
         maxPerBase += 0xFFFF;
     }while((base & 0xFFFF0000) != (size & 0xFFFF0000));
+
+    invalidatePages();
 }
 
 QByteArray HexFile::getDataArray(quint32 len)
@@ -311,7 +315,42 @@ QByteArray HexFile::getDataArray(quint32 len)
 //template <typename OutputIterator>
 //void make_pages(memory const & memory, std::string const & memid, chip_definition const & chip, OutputIterator out)
 //program.hpp
+void HexFile::sharePages()
+{
+    if(!m_pageCache)
+        m_pageCache.reset(new PageCache);
+}
+
+void HexFile::invalidatePages()
+{
+    // Copies of the file may still use the old pages, detach from them
+    if(m_pageCache)
+        m_pageCache.reset(new PageCache);
+}
+
 void HexFile::makePages(std::vector<page> &pages, quint8 memId, chip_definition &chip, std::set<quint32> *skipPages)
+{
+    QSharedPointer<PageCache> cache = m_pageCache;
+    if(!cache)
+        return buildPages(pages, memId, chip, skipPages);
+
+    chip_definition::memorydef const * memdef = chip.getMemDef(memId);
+    if(!memdef)
+        throw QString(QObject::tr("This chip does not have memory type %1")).arg(memId);
+
+    QString key = QString("%1:%2:%3:%4").arg(memId).arg(memdef->size).arg(memdef->pagesize)
+            .arg((memId == MEM_FLASH) ? chip.getOption("avr232boot_patch") : QString());
+
+    std::pair<std::vector<page>, std::set<quint32> > & entry = cache->entries[key];
+    if(entry.first.empty())
+        buildPages(entry.first, memId, chip, &entry.second);
+
+    pages.insert(pages.end(), entry.first.begin(), entry.first.end());
+    if(skipPages)
+        skipPages->insert(entry.second.begin(), entry.second.end());
+}
+
+void HexFile::buildPages(std::vector<page> &pages, quint8 memId, chip_definition &chip, std::set<quint32> *skipPages)
 {
     chip_definition::memorydef const * memdef = chip.getMemDef(memId);
     if(!memdef)
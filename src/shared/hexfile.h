@@ -9,6 +9,7 @@
 #define HEXFILE_H
 
 #include <QTypeInfo>
+#include <QSharedPointer>
 #include <map>
 #include <vector>
 #include <set>
@@ -63,6 +64,7 @@ public:
     void clear()
     {
         m_data.clear();
+        invalidatePages();
     }
 
     void LoadFromFile(const QString& path);
@@ -92,6 +94,10 @@ public:
     }
 
     void makePages(std::vector<page>& pages, quint8 memId, chip_definition& chip, std::set<quint32> *skipPages);
+
+    // Pages made by makePages are kept and shared by all copies
+    // of this image, see GangProgrammer.
+    void sharePages();
     bool intersects(quint32 address, quint32 length);
     void getRange(quint32 address, quint32 length, quint8 * out);
 
@@ -99,10 +105,18 @@ public:
     void setFilePath(QString path) { m_filepath = path; }
 
 private:
+    struct PageCache
+    {
+        std::map<QString, std::pair<std::vector<page>, std::set<quint32> > > entries;
+    };
+
     QByteArray getExtAddrLine(quint32 addr);
+    void buildPages(std::vector<page>& pages, quint8 memId, chip_definition& chip, std::set<quint32> *skipPages);
+    void invalidatePages();
 
     regionMap m_data;
     QString m_filepath;
+    QSharedPointer<PageCache> m_pageCache;
 };
 
 #endif // HEXFILE_H
@@ -43,6 +43,7 @@ SOURCES += ui/mainwindow.cpp \
     WorkTab/WorkTabInfo.cpp \
     LorrisTerminal/lorristerminal.cpp \
     LorrisTerminal/lorristerminalinfo.cpp \
+    LorrisTerminal/terminallogger.cpp \
     connection/connection.cpp \
     connection/serialport.cpp \
     LorrisAnalyzer/lorrisanalyzerinfo.cpp \
@@ -68,6 +69,8 @@ SOURCES += ui/mainwindow.cpp \
     LorrisAnalyzer/DataWidgets/GraphWidget/graphdata.cpp \
     LorrisAnalyzer/DataWidgets/GraphWidget/graphcurve.cpp \
     connection/tcpsocket.cpp \
+    connection/networkthread.cpp \
+    connection/connectionstats.cpp \
     LorrisProxy/lorrisproxyinfo.cpp \
     LorrisProxy/lorrisproxy.cpp \
     LorrisProxy/tcpserver.cpp \
@@ -85,6 +88,7 @@ SOURCES += ui/mainwindow.cpp \
     ui/chooseconnectiondlg.cpp \
     ui/connectbutton.cpp \
     connection/connectionmgr2.cpp \
+    connection/serialportmonitor.cpp \
     LorrisAnalyzer/packetparser.cpp \
     ui/plustabbar.cpp \
     ui/homedialog.cpp \
@@ -108,6 +112,7 @@ SOURCES += ui/mainwindow.cpp \
     ui/rotatebutton.cpp \
     ui/terminalsettings.cpp \
     ui/terminal.cpp \
+    ui/terminalbuffer.cpp \
     misc/sessionmgr.cpp \
     misc/datafileparser.cpp \
     LorrisAnalyzer/DataWidgets/sliderwidget.cpp \
@@ -137,8 +142,10 @@ SOURCES += ui/mainwindow.cpp \
     LorrisProgrammer/shupitopacket.cpp \
     LorrisProgrammer/shupitodesc.cpp \
     LorrisProgrammer/shupito.cpp \
+    LorrisProgrammer/shupitopipeline.cpp \
     LorrisProgrammer/lorrisprogrammerinfo.cpp \
     LorrisProgrammer/lorrisprogrammer.cpp \
+    LorrisProgrammer/gangprogrammer.cpp \
     LorrisProgrammer/programmers/shupitoprogrammer.cpp \
     LorrisProgrammer/programmers/avr232bootprogrammer.cpp \
     LorrisProgrammer/programmers/atsamprogrammer.cpp \
@@ -155,13 +162,16 @@ SOURCES += ui/mainwindow.cpp \
     LorrisProgrammer/ui/miniprogrammerui.cpp \
     LorrisProgrammer/ui/fusewidget.cpp \
     LorrisProgrammer/ui/fullprogrammerui.cpp \
+    LorrisProgrammer/ui/gangdialog.cpp \
     LorrisProgrammer/programmers/avr109programmer.cpp \
+    LorrisProgrammer/programmers/bootloadertransport.cpp \
     ui/bytevalidator.cpp \
     misc/qtobjectpointer.cpp \
     LorrisAnalyzer/searchwidget.cpp \
     LorrisAnalyzer/confirmwidget.cpp \
     LorrisAnalyzer/DataWidgets/RotationWidget/rotationwidget.cpp \
     LorrisAnalyzer/storagedata.cpp \
+    LorrisAnalyzer/storageexport.cpp \
     ui/floatingwidget.cpp \
     ui/floatinginputdialog.cpp \
     LorrisProgrammer/modes/shupitospitunnel.cpp \
@@ -169,6 +179,10 @@ SOURCES += ui/mainwindow.cpp \
     LorrisProgrammer/programmers/arduinoprogrammer.cpp \
     connection/udpsocket.cpp \
     LorrisProgrammer/programmers/zmodemprogrammer.cpp \
+    connection/simulatedport.cpp \
+    LorrisProgrammer/simulatedtargets.cpp \
+    LorrisProgrammer/programmerbenchmark.cpp \
+    LorrisProgrammer/headlessprogrammer.cpp \
     ../dep/qextserialport/src/qextserialport.cpp \
     ../dep/qextserialport/src/qextserialenumerator.cpp
 
@@ -180,6 +194,7 @@ HEADERS += ui/mainwindow.h \
     WorkTab/WorkTabInfo.h \
     LorrisTerminal/lorristerminal.h \
     LorrisTerminal/lorristerminalinfo.h \
+    LorrisTerminal/terminallogger.h \
     connection/connection.h \
     connection/serialport.h \
     LorrisAnalyzer/lorrisanalyzer.h \
@@ -206,6 +221,8 @@ HEADERS += ui/mainwindow.h \
     LorrisAnalyzer/DataWidgets/GraphWidget/graphdata.h \
     LorrisAnalyzer/DataWidgets/GraphWidget/graphcurve.h \
     connection/tcpsocket.h \
+    connection/networkthread.h \
+    connection/connectionstats.h \
     LorrisProxy/lorrisproxyinfo.h \
     LorrisProxy/lorrisproxy.h \
     LorrisProxy/tcpserver.h \
@@ -224,6 +241,7 @@ HEADERS += ui/mainwindow.h \
     ui/chooseconnectiondlg.h \
     ui/connectbutton.h \
     connection/connectionmgr2.h \
+    connection/serialportmonitor.h \
     LorrisAnalyzer/packetparser.h \
     ui/plustabbar.h \
     ui/homedialog.h \
@@ -249,6 +267,7 @@ HEADERS += ui/mainwindow.h \
     ui/rotatebutton.h \
     ui/terminalsettings.h \
     ui/terminal.h \
+    ui/terminalbuffer.h \
     misc/sessionmgr.h \
     misc/datafileparser.h \
     LorrisAnalyzer/DataWidgets/sliderwidget.h \
@@ -279,8 +298,10 @@ HEADERS += ui/mainwindow.h \
     LorrisProgrammer/shupitopacket.h \
     LorrisProgrammer/shupitodesc.h \
     LorrisProgrammer/shupito.h \
+    LorrisProgrammer/shupitopipeline.h \
     LorrisProgrammer/lorrisprogrammerinfo.h \
     LorrisProgrammer/lorrisprogrammer.h \
+    LorrisProgrammer/gangprogrammer.h \
     LorrisProgrammer/programmers/shupitoprogrammer.h \
     LorrisProgrammer/programmers/avr232bootprogrammer.h \
     LorrisProgrammer/programmers/atsamprogrammer.h \
@@ -297,7 +318,9 @@ HEADERS += ui/mainwindow.h \
     LorrisProgrammer/ui/miniprogrammerui.h \
     LorrisProgrammer/ui/fusewidget.h \
     LorrisProgrammer/ui/fullprogrammerui.h \
+    LorrisProgrammer/ui/gangdialog.h \
     LorrisProgrammer/programmers/avr109programmer.h \
+    LorrisProgrammer/programmers/bootloadertransport.h \
     ui/bytevalidator.h \
     misc/qtobjectpointer.h \
     LorrisAnalyzer/searchwidget.h \
@@ -306,12 +329,17 @@ HEADERS += ui/mainwindow.h \
     ui/floatinginputdialog.h \
     LorrisAnalyzer/DataWidgets/RotationWidget/rotationwidget.h \
     LorrisAnalyzer/storagedata.h \
+    LorrisAnalyzer/storageexport.h \
     LorrisProgrammer/modes/shupitospitunnel.h \
     connection/shupitospitunnelconn.h \
     LorrisProgrammer/programmers/arduinoprogrammer.h \
     connection/udpsocket.h \
     LorrisProgrammer/programmers/zmodemprogrammer.h \
     LorrisProgrammer/programmers/zmodemprogrammer-defines.h \
+    connection/simulatedport.h \
+    LorrisProgrammer/simulatedtargets.h \
+    LorrisProgrammer/programmerbenchmark.h \
+    LorrisProgrammer/headlessprogrammer.h \
     ui/termina-colors.h \
     ../dep/qextserialport/src/qextserialport_p.h \
     ../dep/qextserialport/src/qextserialport_global.h \
@@ -435,6 +463,11 @@ unix:!macx:!symbian {
         ../dep/qextserialport/src/qextserialenumerator_unix.cpp \
         ../dep/qextserialport/src/qextserialport_unix.cpp
 
+    linux* {
+        SOURCES += connection/serialportlinux.cpp
+        HEADERS += connection/serialportlinux.h
+    }
+
     QMAKE_POST_LINK = mkdir \
         "$$DESTDIR/translations" 2> /dev/null \
         ; \
@@ -14,11 +14,15 @@
 #include "../connection/udpsocket.h"
 #include "../connection/proxytunnel.h"
 #include "../misc/config.h"
+#include "../misc/utils.h"
 #include <QMenu>
 #include <QPushButton>
 #include <QStyledItemDelegate>
 #include <QPainter>
 #include <QSignalMapper>
+#include <QTimer>
+#include <QFile>
+#include <QFileDialog>
 
 #if QT_VERSION < 0x050000 && defined(Q_OS_WIN)
 #include <QWindowsVistaStyle>
@@ -175,6 +179,7 @@ ChooseConnectionDlg::ChooseConnectionDlg(QWidget *parent) :
     ui->connectionsList->insertAction(0, ui->actionConnect);
     ui->connectionsList->insertAction(0, ui->actionDisconnect);
     ui->connectionsList->insertAction(0, ui->actionClone);
+    ui->connectionsList->insertAction(0, ui->actionExportTrafficStats);
 
     ui->connectionsList->setItemDelegate(new ConnectionListItemDelegate(this));
 
@@ -202,6 +207,10 @@ ChooseConnectionDlg::ChooseConnectionDlg(QWidget *parent) :
     connect(&sConMgr2, SIGNAL(connRemoved(Connection *)), this, SLOT(connRemoved(Connection *)));
     connect(map,       SIGNAL(mapped(int)),               this, SLOT(progBtn_clicked(int)));
 
+    QTimer *statsTimer = new QTimer(this);
+    connect(statsTimer, SIGNAL(timeout()), this, SLOT(updateTrafficStats()));
+    statsTimer->start(1000);
+
     this->on_connectionsList_itemSelectionChanged();
 }
 
@@ -506,6 +515,8 @@ void ChooseConnectionDlg::on_connectionsList_itemSelectionChanged()
         ui->connectionNameEdit->setText(QString());
         ui->connectionNameEdit->setEnabled(false);
         ui->persistNameButton->setVisible(false);
+        ui->actionExportTrafficStats->setEnabled(false);
+        this->updateTrafficStats();
         return;
     }
 
@@ -534,11 +545,26 @@ void ChooseConnectionDlg::on_connectionsList_itemSelectionChanged()
 
     ui->connectionNameEdit->setEnabled(true);
     ui->actionClone->setEnabled(conn->clonable());
+    ui->actionExportTrafficStats->setEnabled(true);
 
     this->updateDetailsUi(conn);
 
     m_current.reset(conn);
     m_current->addRef();
+
+    this->updateTrafficStats();
+}
+
+void ChooseConnectionDlg::updateTrafficStats()
+{
+    if (!m_current || (m_current->state() != st_connected && m_current->stats().bytesIn() == 0 && m_current->stats().bytesOut() == 0))
+    {
+        ui->trafficStatsLabel->setVisible(false);
+        return;
+    }
+
+    ui->trafficStatsLabel->setText(m_current->stats().summary());
+    ui->trafficStatsLabel->setVisible(true);
 }
 
 void ChooseConnectionDlg::on_spDeviceNameEdit_textChanged(const QString &arg1)
@@ -766,6 +792,26 @@ void ChooseConnectionDlg::on_actionClone_triggered()
     this->focusNewConn(new_conn.take());
 }
 
+void ChooseConnectionDlg::on_actionExportTrafficStats_triggered()
+{
+    if (!m_current)
+        return;
+
+    QString filename = QFileDialog::getSaveFileName(this, tr("Export traffic statistics"),
+                                                    m_current->name() + ".txt",
+                                                    tr("Text files (*.txt);;Any file (*.*)"));
+    if (filename.isEmpty())
+        return;
+
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+        return Utils::showErrorBox(tr("Can't open file %1 for writing!").arg(filename), this);
+
+    QString header = QString("# %1\n# %2\n").arg(m_current->name(), m_current->details());
+    file.write(header.toUtf8());
+    file.write(m_current->stats().report().toUtf8());
+}
+
 void ChooseConnectionDlg::on_persistNameButton_clicked()
 {
     Q_ASSERT(m_current && m_current->isNamePersistable());
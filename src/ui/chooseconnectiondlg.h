@@ -79,8 +79,11 @@ private slots:
     void on_actionDisconnect_triggered();
     void on_actionClone_triggered();
 
+    void on_actionExportTrafficStats_triggered();
     void on_persistNameButton_clicked();
 
+    void updateTrafficStats();
+
 private:
     void focusNewConn(Connection * conn);
     void selectConn(Connection * conn);
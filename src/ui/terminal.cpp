@@ -37,8 +37,45 @@
 #include "terminalsettings.h"
 #include "termina-colors.h"
 
+// Two hex digits of each byte
+static ushort hexPairs[256][2];
+// The byte itself if it is printable, '.' otherwise
+static ushort hexChars[256];
+
+// Character attributes stored in the scrollback: foreground and background
+// color, 0 is the default one and n+1 is term256colors[n], and flags
+enum AttrBits
+{
+    ATTR_COLOR_MASK = 0x1FF,
+    ATTR_BG_SHIFT   = 9,
+    ATTR_BOLD       = 1 << 18
+};
+
+static void setAttrColor(quint32& attr, int shift, quint32 color)
+{
+    attr = (attr & ~(quint32(ATTR_COLOR_MASK) << shift)) | (color << shift);
+}
+
+static QColor attrColor(quint32 attr, int shift)
+{
+    const quint32 color = (attr >> shift) & ATTR_COLOR_MASK;
+    return color != 0 ? QColor(term256colors[color-1]) : QColor();
+}
+
+static void initHexTables()
+{
+    static const char* hex = "0123456789ABCDEF";
+    for(int i = 0; i < 256; ++i)
+    {
+        hexPairs[i][0] = hex[i >> 4];
+        hexPairs[i][1] = hex[i & 0x0F];
+        hexChars[i] = (i < 32 || i > 126) ? '.' : i;
+    }
+}
+
 Terminal::Terminal(QWidget *parent) : QAbstractScrollArea(parent)
 {
+    initHexTables();
     m_data.reserve(512);
 
     setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
@@ -51,8 +88,9 @@ Terminal::Terminal(QWidget *parent) : QAbstractScrollArea(parent)
     m_paused = false;
     m_fmt = FMT_MAX+1;
     m_input = INPUT_SEND_KEYPRESS;
-    m_hex_pos = 0;
-    m_last_esc = NULL;
+    m_pause_data_size = 0;
+    m_data_base = 0;
+    resetDecoder();
 
     viewport()->setCursor(Qt::IBeamCursor);
     setFont(Utils::getMonospaceFont());
@@ -111,47 +149,104 @@ Terminal::~Terminal()
 
 void Terminal::appendText(const QByteArray& text)
 {
-    if(m_data.size()+text.size() > m_data.capacity())
-        while(m_data.capacity() < m_data.size()+text.size())
-            m_data.reserve(m_data.capacity()+512);
-
     m_data.insert(m_data.end(), text.data(), text.data()+text.size());
 
-    switch(m_fmt)
-    {
-        case FMT_TEXT: addLines(QString::fromUtf8(text)); break;
-        case FMT_HEX:  addHex();       break;
-    }
+    const int len = decodeUtf8(text.data(), text.size());
+    addLines(m_decoded.data(), len);
+    trimScrollback();
 
     if(!m_paused)
         m_changed = true;
 }
 
-void Terminal::addLines(const QString &text)
+void Terminal::resetDecoder()
+{
+    m_utf8_char = 0;
+    m_utf8_len = 0;
+    m_utf8_left = 0;
+    m_esc_state = ESC_NONE;
+    m_esc_param_cnt = 0;
+    m_attr = 0;
+}
+
+int Terminal::decodeUtf8(const char *data, size_t len)
+{
+    static const quint32 minChar[] = { 0, 0x80, 0x800, 0x10000 };
+
+    // One UTF-16 unit per byte, plus one for the sequence
+    // left from the previous data
+    if(m_decoded.size() < len + 1)
+        m_decoded.resize(len + 1);
+
+    QChar *out = m_decoded.data();
+    for(size_t i = 0; i < len; ++i)
+    {
+        const quint8 b = data[i];
+
+        if(m_utf8_left != 0)
+        {
+            if((b & 0xC0) == 0x80)
+            {
+                m_utf8_char = (m_utf8_char << 6) | (b & 0x3F);
+                if(--m_utf8_left != 0)
+                    continue;
+
+                const quint32 c = m_utf8_char;
+                if(c < minChar[m_utf8_len] || (c >= 0xD800 && c <= 0xDFFF) || c > 0x10FFFF)
+                    *out++ = QChar(QChar::ReplacementCharacter);
+                else if(c >= 0x10000)
+                {
+                    *out++ = QChar(QChar::highSurrogate(c));
+                    *out++ = QChar(QChar::lowSurrogate(c));
+                }
+                else
+                    *out++ = QChar(ushort(c));
+                continue;
+            }
+
+            // the sequence was cut short
+            *out++ = QChar(QChar::ReplacementCharacter);
+            m_utf8_left = 0;
+        }
+
+        if(b < 0x80)
+        {
+            *out++ = QChar(ushort(b));
+            continue;
+        }
+
+        if((b & 0xE0) == 0xC0)
+            m_utf8_len = 1;
+        else if((b & 0xF0) == 0xE0)
+            m_utf8_len = 2;
+        else if((b & 0xF8) == 0xF0)
+            m_utf8_len = 3;
+        else
+        {
+            *out++ = QChar(QChar::ReplacementCharacter);
+            continue;
+        }
+
+        m_utf8_left = m_utf8_len;
+        m_utf8_char = b & (0x3F >> m_utf8_len);
+    }
+    return out - m_decoded.data();
+}
+
+void Terminal::addLines(const QChar *text, int len)
 {
     quint32 pos = m_cursor_pos.y();
-    QChar *line_start = (QChar*)text.data();
-    QChar *line_end = line_start;
+    const QChar *line_start = text;
+    const QChar *line_end = line_start;
 
-    for(int i = 0; i < text.size(); ++i)
+    for(int i = 0; i < len; ++i)
     {
         const auto c = (*line_end).unicode();
 
-        if(!m_esc_seq.isEmpty()) {
-            if(m_esc_seq.length() == 1 && c != '[') {
-                m_esc_seq.clear();
-                line_start = line_end;
-                ++line_end;
-            } else if((*line_end).isLetter()) {
-                m_esc_seq.append(c);
-                handleEscSeq();
-                m_esc_seq.clear();
-                ++line_end;
-                line_start = line_end;
-            } else {
-                m_esc_seq.append(c);
-                ++line_end;
-            }
+        if(m_esc_state != ESC_NONE && escapeChar(c))
+        {
+            ++line_end;
+            line_start = line_end;
             continue;
         }
 
@@ -164,9 +259,9 @@ void Terminal::addLines(const QString &text)
                 if(!m_settings.chars[SET_FORMFEED])
                     break;
 
+                pos = m_lines.begin();
                 m_cursor_pos.setX(0);
-                m_cursor_pos.setY(0);
-                pos = 0;
+                m_cursor_pos.setY(pos);
                 break;
             }
             case '\r':
@@ -201,8 +296,7 @@ void Terminal::addLines(const QString &text)
                 }
                 else
                 {
-                    std::vector<QString>::iterator linePos = m_lines.begin() + pos;
-                    if(linePos == m_lines.end())
+                    if(!m_lines.contains(pos))
                         break;
 
                     if(m_cursor_pos.x() != 0)
@@ -211,10 +305,11 @@ void Terminal::addLines(const QString &text)
                     ++line_end;
                     ++line_start;
 
-                    if((*linePos).size() == 1)
-                        m_lines.erase(linePos);
+                    QString line = m_lines.line(pos);
+                    if(line.size() == 1)
+                        m_lines.remove(pos);
                     else
-                        (*linePos).chop(1);
+                        m_lines.setLine(pos, line.left(line.size()-1));
                 }
 
                 break;
@@ -228,11 +323,11 @@ void Terminal::addLines(const QString &text)
                 if(m_settings.chars[SET_REPLACE_TAB])
                 {
                     addLine(pos, line_start, line_end);
-                    std::vector<QString>::iterator linePos = m_lines.begin() + pos;
-                    if(linePos != m_lines.end())
+                    if(m_lines.contains(pos))
                     {
-                        (*linePos).append(QByteArray(m_settings.tabReplace, ' '));
-                         m_cursor_pos.rx() += m_settings.tabReplace;
+                        QString spaces(m_settings.tabReplace, ' ');
+                        m_lines.write(pos, m_lines.lineLength(pos), spaces.data(), spaces.size(), m_attr);
+                        m_cursor_pos.rx() += m_settings.tabReplace;
                     }
                 }
                 else
@@ -243,18 +338,18 @@ void Terminal::addLines(const QString &text)
             {
                 if(!m_settings.chars[SET_IGNORE_NULL])
                 {
-                    i = text.size()+1;
+                    i = len;
                     break;
                 }
                 else
                 {
                     addLine(pos, line_start, line_end);
 
-                    std::vector<QString>::iterator linePos = m_lines.begin() + pos;
-                    if(linePos != m_lines.end())
-                        (*linePos).append('.');
+                    const QChar dot('.');
+                    if(m_lines.contains(pos))
+                        m_lines.write(pos, m_lines.lineLength(pos), &dot, 1, m_attr);
                     else
-                        m_lines.push_back(QString("."));
+                        m_lines.append(QString(dot), m_attr);
                     break;
                 }
             }
@@ -262,7 +357,7 @@ void Terminal::addLines(const QString &text)
             {
                 if(m_settings.chars[SET_HANDLE_ESCAPE]) {
                     addLine(pos, line_start, line_end);
-                    m_esc_seq.append(c);
+                    m_esc_state = ESC_START;
                 } else {
                     ++line_end;
                 }
@@ -280,30 +375,20 @@ void Terminal::addLines(const QString &text)
         addLine(pos, line_start, line_end);
 }
 
-void Terminal::addLine(quint32 pos, QChar *&line_start, QChar *&line_end)
+void Terminal::addLine(quint32 pos, const QChar *&line_start, const QChar *&line_end)
 {
-    std::vector<QString>::iterator linePos = m_lines.begin() + pos;
-    if(linePos != m_lines.end())
+    if(m_lines.contains(pos))
     {
-        if((line_end - line_start + m_cursor_pos.x()) > (*linePos).length())
-            (*linePos).resize(line_end - line_start + m_cursor_pos.x());
-
-        QChar *lineData = (*linePos).data()+m_cursor_pos.x();
-        std::copy(line_start, line_end, lineData);
-
+        m_lines.write(pos, m_cursor_pos.x(), line_start, line_end - line_start, m_attr);
         m_cursor_pos.rx() += (line_end - line_start);
     }
     else
     {
-        QChar tmp = *line_end;
-        *line_end = 0;
-        m_lines.insert(linePos, QString(line_start));
-        *line_end = tmp;
+        while(m_lines.end() < (int)pos)
+            m_lines.append(QString());
+        m_lines.append(QString(line_start, line_end - line_start), m_attr);
 
-        m_cursor_pos.setX(m_lines[pos].length());
-
-        if(m_last_esc && !m_last_esc->isEmpty())
-            m_escapes[pos][0] = *m_last_esc;
+        m_cursor_pos.setX(line_end - line_start);
     }
 
     m_cursor_pos.setY(pos);
@@ -329,11 +414,13 @@ void Terminal::newlineChar(quint8 option, quint32& pos)
             if(m_cursor_pos.x() == 0)
                 break;
 
-            std::vector<QString>::iterator linePos = m_lines.begin() + pos;
-            if(linePos != m_lines.end() && m_cursor_pos.x() > (*linePos).size())
-                (*linePos).append(QByteArray(m_cursor_pos.x() - (*linePos).size(), ' '));
+            if(m_lines.contains(pos) && m_cursor_pos.x() > m_lines.lineLength(pos))
+            {
+                QString spaces(m_cursor_pos.x() - m_lines.lineLength(pos), ' ');
+                m_lines.write(pos, m_lines.lineLength(pos), spaces.data(), spaces.size());
+            }
             else
-                m_lines.push_back(QString(m_cursor_pos.x(), ' '));
+                m_lines.append(QString(m_cursor_pos.x(), ' '));
             break;
         }
         case NL_RETURN:
@@ -344,54 +431,81 @@ void Terminal::newlineChar(quint8 option, quint32& pos)
     }
 }
 
-void Terminal::addHex()
+int Terminal::hexRows()
 {
-    if(m_hex_pos%16 != 0)
-    {
-        m_hex_pos -= m_hex_pos%16;
-        m_lines.pop_back();
-    }
+    const size_t size = m_paused ? m_pause_data_size : m_data.size();
+    return (size + 15) / 16;
+}
 
-    std::vector<char>::iterator chunk;
+QString Terminal::hexRow(int row)
+{
+    // "AAAAAAAA HH HH ... HH   |cccccccccccccccc|"
+    const size_t size = m_paused ? m_pause_data_size : m_data.size();
+    const size_t offset = size_t(row)*16;
+    const int len = std::min(size - offset, size_t(16));
+    const quint8 *data = (const quint8*)m_data.data() + offset;
 
-    int chunk_size;
-    char *itr;
-    char line[78];
+    QString res(62 + len, ' ');
+    ushort *itr = (ushort*)res.data();
 
-    line[8] = line[57] = line[58] = line[59] = ' ';
-    line[60] = line[77] = '|';
+    const quint64 addr = m_data_base + offset;
+    for(int x = 3; x >= 0; --x, itr += 2)
+    {
+        itr[0] = hexPairs[quint8(addr >> x*8)][0];
+        itr[1] = hexPairs[quint8(addr >> x*8)][1];
+    }
+    ++itr;
 
-    for(quint32 i = m_hex_pos; i < m_data.size(); i += 16)
+    for(int x = 0; x < len; ++x, itr += 3)
     {
-        itr = line;
-        chunk = m_data.begin()+m_hex_pos;
-        chunk_size = std::min(int(m_data.end() - chunk), 16);
+        itr[0] = hexPairs[data[x]][0];
+        itr[1] = hexPairs[data[x]][1];
+    }
 
-        static const char* hex = "0123456789ABCDEF";
-        for(int x = 7; x >= 0; --x, ++itr)
-            *itr = hex[(m_hex_pos >> x*4) & 0x0F];
-        ++itr;
+    ushort *chars = (ushort*)res.data() + 60;
+    chars[0] = '|';
+    for(int x = 0; x < len; ++x)
+        chars[1 + x] = hexChars[data[x]];
+    chars[1 + len] = '|';
+    return res;
+}
 
-        m_hex_pos += chunk_size;
+int Terminal::firstLine()
+{
+    return m_fmt == FMT_HEX ? 0 : lines().begin();
+}
 
-        for(int x = 0; x < chunk_size; ++x)
-        {
-            *(itr++) = hex[quint8(chunk[x]) >> 4];
-            *(itr++) = hex[quint8(chunk[x]) & 0x0F];
-            *(itr++) = ' ';
+int Terminal::endLine()
+{
+    return m_fmt == FMT_HEX ? hexRows() : lines().end();
+}
 
-            line[61+x] = (chunk[x] < 32 || chunk[x] > 126) ? '.' : chunk[x];
-        }
+int Terminal::lineLength(int idx)
+{
+    if(m_fmt != FMT_HEX)
+        return lines().lineLength(idx);
 
-        memset(itr, ' ', (16 - chunk_size)*3);
+    const size_t size = m_paused ? m_pause_data_size : m_data.size();
+    return 62 + std::min(size - size_t(idx)*16, size_t(16));
+}
+
+QString Terminal::lineText(int idx)
+{
+    return m_fmt == FMT_HEX ? hexRow(idx) : lines().line(idx);
+}
 
-        if(chunk_size != 16)
-            *(line + chunk_size + 61) = '|';
+int Terminal::maxLineLength()
+{
+    if(m_fmt != FMT_HEX)
+        return lines().maxLineLength();
+    return hexRows() > 1 ? 78 : (hexRows() == 1 ? lineLength(0) : 0);
+}
 
-        m_lines.push_back(QString::fromLatin1(line, 62+chunk_size));
-    }
-    m_cursor_pos.setY(m_lines.size());
-    m_cursor_pos.setX(0);
+QPoint Terminal::cursorPos()
+{
+    if(m_fmt == FMT_HEX)
+        return QPoint(0, hexRows());
+    return m_paused ? m_cursor_pause_pos : m_cursor_pos;
 }
 
 void Terminal::inputMethodEvent(QInputMethodEvent *e) {
@@ -494,20 +608,26 @@ void Terminal::copyToClipboard()
     QString line;
     int start = m_sel_start.x();
     int stop;
-    for(quint32 i = m_sel_start.y(); i <= (quint32)m_sel_stop.y(); ++i)
+    for(int i = m_sel_start.y(); i <= m_sel_stop.y(); ++i)
     {
-        if(i >= lines().size())
+        if(i >= endLine())
             break;
 
-        if(i == (quint32)m_sel_stop.y())
+        if(i < firstLine())
+        {
+            start = 0;
+            continue;
+        }
+
+        if(i == m_sel_stop.y())
             stop = m_sel_stop.x() - m_sel_start.x();
         else
-            stop = lines()[i].length();
+            stop = lineLength(i);
 
-        text += lines()[i].mid(start, stop);
-        line = lines()[i].mid(start, stop);
+        line = lineText(i).mid(start, stop);
+        text += line;
 
-        if(i != (quint32)m_sel_stop.y())
+        if(i != m_sel_stop.y())
             text += "\r\n";
 
         start = 0;
@@ -519,9 +639,12 @@ void Terminal::copyToClipboard()
 
 void Terminal::selectAll()
 {
-    m_sel_begin = m_sel_start = QPoint(0, 0);
-    m_sel_stop.setY(lines().size()-1);
-    m_sel_stop.setX(lines()[m_sel_stop.y()].length());
+    if(endLine() == firstLine())
+        return;
+
+    m_sel_begin = m_sel_start = QPoint(0, firstLine());
+    m_sel_stop.setY(endLine()-1);
+    m_sel_stop.setX(lineLength(m_sel_stop.y()));
 
     viewport()->update();
 }
@@ -543,14 +666,8 @@ void Terminal::updateScrollBars()
 
     bool scroll = (verticalScrollBar()->value() == verticalScrollBar()->maximum());
 
-    int height = lines().size();
-    int width = 0;
-
-    for(std::size_t i = 0; i < lines().size(); ++i)
-    {
-        if(width < lines()[i].length())
-            width = lines()[i].length();
-    }
+    int height = endLine() - firstLine();
+    int width = maxLineLength();
 
     verticalScrollBar()->setRange(0, height - areaSize.height()/m_char_height + 1);
     horizontalScrollBar()->setRange(0, width - areaSize.width()/m_char_width + 1);
@@ -570,12 +687,12 @@ void Terminal::paintEvent(QPaintEvent *)
     const int height = viewport()->height()/m_char_height;
 
     const int startX = horizontalScrollBar()->value();
-    const int startY = verticalScrollBar()->value();
+    const int startY = firstLine() + verticalScrollBar()->value();
 
     int y = 0;
     int x = 0;
 
-    QPoint& cursor = m_paused ? m_cursor_pause_pos : m_cursor_pos;
+    const QPoint cursor = cursorPos();
 
     // Draw cursor
     if(cursor.x() >= startX && (cursor.x() - startX) < width &&
@@ -615,10 +732,10 @@ void Terminal::paintEvent(QPaintEvent *)
 
         for(quint32 i = 0; i <= max; ++i,++textLine)
         {
-            if(textLine >= lines().size())
+            if((int)textLine < firstLine() || (int)textLine >= endLine())
                 continue;
 
-            int len = (lines()[textLine].length() - startX)*m_char_width;
+            int len = (lineLength(textLine) - startX)*m_char_width;
             adjustSelectionWidth(w, i, max, len);
 
             QRect rec(x, y, w, m_char_height);
@@ -631,75 +748,61 @@ void Terminal::paintEvent(QPaintEvent *)
     }
 
     // draw text
-    std::size_t i = startY;
+    // only the visible lines are copied out of the scrollback
+    int i = startY;
     int maxLines = i + height + 1;
     int maxLen = viewport()->width()/m_char_width + 1;
 
     painter.setPen(QPen(m_settings.colors[COLOR_TEXT]));
 
-    bool colorChanged = false;
-    bool fontChanged = false;
+    const QFont font = painter.font();
+    QFont boldFont = font;
+    boldFont.setBold(true);
+    quint32 painterAttr = 0;
 
-    for(y = 0; (int)i < maxLines && i < lines().size(); ++i, y += m_char_height)
+    const int end = endLine();
+    for(y = 0; i < maxLines && i < end; ++i, y += m_char_height)
     {
-        QString& l = lines()[i];
+        const QString l = lineText(i);
 
         int len = std::min(l.length() - startX, maxLen);
         if(len <= 0)
             continue;
 
-        const auto ei = m_escapes.find(i);
-        if(ei != m_escapes.end()) {
-            const auto blks = ei->second;
-            int curX = startX;
-            for(auto itr = blks.begin(); itr != blks.end();) {
-                const auto cur = itr++;
-                if(itr != blks.end() && itr->first < curX)
-                    continue;
+        const TerminalBuffer::AttrRuns runs = m_fmt == FMT_TEXT ? lines().attrs(i) : TerminalBuffer::AttrRuns();
 
-                int end = std::min(l.length(), maxLen);
-                if(itr != blks.end() && itr->first < end)
-                    end = itr->first;
+        // attribute of the first visible column
+        quint32 attr = 0;
+        int r = 0;
+        for(; r < runs.size() && (int)runs[r].col <= startX; ++r)
+            attr = runs[r].attr;
 
-                if(cur->second.color.isValid()) {
-                    painter.setPen(cur->second.color);
-                    colorChanged = true;
-                } else if(colorChanged) {
-                    painter.setPen(m_settings.colors[COLOR_TEXT]);
-                    colorChanged = false;
-                }
-
-                if(!drawSelection && cur->second.background.isValid()) {
-                    painter.save();
-
-                    painter.setBrush(QBrush(cur->second.background));
-                    painter.setPen(Qt::NoPen);
-
-                    QRectF bgrect((curX - startX)*m_char_width, y, (end - curX)*m_char_width, m_char_height);
-                    painter.drawRect(bgrect);
+        const int lineEnd = startX + len;
+        for(int curX = startX; curX < lineEnd; ++r)
+        {
+            const int next = r < runs.size() ? std::min((int)runs[r].col, lineEnd) : lineEnd;
 
-                    painter.restore();
-                }
+            if(attr != painterAttr)
+            {
+                const QColor color = attrColor(attr, 0);
+                painter.setPen(color.isValid() ? color : m_settings.colors[COLOR_TEXT]);
+                painter.setFont((attr & ATTR_BOLD) ? boldFont : font);
+                painterAttr = attr;
+            }
 
-                if(cur->second.flags & ESC_BOLD) {
-                    fontChanged = true;
-                    QFont f = painter.font();
-                    f.setBold(true);
-                    painter.setFont(f);
-                } else if(fontChanged) {
-                    QFont f = painter.font();
-                    f.setBold(false);
-                    painter.setFont(f);
-                }
+            const QColor background = attrColor(attr, ATTR_BG_SHIFT);
+            if(!drawSelection && background.isValid())
+            {
+                painter.fillRect((curX - startX)*m_char_width, y, (next - curX)*m_char_width,
+                                 m_char_height, background);
+            }
 
-                painter.drawText((curX - startX)*m_char_width, y, viewport()->width(), m_char_height, 0,
-                             QString::fromRawData(l.data()+curX, end - curX));
+            painter.drawText((curX - startX)*m_char_width, y, viewport()->width(), m_char_height, 0,
+                             QString::fromRawData(l.data()+curX, next - curX));
 
-                curX = end;
-            }
-        } else {
-            painter.drawText(0, y, viewport()->width(), m_char_height, 0,
-                         QString::fromRawData(l.data()+startX, len));
+            curX = next;
+            if(r < runs.size())
+                attr = runs[r].attr;
         }
     }
 }
@@ -725,6 +828,7 @@ void Terminal::pause(bool pause)
     if(pause)
     {
         m_pause_lines = m_lines;
+        m_pause_data_size = m_data.size();
         m_cursor_pause_pos = m_cursor_pos;
     }
     else
@@ -740,14 +844,13 @@ void Terminal::clear()
 {
     m_data.clear();
     m_data.reserve(512);
+    m_data_base = 0;
 
-    m_last_esc = NULL;
-    m_esc_seq.clear();
-    m_escapes.clear();
+    resetDecoder();
     m_lines.clear();
     m_pause_lines.clear();
     m_cursor_pos = m_cursor_pause_pos = QPoint(0, 0);
-    m_hex_pos = 0;
+    m_pause_data_size = 0;
 
     m_changed = true;
     updateScrollBars();
@@ -785,7 +888,7 @@ QPoint Terminal::mouseToTextPos(const QPoint& pos)
     int height = viewport()->height()/m_char_height;
 
     int startX = horizontalScrollBar()->value();
-    int startY = verticalScrollBar()->value();
+    int startY = firstLine() + verticalScrollBar()->value();
 
     x = startX + pos.x()/m_char_width;
     if(x > startX + width)
@@ -796,8 +899,8 @@ QPoint Terminal::mouseToTextPos(const QPoint& pos)
     y = startY + pos.y()/m_char_height;
     if(y > startY + height) {
         y = startY + height;
-    } else if(y < 0) {
-        y = 0;
+    } else if(y < firstLine()) {
+        y = firstLine();
         x = 0;
     }
 
@@ -844,17 +947,21 @@ void Terminal::setFmt(int fmt)
     for(quint8 i = 0; i < FMT_MAX; ++i)
         m_fmt_act[i]->setChecked(i == fmt);
 
+    // Both formats are always ready, the text lines are kept up to date
+    // and the hex dump is formatted from m_data when it is painted.
     m_fmt = fmt;
-    redrawAll();
+    m_sel_start = m_sel_stop = m_sel_begin = QPoint();
+    m_changed = true;
+    updateScrollBars();
 
     emit fmtSelected(fmt);
 }
 
 void Terminal::writeToFile(QFile *file)
 {
-    for(quint32 i = 0; i < lines().size(); ++i)
+    for(int i = firstLine(); i < endLine(); ++i)
     {
-        file->write(lines()[i].toUtf8());
+        file->write(lineText(i).toUtf8());
         file->write("\n");
     }
 }
@@ -882,6 +989,7 @@ QString Terminal::getSettingsData()
 
     res += "|" + QString::number(m_fmt);
     res += "|" + QString::number(m_input);
+    res += QString("|%1;%2").arg(m_settings.scrollbackLines).arg(m_settings.scrollbackMiB);
     return res;
 }
 
@@ -918,6 +1026,17 @@ void Terminal::loadSettings(const QString& data)
 
     if(lst.size() >= 6)
         setInput(lst[5].toUInt());
+
+    if(lst.size() >= 7)
+    {
+        QStringList limits = lst[6].split(';', QString::SkipEmptyParts);
+        if(limits.size() >= 2 && limits[0].toUInt() != 0 && limits[1].toUInt() != 0)
+        {
+            m_settings.scrollbackLines = limits[0].toUInt();
+            m_settings.scrollbackMiB = limits[1].toUInt();
+            trimScrollback();
+        }
+    }
 }
 
 void Terminal::setFont(const QFont &f)
@@ -961,26 +1080,84 @@ void Terminal::applySettings(const terminal_settings& set)
 void Terminal::redrawAll()
 {
     m_lines.clear();
-    m_escapes.clear();
-    m_last_esc = NULL;
-    m_esc_seq.clear();
-    m_hex_pos = 0;
+    resetDecoder();
     m_cursor_pos = m_cursor_pause_pos = QPoint(0, 0);
 
     bool paused = m_paused;
     pause(false);
 
-    switch(m_fmt)
+    // The oldest data might have been trimmed in the middle of a character
+    size_t pos = 0;
+    if(m_data_base != 0)
+        while(pos < m_data.size() && (quint8(m_data[pos]) & 0xC0) == 0x80)
+            ++pos;
+
+    // Decode in blocks, so that the decoding buffer stays small
+    static const size_t block = 64*1024;
+    for(; pos < m_data.size(); pos += block)
     {
-        case FMT_TEXT: addLines(QString::fromUtf8(m_data.data(), m_data.size())); break;
-        case FMT_HEX:  addHex();         break;
+        const int len = decodeUtf8(m_data.data() + pos, std::min(block, m_data.size() - pos));
+        addLines(m_decoded.data(), len);
     }
+    trimScrollback();
 
     m_changed = true;
     updateScrollBars();
     pause(paused);
 }
 
+void Terminal::scrollBack(int lines)
+{
+    // Keep the view on the same lines unless it follows the end
+    QScrollBar *bar = verticalScrollBar();
+    if(bar->value() != bar->maximum())
+        bar->setValue(std::max(0, bar->value() - lines));
+}
+
+void Terminal::trimScrollback()
+{
+    const quint64 maxBytes = quint64(m_settings.scrollbackMiB)*1024*1024;
+
+    // Received data are dropped in larger steps, and in whole hex dump rows
+    if(m_data.size() > maxBytes + maxBytes/4)
+    {
+        const size_t drop = (m_data.size() - maxBytes) & ~size_t(15);
+        m_data.erase(m_data.begin(), m_data.begin() + drop);
+        m_data_base += drop;
+        m_pause_data_size = m_pause_data_size > drop ? m_pause_data_size - drop : 0;
+
+        // hex rows are numbered from the start of m_data
+        if(m_fmt == FMT_HEX)
+            scrollBack(drop/16);
+    }
+
+    const int dropped = m_lines.trim(m_settings.scrollbackLines, maxBytes/sizeof(QChar));
+    if(dropped == 0)
+        return;
+
+    int first = m_lines.begin();
+    if(m_cursor_pos.y() < first)
+        m_cursor_pos = QPoint(0, first);
+
+    if(m_fmt == FMT_TEXT && !m_paused)
+        scrollBack(dropped);
+
+    // Line indexes only grow, move them back before they overflow
+    if(first < (1 << 30))
+        return;
+
+    if(m_paused)
+        first = std::min(first, m_pause_lines.begin());
+
+    m_lines.rebase(first);
+    if(m_paused)
+        m_pause_lines.rebase(first);
+
+    QPoint *points[] = { &m_cursor_pos, &m_cursor_pause_pos, &m_sel_start, &m_sel_begin, &m_sel_stop };
+    for(size_t i = 0; i < sizeof_array(points); ++i)
+        points[i]->setY(std::max(0, points[i]->y() - first));
+}
+
 QString Terminal::getCurrNewlineStr(Qt::KeyboardModifiers modifiers)
 {
     static const QString nl[] = {
@@ -1029,100 +1206,107 @@ void Terminal::endBlink()
     update();
 }
 
-void Terminal::handleEscSeq()
+bool Terminal::escapeChar(ushort c)
 {
-    EscBlock blk;
-    if(m_last_esc)
-        blk = *m_last_esc;
+    if(m_esc_state == ESC_START)
+    {
+        // Only CSI sequences are supported, the ESC is dropped otherwise
+        if(c != '[')
+        {
+            m_esc_state = ESC_NONE;
+            return false;
+        }
 
-    if(m_esc_seq[m_esc_seq.size()-1] != 'm')
-        return;
+        m_esc_state = ESC_CSI;
+        m_esc_param_cnt = 1;
+        m_esc_params[0] = 0;
+        return true;
+    }
 
-    QString cnt = m_esc_seq.mid(2, m_esc_seq.size()-3);
-    QStringList parts = cnt.split(';');
-    bool ok = false;
-    for(int i = 0; i < parts.length(); ++i) {
-        int code = parts[i].toInt(&ok);
-        if(!ok)
-            continue;
+    if(c >= '0' && c <= '9')
+    {
+        if(m_esc_param_cnt <= ESC_MAX_PARAMS)
+        {
+            int& param = m_esc_params[m_esc_param_cnt-1];
+            param = std::min(param*10 + (c - '0'), 0xFFFF);
+        }
+    }
+    else if(c == ';' || c == ':')
+    {
+        if(++m_esc_param_cnt <= ESC_MAX_PARAMS)
+            m_esc_params[m_esc_param_cnt-1] = 0;
+    }
+    else if(c >= 0x40 && c <= 0x7E)
+    {
+        if(c == 'm')
+            applySgr();
+        m_esc_state = ESC_NONE;
+    }
+    else if(c < 0x20 || c > 0x7E)
+    {
+        // Not a part of the sequence, it is handled as usual
+        m_esc_state = ESC_NONE;
+        return false;
+    }
+    return true;
+}
+
+void Terminal::applySgr()
+{
+    quint32 attr = m_attr;
+
+    const int cnt = std::min(m_esc_param_cnt, int(ESC_MAX_PARAMS));
+    for(int i = 0; i < cnt; ++i) {
+        const int code = m_esc_params[i];
 
         switch(code) {
         case 0:
-            blk = EscBlock();
+            attr = 0;
             break;
         case 1:
-            blk.flags = EscFlags(blk.flags | ESC_BOLD);
+            attr |= ATTR_BOLD;
             break;
         case 21:
-            blk.flags = EscFlags(blk.flags & ~ESC_BOLD);
+        case 22:
+            attr &= ~quint32(ATTR_BOLD);
             break;
         case 39:
-            blk.color = QColor();
+            setAttrColor(attr, 0, 0);
             break;
         case 49:
-            blk.background = QColor();
+            setAttrColor(attr, ATTR_BG_SHIFT, 0);
             break;
 
-        case 30: blk.color = Qt::black; break;
-        case 31: blk.color = Qt::darkRed; break;
-        case 32: blk.color = Qt::darkGreen; break;
-        case 33: blk.color = Qt::darkYellow; break;
-        case 34: blk.color = Qt::darkBlue; break;
-        case 35: blk.color = Qt::darkMagenta; break;
-        case 36: blk.color = Qt::darkCyan; break;
-        case 37: blk.color = Qt::lightGray; break;
-        case 90: blk.color = Qt::darkGray; break;
-        case 91: blk.color = Qt::red; break;
-        case 92: blk.color = Qt::green; break;
-        case 93: blk.color = Qt::yellow; break;
-        case 94: blk.color = Qt::blue; break;
-        case 95: blk.color = Qt::magenta; break;
-        case 96: blk.color = Qt::cyan; break;
-        case 97: blk.color = Qt::white; break;
-
-        case 40:  blk.background = Qt::black; break;
-        case 41:  blk.background = Qt::darkRed; break;
-        case 42:  blk.background = Qt::darkGreen; break;
-        case 43:  blk.background = Qt::darkYellow; break;
-        case 44:  blk.background = Qt::darkBlue; break;
-        case 45:  blk.background = Qt::darkMagenta; break;
-        case 46:  blk.background = Qt::darkCyan; break;
-        case 47:  blk.background = Qt::lightGray; break;
-        case 100: blk.background = Qt::darkGray; break;
-        case 101: blk.background = Qt::red; break;
-        case 102: blk.background = Qt::green; break;
-        case 103: blk.background = Qt::yellow; break;
-        case 104: blk.background = Qt::blue; break;
-        case 105: blk.background = Qt::magenta; break;
-        case 106: blk.background = Qt::cyan; break;
-        case 107: blk.background = Qt::white; break;
-
         case 38:
         case 48: {
-            if(i+2 >= parts.length())
+            if(i+2 >= cnt)
                 break;
 
-            i += 2;
-            if(parts[i-1] != "5")
-                break;
-
-            uint clridx = parts[i].toUInt(&ok);
-            if(!ok || clridx >= sizeof_array(term256colors))
-                break;
-            if(code == 38)
-                blk.color = term256colors[clridx];
-            else
-                blk.background = term256colors[clridx];
+            const int shift = code == 38 ? 0 : ATTR_BG_SHIFT;
+            if(m_esc_params[i+1] == 5) {
+                if((uint)m_esc_params[i+2] < sizeof_array(term256colors))
+                    setAttrColor(attr, shift, m_esc_params[i+2] + 1);
+                i += 2;
+            } else if(m_esc_params[i+1] == 2) {
+                // 24-bit colors are not supported, skip them
+                i += 4;
+            }
             break;
         }
+
+        default:
+            // the basic colors are the first 16 of the 256-color palette
+            if(code >= 30 && code <= 37)
+                setAttrColor(attr, 0, code - 30 + 1);
+            else if(code >= 90 && code <= 97)
+                setAttrColor(attr, 0, code - 90 + 8 + 1);
+            else if(code >= 40 && code <= 47)
+                setAttrColor(attr, ATTR_BG_SHIFT, code - 40 + 1);
+            else if(code >= 100 && code <= 107)
+                setAttrColor(attr, ATTR_BG_SHIFT, code - 100 + 8 + 1);
+            break;
         }
     }
 
-    if(!blk.isEmpty() || m_last_esc) {
-        m_escapes[m_cursor_pos.y()][m_cursor_pos.x()] = blk;
-        if(!blk.isEmpty())
-            m_last_esc = &m_escapes[m_cursor_pos.y()][m_cursor_pos.x()];
-        else
-            m_last_esc = NULL;
-    }
+    m_attr = attr;
 }
@@ -14,8 +14,8 @@
 #include <QPoint>
 #include <QTime>
 #include <QTimer>
-#include <unordered_map>
-#include <map>
+
+#include "terminalbuffer.h"
 
 class QMenu;
 class QByteArray;
@@ -93,6 +93,8 @@ struct terminal_settings
         chars[SET_ENTER_SEND] = NLS_RN;
         chars[SET_HANDLE_ESCAPE] = 1;
         tabReplace = 4;
+        scrollbackLines = 100000;
+        scrollbackMiB = 32;
 
         colors[COLOR_BG] = Qt::black;
         colors[COLOR_TEXT] = Qt::white;
@@ -108,11 +110,16 @@ struct terminal_settings
             colors[i] = set.colors[i];
 
         tabReplace = set.tabReplace;
+        scrollbackLines = set.scrollbackLines;
+        scrollbackMiB = set.scrollbackMiB;
         font = set.font;
     }
 
     quint8 chars[SET_MAX];
     quint8 tabReplace;
+    // Limits of both the received data and the text kept by the terminal
+    quint32 scrollbackLines;
+    quint32 scrollbackMiB;
     QColor colors[COLOR_MAX];
     QFont font;
 };
@@ -183,49 +190,71 @@ private slots:
 
 private:
     void handleInput(const QString &data, int key = 0);
-    void addLine(quint32 pos, QChar *&line_start, QChar *&line_end);
+    void addLine(quint32 pos, const QChar *&line_start, const QChar *&line_end);
     void newlineChar(quint8 option, quint32& pos);
-    void addLines(const QString& text);
-    void addHex();
+    void addLines(const QChar *text, int len);
+    int decodeUtf8(const char *data, size_t len);
+    void resetDecoder();
+    int hexRows();
+    QString hexRow(int row);
     void redrawAll();
+    void trimScrollback();
+    void scrollBack(int lines);
     QPoint mouseToTextPos(const QPoint& pos);
     QString getCurrNewlineStr(Qt::KeyboardModifiers modifiers);
-    void handleEscSeq();
+    bool escapeChar(ushort c);
+    void applySgr();
 
     inline void adjustSelectionWidth(int &w, quint32 i, quint32 max, int len);
 
-    inline std::vector<QString>& lines()
+    inline TerminalBuffer& lines()
     {
         return m_paused ? m_pause_lines : m_lines;
     }
 
-    enum EscFlags {
-        ESC_BOLD      = 0x01,
+    // Lines as shown in the current format. The text lines are always
+    // kept up to date, rows of the hex dump are formatted when needed.
+    int firstLine();
+    int endLine();
+    int lineLength(int idx);
+    QString lineText(int idx);
+    int maxLineLength();
+    QPoint cursorPos();
+
+    enum EscState {
+        ESC_NONE,
+        ESC_START,   // got ESC
+        ESC_CSI      // got "ESC[", reading the parameters
     };
 
-    struct EscBlock {
-        EscFlags flags;
-        QColor color;
-        QColor background;
-
-        bool isEmpty() const {
-            return !color.isValid() && !background.isValid() && flags == 0;
-        }
-    };
+    enum { ESC_MAX_PARAMS = 16 };
 
-    std::vector<QString> m_lines;
-    std::vector<QString> m_pause_lines;
+    TerminalBuffer m_lines;
+    TerminalBuffer m_pause_lines;
     std::vector<char> m_data;
-    std::unordered_map<int, std::map<int, EscBlock> > m_escapes;
-    QString m_esc_seq;
-    EscBlock *m_last_esc;
+    // Offset of m_data[0] in all the data received since clear()
+    quint64 m_data_base;
+
+    // The decoder state is kept between appendText() calls, so that
+    // characters and escape sequences can be split between them
+    quint32 m_utf8_char;
+    quint8 m_utf8_len;
+    quint8 m_utf8_left;
+    std::vector<QChar> m_decoded;
+
+    quint8 m_esc_state;
+    int m_esc_param_cnt;
+    int m_esc_params[ESC_MAX_PARAMS];
+    // Attribute of the characters being written
+    quint32 m_attr;
 
     QString m_command;
 
     bool m_paused;
     quint8 m_fmt;
     quint8 m_input;
-    int m_hex_pos;
+    // Size of m_data when the output was paused
+    size_t m_pause_data_size;
 
     int m_char_height;
     int m_char_width;
@@ -0,0 +1,260 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#include <vector>
+#include <algorithm>
+#include <utility>
+
+#include "terminalbuffer.h"
+
+TerminalBuffer::TerminalBuffer()
+{
+    clear();
+}
+
+void TerminalBuffer::clear()
+{
+    m_chunks.clear();
+    m_first = 0;
+    m_skip = 0;
+    m_count = 0;
+    m_chars = 0;
+    m_max_len = 0;
+}
+
+TerminalBuffer::chunk& TerminalBuffer::chunkOf(int idx, int& line)
+{
+    Q_ASSERT(contains(idx));
+    const int pos = idx - m_first + m_skip;
+    line = pos % LINES_PER_CHUNK;
+    return m_chunks[pos / LINES_PER_CHUNK];
+}
+
+const TerminalBuffer::chunk& TerminalBuffer::chunkOf(int idx, int& line) const
+{
+    Q_ASSERT(contains(idx));
+    const int pos = idx - m_first + m_skip;
+    line = pos % LINES_PER_CHUNK;
+    return m_chunks[pos / LINES_PER_CHUNK];
+}
+
+int TerminalBuffer::lineEnd(const chunk& c, int line)
+{
+    return line+1 < c.offsets.size() ? c.offsets[line+1] : c.text.size();
+}
+
+QString TerminalBuffer::line(int idx) const
+{
+    int l;
+    const chunk& c = chunkOf(idx, l);
+    return c.text.mid(c.offsets[l], lineEnd(c, l) - c.offsets[l]);
+}
+
+int TerminalBuffer::lineLength(int idx) const
+{
+    int l;
+    const chunk& c = chunkOf(idx, l);
+    return lineEnd(c, l) - c.offsets[l];
+}
+
+TerminalBuffer::AttrRuns TerminalBuffer::attrs(int idx) const
+{
+    int l;
+    const chunk& c = chunkOf(idx, l);
+    return c.attrs.isEmpty() ? AttrRuns() : c.attrs[l];
+}
+
+void TerminalBuffer::setAttr(chunk& c, int line, int len, int from, int to, quint32 attr)
+{
+    if(from >= to)
+        return;
+
+    if(c.attrs.isEmpty())
+    {
+        if(attr == 0)
+            return;
+        c.attrs.resize(c.offsets.size());
+    }
+
+    AttrRuns& runs = c.attrs[line];
+
+    // The common case, the line already ends with this attribute
+    if(runs.isEmpty() ? attr == 0 : (runs.last().col <= quint32(from) && runs.last().attr == attr))
+        return;
+
+    // Replace the runs starting in [from, to], remember the attribute at column "to"
+    int a = 0;
+    while(a < runs.size() && runs[a].col < quint32(from))
+        ++a;
+
+    quint32 after = a > 0 ? runs[a-1].attr : 0;
+    int b = a;
+    while(b < runs.size() && runs[b].col <= quint32(to))
+        after = runs[b++].attr;
+    runs.remove(a, b - a);
+
+    const quint32 before = a > 0 ? runs[a-1].attr : 0;
+    if(before != attr)
+    {
+        const AttrRun run = { quint32(from), attr };
+        runs.insert(a++, run);
+    }
+
+    if(to < len && after != attr)
+    {
+        const AttrRun run = { quint32(to), after };
+        runs.insert(a, run);
+    }
+}
+
+void TerminalBuffer::append(const QString& text, quint32 attr)
+{
+    if(m_chunks.empty() || m_chunks.back().offsets.size() == LINES_PER_CHUNK)
+    {
+        m_chunks.push_back(chunk());
+        m_chunks.back().offsets.reserve(LINES_PER_CHUNK);
+    }
+
+    chunk& c = m_chunks.back();
+    c.offsets.append(c.text.size());
+    c.text.append(text);
+    if(!c.attrs.isEmpty())
+        c.attrs.append(AttrRuns());
+    setAttr(c, c.offsets.size()-1, 0, 0, text.size(), attr);
+
+    ++m_count;
+    m_chars += text.size();
+    updateMaxLen(text.size());
+}
+
+void TerminalBuffer::setLine(int idx, const QString& text)
+{
+    int l;
+    chunk& c = chunkOf(idx, l);
+    const int start = c.offsets[l];
+    const int len = lineEnd(c, l) - start;
+
+    if(l+1 == c.offsets.size())
+    {
+        c.text.truncate(start);
+        c.text.append(text);
+    }
+    else
+    {
+        c.text.replace(start, len, text);
+        const int delta = text.size() - len;
+        for(int i = l+1; i < c.offsets.size(); ++i)
+            c.offsets[i] += delta;
+    }
+
+    if(!c.attrs.isEmpty() && text.size() < len)
+    {
+        AttrRuns& runs = c.attrs[l];
+        while(!runs.isEmpty() && runs.last().col >= quint32(text.size()))
+            runs.pop_back();
+    }
+
+    m_chars += text.size() - len;
+    updateMaxLen(text.size());
+}
+
+void TerminalBuffer::write(int idx, int x, const QChar *data, int len, quint32 attr)
+{
+    int l;
+    chunk& c = chunkOf(idx, l);
+    const int start = c.offsets[l];
+    const int cur = lineEnd(c, l) - start;
+
+    // The common case, text added to the end of the newest line
+    if(x == cur && l+1 == c.offsets.size())
+    {
+        c.text.append(QString::fromRawData(data, len));
+        m_chars += len;
+        updateMaxLen(cur + len);
+        setAttr(c, l, cur, x, x + len, attr);
+        return;
+    }
+
+    QString text = c.text.mid(start, cur);
+    if(text.size() < x)
+        text.append(QString(x - text.size(), ' '));
+    if(text.size() < x + len)
+        text.resize(x + len);
+    std::copy(data, data + len, text.data() + x);
+    setLine(idx, text);
+    setAttr(c, l, cur, x, x + len, attr);
+}
+
+void TerminalBuffer::removeLast()
+{
+    Q_ASSERT(!empty());
+
+    chunk& c = m_chunks.back();
+    m_chars -= c.text.size() - c.offsets.last();
+    c.text.truncate(c.offsets.last());
+    c.offsets.pop_back();
+    if(!c.attrs.isEmpty())
+        c.attrs.pop_back();
+    --m_count;
+
+    if(c.offsets.isEmpty())
+    {
+        m_chunks.pop_back();
+        if(m_chunks.empty())
+            m_skip = 0;
+    }
+}
+
+void TerminalBuffer::remove(int idx)
+{
+    // Lines are only removed near the end, move the following ones back
+    std::vector<std::pair<QString, AttrRuns> > tail;
+    for(int i = idx+1; i < end(); ++i)
+        tail.push_back(std::make_pair(line(i), attrs(i)));
+
+    while(end() > idx)
+        removeLast();
+
+    for(size_t i = 0; i < tail.size(); ++i)
+    {
+        append(tail[i].first);
+        if(tail[i].second.isEmpty())
+            continue;
+
+        chunk& c = m_chunks.back();
+        if(c.attrs.isEmpty())
+            c.attrs.resize(c.offsets.size());
+        c.attrs.last() = tail[i].second;
+    }
+}
+
+int TerminalBuffer::trim(int maxLines, quint64 maxChars)
+{
+    int dropped = 0;
+    while(m_count > 0 && (m_count > maxLines || m_chars > maxChars))
+    {
+        m_chars -= lineLength(m_first);
+        ++m_first;
+        ++m_skip;
+        --m_count;
+        ++dropped;
+
+        // the memory of the dropped lines is freed with their chunk
+        if(m_skip == m_chunks.front().offsets.size())
+        {
+            m_chunks.pop_front();
+            m_skip = 0;
+        }
+    }
+    return dropped;
+}
+
+void TerminalBuffer::rebase(int offset)
+{
+    Q_ASSERT(offset <= m_first);
+    m_first -= offset;
+}
@@ -0,0 +1,103 @@
+/**********************************************
+**    This file is part of Lorris
+**    http://tasssadar.github.com/Lorris/
+**
+**    See README and COPYING
+***********************************************/
+
+#ifndef TERMINALBUFFER_H
+#define TERMINALBUFFER_H
+
+#include <QString>
+#include <QVector>
+#include <deque>
+
+/*
+ * Scrollback of the Terminal. Lines are packed into chunks of a fixed number
+ * of lines, each chunk is a single QString plus the offsets of its lines, so
+ * a line costs four bytes on top of its text. Old lines are dropped from the
+ * front by trim().
+ *
+ * Lines are addressed by indexes which don't change when lines are dropped,
+ * the kept ones are [begin(), end()). Copies share the chunks (Qt's implicit
+ * sharing), only the chunk which is modified afterwards is detached.
+ *
+ * Each line can have character attributes, stored as runs: a run sets the
+ * attribute from its column up to the next run. Attribute 0 is the default
+ * one, the buffer gives no other meaning to the values. Chunks without any
+ * attributes don't keep the runs at all.
+ */
+class TerminalBuffer
+{
+public:
+    struct AttrRun
+    {
+        quint32 col;
+        quint32 attr;
+    };
+    typedef QVector<AttrRun> AttrRuns;
+
+    TerminalBuffer();
+
+    void clear();
+
+    int begin() const { return m_first; }
+    int end() const { return m_first + m_count; }
+    int size() const { return m_count; }
+    bool empty() const { return m_count == 0; }
+    bool contains(int idx) const { return idx >= begin() && idx < end(); }
+
+    // Characters stored in the kept lines
+    quint64 chars() const { return m_chars; }
+    // Longest line seen since the last clear()
+    int maxLineLength() const { return m_max_len; }
+
+    QString line(int idx) const;
+    int lineLength(int idx) const;
+    // Sorted by column, empty if the whole line has the default attribute
+    AttrRuns attrs(int idx) const;
+
+    void append(const QString& text, quint32 attr = 0);
+    // Keeps the attributes of the characters which are left in the line
+    void setLine(int idx, const QString& text);
+    // Overwrites the line from column x, the line is padded with spaces if it is shorter
+    void write(int idx, int x, const QChar *data, int len, quint32 attr = 0);
+    void removeLast();
+    void remove(int idx);
+
+    // Drops the oldest lines until there are at most maxLines of them
+    // with at most maxChars characters. Returns the number of dropped lines.
+    int trim(int maxLines, quint64 maxChars);
+
+    // Shifts all indexes down by offset, offset must not be above begin()
+    void rebase(int offset);
+
+private:
+    enum { LINES_PER_CHUNK = 256 };
+
+    struct chunk
+    {
+        QString text;
+        QVector<quint32> offsets;
+        // Either empty or one item per line
+        QVector<AttrRuns> attrs;
+    };
+
+    chunk& chunkOf(int idx, int& line);
+    const chunk& chunkOf(int idx, int& line) const;
+    static int lineEnd(const chunk& c, int line);
+    // Sets the attribute of columns [from, to) of a line which had len characters
+    static void setAttr(chunk& c, int line, int len, int from, int to, quint32 attr);
+    void updateMaxLen(int len) { if(len > m_max_len) m_max_len = len; }
+
+    std::deque<chunk> m_chunks;
+    // Index of the first kept line and the number of lines
+    // dropped from the front of the first chunk
+    int m_first;
+    int m_skip;
+    int m_count;
+    quint64 m_chars;
+    int m_max_len;
+};
+
+#endif // TERMINALBUFFER_H
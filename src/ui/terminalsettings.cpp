@@ -29,6 +29,8 @@ TerminalSettings::TerminalSettings(const terminal_settings &set, QWidget *parent
     ui->escapeBox->setChecked(set.chars[SET_HANDLE_ESCAPE]);
 
     ui->widthBox->setValue(set.tabReplace);
+    ui->scrollLinesBox->setValue(set.scrollbackLines);
+    ui->scrollDataBox->setValue(set.scrollbackMiB);
     ui->fontBox->setCurrentFont(set.font);
     ui->sizeBox->setEditText(QString::number(set.font.pointSize()));
 
@@ -56,6 +58,8 @@ terminal_settings TerminalSettings::getSettings()
     set.chars[SET_HANDLE_ESCAPE] = ui->escapeBox->isChecked();
 
     set.tabReplace = ui->widthBox->value();
+    set.scrollbackLines = ui->scrollLinesBox->value();
+    set.scrollbackMiB = ui->scrollDataBox->value();
     set.font = ui->fontBox->currentFont();
 
     int size = ui->sizeBox->currentText().toUInt();